@@ -0,0 +1,123 @@
+/*
+ * dio-latency.c - measure O_DIRECT syscall-to-completion latency
+ *
+ * Issues random, block aligned pread()s (or pwrite()s with -w) of a
+ * fixed size against a block device opened with O_DIRECT and reports
+ * the latency distribution.  Small aligned requests on block devices
+ * take the single-bio fast path in fs/block_dev.c; larger ones (-s)
+ * can be used to compare against the generic direct-io code.
+ *
+ * Usage: dio-latency [-w] [-s size] [-n count] <blockdev>
+ *
+ * Warning: -w overwrites data on the device.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long *lat, dev_size, sum = 0;
+	size_t size = 4096;
+	long count = 100000, i;
+	int write_mode = 0;
+	void *buf;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "ws:n:")) != -1) {
+		switch (opt) {
+		case 'w':
+			write_mode = 1;
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			count = strtol(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || !size || count <= 0)
+		goto usage;
+
+	fd = open(argv[optind], (write_mode ? O_RDWR : O_RDONLY) | O_DIRECT);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &dev_size) < 0) {
+		perror("BLKGETSIZE64");
+		return 1;
+	}
+	if (dev_size < size) {
+		fprintf(stderr, "device smaller than request size\n");
+		return 1;
+	}
+	if (posix_memalign(&buf, 4096, size)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	memset(buf, 0x5a, size);
+	lat = calloc(count, sizeof(*lat));
+	if (!lat) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	srandom(getpid());
+	for (i = 0; i < count; i++) {
+		off_t off = (random() % (dev_size / size)) * size;
+		unsigned long long t0 = now_ns();
+		ssize_t ret;
+
+		if (write_mode)
+			ret = pwrite(fd, buf, size, off);
+		else
+			ret = pread(fd, buf, size, off);
+		lat[i] = now_ns() - t0;
+		if (ret != (ssize_t)size) {
+			perror(write_mode ? "pwrite" : "pread");
+			return 1;
+		}
+		sum += lat[i];
+	}
+
+	qsort(lat, count, sizeof(*lat), cmp_ull);
+	printf("%s %zu bytes x %ld: avg %llu ns, min %llu, p50 %llu, "
+	       "p99 %llu, max %llu\n", write_mode ? "write" : "read",
+	       size, count, sum / count, lat[0], lat[count / 2],
+	       lat[count * 99 / 100], lat[count - 1]);
+
+	close(fd);
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-w] [-s size] [-n count] <blockdev>\n",
+		argv[0]);
+	return 1;
+}
@@ -0,0 +1,218 @@
+/*
+ * tbs-bench.c - check how a block device is shared between blkio cgroups
+ *
+ * Starts -j readers in each of the given blkio cgroups, all issuing
+ * random, block aligned O_DIRECT pread()s of -s bytes against the device
+ * for -t seconds, then prints per cgroup the throughput, its share of the
+ * total next to its share of the blkio.weight sum, and the average and
+ * worst request latency.  With the tbs scheduler the two shares should
+ * match, and a cgroup with blkio.latency_target set should see its worst
+ * latency near the target.
+ *
+ * The device needs a request queue for the elevator to matter: brd and
+ * loop devices bypass it.  A RAM backed scsi_debug disk works, e.g.
+ *
+ *   modprobe scsi_debug dev_size_mb=256 delay=0
+ *   echo tbs > /sys/block/sdX/queue/scheduler
+ *   mkdir /cgroup/blkio/a /cgroup/blkio/b
+ *   echo 200 > /cgroup/blkio/a/blkio.weight
+ *   echo 800 > /cgroup/blkio/b/blkio.weight
+ *   tbs-bench /dev/sdX /cgroup/blkio/a /cgroup/blkio/b
+ *
+ * Usage: tbs-bench [-s size] [-t seconds] [-j jobs] <blockdev> <cgroup>...
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <linux/fs.h>
+
+struct group_stats {
+	unsigned long long ios;
+	unsigned long long lat_sum;
+	unsigned long long lat_max;
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int write_file(const char *dir, const char *name, const char *val)
+{
+	char path[4096];
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -1;
+	ret = write(fd, val, strlen(val)) == (ssize_t)strlen(val) ? 0 : -1;
+	close(fd);
+	return ret;
+}
+
+static unsigned long read_weight(const char *dir)
+{
+	char path[4096];
+	unsigned long weight = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/blkio.weight", dir);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%lu", &weight) != 1)
+		weight = 0;
+	fclose(f);
+	return weight;
+}
+
+/* One reader: join @cgroup and read until @end, accumulating into @st */
+static int reader(const char *dev, const char *cgroup, size_t size,
+		  unsigned long long end, struct group_stats *st)
+{
+	unsigned long long dev_size, t0, lat;
+	char pid[32];
+	void *buf;
+	int fd;
+
+	snprintf(pid, sizeof(pid), "%d\n", getpid());
+	if (write_file(cgroup, "tasks", pid)) {
+		perror(cgroup);
+		return 1;
+	}
+
+	fd = open(dev, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &dev_size) < 0) {
+		perror("BLKGETSIZE64");
+		return 1;
+	}
+	if (dev_size < size) {
+		fprintf(stderr, "device smaller than request size\n");
+		return 1;
+	}
+	if (posix_memalign(&buf, 4096, size)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	srandom(getpid());
+	while ((t0 = now_ns()) < end) {
+		off_t off = (random() % (dev_size / size)) * size;
+
+		if (pread(fd, buf, size, off) != (ssize_t)size) {
+			perror("pread");
+			return 1;
+		}
+		lat = now_ns() - t0;
+		__sync_fetch_and_add(&st->ios, 1);
+		__sync_fetch_and_add(&st->lat_sum, lat);
+		while (lat > st->lat_max)
+			__sync_bool_compare_and_swap(&st->lat_max,
+						     st->lat_max, lat);
+	}
+
+	close(fd);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long end, total = 0;
+	unsigned long weight_sum = 0, *weight;
+	int seconds = 10, jobs = 4, nr_groups, opt, i, j, status, ret = 0;
+	struct group_stats *st;
+	size_t size = 4096;
+
+	while ((opt = getopt(argc, argv, "s:t:j:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	nr_groups = argc - optind - 1;
+	if (nr_groups < 1 || !size || seconds <= 0 || jobs <= 0)
+		goto usage;
+
+	st = mmap(NULL, nr_groups * sizeof(*st), PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	weight = calloc(nr_groups, sizeof(*weight));
+	if (st == MAP_FAILED || !weight) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	memset(st, 0, nr_groups * sizeof(*st));
+
+	for (i = 0; i < nr_groups; i++) {
+		weight[i] = read_weight(argv[optind + 1 + i]);
+		weight_sum += weight[i];
+	}
+
+	end = now_ns() + seconds * 1000000000ULL;
+	for (i = 0; i < nr_groups; i++) {
+		for (j = 0; j < jobs; j++) {
+			pid_t pid = fork();
+
+			if (pid < 0) {
+				perror("fork");
+				return 1;
+			}
+			if (!pid)
+				exit(reader(argv[optind], argv[optind + 1 + i],
+					    size, end, &st[i]));
+		}
+	}
+	while (wait(&status) > 0) {
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			ret = 1;
+	}
+
+	for (i = 0; i < nr_groups; i++)
+		total += st[i].ios;
+	if (!total) {
+		fprintf(stderr, "no IO completed\n");
+		return 1;
+	}
+
+	printf("%zu byte reads, %d jobs per cgroup, %d s\n",
+	       size, jobs, seconds);
+	for (i = 0; i < nr_groups; i++) {
+		printf("%s: %.1f MB/s, share %.1f%% (weight %.1f%%), "
+		       "avg %llu us, max %llu us\n", argv[optind + 1 + i],
+		       (double)st[i].ios * size / seconds / 1000000,
+		       100.0 * st[i].ios / total,
+		       weight_sum ? 100.0 * weight[i] / weight_sum : 0.0,
+		       st[i].ios ? st[i].lat_sum / st[i].ios / 1000 : 0,
+		       st[i].lat_max / 1000);
+	}
+	return ret;
+
+usage:
+	fprintf(stderr, "usage: %s [-s size] [-t seconds] [-j jobs] "
+		"<blockdev> <cgroup>...\n", argv[0]);
+	return 1;
+}
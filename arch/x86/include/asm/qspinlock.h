@@ -0,0 +1,61 @@
+#ifndef _ASM_X86_QSPINLOCK_H
+#define _ASM_X86_QSPINLOCK_H
+
+/*
+ * Queued spinlocks, included from asm/spinlock.h.
+ *
+ * The uncontended lock is a single cmpxchg of the lock word from 0 to
+ * locked, and unlock is a plain store to the locked byte, as cheap as the
+ * ticket lock.  A CPU that finds the lock taken appends a per-cpu MCS
+ * node to the queue whose tail is encoded in the lock word, and spins on
+ * that node rather than on the lock, so only the CPU at the head of the
+ * queue watches the lock word itself.  See arch/x86/kernel/qspinlock.c.
+ */
+
+#define _Q_LOCKED_VAL		1U
+#define _Q_LOCKED_MASK		0xffU
+#define _Q_TAIL_IDX_OFFSET	16
+#define _Q_TAIL_IDX_BITS	2
+#define _Q_TAIL_CPU_OFFSET	(_Q_TAIL_IDX_OFFSET + _Q_TAIL_IDX_BITS)
+#define _Q_TAIL_MASK		0xffff0000U
+
+extern void queue_spin_lock_slowpath(arch_spinlock_t *lock);
+
+static inline int arch_spin_is_locked(arch_spinlock_t *lock)
+{
+	return ACCESS_ONCE(lock->val) != 0;
+}
+
+static inline int arch_spin_is_contended(arch_spinlock_t *lock)
+{
+	return (ACCESS_ONCE(lock->val) & _Q_TAIL_MASK) != 0;
+}
+#define arch_spin_is_contended	arch_spin_is_contended
+
+static __always_inline int arch_spin_trylock(arch_spinlock_t *lock)
+{
+	/* cmpxchg is a full barrier, so nothing can move before it */
+	return !ACCESS_ONCE(lock->val) &&
+	       cmpxchg(&lock->val, 0, _Q_LOCKED_VAL) == 0;
+}
+
+static __always_inline void arch_spin_lock(arch_spinlock_t *lock)
+{
+	if (likely(cmpxchg(&lock->val, 0, _Q_LOCKED_VAL) == 0))
+		return;
+	queue_spin_lock_slowpath(lock);
+}
+
+static __always_inline void arch_spin_unlock(arch_spinlock_t *lock)
+{
+	barrier();		/* keep the critical section before the release */
+	ACCESS_ONCE(lock->locked) = 0;
+}
+
+static __always_inline void arch_spin_lock_flags(arch_spinlock_t *lock,
+						  unsigned long flags)
+{
+	arch_spin_lock(lock);
+}
+
+#endif /* _ASM_X86_QSPINLOCK_H */
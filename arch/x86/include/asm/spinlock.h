@@ -37,6 +37,10 @@
 # define UNLOCK_LOCK_PREFIX
 #endif
 
+#ifdef CONFIG_X86_QUEUED_SPINLOCKS
+#include <asm/qspinlock.h>
+#else /* !CONFIG_X86_QUEUED_SPINLOCKS */
+
 /*
  * Ticket locks are conceptually two parts, one indicating the current head of
  * the queue, and the other indicating the current tail. The lock is acquired
@@ -133,6 +137,7 @@ static __always_inline void arch_spin_lock_flags(arch_spinlock_t *lock,
 }
 
 #endif	/* CONFIG_PARAVIRT_SPINLOCKS */
+#endif	/* CONFIG_X86_QUEUED_SPINLOCKS */
 
 static inline void arch_spin_unlock_wait(arch_spinlock_t *lock)
 {
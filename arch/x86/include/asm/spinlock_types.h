@@ -7,6 +7,29 @@
 
 #include <linux/types.h>
 
+#ifdef CONFIG_X86_QUEUED_SPINLOCKS
+
+/*
+ * Queued spinlock word, see asm/qspinlock.h:
+ *
+ *  bits  0- 7: locked byte
+ *  bits  8-15: unused
+ *  bits 16-17: tail index, the per-cpu queue node in use
+ *  bits 18-31: tail cpu + 1, 0 if nobody is queued
+ */
+typedef struct arch_spinlock {
+	union {
+		u32 val;
+		struct {
+			u8 locked;
+			u8 __unused;
+			u16 tail;
+		};
+	};
+} arch_spinlock_t;
+
+#else /* !CONFIG_X86_QUEUED_SPINLOCKS */
+
 #if (CONFIG_NR_CPUS < 256)
 typedef u8  __ticket_t;
 typedef u16 __ticketpair_t;
@@ -26,6 +49,8 @@ typedef struct arch_spinlock {
 	};
 } arch_spinlock_t;
 
+#endif /* CONFIG_X86_QUEUED_SPINLOCKS */
+
 #define __ARCH_SPIN_LOCK_UNLOCKED	{ { 0 } }
 
 #include <asm/rwlock.h>
@@ -0,0 +1,124 @@
+/*
+ * Queued spinlock slowpath
+ *
+ * Each cpu has one MCS queue node per context that can take a spinlock
+ * (task, softirq, hardirq, nmi).  A contending cpu publishes its node as
+ * the new tail in the lock word and, if there was a previous tail, links
+ * itself behind it and spins on its own node until its predecessor hands
+ * over the head of the queue.  Only the head spins on the lock word, and
+ * takes the lock once the owner drops the locked byte; it then passes the
+ * head on to its successor with a single store to the successor's node.
+ *
+ * Lock word layout is described in asm/spinlock_types.h.
+ */
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/module.h>
+#include <linux/bug.h>
+
+#define MAX_NODES	4
+
+struct qnode {
+	struct qnode *next;
+	int locked;		/* set by the predecessor: we're the head */
+	int count;		/* nesting level, only used in node 0 */
+};
+
+static DEFINE_PER_CPU_ALIGNED(struct qnode, qnodes[MAX_NODES]);
+
+static inline u32 encode_tail(int cpu, int idx)
+{
+	return ((cpu + 1) << _Q_TAIL_CPU_OFFSET) | (idx << _Q_TAIL_IDX_OFFSET);
+}
+
+static inline struct qnode *decode_tail(u32 tail)
+{
+	int cpu = (tail >> _Q_TAIL_CPU_OFFSET) - 1;
+	int idx = (tail >> _Q_TAIL_IDX_OFFSET) & ((1 << _Q_TAIL_IDX_BITS) - 1);
+
+	return per_cpu_ptr(&qnodes[idx], cpu);
+}
+
+/*
+ * Make @tail the queue tail, keeping the locked byte as it is, and
+ * return the old lock word.
+ */
+static inline u32 xchg_tail(arch_spinlock_t *lock, u32 tail)
+{
+	u32 old, val = ACCESS_ONCE(lock->val);
+
+	for (;;) {
+		old = cmpxchg(&lock->val, val, (val & ~_Q_TAIL_MASK) | tail);
+		if (old == val)
+			return old;
+		val = old;
+	}
+}
+
+void queue_spin_lock_slowpath(arch_spinlock_t *lock)
+{
+	struct qnode *node, *next;
+	u32 tail, old, val;
+	int idx;
+
+	BUILD_BUG_ON(CONFIG_NR_CPUS >= (1U << (32 - _Q_TAIL_CPU_OFFSET)));
+
+	node = this_cpu_ptr(&qnodes[0]);
+	idx = node->count++;
+
+	/* nested deeper than we have nodes for: just spin on the word */
+	if (unlikely(idx >= MAX_NODES)) {
+		while (!arch_spin_trylock(lock))
+			cpu_relax();
+		goto release;
+	}
+
+	tail = encode_tail(smp_processor_id(), idx);
+	node += idx;
+	node->locked = 0;
+	node->next = NULL;
+
+	/* the owner may have gone while we were setting up */
+	if (arch_spin_trylock(lock))
+		goto release;
+
+	/* cmpxchg in xchg_tail() orders the node init before publishing */
+	old = xchg_tail(lock, tail);
+	if (old & _Q_TAIL_MASK) {
+		ACCESS_ONCE(decode_tail(old)->next) = node;
+		while (!ACCESS_ONCE(node->locked))
+			cpu_relax();
+	}
+
+	/* head of the queue: wait for the owner to drop the locked byte */
+	for (;;) {
+		val = ACCESS_ONCE(lock->val);
+		if (val & _Q_LOCKED_MASK) {
+			cpu_relax();
+			continue;
+		}
+		/* still the tail: take the lock and empty the queue at once */
+		if ((val & _Q_TAIL_MASK) == tail) {
+			if (cmpxchg(&lock->val, val, _Q_LOCKED_VAL) == val)
+				goto release;
+			continue;
+		}
+		/*
+		 * Somebody queued behind us.  The fast path and trylock only
+		 * succeed on a zero word, so nobody else can take the locked
+		 * byte while the tail is set.
+		 */
+		ACCESS_ONCE(lock->locked) = _Q_LOCKED_VAL;
+		break;
+	}
+
+	/* hand the head of the queue on, our successor may still be linking */
+	while (!(next = ACCESS_ONCE(node->next)))
+		cpu_relax();
+	barrier();
+	ACCESS_ONCE(next->locked) = 1;
+
+release:
+	this_cpu_dec(qnodes[0].count);
+}
+EXPORT_SYMBOL(queue_spin_lock_slowpath);
@@ -419,6 +419,38 @@ void blkiocg_update_dispatch_stats(struct blkio_group *blkg,
 }
 EXPORT_SYMBOL_GPL(blkiocg_update_dispatch_stats);
 
+void blkiocg_update_throttled_stats(struct blkio_group *blkg, bool direction,
+					bool sync)
+{
+	struct blkio_group_stats_cpu *stats_cpu;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	stats_cpu = this_cpu_ptr(blkg->stats_cpu);
+	u64_stats_update_begin(&stats_cpu->syncp);
+	blkio_add_stat(stats_cpu->stat_arr_cpu[BLKIO_STAT_CPU_THROTTLED],
+			1, direction, sync);
+	u64_stats_update_end(&stats_cpu->syncp);
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL_GPL(blkiocg_update_throttled_stats);
+
+void blkiocg_update_throttle_time_stats(struct blkio_group *blkg,
+		uint64_t time, bool direction, bool sync)
+{
+	struct blkio_group_stats_cpu *stats_cpu;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	stats_cpu = this_cpu_ptr(blkg->stats_cpu);
+	u64_stats_update_begin(&stats_cpu->syncp);
+	blkio_add_stat(stats_cpu->stat_arr_cpu[BLKIO_STAT_CPU_THROTTLE_TIME],
+			time, direction, sync);
+	u64_stats_update_end(&stats_cpu->syncp);
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL_GPL(blkiocg_update_throttle_time_stats);
+
 void blkiocg_update_completion_stats(struct blkio_group *blkg,
 	uint64_t start_time, uint64_t io_start_time, bool direction, bool sync)
 {
@@ -886,6 +918,12 @@ unsigned int blkcg_get_weight(struct blkio_cgroup *blkcg,
 }
 EXPORT_SYMBOL_GPL(blkcg_get_weight);
 
+unsigned int blkcg_get_latency_target(struct blkio_cgroup *blkcg)
+{
+	return ACCESS_ONCE(blkcg->latency_target);
+}
+EXPORT_SYMBOL_GPL(blkcg_get_latency_target);
+
 uint64_t blkcg_get_read_bps(struct blkio_cgroup *blkcg, dev_t dev)
 {
 	struct blkio_policy_node *pn;
@@ -1301,6 +1339,12 @@ static int blkiocg_file_read_map(struct cgroup *cgrp, struct cftype *cft,
 		case BLKIO_THROTL_io_serviced:
 			return blkio_read_blkg_stats(blkcg, cft, cb,
 						BLKIO_STAT_CPU_SERVICED, 1, 1);
+		case BLKIO_THROTL_io_throttled:
+			return blkio_read_blkg_stats(blkcg, cft, cb,
+						BLKIO_STAT_CPU_THROTTLED, 1, 1);
+		case BLKIO_THROTL_io_wait_time:
+			return blkio_read_blkg_stats(blkcg, cft, cb,
+					BLKIO_STAT_CPU_THROTTLE_TIME, 1, 1);
 		default:
 			BUG();
 		}
@@ -1350,6 +1394,8 @@ static u64 blkiocg_file_read_u64 (struct cgroup *cgrp, struct cftype *cft) {
 		switch(name) {
 		case BLKIO_PROP_weight:
 			return (u64)blkcg->weight;
+		case BLKIO_PROP_latency_target:
+			return (u64)blkcg->latency_target;
 		}
 		break;
 	default:
@@ -1372,6 +1418,11 @@ blkiocg_file_write_u64(struct cgroup *cgrp, struct cftype *cft, u64 val)
 		switch(name) {
 		case BLKIO_PROP_weight:
 			return blkio_weight_write(blkcg, val);
+		case BLKIO_PROP_latency_target:
+			if (val > UINT_MAX)
+				return -EINVAL;
+			blkcg->latency_target = (unsigned int)val;
+			return 0;
 		}
 		break;
 	default:
@@ -1397,6 +1448,13 @@ struct cftype blkio_files[] = {
 		.read_u64 = blkiocg_file_read_u64,
 		.write_u64 = blkiocg_file_write_u64,
 	},
+	{
+		.name = "latency_target",
+		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_PROP,
+				BLKIO_PROP_latency_target),
+		.read_u64 = blkiocg_file_read_u64,
+		.write_u64 = blkiocg_file_write_u64,
+	},
 	{
 		.name = "time",
 		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_PROP,
@@ -1497,6 +1555,18 @@ struct cftype blkio_files[] = {
 				BLKIO_THROTL_io_serviced),
 		.read_map = blkiocg_file_read_map,
 	},
+	{
+		.name = "throttle.io_throttled",
+		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_THROTL,
+				BLKIO_THROTL_io_throttled),
+		.read_map = blkiocg_file_read_map,
+	},
+	{
+		.name = "throttle.io_wait_time",
+		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_THROTL,
+				BLKIO_THROTL_io_wait_time),
+		.read_map = blkiocg_file_read_map,
+	},
 #endif /* CONFIG_BLK_DEV_THROTTLING */
 
 #ifdef CONFIG_DEBUG_BLK_CGROUP
@@ -63,6 +63,10 @@ enum stat_type_cpu {
 	BLKIO_STAT_CPU_SERVICED,
 	/* Number of IOs merged */
 	BLKIO_STAT_CPU_MERGED,
+	/* Number of IOs delayed by throttling */
+	BLKIO_STAT_CPU_THROTTLED,
+	/* Total time (in ns) IOs spent delayed by throttling */
+	BLKIO_STAT_CPU_THROTTLE_TIME,
 	BLKIO_STAT_CPU_NR
 };
 
@@ -99,6 +103,7 @@ enum blkcg_file_name_prop {
 	BLKIO_PROP_idle_time,
 	BLKIO_PROP_empty_time,
 	BLKIO_PROP_dequeue,
+	BLKIO_PROP_latency_target,
 };
 
 /* cgroup files owned by throttle policy */
@@ -109,11 +114,15 @@ enum blkcg_file_name_throtl {
 	BLKIO_THROTL_write_iops_device,
 	BLKIO_THROTL_io_service_bytes,
 	BLKIO_THROTL_io_serviced,
+	BLKIO_THROTL_io_throttled,
+	BLKIO_THROTL_io_wait_time,
 };
 
 struct blkio_cgroup {
 	struct cgroup_subsys_state css;
 	unsigned int weight;
+	/* completion latency target in usecs, 0 if none */
+	unsigned int latency_target;
 	spinlock_t lock;
 	struct hlist_head blkg_list;
 	struct list_head policy_list; /* list of blkio_policy_node */
@@ -199,6 +208,7 @@ struct blkio_policy_node {
 
 extern unsigned int blkcg_get_weight(struct blkio_cgroup *blkcg,
 				     dev_t dev);
+extern unsigned int blkcg_get_latency_target(struct blkio_cgroup *blkcg);
 extern uint64_t blkcg_get_read_bps(struct blkio_cgroup *blkcg,
 				     dev_t dev);
 extern uint64_t blkcg_get_write_bps(struct blkio_cgroup *blkcg,
@@ -327,6 +337,10 @@ void blkiocg_update_io_add_stats(struct blkio_group *blkg,
 		struct blkio_group *curr_blkg, bool direction, bool sync);
 void blkiocg_update_io_remove_stats(struct blkio_group *blkg,
 					bool direction, bool sync);
+void blkiocg_update_throttled_stats(struct blkio_group *blkg, bool direction,
+					bool sync);
+void blkiocg_update_throttle_time_stats(struct blkio_group *blkg,
+		uint64_t time, bool direction, bool sync);
 #else
 struct cgroup;
 static inline struct blkio_cgroup *
@@ -360,5 +374,9 @@ static inline void blkiocg_update_io_add_stats(struct blkio_group *blkg,
 		struct blkio_group *curr_blkg, bool direction, bool sync) {}
 static inline void blkiocg_update_io_remove_stats(struct blkio_group *blkg,
 						bool direction, bool sync) {}
+static inline void blkiocg_update_throttled_stats(struct blkio_group *blkg,
+						bool direction, bool sync) {}
+static inline void blkiocg_update_throttle_time_stats(struct blkio_group *blkg,
+		uint64_t time, bool direction, bool sync) {}
 #endif
 #endif /* _BLK_CGROUP_H */
@@ -498,9 +498,13 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	if (err)
 		goto fail_id;
 
-	if (blk_throtl_init(q))
+	q->comp_stats = alloc_percpu(struct blk_comp_stats);
+	if (!q->comp_stats)
 		goto fail_bdi;
 
+	if (blk_throtl_init(q))
+		goto fail_stats;
+
 	setup_timer(&q->backing_dev_info.laptop_mode_wb_timer,
 		    laptop_mode_timer_fn, (unsigned long) q);
 	setup_timer(&q->timeout, blk_rq_timed_out_timer, (unsigned long) q);
@@ -524,6 +528,8 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 
 	return q;
 
+fail_stats:
+	free_percpu(q->comp_stats);
 fail_bdi:
 	bdi_destroy(&q->backing_dev_info);
 fail_id:
@@ -14,17 +14,49 @@
 
 static DEFINE_PER_CPU(struct list_head, blk_cpu_done);
 
+#if defined(CONFIG_SMP) && defined(CONFIG_USE_GENERIC_SMP_HELPERS)
+/*
+ * Completions handed to this cpu by other cpus. They are collected on one
+ * list and a single IPI is sent per batch, instead of one per request.
+ */
+struct blk_remote_done {
+	spinlock_t		lock;
+	struct list_head	list;
+	bool			ipi_pending;
+	struct call_single_data	csd;
+};
+static DEFINE_PER_CPU_SHARED_ALIGNED(struct blk_remote_done, blk_remote_done);
+
+/* cpu that this cpu last sent remote completions to */
+static DEFINE_PER_CPU(int, blk_steer_cpu);
+
+static void blk_splice_remote(struct list_head *list)
+{
+	struct blk_remote_done *rd = &__get_cpu_var(blk_remote_done);
+
+	spin_lock(&rd->lock);
+	list_splice_tail_init(&rd->list, list);
+	spin_unlock(&rd->lock);
+}
+#else
+static inline void blk_splice_remote(struct list_head *list)
+{
+}
+#endif
+
 /*
  * Softirq action handler - move entries to local list and loop over them
  * while passing them to the queue registered handler.
  */
 static void blk_done_softirq(struct softirq_action *h)
 {
-	struct list_head *cpu_list, local_list;
+	struct list_head *cpu_list;
+	LIST_HEAD(local_list);
 
 	local_irq_disable();
 	cpu_list = &__get_cpu_var(blk_cpu_done);
-	list_replace_init(cpu_list, &local_list);
+	list_splice_init(cpu_list, &local_list);
+	blk_splice_remote(&local_list);
 	local_irq_enable();
 
 	while (!list_empty(&local_list)) {
@@ -32,6 +64,7 @@ static void blk_done_softirq(struct softirq_action *h)
 
 		rq = list_entry(local_list.next, struct request, csd.list);
 		list_del_init(&rq->csd.list);
+		this_cpu_inc(rq->q->comp_stats->completed);
 		rq->q->softirq_done_fn(rq);
 	}
 }
@@ -39,43 +72,103 @@ static void blk_done_softirq(struct softirq_action *h)
 #if defined(CONFIG_SMP) && defined(CONFIG_USE_GENERIC_SMP_HELPERS)
 static void trigger_softirq(void *data)
 {
-	struct request *rq = data;
-	unsigned long flags;
-	struct list_head *list;
+	struct blk_remote_done *rd = data;
 
-	local_irq_save(flags);
-	list = &__get_cpu_var(blk_cpu_done);
-	list_add_tail(&rq->csd.list, list);
+	spin_lock(&rd->lock);
+	rd->ipi_pending = false;
+	spin_unlock(&rd->lock);
 
-	if (list->next == &rq->csd.list)
-		raise_softirq_irqoff(BLOCK_SOFTIRQ);
+	raise_softirq_irqoff(BLOCK_SOFTIRQ);
+}
 
-	local_irq_restore(flags);
+/*
+ * With QUEUE_FLAG_SAME_COMP any cpu sharing a cache with the submitter is
+ * as good as the submitter itself. If we already have a batch pending on
+ * such a cpu, add to that batch rather than starting a new one, so that
+ * completions for a cache domain end up on one cpu per interrupt.
+ */
+static int blk_steer_target(int ccpu)
+{
+	int last = __this_cpu_read(blk_steer_cpu);
+
+	if (last != ccpu && cpu_online(last) &&
+	    cpus_share_cache(last, ccpu) &&
+	    !list_empty(&per_cpu(blk_remote_done, last).list))
+		return last;
+
+	return ccpu;
 }
 
 /*
- * Setup and invoke a run of 'trigger_softirq' on the given cpu.
+ * Queue the request on the given cpu and, if that starts a new batch,
+ * kick it with an IPI.
  */
 static int raise_blk_irq(int cpu, struct request *rq)
 {
-	if (cpu_online(cpu)) {
-		struct call_single_data *data = &rq->csd;
+	struct blk_remote_done *rd;
+	bool kick = false;
 
-		data->func = trigger_softirq;
-		data->info = rq;
-		data->flags = 0;
+	if (!cpu_online(cpu))
+		return 1;
 
-		__smp_call_function_single(cpu, data, 0);
-		return 0;
-	}
+	rd = &per_cpu(blk_remote_done, cpu);
+	spin_lock(&rd->lock);
+	if (list_empty(&rd->list) && !rd->ipi_pending)
+		kick = rd->ipi_pending = true;
+	list_add_tail(&rq->csd.list, &rd->list);
+	spin_unlock(&rd->lock);
 
-	return 1;
+	__this_cpu_write(blk_steer_cpu, cpu);
+
+	if (kick) {
+		__this_cpu_inc(rq->q->comp_stats->ipi_sent);
+		__smp_call_function_single(cpu, &rd->csd, 0);
+	} else
+		__this_cpu_inc(rq->q->comp_stats->ipi_batched);
+
+	return 0;
+}
+
+static void blk_remote_cpu_dead(int cpu)
+{
+	struct blk_remote_done *rd = &per_cpu(blk_remote_done, cpu);
+
+	spin_lock(&rd->lock);
+	list_splice_tail_init(&rd->list, &__get_cpu_var(blk_cpu_done));
+	rd->ipi_pending = false;
+	/* an IPI lost with the cpu would leave the csd locked forever */
+	rd->csd.flags = 0;
+	spin_unlock(&rd->lock);
+}
+
+static void __init blk_remote_init(int cpu)
+{
+	struct blk_remote_done *rd = &per_cpu(blk_remote_done, cpu);
+
+	spin_lock_init(&rd->lock);
+	INIT_LIST_HEAD(&rd->list);
+	rd->csd.func = trigger_softirq;
+	rd->csd.info = rd;
+	per_cpu(blk_steer_cpu, cpu) = cpu;
 }
 #else /* CONFIG_SMP && CONFIG_USE_GENERIC_SMP_HELPERS */
+static inline int blk_steer_target(int ccpu)
+{
+	return ccpu;
+}
+
 static int raise_blk_irq(int cpu, struct request *rq)
 {
 	return 1;
 }
+
+static inline void blk_remote_cpu_dead(int cpu)
+{
+}
+
+static inline void blk_remote_init(int cpu)
+{
+}
 #endif
 
 static int __cpuinit blk_cpu_notify(struct notifier_block *self,
@@ -91,6 +184,7 @@ static int __cpuinit blk_cpu_notify(struct notifier_block *self,
 		local_irq_disable();
 		list_splice_init(&per_cpu(blk_cpu_done, cpu),
 				 &__get_cpu_var(blk_cpu_done));
+		blk_remote_cpu_dead(cpu);
 		raise_softirq_irqoff(BLOCK_SOFTIRQ);
 		local_irq_enable();
 	}
@@ -107,7 +201,7 @@ void __blk_complete_request(struct request *req)
 	int ccpu, cpu;
 	struct request_queue *q = req->q;
 	unsigned long flags;
-	bool shared = false;
+	bool shared = false, force = false;
 
 	BUG_ON(!q->softirq_done_fn);
 
@@ -119,7 +213,8 @@ void __blk_complete_request(struct request *req)
 	 */
 	if (req->cpu != -1) {
 		ccpu = req->cpu;
-		if (!test_bit(QUEUE_FLAG_SAME_FORCE, &q->queue_flags))
+		force = test_bit(QUEUE_FLAG_SAME_FORCE, &q->queue_flags);
+		if (!force)
 			shared = cpus_share_cache(cpu, ccpu);
 	} else
 		ccpu = cpu;
@@ -146,8 +241,12 @@ do_local:
 		 */
 		if (list->next == &req->csd.list)
 			raise_softirq_irqoff(BLOCK_SOFTIRQ);
-	} else if (raise_blk_irq(ccpu, req))
-		goto do_local;
+	} else {
+		if (!force)
+			ccpu = blk_steer_target(ccpu);
+		if (raise_blk_irq(ccpu, req))
+			goto do_local;
+	}
 
 	local_irq_restore(flags);
 }
@@ -176,8 +275,10 @@ static __init int blk_softirq_init(void)
 {
 	int i;
 
-	for_each_possible_cpu(i)
+	for_each_possible_cpu(i) {
 		INIT_LIST_HEAD(&per_cpu(blk_cpu_done, i));
+		blk_remote_init(i);
+	}
 
 	open_softirq(BLOCK_SOFTIRQ, blk_done_softirq);
 	register_hotcpu_notifier(&blk_cpu_notifier);
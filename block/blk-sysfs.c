@@ -275,6 +275,23 @@ queue_rq_affinity_store(struct request_queue *q, const char *page, size_t count)
 	return ret;
 }
 
+static ssize_t queue_completion_cpus_show(struct request_queue *q, char *page)
+{
+	ssize_t len = 0;
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		struct blk_comp_stats *st = per_cpu_ptr(q->comp_stats, cpu);
+
+		if (!st->completed && !st->ipi_sent && !st->ipi_batched)
+			continue;
+		len += scnprintf(page + len, PAGE_SIZE - len,
+				 "cpu%d %lu %lu %lu\n", cpu, st->completed,
+				 st->ipi_sent, st->ipi_batched);
+	}
+	return len;
+}
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -377,6 +394,11 @@ static struct queue_sysfs_entry queue_rq_affinity_entry = {
 	.store = queue_rq_affinity_store,
 };
 
+static struct queue_sysfs_entry queue_completion_cpus_entry = {
+	.attr = {.name = "completion_cpus", .mode = S_IRUGO },
+	.show = queue_completion_cpus_show,
+};
+
 static struct queue_sysfs_entry queue_iostats_entry = {
 	.attr = {.name = "iostats", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_show_iostats,
@@ -409,6 +431,7 @@ static struct attribute *default_attrs[] = {
 	&queue_nonrot_entry.attr,
 	&queue_nomerges_entry.attr,
 	&queue_rq_affinity_entry.attr,
+	&queue_completion_cpus_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
 	NULL,
@@ -500,6 +523,7 @@ static void blk_release_queue(struct kobject *kobj)
 	blk_trace_shutdown(q);
 
 	bdi_destroy(&q->backing_dev_info);
+	free_percpu(q->comp_stats);
 
 	ida_simple_remove(&blk_queue_ida, q->id);
 	kmem_cache_free(blk_requestq_cachep, q);
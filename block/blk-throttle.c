@@ -21,6 +21,13 @@ static int throtl_quantum = 32;
 /* Throttling is performed over 100ms slice and after that slice is renewed */
 static unsigned long throtl_slice = HZ/10;	/* 100 ms */
 
+/*
+ * A cpu may take at most this fraction of a slice's worth of IO as cached
+ * tokens, which bounds how much a group can be underserved by tokens that
+ * are invalidated before use.
+ */
+static unsigned int throtl_token_div = 8;
+
 /* A workqueue to queue throttle related work */
 static struct workqueue_struct *kthrotld_workqueue;
 static void throtl_schedule_delayed_work(struct throtl_data *td,
@@ -38,6 +45,18 @@ struct throtl_rb_root {
 
 #define rb_entry_tg(node)	rb_entry((node), struct throtl_grp, rb_node)
 
+/*
+ * Per cpu cache of bytes and ios which have already been charged to a
+ * group and all its ancestors. A bio that fits in the cache of the
+ * submitting cpu is let through without taking the queue lock. The cache
+ * is only valid while gen matches tg_token_gen() of the group.
+ */
+struct throtl_token_cache {
+	uint64_t bytes[2];
+	unsigned int ios[2];
+	unsigned int gen;
+};
+
 struct throtl_grp {
 	/* List of throtl groups on the request queue*/
 	struct hlist_node tg_node;
@@ -56,11 +75,18 @@ struct throtl_grp {
 	atomic_t ref;
 	unsigned int flags;
 
+	/* group of the parent cgroup, its limits apply to us as well */
+	struct throtl_grp *parent;
+
 	/* Two lists for READ and WRITE */
 	struct bio_list bio_lists[2];
 
 	/* Number of queued bios on READ and WRITE lists */
 	unsigned int nr_queued[2];
+	/* ... of which are sync */
+	unsigned int nr_queued_sync[2];
+	/* last time the queued bios were charged their wait time */
+	unsigned long long queue_time_stamp;
 
 	/* bytes per second rate limits */
 	uint64_t bps[2];
@@ -80,6 +106,9 @@ struct throtl_grp {
 	/* Some throttle limits got updated for the group */
 	int limits_changed;
 
+	struct throtl_token_cache __percpu *tokens;
+	unsigned int token_gen;
+
 	struct rcu_head rcu_head;
 };
 
@@ -154,11 +183,16 @@ static inline struct throtl_grp *throtl_ref_get_tg(struct throtl_grp *tg)
 	return tg;
 }
 
+static void throtl_put_tg(struct throtl_grp *tg);
+
 static void throtl_free_tg(struct rcu_head *head)
 {
 	struct throtl_grp *tg;
 
 	tg = container_of(head, struct throtl_grp, rcu_head);
+	if (tg->parent)
+		throtl_put_tg(tg->parent);
+	free_percpu(tg->tokens);
 	free_percpu(tg->blkg.stats_cpu);
 	kfree(tg);
 }
@@ -280,6 +314,13 @@ static struct throtl_grp *throtl_alloc_tg(struct throtl_data *td)
 		return NULL;
 	}
 
+	tg->tokens = alloc_percpu(struct throtl_token_cache);
+	if (!tg->tokens) {
+		free_percpu(tg->blkg.stats_cpu);
+		kfree(tg);
+		return NULL;
+	}
+
 	throtl_init_group(tg);
 	return tg;
 }
@@ -303,30 +344,25 @@ throtl_grp *throtl_find_tg(struct throtl_data *td, struct blkio_cgroup *blkcg)
 	return tg;
 }
 
-static struct throtl_grp * throtl_get_tg(struct throtl_data *td)
+/*
+ * Create the group of @blkcg below @parent, or return the one somebody
+ * else created meanwhile. Returns the root group if allocation fails and
+ * NULL if the queue died.
+ *
+ * Called with queue lock held, which is dropped to allocate the group.
+ */
+static struct throtl_grp *throtl_create_tg(struct throtl_data *td,
+					   struct blkio_cgroup *blkcg,
+					   struct throtl_grp *parent)
 {
 	struct throtl_grp *tg = NULL, *__tg = NULL;
-	struct blkio_cgroup *blkcg;
 	struct request_queue *q = td->queue;
 
-	/* no throttling for dead queue */
-	if (unlikely(blk_queue_dead(q)))
-		return NULL;
-
-	rcu_read_lock();
-	blkcg = task_blkio_cgroup(current);
-	tg = throtl_find_tg(td, blkcg);
-	if (tg) {
-		rcu_read_unlock();
-		return tg;
-	}
-
 	/*
 	 * Need to allocate a group. Allocation of group also needs allocation
 	 * of per cpu stats which in-turn takes a mutex() and can block. Hence
-	 * we need to drop rcu lock and queue_lock before we call alloc.
+	 * we need to drop queue_lock before we call alloc.
 	 */
-	rcu_read_unlock();
 	spin_unlock_irq(q->queue_lock);
 
 	tg = throtl_alloc_tg(td);
@@ -336,36 +372,105 @@ static struct throtl_grp * throtl_get_tg(struct throtl_data *td)
 
 	/* Make sure @q is still alive */
 	if (unlikely(blk_queue_dead(q))) {
-		kfree(tg);
+		if (tg)
+			throtl_put_tg(tg);
 		return NULL;
 	}
 
-	/*
-	 * Initialize the new group. After sleeping, read the blkcg again.
-	 */
-	rcu_read_lock();
-	blkcg = task_blkio_cgroup(current);
-
 	/*
 	 * If some other thread already allocated the group while we were
 	 * not holding queue lock, free up the group
 	 */
+	rcu_read_lock();
 	__tg = throtl_find_tg(td, blkcg);
+	rcu_read_unlock();
 
 	if (__tg) {
-		kfree(tg);
-		rcu_read_unlock();
+		if (tg)
+			throtl_put_tg(tg);
 		return __tg;
 	}
 
 	/* Group allocation failed. Account the IO to root group */
-	if (!tg) {
-		tg = td->root_tg;
+	if (!tg)
+		return td->root_tg;
+
+	if (parent)
+		tg->parent = throtl_ref_get_tg(parent);
+
+	rcu_read_lock();
+	throtl_init_add_tg_lists(td, tg, blkcg);
+	rcu_read_unlock();
+	return tg;
+}
+
+/*
+ * Look up or create the group of @blkcg. Groups of ancestor cgroups are
+ * created first, so that a group is never visible without its parent:
+ * each round creates the topmost missing one. This is iterative because
+ * the depth of the hierarchy is up to the user.
+ *
+ * Called with queue lock held, which is dropped to allocate groups.
+ * The caller has to pin @blkcg, which pins its ancestors too.
+ */
+static struct throtl_grp *throtl_get_tg_blkcg(struct throtl_data *td,
+					       struct blkio_cgroup *blkcg)
+{
+	struct throtl_grp *tg, *parent;
+	struct cgroup *cgrp;
+
+	for (;;) {
+		rcu_read_lock();
+		tg = throtl_find_tg(td, blkcg);
+		rcu_read_unlock();
+		if (tg)
+			return tg;
+
+		/* the root cgroup always has a group, so this terminates */
+		cgrp = blkcg->css.cgroup;
+		for (;;) {
+			rcu_read_lock();
+			parent = throtl_find_tg(td,
+					cgroup_to_blkio_cgroup(cgrp->parent));
+			rcu_read_unlock();
+			if (parent)
+				break;
+			cgrp = cgrp->parent;
+		}
+
+		tg = throtl_create_tg(td, cgroup_to_blkio_cgroup(cgrp), parent);
+		if (!tg || tg == td->root_tg)
+			return tg;
+	}
+}
+
+static struct throtl_grp * throtl_get_tg(struct throtl_data *td)
+{
+	struct throtl_grp *tg = NULL;
+	struct blkio_cgroup *blkcg;
+	struct request_queue *q = td->queue;
+
+	/* no throttling for dead queue */
+	if (unlikely(blk_queue_dead(q)))
+		return NULL;
+
+	rcu_read_lock();
+	blkcg = task_blkio_cgroup(current);
+	tg = throtl_find_tg(td, blkcg);
+	if (tg) {
+		rcu_read_unlock();
 		return tg;
 	}
 
-	throtl_init_add_tg_lists(td, tg, blkcg);
+	/* The task may be moving to another cgroup, use the root group */
+	if (!css_tryget(&blkcg->css)) {
+		rcu_read_unlock();
+		return td->root_tg;
+	}
 	rcu_read_unlock();
+
+	tg = throtl_get_tg_blkcg(td, blkcg);
+	css_put(&blkcg->css);
 	return tg;
 }
 
@@ -484,9 +589,33 @@ static void throtl_schedule_next_dispatch(struct throtl_data *td)
 		throtl_schedule_delayed_work(td, (st->min_disptime - jiffies));
 }
 
+/*
+ * Cached tokens were charged to the group and all its ancestors, so they
+ * go stale when any of them invalidates: combine all their generations.
+ */
+static unsigned int tg_token_gen(struct throtl_grp *tg)
+{
+	unsigned int gen = 0;
+
+	for (; tg; tg = tg->parent)
+		gen += ACCESS_ONCE(tg->token_gen);
+	return gen;
+}
+
+/*
+ * Invalidate tokens cached by all cpus for @tg and the groups below it.
+ * Called with queue lock held.
+ */
+static inline void throtl_invalidate_tokens(struct throtl_grp *tg)
+{
+	tg->token_gen++;
+}
+
 static inline void
 throtl_start_new_slice(struct throtl_data *td, struct throtl_grp *tg, bool rw)
 {
+	/* tokens charged to the old slice must not be spent in the new one */
+	throtl_invalidate_tokens(tg);
 	tg->bytes_disp[rw] = 0;
 	tg->io_disp[rw] = 0;
 	tg->slice_start[rw] = jiffies;
@@ -679,24 +808,21 @@ static bool tg_no_rule_group(struct throtl_grp *tg, bool rw) {
 	return 0;
 }
 
-/*
- * Returns whether one can dispatch a bio or not. Also returns approx number
- * of jiffies to wait before this bio is with-in IO rate and can be dispatched
- */
-static bool tg_may_dispatch(struct throtl_data *td, struct throtl_grp *tg,
+/* Neither the group nor any of its ancestors has a limit for @rw */
+static bool tg_no_rule_path(struct throtl_grp *tg, bool rw)
+{
+	for (; tg; tg = tg->parent)
+		if (!tg_no_rule_group(tg, rw))
+			return 0;
+	return 1;
+}
+
+static bool __tg_may_dispatch(struct throtl_data *td, struct throtl_grp *tg,
 				struct bio *bio, unsigned long *wait)
 {
 	bool rw = bio_data_dir(bio);
 	unsigned long bps_wait = 0, iops_wait = 0, max_wait = 0;
 
-	/*
- 	 * Currently whole state machine of group depends on first bio
-	 * queued in the group bio list. So one should not be calling
-	 * this function with a different bio if there are other bios
-	 * queued.
-	 */
-	BUG_ON(tg->nr_queued[rw] && bio != bio_list_peek(&tg->bio_lists[rw]));
-
 	/* If tg->bps = -1, then BW is unlimited */
 	if (tg->bps[rw] == -1 && tg->iops[rw] == -1) {
 		if (wait)
@@ -734,29 +860,220 @@ static bool tg_may_dispatch(struct throtl_data *td, struct throtl_grp *tg,
 	return 0;
 }
 
+/*
+ * Returns whether one can dispatch a bio or not. Also returns approx number
+ * of jiffies to wait before this bio is with-in IO rate of the group and
+ * all its ancestors and can be dispatched
+ */
+static bool tg_may_dispatch(struct throtl_data *td, struct throtl_grp *tg,
+				struct bio *bio, unsigned long *wait)
+{
+	bool rw = bio_data_dir(bio);
+	unsigned long tg_wait, max_wait = 0;
+	bool dispatch = true;
+
+	/*
+ 	 * Currently whole state machine of group depends on first bio
+	 * queued in the group bio list. So one should not be calling
+	 * this function with a different bio if there are other bios
+	 * queued.
+	 */
+	BUG_ON(tg->nr_queued[rw] && bio != bio_list_peek(&tg->bio_lists[rw]));
+
+	for (; tg; tg = tg->parent) {
+		if (!__tg_may_dispatch(td, tg, bio, &tg_wait)) {
+			dispatch = false;
+			max_wait = max(max_wait, tg_wait);
+		}
+	}
+
+	if (wait)
+		*wait = max_wait;
+	return dispatch;
+}
+
 static void throtl_charge_bio(struct throtl_grp *tg, struct bio *bio)
 {
 	bool rw = bio_data_dir(bio);
 	bool sync = rw_is_sync(bio->bi_rw);
+	struct throtl_grp *__tg;
 
-	/* Charge the bio to the group */
-	tg->bytes_disp[rw] += bio->bi_size;
-	tg->io_disp[rw]++;
+	/* Charge the bio to the group and the groups above it */
+	for (__tg = tg; __tg; __tg = __tg->parent) {
+		__tg->bytes_disp[rw] += bio->bi_size;
+		__tg->io_disp[rw]++;
+	}
 
 	blkiocg_update_dispatch_stats(&tg->blkg, bio->bi_size, rw, sync);
 }
 
+static void throtl_trim_slices(struct throtl_data *td, struct throtl_grp *tg,
+				bool rw)
+{
+	for (; tg; tg = tg->parent)
+		throtl_trim_slice(td, tg, rw);
+}
+
+/* Round the time elapsed in the current slice up to full slices */
+static unsigned long tg_slice_elapsed_rnd(struct throtl_grp *tg, bool rw)
+{
+	unsigned long jiffy_elapsed = jiffies - tg->slice_start[rw];
+
+	/* Slice has just started. Consider one slice interval */
+	if (!jiffy_elapsed)
+		jiffy_elapsed = throtl_slice;
+
+	return roundup(jiffy_elapsed, throtl_slice);
+}
+
+/*
+ * Work out how many bytes and ios the cpu cache of @tg may take for @rw:
+ * a fraction of a slice worth of the limits of the group and of its
+ * ancestors, but no more than what is left in any of their current
+ * slices. Unlimited quantities are returned as -1.
+ */
+static void tg_token_batch(struct throtl_grp *tg, bool rw, uint64_t *bytes,
+			   unsigned int *ios)
+{
+	uint64_t tmp, allowed;
+
+	*bytes = -1;
+	*ios = -1;
+
+	for (; tg; tg = tg->parent) {
+		if (tg->bps[rw] != -1) {
+			tmp = tg->bps[rw] * tg_slice_elapsed_rnd(tg, rw);
+			do_div(tmp, HZ);
+			allowed = tmp > tg->bytes_disp[rw] ?
+					tmp - tg->bytes_disp[rw] : 0;
+			tmp = tg->bps[rw] * throtl_slice;
+			do_div(tmp, HZ * throtl_token_div);
+			*bytes = min3(*bytes, allowed, tmp);
+		}
+		if (tg->iops[rw] != -1) {
+			tmp = (u64)tg->iops[rw] * tg_slice_elapsed_rnd(tg, rw);
+			do_div(tmp, HZ);
+			allowed = tmp > tg->io_disp[rw] ?
+					tmp - tg->io_disp[rw] : 0;
+			tmp = (u64)tg->iops[rw] * throtl_slice;
+			do_div(tmp, HZ * throtl_token_div);
+			*ios = min3((uint64_t)*ios, allowed, tmp);
+		}
+	}
+}
+
+/*
+ * Charge a batch of IO to @tg and its ancestors up front and hand it to
+ * the cache of the local cpu, so that following bios of this cpu can be
+ * let through without the queue lock. Called with queue lock held.
+ */
+static void throtl_refill_tokens(struct throtl_data *td,
+				 struct throtl_grp *tg, bool rw)
+{
+	struct throtl_token_cache *tc;
+	struct throtl_grp *__tg;
+	unsigned int ios, gen;
+	uint64_t bytes;
+
+	tg_token_batch(tg, rw, &bytes, &ios);
+	if (!bytes || !ios || (bytes == -1 && ios == -1))
+		return;
+
+	for (__tg = tg; __tg; __tg = __tg->parent) {
+		if (__tg->bps[rw] != -1)
+			__tg->bytes_disp[rw] += bytes;
+		if (__tg->iops[rw] != -1)
+			__tg->io_disp[rw] += ios;
+	}
+
+	/* we're under queue lock with irqs off, the cache is ours */
+	tc = this_cpu_ptr(tg->tokens);
+	gen = tg_token_gen(tg);
+	if (tc->gen != gen) {
+		memset(tc, 0, sizeof(*tc));
+		tc->gen = gen;
+	}
+	tc->bytes[rw] = (bytes == -1 || tc->bytes[rw] == -1) ?
+				-1 : tc->bytes[rw] + bytes;
+	tc->ios[rw] = (ios == -1 || tc->ios[rw] == -1) ?
+				-1 : tc->ios[rw] + ios;
+}
+
+/*
+ * Try to pay for @bio with tokens cached on the local cpu. Can be called
+ * without the queue lock, under rcu.
+ */
+static bool throtl_consume_tokens(struct throtl_grp *tg, struct bio *bio)
+{
+	bool rw = bio_data_dir(bio);
+	struct throtl_token_cache *tc;
+	unsigned long flags;
+	bool ret = false;
+
+	/* don't overtake bios already waiting in the group */
+	if (ACCESS_ONCE(tg->nr_queued[rw]))
+		return false;
+
+	local_irq_save(flags);
+	tc = this_cpu_ptr(tg->tokens);
+	if (tc->gen == tg_token_gen(tg) && tc->ios[rw] &&
+	    tc->bytes[rw] >= bio->bi_size) {
+		tc->bytes[rw] -= bio->bi_size;
+		tc->ios[rw]--;
+		ret = true;
+	}
+	local_irq_restore(flags);
+
+	return ret;
+}
+
+/*
+ * Charge the time bios have spent queued since the last update to the
+ * group's wait time stats. Has to be called before nr_queued changes.
+ */
+static void tg_update_queue_time(struct throtl_grp *tg)
+{
+	unsigned long long now = sched_clock();
+	unsigned long long delta;
+	int rw;
+
+	if (time_after64(now, tg->queue_time_stamp)) {
+		delta = now - tg->queue_time_stamp;
+		for (rw = READ; rw <= WRITE; rw++) {
+			unsigned int sync = tg->nr_queued_sync[rw];
+			unsigned int async = tg->nr_queued[rw] - sync;
+
+			if (sync)
+				blkiocg_update_throttle_time_stats(&tg->blkg,
+						delta * sync, rw, true);
+			if (async)
+				blkiocg_update_throttle_time_stats(&tg->blkg,
+						delta * async, rw, false);
+		}
+	}
+	tg->queue_time_stamp = now;
+}
+
 static void throtl_add_bio_tg(struct throtl_data *td, struct throtl_grp *tg,
 			struct bio *bio)
 {
 	bool rw = bio_data_dir(bio);
+	bool sync = rw_is_sync(bio->bi_rw);
+
+	tg_update_queue_time(tg);
+	blkiocg_update_throttled_stats(&tg->blkg, rw, sync);
 
 	bio_list_add(&tg->bio_lists[rw], bio);
 	/* Take a bio reference on tg */
 	throtl_ref_get_tg(tg);
 	tg->nr_queued[rw]++;
+	if (sync)
+		tg->nr_queued_sync[rw]++;
 	td->nr_queued[rw]++;
 	throtl_enqueue_tg(td, tg);
+
+	/* later bios must queue up behind this one */
+	throtl_invalidate_tokens(tg);
 }
 
 static void tg_update_disptime(struct throtl_data *td, struct throtl_grp *tg)
@@ -784,10 +1101,12 @@ static void tg_dispatch_one_bio(struct throtl_data *td, struct throtl_grp *tg,
 {
 	struct bio *bio;
 
+	tg_update_queue_time(tg);
+
 	bio = bio_list_pop(&tg->bio_lists[rw]);
 	tg->nr_queued[rw]--;
-	/* Drop bio reference on tg */
-	throtl_put_tg(tg);
+	if (rw_is_sync(bio->bi_rw))
+		tg->nr_queued_sync[rw]--;
 
 	BUG_ON(td->nr_queued[rw] <= 0);
 	td->nr_queued[rw]--;
@@ -796,7 +1115,10 @@ static void tg_dispatch_one_bio(struct throtl_data *td, struct throtl_grp *tg,
 	bio_list_add(bl, bio);
 	bio->bi_rw |= REQ_THROTTLED;
 
-	throtl_trim_slice(td, tg, rw);
+	throtl_trim_slices(td, tg, rw);
+
+	/* Drop bio reference on tg */
+	throtl_put_tg(tg);
 }
 
 static int throtl_dispatch_tg(struct throtl_data *td, struct throtl_grp *tg,
@@ -876,6 +1198,12 @@ static void throtl_process_limit_change(struct throtl_data *td)
 	throtl_log(td, "limits changed");
 
 	hlist_for_each_entry_safe(tg, pos, n, &td->tg_list, tg_node) {
+		/*
+		 * Cached tokens were sized for the old limits of the group
+		 * or of one of its ancestors, drop them.
+		 */
+		throtl_invalidate_tokens(tg);
+
 		if (!tg->limits_changed)
 			continue;
 
@@ -894,10 +1222,12 @@ static void throtl_process_limit_change(struct throtl_data *td)
 		 */
 		throtl_start_new_slice(td, tg, 0);
 		throtl_start_new_slice(td, tg, 1);
+	}
 
+	/* a changed ancestor limit affects the dispatch time of descendants */
+	hlist_for_each_entry_safe(tg, pos, n, &td->tg_list, tg_node)
 		if (throtl_tg_on_rr(tg))
 			tg_update_disptime(td, tg);
-	}
 }
 
 /* Dispatch throttled bios. Should be called without queue lock held. */
@@ -1134,7 +1464,11 @@ bool blk_throtl_bio(struct request_queue *q, struct bio *bio)
 	if (tg) {
 		throtl_tg_fill_dev_details(td, tg);
 
-		if (tg_no_rule_group(tg, rw)) {
+		/*
+		 * Also let the bio through if the group and its ancestors
+		 * have limits but the local cpu still holds enough tokens.
+		 */
+		if (tg_no_rule_path(tg, rw) || throtl_consume_tokens(tg, bio)) {
 			blkiocg_update_dispatch_stats(&tg->blkg, bio->bi_size,
 					rw, rw_is_sync(bio->bi_rw));
 			rcu_read_unlock();
@@ -1177,7 +1511,8 @@ bool blk_throtl_bio(struct request_queue *q, struct bio *bio)
 		 *
 		 * So keep on trimming slice even if bio is not queued.
 		 */
-		throtl_trim_slice(td, tg, rw);
+		throtl_trim_slices(td, tg, rw);
+		throtl_refill_tokens(td, tg, rw);
 		goto out_unlock;
 	}
 
@@ -0,0 +1,527 @@
+/*
+ *  Token bucket i/o scheduler.
+ *
+ *  Divides a device between blkio cgroups in proportion to their weight
+ *  without the idling and slice accounting CFQ needs for rotational
+ *  media. Each group gets a token budget, in bytes, every time it comes
+ *  around in a deficit round robin over the groups with queued requests,
+ *  and may dispatch while its budget covers the cost of its oldest
+ *  request. Groups with a latency target that is exceeded by their
+ *  oldest request are dispatched ahead of the rotation and pay for it
+ *  with budget they have yet to earn.
+ *
+ *  See Documentation/block/tbs-iosched.txt
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/jiffies.h>
+#include <linux/rbtree.h>
+#include <linux/hash.h>
+#include "blk-cgroup.h"
+
+/*
+ * tunables
+ */
+/* bytes of budget per round for a group of default weight */
+static const int tbs_quantum = 64 * 1024;
+/* fixed per-request cost in bytes, on top of the request size */
+static const int tbs_rq_cost = 4096;
+
+#define TBS_HASH_SHIFT		5
+#define TBS_HASH_SIZE		(1 << TBS_HASH_SHIFT)
+
+/* how often a busy group re-reads its cgroup settings */
+#define TBS_REFRESH_INTERVAL	HZ
+
+struct tbs_group {
+	struct hlist_node hash_node;
+	/* on tbs_data->active while requests are queued */
+	struct list_head active_node;
+	/* on tbs_data->late_tree, keyed by fifo_time of the oldest request */
+	struct rb_node late_node;
+	/* queued requests in arrival order */
+	struct list_head fifo;
+
+	unsigned short blkcg_id;
+	/* number of allocated requests referencing this group */
+	unsigned int ref;
+
+	unsigned int weight;
+	unsigned long latency_target;
+	unsigned long refresh_time;
+
+	long budget;
+};
+
+struct tbs_data {
+	struct request_queue *queue;
+
+	struct hlist_head group_hash[TBS_HASH_SIZE];
+	struct list_head active;
+	struct rb_root late_tree;
+
+	/* used when no group can be allocated, never freed */
+	struct tbs_group root_group;
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int quantum;
+	int rq_cost;
+};
+
+#define RQ_TBS_GROUP(rq)	((struct tbs_group *) (rq)->elv.priv[0])
+
+#if defined(CONFIG_BLK_CGROUP) || defined(CONFIG_BLK_CGROUP_MODULE)
+static unsigned short tbs_current_blkcg_id(void)
+{
+	struct blkio_cgroup *blkcg;
+	unsigned short id;
+
+	rcu_read_lock();
+	blkcg = task_blkio_cgroup(current);
+	id = css_id(&blkcg->css);
+	rcu_read_unlock();
+
+	return id;
+}
+
+static dev_t tbs_queue_dev(struct request_queue *q)
+{
+	struct backing_dev_info *bdi = &q->backing_dev_info;
+	unsigned int major, minor;
+
+	if (bdi->dev && sscanf(dev_name(bdi->dev), "%u:%u", &major, &minor) == 2)
+		return MKDEV(major, minor);
+	return 0;
+}
+
+static void tbs_read_settings(struct tbs_data *td, unsigned short id,
+			      unsigned int *weight, unsigned long *target)
+{
+	struct cgroup_subsys_state *css;
+	struct blkio_cgroup *blkcg;
+
+	rcu_read_lock();
+	css = css_lookup(&blkio_subsys, id);
+	if (css) {
+		blkcg = container_of(css, struct blkio_cgroup, css);
+		*weight = blkcg_get_weight(blkcg, tbs_queue_dev(td->queue));
+		*target = usecs_to_jiffies(blkcg_get_latency_target(blkcg));
+	}
+	rcu_read_unlock();
+}
+#else
+static inline unsigned short tbs_current_blkcg_id(void)
+{
+	return 0;
+}
+
+static inline void tbs_read_settings(struct tbs_data *td, unsigned short id,
+				     unsigned int *weight,
+				     unsigned long *target)
+{
+}
+#endif
+
+static void tbs_init_group(struct tbs_group *tg, unsigned short id)
+{
+	INIT_HLIST_NODE(&tg->hash_node);
+	INIT_LIST_HEAD(&tg->active_node);
+	RB_CLEAR_NODE(&tg->late_node);
+	INIT_LIST_HEAD(&tg->fifo);
+	tg->blkcg_id = id;
+	tg->weight = BLKIO_WEIGHT_DEFAULT;
+	tg->refresh_time = jiffies;
+}
+
+static struct tbs_group *tbs_find_group(struct tbs_data *td, unsigned short id)
+{
+	struct hlist_head *head = &td->group_hash[hash_long(id, TBS_HASH_SHIFT)];
+	struct hlist_node *n;
+	struct tbs_group *tg;
+
+	hlist_for_each_entry(tg, n, head, hash_node)
+		if (tg->blkcg_id == id)
+			return tg;
+	return NULL;
+}
+
+static void tbs_late_add(struct tbs_data *td, struct tbs_group *tg)
+{
+	struct rb_node **p = &td->late_tree.rb_node;
+	struct rb_node *parent = NULL;
+	unsigned long key = rq_fifo_time(rq_entry_fifo(tg->fifo.next));
+	struct tbs_group *__tg;
+
+	while (*p) {
+		parent = *p;
+		__tg = rb_entry(parent, struct tbs_group, late_node);
+		if (time_before(key, rq_fifo_time(rq_entry_fifo(__tg->fifo.next))))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&tg->late_node, parent, p);
+	rb_insert_color(&tg->late_node, &td->late_tree);
+}
+
+static void tbs_late_del(struct tbs_data *td, struct tbs_group *tg)
+{
+	if (!RB_EMPTY_NODE(&tg->late_node)) {
+		rb_erase(&tg->late_node, &td->late_tree);
+		RB_CLEAR_NODE(&tg->late_node);
+	}
+}
+
+/*
+ * Return the group whose oldest request has passed its latency target,
+ * if any.
+ */
+static struct tbs_group *tbs_late_group(struct tbs_data *td)
+{
+	struct rb_node *node = rb_first(&td->late_tree);
+	struct tbs_group *tg;
+
+	if (!node)
+		return NULL;
+
+	tg = rb_entry(node, struct tbs_group, late_node);
+	if (time_before(jiffies, rq_fifo_time(rq_entry_fifo(tg->fifo.next))))
+		return NULL;
+	return tg;
+}
+
+static inline long tbs_cost(struct tbs_data *td, struct request *rq)
+{
+	return blk_rq_bytes(rq) + td->rq_cost;
+}
+
+static inline long tbs_group_quantum(struct tbs_data *td, struct tbs_group *tg)
+{
+	return max_t(long, 1, (long)td->quantum * tg->weight /
+			      BLKIO_WEIGHT_DEFAULT);
+}
+
+static void tbs_add_request(struct request_queue *q, struct request *rq)
+{
+	struct tbs_data *td = q->elevator->elevator_data;
+	struct tbs_group *tg = RQ_TBS_GROUP(rq);
+	bool first = list_empty(&tg->fifo);
+
+	rq_set_fifo_time(rq, jiffies + tg->latency_target);
+	list_add_tail(&rq->queuelist, &tg->fifo);
+
+	if (first) {
+		/* no credit is carried over from the last busy period */
+		tg->budget = 0;
+		list_add_tail(&tg->active_node, &td->active);
+		if (tg->latency_target)
+			tbs_late_add(td, tg);
+	}
+}
+
+static void tbs_remove_request(struct tbs_data *td, struct request *rq)
+{
+	struct tbs_group *tg = RQ_TBS_GROUP(rq);
+	bool was_first = tg->fifo.next == &rq->queuelist;
+
+	if (was_first)
+		tbs_late_del(td, tg);
+	rq_fifo_clear(rq);
+
+	if (list_empty(&tg->fifo))
+		list_del_init(&tg->active_node);
+	else if (was_first && tg->latency_target)
+		tbs_late_add(td, tg);
+}
+
+static void
+tbs_merged_requests(struct request_queue *q, struct request *rq,
+		    struct request *next)
+{
+	tbs_remove_request(q->elevator->elevator_data, next);
+}
+
+static int tbs_allow_merge(struct request_queue *q, struct request *rq,
+			   struct bio *bio)
+{
+	/* don't let a bio ride in another group's request */
+	return RQ_TBS_GROUP(rq)->blkcg_id == tbs_current_blkcg_id();
+}
+
+static void tbs_dispatch_group(struct tbs_data *td, struct tbs_group *tg)
+{
+	struct request *rq = rq_entry_fifo(tg->fifo.next);
+
+	tg->budget -= tbs_cost(td, rq);
+	tbs_remove_request(td, rq);
+	elv_dispatch_add_tail(td->queue, rq);
+}
+
+/*
+ * Refills @tg needs before its budget covers its oldest request.
+ */
+static long tbs_group_rounds(struct tbs_data *td, struct tbs_group *tg)
+{
+	long deficit = tbs_cost(td, rq_entry_fifo(tg->fifo.next)) - tg->budget;
+
+	if (deficit <= 0)
+		return 0;
+	return DIV_ROUND_UP(deficit, tbs_group_quantum(td, tg));
+}
+
+/*
+ * Deficit round robin over the active groups: the group at the head keeps
+ * dispatching while its budget covers its oldest request, otherwise it is
+ * refilled by its weighted quantum and rotated to the tail.
+ *
+ * If no group can dispatch before several full rounds, those rounds are
+ * handed out in one pass instead: a full round leaves the list in the
+ * same order, so only the budgets change.  The rotation below then finds
+ * a group within two rounds, however large the requests are compared to
+ * the quantum.
+ */
+static struct tbs_group *tbs_select_group(struct tbs_data *td)
+{
+	struct tbs_group *tg;
+	long rounds = LONG_MAX;
+
+	tg = tbs_late_group(td);
+	if (tg)
+		return tg;
+	if (list_empty(&td->active))
+		return NULL;
+
+	tg = list_first_entry(&td->active, struct tbs_group, active_node);
+	if (tg->budget >= tbs_cost(td, rq_entry_fifo(tg->fifo.next)))
+		return tg;
+
+	list_for_each_entry(tg, &td->active, active_node)
+		rounds = min(rounds, tbs_group_rounds(td, tg));
+	if (rounds > 1) {
+		list_for_each_entry(tg, &td->active, active_node)
+			tg->budget += (rounds - 1) * tbs_group_quantum(td, tg);
+	}
+
+	while (!list_empty(&td->active)) {
+		tg = list_first_entry(&td->active, struct tbs_group,
+				      active_node);
+		if (tg->budget >= tbs_cost(td, rq_entry_fifo(tg->fifo.next)))
+			return tg;
+
+		tg->budget += tbs_group_quantum(td, tg);
+		list_move_tail(&tg->active_node, &td->active);
+	}
+	return NULL;
+}
+
+static int tbs_dispatch_requests(struct request_queue *q, int force)
+{
+	struct tbs_data *td = q->elevator->elevator_data;
+	struct tbs_group *tg;
+	int dispatched = 0;
+
+	if (unlikely(force)) {
+		while (!list_empty(&td->active)) {
+			tg = list_first_entry(&td->active, struct tbs_group,
+					      active_node);
+			tbs_dispatch_group(td, tg);
+			dispatched++;
+		}
+		return dispatched;
+	}
+
+	tg = tbs_select_group(td);
+	if (!tg)
+		return 0;
+
+	tbs_dispatch_group(td, tg);
+	return 1;
+}
+
+static int
+tbs_set_request(struct request_queue *q, struct request *rq, gfp_t gfp_mask)
+{
+	struct tbs_data *td = q->elevator->elevator_data;
+	unsigned short id = tbs_current_blkcg_id();
+	unsigned int weight = BLKIO_WEIGHT_DEFAULT;
+	unsigned long target = 0;
+	struct tbs_group *tg, *new = NULL;
+
+	spin_lock_irq(q->queue_lock);
+	tg = tbs_find_group(td, id);
+	if (tg && time_before(jiffies, tg->refresh_time))
+		goto out;
+	spin_unlock_irq(q->queue_lock);
+
+	/* new or stale group, look at its cgroup outside the queue lock */
+	tbs_read_settings(td, id, &weight, &target);
+	if (!tg)
+		new = kmalloc_node(sizeof(*new), gfp_mask | __GFP_ZERO,
+				   q->node);
+
+	spin_lock_irq(q->queue_lock);
+	tg = tbs_find_group(td, id);
+	if (!tg && new) {
+		tbs_init_group(new, id);
+		hlist_add_head(&new->hash_node,
+			       &td->group_hash[hash_long(id, TBS_HASH_SHIFT)]);
+		tg = new;
+		new = NULL;
+	}
+	if (!tg) {
+		tg = &td->root_group;
+	} else {
+		tg->weight = weight;
+		tg->latency_target = target;
+		tg->refresh_time = jiffies + TBS_REFRESH_INTERVAL;
+	}
+out:
+	tg->ref++;
+	rq->elv.priv[0] = tg;
+	spin_unlock_irq(q->queue_lock);
+
+	kfree(new);
+	return 0;
+}
+
+static void tbs_put_request(struct request *rq)
+{
+	struct tbs_data *td = rq->q->elevator->elevator_data;
+	struct tbs_group *tg = RQ_TBS_GROUP(rq);
+
+	if (!tg)
+		return;
+
+	rq->elv.priv[0] = NULL;
+	BUG_ON(!tg->ref);
+	if (--tg->ref || tg == &td->root_group)
+		return;
+
+	BUG_ON(!list_empty(&tg->fifo));
+	hlist_del(&tg->hash_node);
+	kfree(tg);
+}
+
+static void tbs_exit_queue(struct elevator_queue *e)
+{
+	struct tbs_data *td = e->elevator_data;
+
+	BUG_ON(!list_empty(&td->active));
+	kfree(td);
+}
+
+static void *tbs_init_queue(struct request_queue *q)
+{
+	struct tbs_data *td;
+	int i;
+
+	td = kmalloc_node(sizeof(*td), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!td)
+		return NULL;
+
+	td->queue = q;
+	for (i = 0; i < TBS_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&td->group_hash[i]);
+	INIT_LIST_HEAD(&td->active);
+	td->late_tree = RB_ROOT;
+	tbs_init_group(&td->root_group, 0);
+	td->quantum = tbs_quantum;
+	td->rq_cost = tbs_rq_cost;
+	return td;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+tbs_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+tbs_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR)					\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct tbs_data *td = e->elevator_data;				\
+	return tbs_var_show(__VAR, (page));				\
+}
+SHOW_FUNCTION(tbs_quantum_show, td->quantum);
+SHOW_FUNCTION(tbs_rq_cost_show, td->rq_cost);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX)				\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct tbs_data *td = e->elevator_data;				\
+	int __data;							\
+	int ret = tbs_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	*(__PTR) = __data;						\
+	return ret;							\
+}
+STORE_FUNCTION(tbs_quantum_store, &td->quantum, 512, INT_MAX);
+STORE_FUNCTION(tbs_rq_cost_store, &td->rq_cost, 0, INT_MAX);
+#undef STORE_FUNCTION
+
+#define TBS_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, tbs_##name##_show, tbs_##name##_store)
+
+static struct elv_fs_entry tbs_attrs[] = {
+	TBS_ATTR(quantum),
+	TBS_ATTR(rq_cost),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_tbs = {
+	.ops = {
+		.elevator_merge_req_fn =	tbs_merged_requests,
+		.elevator_allow_merge_fn =	tbs_allow_merge,
+		.elevator_dispatch_fn =		tbs_dispatch_requests,
+		.elevator_add_req_fn =		tbs_add_request,
+		.elevator_set_req_fn =		tbs_set_request,
+		.elevator_put_req_fn =		tbs_put_request,
+		.elevator_init_fn =		tbs_init_queue,
+		.elevator_exit_fn =		tbs_exit_queue,
+	},
+
+	.elevator_attrs = tbs_attrs,
+	.elevator_name = "tbs",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init tbs_init(void)
+{
+	return elv_register(&iosched_tbs);
+}
+
+static void __exit tbs_exit(void)
+{
+	elv_unregister(&iosched_tbs);
+}
+
+module_init(tbs_init);
+module_exit(tbs_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Token bucket IO scheduler");
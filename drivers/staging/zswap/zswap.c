@@ -0,0 +1,778 @@
+/*
+ * zswap.c - compressed cache for swap pages
+ *
+ * zswap is a frontswap backend that compresses pages being swapped out
+ * and keeps them in a zsmalloc pool instead of writing them to the swap
+ * device. The pool is capped at a percentage of RAM; when it gets close
+ * to the cap, a worker writes the least recently stored pages back to the
+ * swap device to make room.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/frontswap.h>
+#include <linux/rbtree.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/crypto.h>
+#include <linux/pagemap.h>
+#include <linux/writeback.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+
+#include "../zsmalloc/zsmalloc.h"
+
+/*********************************
+* statistics
+**********************************/
+/* Number of pages stored in the pool */
+static atomic_t zswap_stored_pages = ATOMIC_INIT(0);
+
+/*
+ * The statistics below are not protected from concurrent access for
+ * performance reasons so they may not be 100% accurate.  However,
+ * they do provide useful information on roughly how many times a
+ * certain event is occurring.
+ */
+static u64 zswap_written_back_pages;
+static u64 zswap_writeback_skipped;
+static u64 zswap_reject_pool_limit;
+static u64 zswap_reject_compress_poor;
+static u64 zswap_reject_alloc_fail;
+static u64 zswap_reject_kmemcache_fail;
+static u64 zswap_duplicate_entry;
+
+/*********************************
+* tunables
+**********************************/
+/* Enable/disable zswap (disabled by default, fixed at boot for now) */
+static bool zswap_enabled __read_mostly;
+module_param_named(enabled, zswap_enabled, bool, 0);
+
+/* Compressor to be used by zswap (fixed at boot for now) */
+#define ZSWAP_COMPRESSOR_DEFAULT "lzo"
+static char *zswap_compressor = ZSWAP_COMPRESSOR_DEFAULT;
+module_param_named(compressor, zswap_compressor, charp, 0);
+
+/* The maximum percentage of memory that the compressed pool can occupy */
+static unsigned int zswap_max_pool_percent = 20;
+module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
+
+/*
+ * Pages that don't compress below this size are rejected and go straight
+ * to the swap device: storing them would cost about as much memory as
+ * keeping them uncompressed.
+ */
+#define ZSWAP_MAX_COMPRESSED	(PAGE_SIZE * 3 / 4)
+
+/*
+ * The writeback worker is kicked once the pool is above ZSWAP_WB_START_PCT
+ * percent of its limit and writes back until it is below ZSWAP_WB_STOP_PCT.
+ */
+#define ZSWAP_WB_START_PCT	95
+#define ZSWAP_WB_STOP_PCT	85
+
+/*********************************
+* data structures
+**********************************/
+/*
+ * struct zswap_entry
+ *
+ * This structure contains the metadata for tracking a single compressed
+ * page within zswap.
+ *
+ * rbnode - links the entry into red-black tree for the appropriate swap type
+ * lru - links the entry into the store-order list of its tree
+ * refcount - the tree holds one reference while the entry is in it, the
+ *            load and writeback paths take another while they use it
+ * offset - the swap offset for the entry.  Index into the red-black tree.
+ * handle - zsmalloc allocation handle that stores the compressed page data
+ * length - the length in bytes of the compressed page data
+ */
+struct zswap_entry {
+	struct rb_node rbnode;
+	struct list_head lru;
+	int refcount;
+	pgoff_t offset;
+	void *handle;
+	unsigned int length;
+};
+
+/*
+ * The tree lock in the zswap_tree struct protects a few things:
+ * - the rbtree
+ * - the lru list
+ * - the refcount field of each entry in the tree
+ */
+struct zswap_tree {
+	struct rb_root rbroot;
+	struct list_head lru;
+	spinlock_t lock;
+};
+
+static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
+
+static struct zs_pool *zswap_pool;
+static struct kmem_cache *zswap_entry_cache;
+
+static void zswap_writeback_fn(struct work_struct *work);
+static DECLARE_WORK(zswap_writeback_work, zswap_writeback_fn);
+
+/*********************************
+* pool size helpers
+**********************************/
+static unsigned long zswap_pool_pages(void)
+{
+	return zs_get_total_size_bytes(zswap_pool) >> PAGE_SHIFT;
+}
+
+static unsigned long zswap_max_pool_pages(void)
+{
+	return totalram_pages * zswap_max_pool_percent / 100;
+}
+
+static void zswap_maybe_kick_writeback(unsigned long pool_pages)
+{
+	if (pool_pages * 100 >= zswap_max_pool_pages() * ZSWAP_WB_START_PCT)
+		schedule_work(&zswap_writeback_work);
+}
+
+/*********************************
+* rbtree functions
+**********************************/
+static struct zswap_entry *zswap_rb_search(struct rb_root *root, pgoff_t offset)
+{
+	struct rb_node *node = root->rb_node;
+	struct zswap_entry *entry;
+
+	while (node) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		if (entry->offset > offset)
+			node = node->rb_left;
+		else if (entry->offset < offset)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * In the case that an entry with the same offset is found, a pointer to
+ * the existing entry is stored in dupentry and the function returns -EEXIST
+ */
+static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
+			   struct zswap_entry **dupentry)
+{
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+	struct zswap_entry *myentry;
+
+	while (*link) {
+		parent = *link;
+		myentry = rb_entry(parent, struct zswap_entry, rbnode);
+		if (myentry->offset > entry->offset)
+			link = &(*link)->rb_left;
+		else if (myentry->offset < entry->offset)
+			link = &(*link)->rb_right;
+		else {
+			*dupentry = myentry;
+			return -EEXIST;
+		}
+	}
+	rb_link_node(&entry->rbnode, parent, link);
+	rb_insert_color(&entry->rbnode, root);
+	return 0;
+}
+
+/* remove the entry from the tree and the lru, caller holds tree->lock */
+static void zswap_rb_erase(struct zswap_tree *tree, struct zswap_entry *entry)
+{
+	rb_erase(&entry->rbnode, &tree->rbroot);
+	RB_CLEAR_NODE(&entry->rbnode);
+	list_del_init(&entry->lru);
+}
+
+/*********************************
+* zswap entry functions
+**********************************/
+static struct zswap_entry *zswap_entry_cache_alloc(gfp_t gfp)
+{
+	struct zswap_entry *entry;
+
+	entry = kmem_cache_alloc(zswap_entry_cache, gfp);
+	if (!entry)
+		return NULL;
+	entry->refcount = 1;
+	RB_CLEAR_NODE(&entry->rbnode);
+	INIT_LIST_HEAD(&entry->lru);
+	return entry;
+}
+
+/* drop a reference, freeing the entry on the last one; caller holds lock */
+static void zswap_entry_put(struct zswap_entry *entry)
+{
+	if (--entry->refcount)
+		return;
+
+	zs_free(zswap_pool, entry->handle);
+	kmem_cache_free(zswap_entry_cache, entry);
+	atomic_dec(&zswap_stored_pages);
+}
+
+/*********************************
+* per-cpu code
+**********************************/
+static DEFINE_PER_CPU(u8 *, zswap_dstmem);
+static DEFINE_PER_CPU(struct crypto_comp *, zswap_comp_tfm);
+
+static int __zswap_cpu_notifier(unsigned long action, unsigned long cpu)
+{
+	struct crypto_comp *tfm;
+	u8 *dst;
+
+	switch (action) {
+	case CPU_UP_PREPARE:
+		tfm = crypto_alloc_comp(zswap_compressor, 0, 0);
+		if (IS_ERR(tfm)) {
+			pr_err("can't allocate compressor transform\n");
+			return NOTIFY_BAD;
+		}
+		/* lzo can expand incompressible data, leave room for that */
+		dst = kmalloc_node(PAGE_SIZE * 2, GFP_KERNEL, cpu_to_node(cpu));
+		if (!dst) {
+			pr_err("can't allocate compressor buffer\n");
+			crypto_free_comp(tfm);
+			return NOTIFY_BAD;
+		}
+		per_cpu(zswap_comp_tfm, cpu) = tfm;
+		per_cpu(zswap_dstmem, cpu) = dst;
+		break;
+	case CPU_DEAD:
+	case CPU_UP_CANCELED:
+		tfm = per_cpu(zswap_comp_tfm, cpu);
+		if (tfm) {
+			crypto_free_comp(tfm);
+			per_cpu(zswap_comp_tfm, cpu) = NULL;
+		}
+		dst = per_cpu(zswap_dstmem, cpu);
+		kfree(dst);
+		per_cpu(zswap_dstmem, cpu) = NULL;
+		break;
+	default:
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static int zswap_cpu_notifier(struct notifier_block *nb,
+			      unsigned long action, void *pcpu)
+{
+	unsigned long cpu = (unsigned long)pcpu;
+
+	return __zswap_cpu_notifier(action, cpu);
+}
+
+static struct notifier_block zswap_cpu_notifier_block = {
+	.notifier_call = zswap_cpu_notifier
+};
+
+static int zswap_cpu_init(void)
+{
+	unsigned long cpu;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu)
+		if (__zswap_cpu_notifier(CPU_UP_PREPARE, cpu) != NOTIFY_OK)
+			goto cleanup;
+	register_cpu_notifier(&zswap_cpu_notifier_block);
+	put_online_cpus();
+	return 0;
+
+cleanup:
+	for_each_online_cpu(cpu)
+		__zswap_cpu_notifier(CPU_UP_CANCELED, cpu);
+	put_online_cpus();
+	return -ENOMEM;
+}
+
+/*********************************
+* writeback code
+**********************************/
+/*
+ * Write the least recently stored entry of the tree back to the swap
+ * device. The page is brought into the swap cache with the decompressed
+ * data and written out through __swap_writepage(), which bypasses
+ * frontswap. Returns 0 if an entry was written back.
+ */
+static int zswap_writeback_one(struct zswap_tree *tree, unsigned type)
+{
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+	struct zswap_entry *entry;
+	struct crypto_comp *tfm;
+	bool page_was_allocated;
+	unsigned int dlen;
+	struct page *page;
+	pgoff_t offset;
+	u8 *src, *dst;
+	int ret;
+
+	spin_lock(&tree->lock);
+	if (list_empty(&tree->lru)) {
+		spin_unlock(&tree->lock);
+		return -ENOENT;
+	}
+	entry = list_first_entry(&tree->lru, struct zswap_entry, lru);
+	list_del_init(&entry->lru);
+	entry->refcount++;
+	offset = entry->offset;
+	spin_unlock(&tree->lock);
+
+	page = __read_swap_cache_async(swp_entry(type, offset), GFP_KERNEL,
+				       NULL, 0, &page_was_allocated);
+	if (!page) {
+		/* the swap entry was freed under us, or we are out of memory */
+		ret = -ENOMEM;
+		goto requeue;
+	}
+	if (!page_was_allocated) {
+		/*
+		 * The page is already in the swap cache: it is being
+		 * faulted in or reclaimed, so leave the entry alone.
+		 */
+		page_cache_release(page);
+		zswap_writeback_skipped++;
+		ret = -EEXIST;
+		goto requeue;
+	}
+
+	/*
+	 * The entry may have been invalidated, or replaced by a newer store,
+	 * while we slept in the allocation. Our locked swap cache page pins
+	 * the slot now, so once it checks out it stays current.
+	 */
+	spin_lock(&tree->lock);
+	if (zswap_rb_search(&tree->rbroot, offset) != entry) {
+		spin_unlock(&tree->lock);
+		delete_from_swap_cache(page);
+		unlock_page(page);
+		page_cache_release(page);
+		zswap_writeback_skipped++;
+		ret = -ENOENT;
+		goto requeue;
+	}
+	spin_unlock(&tree->lock);
+
+	dlen = PAGE_SIZE;
+	src = zs_map_object(zswap_pool, entry->handle);
+	tfm = __this_cpu_read(zswap_comp_tfm);
+	dst = kmap_atomic(page);
+	ret = crypto_comp_decompress(tfm, src, entry->length, dst, &dlen);
+	kunmap_atomic(dst);
+	zs_unmap_object(zswap_pool, entry->handle);
+	BUG_ON(ret);
+	BUG_ON(dlen != PAGE_SIZE);
+
+	SetPageUptodate(page);
+	/* move it to the tail of the inactive list after end_writeback */
+	SetPageReclaim(page);
+	__swap_writepage(page, &wbc);
+	page_cache_release(page);
+	zswap_written_back_pages++;
+
+	spin_lock(&tree->lock);
+	/* drop the tree's reference unless the entry was invalidated meanwhile */
+	if (zswap_rb_search(&tree->rbroot, offset) == entry) {
+		zswap_rb_erase(tree, entry);
+		zswap_entry_put(entry);
+	}
+	zswap_entry_put(entry);
+	spin_unlock(&tree->lock);
+	return 0;
+
+requeue:
+	spin_lock(&tree->lock);
+	if (!RB_EMPTY_NODE(&entry->rbnode) && list_empty(&entry->lru))
+		list_add_tail(&entry->lru, &tree->lru);
+	zswap_entry_put(entry);
+	spin_unlock(&tree->lock);
+	return ret;
+}
+
+static void zswap_writeback_fn(struct work_struct *work)
+{
+	unsigned long target;
+	int type, progress;
+
+	do {
+		progress = 0;
+		for (type = 0; type < MAX_SWAPFILES; type++) {
+			struct zswap_tree *tree = zswap_trees[type];
+
+			if (!tree)
+				continue;
+			target = zswap_max_pool_pages() * ZSWAP_WB_STOP_PCT;
+			if (zswap_pool_pages() * 100 <= target)
+				return;
+			if (!zswap_writeback_one(tree, type))
+				progress++;
+		}
+		cond_resched();
+	} while (progress);
+}
+
+/*********************************
+* frontswap hooks
+**********************************/
+/* attempts to compress and store an single page */
+static int zswap_frontswap_store(unsigned type, pgoff_t offset,
+				 struct page *page)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry, *dupentry;
+	struct crypto_comp *tfm;
+	unsigned int dlen;
+	unsigned long pool_pages;
+	u8 *src, *dst, *buf;
+	void *handle;
+	int ret;
+
+	if (!tree)
+		return -ENODEV;
+
+	pool_pages = zswap_pool_pages();
+	if (pool_pages >= zswap_max_pool_pages()) {
+		zswap_reject_pool_limit++;
+		schedule_work(&zswap_writeback_work);
+		ret = -ENOMEM;
+		goto reject;
+	}
+
+	entry = zswap_entry_cache_alloc(GFP_KERNEL);
+	if (!entry) {
+		zswap_reject_kmemcache_fail++;
+		ret = -ENOMEM;
+		goto reject;
+	}
+
+	/* compress */
+	dlen = PAGE_SIZE * 2;
+	dst = get_cpu_var(zswap_dstmem);
+	tfm = __this_cpu_read(zswap_comp_tfm);
+	src = kmap_atomic(page);
+	ret = crypto_comp_compress(tfm, src, PAGE_SIZE, dst, &dlen);
+	kunmap_atomic(src);
+	if (ret) {
+		ret = -EINVAL;
+		goto put_dstmem;
+	}
+	if (dlen > ZSWAP_MAX_COMPRESSED) {
+		zswap_reject_compress_poor++;
+		ret = -E2BIG;
+		goto put_dstmem;
+	}
+
+	/* store */
+	handle = zs_malloc(zswap_pool, dlen);
+	if (!handle) {
+		zswap_reject_alloc_fail++;
+		ret = -ENOMEM;
+		goto put_dstmem;
+	}
+	buf = zs_map_object(zswap_pool, handle);
+	memcpy(buf, dst, dlen);
+	zs_unmap_object(zswap_pool, handle);
+	put_cpu_var(zswap_dstmem);
+
+	/* populate entry */
+	entry->offset = offset;
+	entry->handle = handle;
+	entry->length = dlen;
+
+	/* map */
+	spin_lock(&tree->lock);
+	do {
+		ret = zswap_rb_insert(&tree->rbroot, entry, &dupentry);
+		if (ret == -EEXIST) {
+			zswap_duplicate_entry++;
+			zswap_rb_erase(tree, dupentry);
+			zswap_entry_put(dupentry);
+		}
+	} while (ret == -EEXIST);
+	list_add_tail(&entry->lru, &tree->lru);
+	spin_unlock(&tree->lock);
+
+	atomic_inc(&zswap_stored_pages);
+	zswap_maybe_kick_writeback(pool_pages);
+	return 0;
+
+put_dstmem:
+	put_cpu_var(zswap_dstmem);
+	kmem_cache_free(zswap_entry_cache, entry);
+reject:
+	/*
+	 * Frontswap forgets the offset when the store fails. Drop an older
+	 * entry for it as well, or writeback could later put its stale data
+	 * over the newer copy on the swap device.
+	 */
+	spin_lock(&tree->lock);
+	dupentry = zswap_rb_search(&tree->rbroot, offset);
+	if (dupentry) {
+		zswap_rb_erase(tree, dupentry);
+		zswap_entry_put(dupentry);
+	}
+	spin_unlock(&tree->lock);
+	return ret;
+}
+
+/*
+ * returns 0 if the page was successfully decompressed
+ * return -1 on entry not found or error
+*/
+static int zswap_frontswap_load(unsigned type, pgoff_t offset,
+				struct page *page)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+	struct crypto_comp *tfm;
+	unsigned int dlen;
+	u8 *src, *dst;
+	int ret;
+
+	if (!tree)
+		return -1;
+
+	/* find */
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (!entry) {
+		/* entry was written back */
+		spin_unlock(&tree->lock);
+		return -1;
+	}
+	entry->refcount++;
+	spin_unlock(&tree->lock);
+
+	/* decompress */
+	dlen = PAGE_SIZE;
+	src = zs_map_object(zswap_pool, entry->handle);
+	tfm = __this_cpu_read(zswap_comp_tfm);
+	dst = kmap_atomic(page);
+	ret = crypto_comp_decompress(tfm, src, entry->length, dst, &dlen);
+	kunmap_atomic(dst);
+	zs_unmap_object(zswap_pool, entry->handle);
+	BUG_ON(ret);
+
+	spin_lock(&tree->lock);
+	zswap_entry_put(entry);
+	spin_unlock(&tree->lock);
+
+	return 0;
+}
+
+/* frees an entry in zswap */
+static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+
+	if (!tree)
+		return;
+
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (entry) {
+		zswap_rb_erase(tree, entry);
+		zswap_entry_put(entry);
+	}
+	spin_unlock(&tree->lock);
+}
+
+/* frees all zswap entries for the given swap type */
+static void zswap_frontswap_invalidate_area(unsigned type)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+	struct rb_node *node;
+
+	if (!tree)
+		return;
+
+	spin_lock(&tree->lock);
+	while ((node = rb_first(&tree->rbroot))) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		zswap_rb_erase(tree, entry);
+		zswap_entry_put(entry);
+	}
+	spin_unlock(&tree->lock);
+}
+
+/*
+ * Trees are kept around after swapoff, so that the writeback worker
+ * never sees one go away; a later swapon of the same type reuses it.
+ */
+static void zswap_frontswap_init(unsigned type)
+{
+	struct zswap_tree *tree;
+
+	if (zswap_trees[type])
+		return;
+
+	tree = kzalloc(sizeof(*tree), GFP_KERNEL);
+	if (!tree) {
+		pr_err("alloc failed, zswap disabled for swap type %d\n", type);
+		return;
+	}
+	tree->rbroot = RB_ROOT;
+	INIT_LIST_HEAD(&tree->lru);
+	spin_lock_init(&tree->lock);
+	zswap_trees[type] = tree;
+}
+
+static struct frontswap_ops zswap_frontswap_ops = {
+	.put_page = zswap_frontswap_store,
+	.get_page = zswap_frontswap_load,
+	.invalidate_page = zswap_frontswap_invalidate_page,
+	.invalidate_area = zswap_frontswap_invalidate_area,
+	.init = zswap_frontswap_init
+};
+
+/*********************************
+* debugfs functions
+**********************************/
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *zswap_debugfs_root;
+
+static int zswap_stored_pages_get(void *data, u64 *val)
+{
+	*val = atomic_read(&zswap_stored_pages);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_stored_pages_fops, zswap_stored_pages_get,
+			NULL, "%llu\n");
+
+static int zswap_pool_pages_get(void *data, u64 *val)
+{
+	*val = zswap_pool_pages();
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_pool_pages_fops, zswap_pool_pages_get,
+			NULL, "%llu\n");
+
+static int __init zswap_debugfs_init(void)
+{
+	if (!debugfs_initialized())
+		return -ENODEV;
+
+	zswap_debugfs_root = debugfs_create_dir("zswap", NULL);
+	if (!zswap_debugfs_root)
+		return -ENOMEM;
+
+	debugfs_create_u64("written_back_pages", S_IRUGO,
+			zswap_debugfs_root, &zswap_written_back_pages);
+	debugfs_create_u64("writeback_skipped", S_IRUGO,
+			zswap_debugfs_root, &zswap_writeback_skipped);
+	debugfs_create_u64("reject_pool_limit", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_pool_limit);
+	debugfs_create_u64("reject_compress_poor", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_compress_poor);
+	debugfs_create_u64("reject_alloc_fail", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_alloc_fail);
+	debugfs_create_u64("reject_kmemcache_fail", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_kmemcache_fail);
+	debugfs_create_u64("duplicate_entry", S_IRUGO,
+			zswap_debugfs_root, &zswap_duplicate_entry);
+	debugfs_create_file("stored_pages", S_IRUGO,
+			zswap_debugfs_root, NULL, &zswap_stored_pages_fops);
+	debugfs_create_file("pool_pages", S_IRUGO,
+			zswap_debugfs_root, NULL, &zswap_pool_pages_fops);
+
+	return 0;
+}
+#else
+static int __init zswap_debugfs_init(void)
+{
+	return 0;
+}
+#endif
+
+/*********************************
+* module init
+**********************************/
+static int __init init_zswap(void)
+{
+	if (!zswap_enabled)
+		return 0;
+
+	pr_info("loading zswap\n");
+
+	if (!crypto_has_comp(zswap_compressor, 0, 0)) {
+		pr_info("%s compressor not available, using %s\n",
+			zswap_compressor, ZSWAP_COMPRESSOR_DEFAULT);
+		zswap_compressor = ZSWAP_COMPRESSOR_DEFAULT;
+		if (!crypto_has_comp(zswap_compressor, 0, 0)) {
+			pr_err("default compressor not available\n");
+			goto error;
+		}
+	}
+
+	zswap_entry_cache = KMEM_CACHE(zswap_entry, 0);
+	if (!zswap_entry_cache) {
+		pr_err("entry cache creation failed\n");
+		goto error;
+	}
+
+	/*
+	 * Stores run from reclaim with the per-cpu compression buffer held,
+	 * so the pool must neither sleep nor dip into the emergency reserves.
+	 */
+	zswap_pool = zs_create_pool("zswap", __GFP_NORETRY | __GFP_NOWARN |
+				    __GFP_NOMEMALLOC | __GFP_HIGHMEM);
+	if (!zswap_pool) {
+		pr_err("pool creation failed\n");
+		goto pool_fail;
+	}
+
+	if (zswap_cpu_init()) {
+		pr_err("per-cpu initialization failed\n");
+		goto cpu_fail;
+	}
+
+	frontswap_register_ops(&zswap_frontswap_ops);
+	if (zswap_debugfs_init())
+		pr_warn("debugfs initialization failed\n");
+	pr_info("using %s compressor, pool limited to %u%% of RAM\n",
+		zswap_compressor, zswap_max_pool_percent);
+	return 0;
+
+cpu_fail:
+	zs_destroy_pool(zswap_pool);
+pool_fail:
+	kmem_cache_destroy(zswap_entry_cache);
+error:
+	zswap_enabled = false;
+	return -ENOMEM;
+}
+/* must be late so crypto and zsmalloc have been initialized */
+late_initcall(init_zswap);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed cache for swap pages");
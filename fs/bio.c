@@ -25,6 +25,9 @@
 #include <linux/export.h>
 #include <linux/mempool.h>
 #include <linux/workqueue.h>
+#include <linux/cpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <scsi/sg.h>		/* for struct sg_iovec */
 
 #include <trace/events/block.h>
@@ -37,6 +40,25 @@
 
 static mempool_t *bio_split_pool __read_mostly;
 
+/*
+ * Bio sets with a per-cpu cache keep up to BIO_CACHE_MAX freed bios
+ * (including their inline vecs) per cpu, and hand BIO_CACHE_BATCH of them
+ * back to the mempool once that is exceeded.
+ */
+#define BIO_CACHE_MAX		64
+#define BIO_CACHE_BATCH		(BIO_CACHE_MAX / 2)
+
+struct bio_cache_stats {
+	unsigned long alloc_hit;
+	unsigned long alloc_miss;
+	unsigned long free_cached;
+	unsigned long free_pool;
+};
+static DEFINE_PER_CPU(struct bio_cache_stats, bio_cache_stats);
+
+static DEFINE_MUTEX(bio_cache_lock);
+static LIST_HEAD(bio_cache_sets);
+
 /*
  * if you change this list, also change bvec_alloc or things will
  * break badly! cannot be bigger than what you can fit into an
@@ -230,6 +252,89 @@ fallback:
 	return bvl;
 }
 
+static struct bio *bio_cache_get(struct bio_set *bs)
+{
+	struct bio_alloc_cache *cache;
+	unsigned long flags;
+	struct bio *bio;
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(bs->cache);
+	bio = cache->free_list;
+	if (bio) {
+		cache->free_list = bio->bi_next;
+		cache->nr--;
+		__this_cpu_inc(bio_cache_stats.alloc_hit);
+	} else
+		__this_cpu_inc(bio_cache_stats.alloc_miss);
+	local_irq_restore(flags);
+
+	return bio;
+}
+
+static void bio_cache_release(struct bio_set *bs, struct bio *list)
+{
+	while (list) {
+		struct bio *bio = list;
+
+		list = bio->bi_next;
+		mempool_free((void *) bio - bs->front_pad, bs->bio_pool);
+	}
+}
+
+static bool bio_cache_put(struct bio_set *bs, struct bio *bio)
+{
+	struct bio_alloc_cache *cache;
+	struct bio *trim = NULL;
+	unsigned long flags;
+
+	/*
+	 * Don't sit on bios while the mempool is below its reserve, someone
+	 * may be waiting in mempool_alloc() for them to come back.
+	 */
+	if (bs->bio_pool->curr_nr < bs->bio_pool->min_nr) {
+		this_cpu_inc(bio_cache_stats.free_pool);
+		return false;
+	}
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(bs->cache);
+	bio->bi_next = cache->free_list;
+	cache->free_list = bio;
+	if (++cache->nr > BIO_CACHE_MAX) {
+		struct bio *last = cache->free_list;
+		int i;
+
+		for (i = 1; i < BIO_CACHE_MAX - BIO_CACHE_BATCH; i++)
+			last = last->bi_next;
+		trim = last->bi_next;
+		last->bi_next = NULL;
+		cache->nr = BIO_CACHE_MAX - BIO_CACHE_BATCH;
+		__this_cpu_add(bio_cache_stats.free_pool,
+			       BIO_CACHE_BATCH + 1);
+	}
+	__this_cpu_inc(bio_cache_stats.free_cached);
+	local_irq_restore(flags);
+
+	bio_cache_release(bs, trim);
+	return true;
+}
+
+static void bio_cache_drain_cpu(struct bio_set *bs, int cpu)
+{
+	struct bio_alloc_cache *cache = per_cpu_ptr(bs->cache, cpu);
+	struct bio *list;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	list = cache->free_list;
+	cache->free_list = NULL;
+	cache->nr = 0;
+	local_irq_restore(flags);
+
+	bio_cache_release(bs, list);
+}
+
 void bio_free(struct bio *bio, struct bio_set *bs)
 {
 	void *p;
@@ -240,6 +345,9 @@ void bio_free(struct bio *bio, struct bio_set *bs)
 	if (bio_integrity(bio))
 		bio_integrity_free(bio, bs);
 
+	if (bs->cache && bio_cache_put(bs, bio))
+		return;
+
 	/*
 	 * If we have front padding, adjust the bio pointer before freeing
 	 */
@@ -281,10 +389,15 @@ struct bio *bio_alloc_bioset(gfp_t gfp_mask, int nr_iovecs, struct bio_set *bs)
 	struct bio *bio;
 	void *p;
 
-	p = mempool_alloc(bs->bio_pool, gfp_mask);
-	if (unlikely(!p))
-		return NULL;
-	bio = p + bs->front_pad;
+	bio = bs->cache ? bio_cache_get(bs) : NULL;
+	if (bio)
+		p = (void *) bio - bs->front_pad;
+	else {
+		p = mempool_alloc(bs->bio_pool, gfp_mask);
+		if (unlikely(!p))
+			return NULL;
+		bio = p + bs->front_pad;
+	}
 
 	bio_init(bio);
 
@@ -1602,6 +1715,18 @@ static void biovec_free_pools(struct bio_set *bs)
 
 void bioset_free(struct bio_set *bs)
 {
+	if (bs->cache) {
+		int cpu;
+
+		mutex_lock(&bio_cache_lock);
+		list_del(&bs->cache_list);
+		mutex_unlock(&bio_cache_lock);
+
+		for_each_possible_cpu(cpu)
+			bio_cache_drain_cpu(bs, cpu);
+		free_percpu(bs->cache);
+	}
+
 	if (bs->bio_pool)
 		mempool_destroy(bs->bio_pool);
 
@@ -1636,6 +1761,7 @@ struct bio_set *bioset_create(unsigned int pool_size, unsigned int front_pad)
 		return NULL;
 
 	bs->front_pad = front_pad;
+	INIT_LIST_HEAD(&bs->cache_list);
 
 	bs->bio_slab = bio_find_or_create_slab(front_pad + back_pad);
 	if (!bs->bio_slab) {
@@ -1656,6 +1782,102 @@ bad:
 }
 EXPORT_SYMBOL(bioset_create);
 
+/**
+ * bioset_enable_cache - enable per-cpu recycling of bios for a bio_set
+ * @bs:		the bio_set
+ *
+ * Description:
+ *   Freed bios of @bs are kept on a small per-cpu list and handed out
+ *   again by bio_alloc_bioset() without going through the mempool and
+ *   slab. Bios allocated with more than BIO_INLINE_VECS vecs still get
+ *   their bvec array from the bvec pools. Must be called before the first
+ *   bio is allocated from @bs.
+ */
+int bioset_enable_cache(struct bio_set *bs)
+{
+	struct bio_alloc_cache __percpu *cache;
+
+	cache = alloc_percpu(struct bio_alloc_cache);
+	if (!cache)
+		return -ENOMEM;
+
+	mutex_lock(&bio_cache_lock);
+	bs->cache = cache;
+	list_add(&bs->cache_list, &bio_cache_sets);
+	mutex_unlock(&bio_cache_lock);
+	return 0;
+}
+EXPORT_SYMBOL(bioset_enable_cache);
+
+static int __cpuinit bio_cache_cpu_notify(struct notifier_block *self,
+					  unsigned long action, void *hcpu)
+{
+	int cpu = (unsigned long) hcpu;
+	struct bio_set *bs;
+
+	if (action != CPU_DEAD && action != CPU_DEAD_FROZEN)
+		return NOTIFY_OK;
+
+	mutex_lock(&bio_cache_lock);
+	list_for_each_entry(bs, &bio_cache_sets, cache_list)
+		bio_cache_drain_cpu(bs, cpu);
+	mutex_unlock(&bio_cache_lock);
+
+	return NOTIFY_OK;
+}
+
+#ifdef CONFIG_DEBUG_FS
+static int bio_cache_stats_show(struct seq_file *m, void *v)
+{
+	struct bio_cache_stats sum = { 0, };
+	unsigned int cached = 0;
+	struct bio_set *bs;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct bio_cache_stats *st = &per_cpu(bio_cache_stats, cpu);
+
+		sum.alloc_hit += st->alloc_hit;
+		sum.alloc_miss += st->alloc_miss;
+		sum.free_cached += st->free_cached;
+		sum.free_pool += st->free_pool;
+	}
+
+	mutex_lock(&bio_cache_lock);
+	list_for_each_entry(bs, &bio_cache_sets, cache_list)
+		for_each_possible_cpu(cpu)
+			cached += per_cpu_ptr(bs->cache, cpu)->nr;
+	mutex_unlock(&bio_cache_lock);
+
+	seq_printf(m, "alloc_hit %lu\n", sum.alloc_hit);
+	seq_printf(m, "alloc_miss %lu\n", sum.alloc_miss);
+	seq_printf(m, "free_cached %lu\n", sum.free_cached);
+	seq_printf(m, "free_pool %lu\n", sum.free_pool);
+	seq_printf(m, "cached %u\n", cached);
+	return 0;
+}
+
+static int bio_cache_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, bio_cache_stats_show, NULL);
+}
+
+static const struct file_operations bio_cache_stats_fops = {
+	.open		= bio_cache_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init bio_cache_debugfs_init(void)
+{
+	debugfs_create_file("bio_cache", S_IRUGO, NULL, NULL,
+			    &bio_cache_stats_fops);
+	return 0;
+}
+late_initcall(bio_cache_debugfs_init);
+#endif
+
 static void __init biovec_init_slabs(void)
 {
 	int i;
@@ -1693,6 +1915,10 @@ static int __init init_bio(void)
 	if (bioset_integrity_create(fs_bio_set, BIO_POOL_SIZE))
 		panic("bio: can't create integrity pool\n");
 
+	if (bioset_enable_cache(fs_bio_set))
+		panic("bio: can't allocate bio cache\n");
+	hotcpu_notifier(bio_cache_cpu_notify, 0);
+
 	bio_split_pool = mempool_create_kmalloc_pool(BIO_SPLIT_ENTRIES,
 						     sizeof(struct bio_pair));
 	if (!bio_split_pool)
@@ -27,6 +27,7 @@
 #include <linux/namei.h>
 #include <linux/log2.h>
 #include <linux/cleancache.h>
+#include <linux/task_io_accounting_ops.h>
 #include <asm/uaccess.h>
 #include "internal.h"
 
@@ -216,14 +217,140 @@ blkdev_get_blocks(struct inode *inode, sector_t iblock,
 	return 0;
 }
 
+/*
+ * Small synchronous O_DIRECT requests against a block device don't need
+ * the block mapping and multi-bio machinery of the generic direct-io code:
+ * the device offset is the file offset and the whole request fits into a
+ * single bio.  Build that bio on the stack and wait for it directly.
+ */
+#define DIO_INLINE_BIO_VECS	4
+
+static void blkdev_bio_end_io_simple(struct bio *bio, int error)
+{
+	struct task_struct *waiter = bio->bi_private;
+
+	/* once bi_private is cleared the submitter may free the bio */
+	smp_wmb();
+	bio->bi_private = NULL;
+	wake_up_process(waiter);
+}
+
+static bool blkdev_dio_simple_ok(struct kiocb *iocb, struct block_device *bdev,
+				 const struct iovec *iov, loff_t offset,
+				 unsigned long nr_segs)
+{
+	unsigned long addr = (unsigned long)iov->iov_base;
+	size_t len = iov->iov_len;
+	unsigned int mask = bdev_logical_block_size(bdev) - 1;
+
+	if (!is_sync_kiocb(iocb) || nr_segs != 1 || !len)
+		return false;
+	if ((offset | addr | len) & mask)
+		return false;
+	if (((addr & ~PAGE_MASK) + len) > DIO_INLINE_BIO_VECS * PAGE_SIZE)
+		return false;
+	if (offset + len > i_size_read(bdev->bd_inode))
+		return false;
+	/* integrity payloads are released from bio_put(), which we skip */
+	if (bdev_get_integrity(bdev))
+		return false;
+	return true;
+}
+
+/*
+ * Returns -ENOTBLK if the request has to be handed to the generic
+ * direct-io code instead.
+ */
+static ssize_t
+__blkdev_direct_IO_simple(int rw, struct block_device *bdev,
+			  const struct iovec *iov, loff_t offset)
+{
+	struct inode *inode = bdev->bd_inode;
+	unsigned long addr = (unsigned long)iov->iov_base;
+	size_t len = iov->iov_len;
+	struct bio_vec vecs[DIO_INLINE_BIO_VECS];
+	struct page *pages[DIO_INLINE_BIO_VECS];
+	unsigned int first = addr & ~PAGE_MASK;
+	int nr_pages = DIV_ROUND_UP(first + len, PAGE_SIZE);
+	size_t done = 0;
+	struct bio bio;
+	ssize_t ret;
+	int i, got;
+
+	got = get_user_pages_fast(addr, nr_pages, rw == READ, pages);
+	if (got < nr_pages) {
+		ret = got < 0 ? got : -EFAULT;
+		goto out_put;
+	}
+
+	bio_init(&bio);
+	bio.bi_io_vec = vecs;
+	bio.bi_max_vecs = DIO_INLINE_BIO_VECS;
+	bio.bi_bdev = bdev;
+	bio.bi_sector = offset >> 9;
+	bio.bi_end_io = blkdev_bio_end_io_simple;
+	bio.bi_private = current;
+
+	for (i = 0; i < nr_pages; i++) {
+		unsigned int off = i ? 0 : first;
+		unsigned int bytes = min_t(size_t, PAGE_SIZE - off, len - done);
+
+		if (bio_add_page(&bio, pages[i], bytes, off) != bytes) {
+			ret = -ENOTBLK;
+			goto out_put;
+		}
+		done += bytes;
+	}
+
+	if (rw & WRITE) {
+		rw = WRITE_ODIRECT;
+		task_io_account_write(len);
+	}
+
+	atomic_inc(&inode->i_dio_count);
+	submit_bio(rw, &bio);
+
+	for (;;) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (!ACCESS_ONCE(bio.bi_private))
+			break;
+		io_schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+	smp_rmb();
+
+	ret = test_bit(BIO_UPTODATE, &bio.bi_flags) ? len : -EIO;
+	inode_dio_done(inode);
+
+	for (i = 0; i < nr_pages; i++) {
+		if (rw == READ && !PageCompound(pages[i]))
+			set_page_dirty_lock(pages[i]);
+		page_cache_release(pages[i]);
+	}
+	return ret;
+
+out_put:
+	for (i = 0; i < got; i++)
+		page_cache_release(pages[i]);
+	return ret;
+}
+
 static ssize_t
 blkdev_direct_IO(int rw, struct kiocb *iocb, const struct iovec *iov,
 			loff_t offset, unsigned long nr_segs)
 {
 	struct file *file = iocb->ki_filp;
 	struct inode *inode = file->f_mapping->host;
+	struct block_device *bdev = I_BDEV(inode);
+
+	if (blkdev_dio_simple_ok(iocb, bdev, iov, offset, nr_segs)) {
+		ssize_t ret = __blkdev_direct_IO_simple(rw, bdev, iov, offset);
+
+		if (ret != -ENOTBLK)
+			return ret;
+	}
 
-	return __blockdev_direct_IO(rw, iocb, inode, I_BDEV(inode), iov, offset,
+	return __blockdev_direct_IO(rw, iocb, inode, bdev, iov, offset,
 				    nr_segs, blkdev_get_blocks, NULL, NULL, 0);
 }
 
@@ -54,6 +54,7 @@ static inline void file_free(struct file *f)
 {
 	percpu_counter_dec(&nr_files);
 	file_check_state(f);
+	kfree(f->f_ra_streams);
 	call_rcu(&f->f_u.fu_rcuhead, file_free_rcu);
 }
 
@@ -540,6 +540,7 @@ u64 gfs2_ri_total(struct gfs2_sbd *sdp)
 	struct file_ra_state ra_state;
 	int error, rgrps;
 
+	memset(&ra_state, 0, sizeof(ra_state));
 	file_ra_state_init(&ra_state, inode->i_mapping);
 	for (rgrps = 0;; rgrps++) {
 		loff_t pos = rgrps * sizeof(struct gfs2_rindex);
@@ -659,6 +660,7 @@ static int gfs2_ri_update(struct gfs2_inode *ip)
 	struct file_ra_state ra_state;
 	int error;
 
+	memset(&ra_state, 0, sizeof(ra_state));
 	file_ra_state_init(&ra_state, inode->i_mapping);
 	do {
 		error = read_rindex_entry(ip, &ra_state);
@@ -1727,7 +1727,7 @@ out:
 	return ~0U;
 }
 
-#define PROC_FDINFO_MAX 64
+#define PROC_FDINFO_MAX 192
 
 static int proc_fd_info(struct inode *inode, struct path *path, char *info)
 {
@@ -1763,9 +1763,18 @@ static int proc_fd_info(struct inode *inode, struct path *path, char *info)
 			if (info)
 				snprintf(info, PROC_FDINFO_MAX,
 					 "pos:\t%lli\n"
-					 "flags:\t0%o\n",
+					 "flags:\t0%o\n"
+					 "ra_hits:\t%lu\n"
+					 "ra_misses:\t%lu\n"
+					 "ra_pages:\t%lu\n"
+					 "ra_wasted:\t%lu\n",
 					 (long long) file->f_pos,
-					 f_flags);
+					 f_flags,
+					 file->f_ra.ra_hits,
+					 file->f_ra.ra_misses,
+					 file->f_ra.ra_pages_read,
+					 file->f_ra_streams ?
+					 file->f_ra_streams->pages_wasted : 0);
 			spin_unlock(&files->file_lock);
 			put_files_struct(files);
 			return 0;
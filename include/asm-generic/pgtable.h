@@ -438,6 +438,14 @@ extern void untrack_pfn_vma(struct vm_area_struct *vma, unsigned long pfn,
 
 #ifdef CONFIG_MMU
 
+#ifndef CONFIG_NUMA_BALANCING
+/* Only NUMA hinting needs to tell PROT_NONE ptes from present ones */
+static inline int pte_protnone(pte_t pte)
+{
+	return 0;
+}
+#endif
+
 #ifndef CONFIG_TRANSPARENT_HUGEPAGE
 static inline int pmd_trans_huge(pmd_t pmd)
 {
@@ -211,6 +211,7 @@ extern void bio_pair_release(struct bio_pair *dbio);
 
 extern struct bio_set *bioset_create(unsigned int, unsigned int);
 extern void bioset_free(struct bio_set *);
+extern int bioset_enable_cache(struct bio_set *);
 
 extern struct bio *bio_alloc(gfp_t, unsigned int);
 extern struct bio *bio_kmalloc(gfp_t, unsigned int);
@@ -279,6 +280,14 @@ extern unsigned int bvec_nr_vecs(unsigned short idx);
 #define BIOVEC_NR_POOLS 6
 #define BIOVEC_MAX_IDX	(BIOVEC_NR_POOLS - 1)
 
+/*
+ * per-cpu list of freed bios, see bioset_enable_cache()
+ */
+struct bio_alloc_cache {
+	struct bio *free_list;
+	unsigned int nr;
+};
+
 struct bio_set {
 	struct kmem_cache *bio_slab;
 	unsigned int front_pad;
@@ -288,6 +297,9 @@ struct bio_set {
 	mempool_t *bio_integrity_pool;
 #endif
 	mempool_t *bvec_pool;
+
+	struct bio_alloc_cache __percpu *cache;
+	struct list_head cache_list;
 };
 
 struct biovec_slab {
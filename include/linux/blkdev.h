@@ -243,6 +243,15 @@ struct blk_queue_tag {
 #define BLK_SCSI_MAX_CMDS	(256)
 #define BLK_SCSI_CMD_PER_LONG	(BLK_SCSI_MAX_CMDS / (sizeof(long) * 8))
 
+/*
+ * per-cpu completion statistics, see blk-softirq.c
+ */
+struct blk_comp_stats {
+	unsigned long	completed;	/* completions run on this cpu */
+	unsigned long	ipi_sent;	/* remote completions that sent an IPI */
+	unsigned long	ipi_batched;	/* remote completions that joined one */
+};
+
 struct queue_limits {
 	unsigned long		bounce_pfn;
 	unsigned long		seg_boundary_mask;
@@ -358,6 +367,8 @@ struct request_queue {
 	unsigned int		nr_sorted;
 	unsigned int		in_flight[2];
 
+	struct blk_comp_stats __percpu *comp_stats;
+
 	unsigned int		rq_timeout;
 	struct timer_list	timeout;
 	struct list_head	timeout_list;
@@ -0,0 +1,66 @@
+#ifndef _LINUX_CONTEXT_TRACKING_H
+#define _LINUX_CONTEXT_TRACKING_H
+
+#include <linux/percpu.h>
+#include <asm/ptrace.h>
+
+struct task_struct;
+
+#ifdef CONFIG_CONTEXT_TRACKING
+
+struct context_tracking {
+	bool active;			/* cpu is in nohz_full= */
+	enum {
+		IN_KERNEL = 0,
+		IN_USER,
+	} state;
+	unsigned long acct_jiffies;	/* cputime accounted up to here */
+};
+
+DECLARE_PER_CPU(struct context_tracking, context_tracking);
+
+/* Does this cpu track user/kernel transitions?  Preemption disabled. */
+static inline bool context_tracking_active(void)
+{
+	return __this_cpu_read(context_tracking.active);
+}
+
+extern void context_tracking_cpu_set(int cpu);
+extern void context_tracking_account(struct task_struct *p,
+				     int hardirq_offset);
+extern void user_enter(void);
+extern void user_exit(void);
+extern void context_tracking_task_switch(struct task_struct *prev,
+					 struct task_struct *next);
+
+/*
+ * An exception taken from user mode leaves it like a syscall does, and
+ * the return to user mode enters it again.  Exceptions in the kernel
+ * find the cpu already in kernel state and don't change it.
+ */
+static inline void exception_enter(struct pt_regs *regs)
+{
+	user_exit();
+}
+
+static inline void exception_exit(struct pt_regs *regs)
+{
+	if (user_mode(regs))
+		user_enter();
+}
+
+#else
+
+static inline bool context_tracking_active(void) { return false; }
+static inline void context_tracking_account(struct task_struct *p,
+					    int hardirq_offset) { }
+static inline void user_enter(void) { }
+static inline void user_exit(void) { }
+static inline void context_tracking_task_switch(struct task_struct *prev,
+						struct task_struct *next) { }
+static inline void exception_enter(struct pt_regs *regs) { }
+static inline void exception_exit(struct pt_regs *regs) { }
+
+#endif /* CONFIG_CONTEXT_TRACKING */
+
+#endif /* _LINUX_CONTEXT_TRACKING_H */
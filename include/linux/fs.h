@@ -950,6 +950,33 @@ struct fown_struct {
 	int signum;		/* posix.1b rt signal to be delivered on IO */
 };
 
+/*
+ * A readahead stream other than the current one, remembered so that
+ * interleaved readers of one file each keep their own window.  With a
+ * stride, the stream reads @size pages every @stride pages and @start is
+ * the next stride point not read ahead yet.
+ */
+struct file_ra_stream {
+	pgoff_t start;			/* window start / next stride point */
+	pgoff_t prev;			/* last page read by this stream */
+	unsigned int size;		/* window size / pages per stride point */
+	unsigned int async_size;	/* as in file_ra_state */
+	unsigned int stride;		/* 0 for sequential streams */
+};
+
+#define RA_STREAMS	4
+
+/*
+ * Other streams on a file, most recently used first.  Only allocated on
+ * the first non-sequential read, so that sequential readers don't pay for
+ * it, and owned by the struct file rather than its file_ra_state, which
+ * gets copied around by value.
+ */
+struct file_ra_streams {
+	struct file_ra_stream streams[RA_STREAMS];
+	unsigned long pages_wasted;	/* left unread by dropped streams */
+};
+
 /*
  * Track a single file's readahead state
  */
@@ -962,6 +989,11 @@ struct file_ra_state {
 	unsigned int ra_pages;		/* Maximum readahead window */
 	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
 	loff_t prev_pos;		/* Cache last read() position */
+
+	/* statistics, shown in /proc/<pid>/fdinfo */
+	unsigned long ra_hits;		/* reads that found readahead ready */
+	unsigned long ra_misses;	/* reads that had to wait for I/O */
+	unsigned long ra_pages_read;	/* pages submitted by readahead */
 };
 
 /*
@@ -1005,6 +1037,7 @@ struct file {
 	struct fown_struct	f_owner;
 	const struct cred	*f_cred;
 	struct file_ra_state	f_ra;
+	struct file_ra_streams	*f_ra_streams;
 
 	u64			f_version;
 #ifdef CONFIG_SECURITY
@@ -124,6 +124,8 @@ struct robust_list_head {
 #define FUTEX_BITSET_MATCH_ANY	0xffffffff
 
 #ifdef __KERNEL__
+#include <linux/errno.h>
+
 struct inode;
 struct mm_struct;
 struct task_struct;
@@ -177,6 +179,9 @@ union futex_key {
 extern void exit_robust_list(struct task_struct *curr);
 extern void exit_pi_state_list(struct task_struct *curr);
 extern int futex_cmpxchg_enabled;
+extern int futex_set_private_hash(unsigned long nr_buckets);
+extern int futex_get_private_hash(void);
+extern void futex_free_private_hash(struct mm_struct *mm);
 #else
 static inline void exit_robust_list(struct task_struct *curr)
 {
@@ -184,6 +189,17 @@ static inline void exit_robust_list(struct task_struct *curr)
 static inline void exit_pi_state_list(struct task_struct *curr)
 {
 }
+static inline int futex_set_private_hash(unsigned long nr_buckets)
+{
+	return -EINVAL;
+}
+static inline int futex_get_private_hash(void)
+{
+	return -EINVAL;
+}
+static inline void futex_free_private_hash(struct mm_struct *mm)
+{
+}
 #endif
 #endif /* __KERNEL__ */
 
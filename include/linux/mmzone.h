@@ -220,13 +220,28 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->watermark[WMARK_LOW])
 #define high_wmark_pages(z) (z->watermark[WMARK_HIGH])
 
+/*
+ * Small high-order pages (up to PAGE_ALLOC_COSTLY_ORDER) are cached on the
+ * per-cpu lists as well, one list per migrate type and order.  NOMMU keeps
+ * them in the buddy lists; see zone_batchsize().
+ */
+#ifdef CONFIG_MMU
+#define PCP_MAX_ORDER		PAGE_ALLOC_COSTLY_ORDER
+#else
+#define PCP_MAX_ORDER		0
+#endif
+#define NR_PCP_LISTS		(MIGRATE_PCPTYPES * (PCP_MAX_ORDER + 1))
+
 struct per_cpu_pages {
-	int count;		/* number of pages in the list */
+	int count;		/* number of base pages in the lists */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
+	int high_min;		/* high watermark when allocation is idle */
+	int high_max;		/* high watermark limit under load */
+	int alloc_factor;	/* refill scale, decayed by vmstat_update */
 
-	/* Lists of pages, one per migrate type stored on the pcp-lists */
-	struct list_head lists[MIGRATE_PCPTYPES];
+	/* Lists of pages, one per migrate type and order */
+	struct list_head lists[NR_PCP_LISTS];
 };
 
 struct per_cpu_pageset {
@@ -667,6 +682,10 @@ extern struct page *mem_map;
  * per-zone basis.
  */
 struct bootmem_data;
+
+/* Upper limit of vm.kswapd_threads */
+#define MAX_KSWAPD_THREADS	16
+
 typedef struct pglist_data {
 	struct zone node_zones[MAX_NR_ZONES];
 	struct zonelist node_zonelists[MAX_ZONELISTS];
@@ -697,8 +716,19 @@ typedef struct pglist_data {
 	int node_id;
 	wait_queue_head_t kswapd_wait;
 	struct task_struct *kswapd;	/* Protected by lock_memory_hotplug() */
+	/* extra threads sharing kswapd_wait, see vm.kswapd_threads */
+	struct task_struct *kswapd_extra[MAX_KSWAPD_THREADS - 1];
+	int kswapd_awake;		/* kswapd threads not asleep */
 	int kswapd_max_order;
 	enum zone_type classzone_idx;
+	wait_queue_head_t reclaim_wait;	/* throttled direct reclaimers */
+	atomic_t nr_reclaimers;		/* tasks in direct reclaim */
+#ifdef CONFIG_NUMA_BALANCING
+	/* NUMA hinting migrations into this node, see migrate_misplaced_page() */
+	spinlock_t numabalancing_migrate_lock;
+	unsigned long numabalancing_migrate_next_window;
+	unsigned long numabalancing_migrate_nr_pages;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
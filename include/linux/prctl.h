@@ -139,4 +139,13 @@
 #define PR_SET_NO_NEW_PRIVS 38
 #define PR_GET_NO_NEW_PRIVS 39
 
+/*
+ * Give the process its own hash table for private futexes, with at least
+ * arg2 buckets, instead of sharing the global one.  Only allowed while the
+ * process is single threaded, and only once.  PR_GET_FUTEX_HASH returns
+ * the number of private buckets, or 0 when the global hash is used.
+ */
+#define PR_SET_FUTEX_HASH 40
+#define PR_GET_FUTEX_HASH 41
+
 #endif /* _LINUX_PRCTL_H */
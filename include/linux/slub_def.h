@@ -58,6 +58,8 @@ struct kmem_cache_node {
 	spinlock_t list_lock;	/* Protect partial list and nr_partial */
 	unsigned long nr_partial;
 	struct list_head partial;
+	unsigned long list_lock_taken;	/* Hot path acquisitions of list_lock */
+	unsigned long list_lock_contended; /* ... that found it already held */
 #ifdef CONFIG_SLUB_DEBUG
 	atomic_long_t nr_slabs;
 	atomic_long_t total_objects;
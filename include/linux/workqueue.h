@@ -10,6 +10,8 @@
 #include <linux/bitops.h>
 #include <linux/lockdep.h>
 #include <linux/threads.h>
+#include <linux/numa.h>
+#include <linux/cpumask.h>
 #include <linux/atomic.h>
 
 struct workqueue_struct;
@@ -54,9 +56,12 @@ enum {
 	WORK_NR_COLORS		= (1 << WORK_STRUCT_COLOR_BITS) - 1,
 	WORK_NO_COLOR		= WORK_NR_COLORS,
 
-	/* special cpu IDs */
+	/*
+	 * special cpu IDs, the unbound gcwq of each node is identified
+	 * by WORK_CPU_UNBOUND + node
+	 */
 	WORK_CPU_UNBOUND	= NR_CPUS,
-	WORK_CPU_NONE		= NR_CPUS + 1,
+	WORK_CPU_NONE		= NR_CPUS + MAX_NUMNODES,
 	WORK_CPU_LAST		= WORK_CPU_NONE,
 
 	/*
@@ -254,9 +259,11 @@ enum {
 	WQ_MEM_RECLAIM		= 1 << 3, /* may be used for memory reclaim */
 	WQ_HIGHPRI		= 1 << 4, /* high priority */
 	WQ_CPU_INTENSIVE	= 1 << 5, /* cpu instensive workqueue */
+	WQ_SYSFS		= 1 << 6, /* visible in sysfs, see wq_sysfs_init() */
 
-	WQ_DRAINING		= 1 << 6, /* internal: workqueue is draining */
-	WQ_RESCUER		= 1 << 7, /* internal: workqueue has rescuer */
+	WQ_DRAINING		= 1 << 7, /* internal: workqueue is draining */
+	WQ_RESCUER		= 1 << 8, /* internal: workqueue has rescuer */
+	WQ_ORDERED		= 1 << 9, /* internal: unbound, max_active 1 */
 
 	WQ_MAX_ACTIVE		= 512,	  /* I like 512, better ideas? */
 	WQ_MAX_UNBOUND_PER_CPU	= 4,	  /* 4 * #cpus for unbound wq */
@@ -267,6 +274,20 @@ enum {
 #define WQ_UNBOUND_MAX_ACTIVE	\
 	max_t(int, WQ_MAX_ACTIVE, num_possible_cpus() * WQ_MAX_UNBOUND_PER_CPU)
 
+/**
+ * struct workqueue_attrs - attributes of an unbound workqueue
+ * @nice: nice level the work items are executed at
+ * @cpumask: cpus the work items are allowed to run on
+ *
+ * Unbound workers are shared by all unbound workqueues of a NUMA node
+ * and pick up the attributes of the workqueue whose work item they
+ * are about to execute.  See apply_workqueue_attrs().
+ */
+struct workqueue_attrs {
+	int			nice;
+	cpumask_var_t		cpumask;
+};
+
 /*
  * System-wide workqueues which are always present.
  *
@@ -365,6 +386,11 @@ __alloc_workqueue_key(const char *fmt, unsigned int flags, int max_active,
 
 extern void destroy_workqueue(struct workqueue_struct *wq);
 
+extern struct workqueue_attrs *alloc_workqueue_attrs(gfp_t gfp_mask);
+extern void free_workqueue_attrs(struct workqueue_attrs *attrs);
+extern int apply_workqueue_attrs(struct workqueue_struct *wq,
+				 const struct workqueue_attrs *attrs);
+
 extern int queue_work(struct workqueue_struct *wq, struct work_struct *work);
 extern int queue_work_on(int cpu, struct workqueue_struct *wq,
 			struct work_struct *work);
@@ -0,0 +1,129 @@
+/*
+ * Context tracking for the nohz_full= CPUs
+ *
+ * Those CPUs may run a task for long stretches without the tick, so
+ * nothing samples what they are doing.  Instead the architecture reports
+ * every transition between kernel and user mode of the task running
+ * there (it has TIF_NOHZ set), and we
+ *
+ *  - tell RCU that user mode is an extended quiescent state, so grace
+ *    periods don't wait for a tick on that cpu, and
+ *
+ *  - charge the jiffies elapsed since the previous transition to the
+ *    mode the task is leaving.  The tick, when it runs, and the context
+ *    switch do the same, so time is accounted with the tick's jiffy
+ *    granularity whether or not the tick is running.
+ */
+#include <linux/context_tracking.h>
+#include <linux/kernel_stat.h>
+#include <linux/rcupdate.h>
+#include <linux/hardirq.h>
+#include <linux/jiffies.h>
+#include <linux/sched.h>
+
+DEFINE_PER_CPU(struct context_tracking, context_tracking);
+
+/* Called at boot for each cpu in nohz_full=, before it comes up. */
+void __init context_tracking_cpu_set(int cpu)
+{
+	struct context_tracking *ct = &per_cpu(context_tracking, cpu);
+
+	ct->acct_jiffies = jiffies;
+	ct->active = true;
+}
+
+/*
+ * Charge the jiffies since the last transition to @p, as user time if
+ * the cpu was in user mode and as system (or idle) time otherwise.
+ * Interrupts must be disabled.
+ */
+void context_tracking_account(struct task_struct *p, int hardirq_offset)
+{
+	struct context_tracking *ct = &__get_cpu_var(context_tracking);
+	unsigned long now = ACCESS_ONCE(jiffies);
+	cputime_t delta;
+
+	if (now == ct->acct_jiffies)
+		return;
+	delta = jiffies_to_cputime(now - ct->acct_jiffies);
+	ct->acct_jiffies = now;
+
+	if (ct->state == IN_USER)
+		account_user_time(p, delta, cputime_to_scaled(delta));
+	else if (!is_idle_task(p) || irq_count() != hardirq_offset)
+		account_system_time(p, hardirq_offset, delta,
+				    cputime_to_scaled(delta));
+	else
+		account_idle_time(delta);
+}
+
+/**
+ * user_enter - the current task is about to resume user mode
+ *
+ * Called with the task's last use of RCU behind it: user mode is an
+ * RCU extended quiescent state until the matching user_exit().
+ */
+void user_enter(void)
+{
+	unsigned long flags;
+
+	/*
+	 * An exception in an irq could get here with RCU watching only
+	 * because of rcu_irq_enter(); leaving that to the irq exit keeps
+	 * the RCU nesting count straight.
+	 */
+	if (in_interrupt())
+		return;
+
+	local_irq_save(flags);
+	if (__this_cpu_read(context_tracking.active) &&
+	    __this_cpu_read(context_tracking.state) != IN_USER) {
+		context_tracking_account(current, 0);
+		__this_cpu_write(context_tracking.state, IN_USER);
+		rcu_user_enter();
+	}
+	local_irq_restore(flags);
+}
+
+/**
+ * user_exit - the current task has entered the kernel from user mode
+ *
+ * Called before the first use of RCU after a syscall or exception
+ * entry.  Does nothing if the cpu is already in kernel state.
+ */
+void user_exit(void)
+{
+	unsigned long flags;
+
+	if (in_interrupt())
+		return;
+
+	local_irq_save(flags);
+	if (__this_cpu_read(context_tracking.state) == IN_USER) {
+		rcu_user_exit();
+		context_tracking_account(current, 0);
+		__this_cpu_write(context_tracking.state, IN_KERNEL);
+	}
+	local_irq_restore(flags);
+}
+
+/**
+ * context_tracking_task_switch - hand over the tracking to @next
+ *
+ * Called from the scheduler with interrupts disabled.  The time since
+ * the last transition belongs to @prev, and the TIF_NOHZ flag that
+ * routes syscalls through the tracking hooks follows whichever task
+ * runs on a tracked cpu.  Tasks that carry it elsewhere, e.g. after a
+ * fork or a migration, lose it when they next run.
+ */
+void context_tracking_task_switch(struct task_struct *prev,
+				  struct task_struct *next)
+{
+	if (__this_cpu_read(context_tracking.active)) {
+		context_tracking_account(prev, 0);
+		clear_tsk_thread_flag(prev, TIF_NOHZ);
+		set_tsk_thread_flag(next, TIF_NOHZ);
+	} else if (unlikely(test_tsk_thread_flag(next, TIF_NOHZ))) {
+		clear_tsk_thread_flag(next, TIF_NOHZ);
+	}
+}
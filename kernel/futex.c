@@ -61,6 +61,8 @@
 #include <linux/nsproxy.h>
 #include <linux/ptrace.h>
 #include <linux/hugetlb.h>
+#include <linux/bootmem.h>
+#include <linux/log2.h>
 
 #include <asm/futex.h>
 
@@ -68,8 +70,6 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
-
 /*
  * Futex flags used to encode options to functions and preserve them across
  * restarts.
@@ -147,9 +147,33 @@ static const struct futex_q futex_q_init = {
 struct futex_hash_bucket {
 	spinlock_t lock;
 	struct plist_head chain;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * The global hash is sized at boot from the number of possible cpus and
+ * allocated with alloc_large_system_hash(), which spreads it over all
+ * nodes on NUMA machines (see hashdist).
+ */
+static unsigned long __read_mostly futex_hashsize;
+static struct futex_hash_bucket *futex_queues __read_mostly;
+
+/*
+ * A process may ask for a hash of its own for its private futexes, so
+ * that its waiters neither collide with nor contend against anybody
+ * else's.  It lives until the mm is freed.
+ */
+struct futex_private_hash {
+	unsigned long size;
+	struct futex_hash_bucket queues[0];
 };
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+#define FUTEX_PRIVATE_HASH_MIN	16
+#define FUTEX_PRIVATE_HASH_MAX	4096
+
+static inline int futex_key_is_private(union futex_key *key)
+{
+	return !(key->both.offset & (FUT_OFF_INODE|FUT_OFF_MMSHARED));
+}
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
@@ -159,7 +183,75 @@ static struct futex_hash_bucket *hash_futex(union futex_key *key)
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+
+	if (futex_key_is_private(key)) {
+		struct futex_private_hash *fph;
+
+		fph = ACCESS_ONCE(key->private.mm->futex_hash);
+		if (fph)
+			return &fph->queues[hash & (fph->size - 1)];
+	}
+	return &futex_queues[hash & (futex_hashsize - 1)];
+}
+
+static void futex_init_buckets(struct futex_hash_bucket *queues,
+			       unsigned long size)
+{
+	unsigned long i;
+
+	for (i = 0; i < size; i++) {
+		plist_head_init(&queues[i].chain);
+		spin_lock_init(&queues[i].lock);
+	}
+}
+
+/**
+ * futex_set_private_hash() - give current's mm a private futex hash
+ * @nr_buckets:	minimum number of buckets, rounded up to a power of two
+ *
+ * The private futex keys of the process hash into the new table from now
+ * on.  Waiters already queued in the global hash would be lost, so this
+ * is only allowed while the mm has a single user, and only once.
+ */
+int futex_set_private_hash(unsigned long nr_buckets)
+{
+	struct mm_struct *mm = current->mm;
+	struct futex_private_hash *fph;
+
+	if (!mm || nr_buckets > FUTEX_PRIVATE_HASH_MAX)
+		return -EINVAL;
+	if (atomic_read(&mm->mm_users) != 1 || mm->futex_hash)
+		return -EBUSY;
+
+	nr_buckets = roundup_pow_of_two(max_t(unsigned long, nr_buckets,
+					      FUTEX_PRIVATE_HASH_MIN));
+	fph = kmalloc(sizeof(*fph) + nr_buckets * sizeof(fph->queues[0]),
+		      GFP_KERNEL | __GFP_NOWARN);
+	if (!fph)
+		return -ENOMEM;
+
+	fph->size = nr_buckets;
+	futex_init_buckets(fph->queues, nr_buckets);
+
+	if (cmpxchg(&mm->futex_hash, NULL, fph)) {
+		kfree(fph);
+		return -EBUSY;
+	}
+	return 0;
+}
+
+int futex_get_private_hash(void)
+{
+	struct mm_struct *mm = current->mm;
+
+	if (!mm || !mm->futex_hash)
+		return 0;
+	return mm->futex_hash->size;
+}
+
+void futex_free_private_hash(struct mm_struct *mm)
+{
+	kfree(mm->futex_hash);
 }
 
 /*
@@ -2730,8 +2822,8 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 
 static int __init futex_init(void)
 {
+	unsigned int futex_shift;
 	u32 curval;
-	int i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2746,10 +2838,19 @@ static int __init futex_init(void)
 	if (cmpxchg_futex_value_locked(&curval, NULL, 0, 0) == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+#if CONFIG_BASE_SMALL
+	futex_hashsize = 16;
+#else
+	futex_hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+#endif
+
+	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
+					       futex_hashsize, 0,
+					       futex_hashsize < 256 ? HASH_SMALL : 0,
+					       &futex_shift, NULL,
+					       futex_hashsize);
+	futex_hashsize = 1UL << futex_shift;
+	futex_init_buckets(futex_queues, futex_hashsize);
 
 	return 0;
 }
@@ -46,6 +46,8 @@
 #include <linux/stat.h>
 #include <linux/srcu.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/hrtimer.h>
 #include <asm/byteorder.h>
 
 MODULE_LICENSE("GPL");
@@ -72,6 +74,7 @@ static int stall_cpu_holdoff = 10; /* Time to wait until stall (s).  */
 static int test_boost = 1;	/* Test RCU prio boost: 0=no, 1=maybe, 2=yes. */
 static int test_boost_interval = 7; /* Interval between boost tests, seconds. */
 static int test_boost_duration = 4; /* Duration of each boost test, seconds. */
+static int cbflood;		/* Callbacks per CPU per flood burst, 0=off. */
 static char *torture_type = "rcu"; /* What RCU implementation to torture. */
 
 module_param(nreaders, int, 0444);
@@ -112,6 +115,8 @@ module_param(test_boost_interval, int, 0444);
 MODULE_PARM_DESC(test_boost_interval, "Interval between boost tests, seconds.");
 module_param(test_boost_duration, int, 0444);
 MODULE_PARM_DESC(test_boost_duration, "Duration of each boost test, seconds.");
+module_param(cbflood, int, 0444);
+MODULE_PARM_DESC(cbflood, "Callbacks per CPU per flood burst, 0=disable");
 module_param(torture_type, charp, 0444);
 MODULE_PARM_DESC(torture_type, "Type of RCU to torture (rcu, rcu_bh, srcu)");
 
@@ -135,6 +140,7 @@ static struct task_struct *stutter_task;
 static struct task_struct *fqs_task;
 static struct task_struct *boost_tasks[NR_CPUS];
 static struct task_struct *shutdown_task;
+static struct rcu_torture_cbflood *cbflood_data;
 #ifdef CONFIG_HOTPLUG_CPU
 static struct task_struct *onoff_task;
 #endif /* #ifdef CONFIG_HOTPLUG_CPU */
@@ -176,6 +182,25 @@ static long n_online_successes;
 static struct list_head rcu_torture_removed;
 static cpumask_var_t shuffle_tmp_mask;
 
+/*
+ * Callback flood: per-CPU SCHED_FIFO kthread that queues bursts of
+ * callbacks and measures how late it wakes from 1ms sleeps, which is
+ * mostly softirq time spent invoking those callbacks.  On no-CBs CPUs
+ * the callbacks are invoked elsewhere, so the lateness should drop.
+ */
+struct rcu_torture_cbflood_head {
+	struct rcu_head rh;
+	atomic_t *outstanding;
+};
+
+struct rcu_torture_cbflood {
+	struct task_struct *task;
+	struct rcu_torture_cbflood_head *heads;
+	atomic_t outstanding;		/* callbacks of last burst not yet run */
+	unsigned long bursts;
+	s64 max_lat_ns;			/* worst wakeup lateness */
+};
+
 static int stutter_pause_test;
 
 #if defined(MODULE) || defined(CONFIG_RCU_TORTURE_TEST_RUNNABLE)
@@ -328,6 +353,7 @@ struct rcu_torture_ops {
 	void (*deferred_free)(struct rcu_torture *p);
 	void (*sync)(void);
 	void (*cb_barrier)(void);
+	void (*call)(struct rcu_head *head, void (*func)(struct rcu_head *rcu));
 	void (*fqs)(void);
 	int (*stats)(char *page);
 	int irq_capable;
@@ -418,6 +444,7 @@ static struct rcu_torture_ops rcu_ops = {
 	.deferred_free	= rcu_torture_deferred_free,
 	.sync		= synchronize_rcu,
 	.cb_barrier	= rcu_barrier,
+	.call		= call_rcu,
 	.fqs		= rcu_force_quiescent_state,
 	.stats		= NULL,
 	.irq_capable	= 1,
@@ -520,6 +547,7 @@ static struct rcu_torture_ops rcu_bh_ops = {
 	.deferred_free	= rcu_bh_torture_deferred_free,
 	.sync		= synchronize_rcu_bh,
 	.cb_barrier	= rcu_barrier_bh,
+	.call		= call_rcu_bh,
 	.fqs		= rcu_bh_force_quiescent_state,
 	.stats		= NULL,
 	.irq_capable	= 1,
@@ -715,6 +743,7 @@ static struct rcu_torture_ops sched_ops = {
 	.deferred_free	= rcu_sched_torture_deferred_free,
 	.sync		= synchronize_sched,
 	.cb_barrier	= rcu_barrier_sched,
+	.call		= call_rcu_sched,
 	.fqs		= rcu_sched_force_quiescent_state,
 	.stats		= NULL,
 	.irq_capable	= 1,
@@ -967,6 +996,55 @@ rcu_torture_fakewriter(void *arg)
 	return 0;
 }
 
+static void rcu_torture_cbflood_cb(struct rcu_head *rhp)
+{
+	struct rcu_torture_cbflood_head *h =
+		container_of(rhp, struct rcu_torture_cbflood_head, rh);
+
+	atomic_dec(h->outstanding);
+}
+
+/*
+ * RCU torture callback flooder.  Once the previous burst has been
+ * invoked, queue another cbflood callbacks on this CPU, then sleep for
+ * a millisecond and record how late the wakeup was.
+ */
+static int
+rcu_torture_cbflood(void *arg)
+{
+	struct rcu_torture_cbflood *cbf = arg;
+	struct sched_param sp = { .sched_priority = 1 };
+	ktime_t expires;
+	s64 lat;
+	int i;
+
+	VERBOSE_PRINTK_STRING("rcu_torture_cbflood task started");
+	sched_setscheduler_nocheck(current, SCHED_FIFO, &sp);
+
+	do {
+		if (!atomic_read(&cbf->outstanding)) {
+			atomic_set(&cbf->outstanding, cbflood);
+			for (i = 0; i < cbflood; i++)
+				cur_ops->call(&cbf->heads[i].rh,
+					      rcu_torture_cbflood_cb);
+			cbf->bursts++;
+		}
+		expires = ktime_add_ns(ktime_get(), NSEC_PER_MSEC);
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_hrtimeout(&expires, HRTIMER_MODE_ABS);
+		lat = ktime_to_ns(ktime_sub(ktime_get(), expires));
+		if (lat > cbf->max_lat_ns)
+			cbf->max_lat_ns = lat;
+		rcu_stutter_wait("rcu_torture_cbflood");
+	} while (!kthread_should_stop() && fullstop == FULLSTOP_DONTSTOP);
+
+	VERBOSE_PRINTK_STRING("rcu_torture_cbflood task stopping");
+	rcutorture_shutdown_absorb("rcu_torture_cbflood");
+	while (!kthread_should_stop())
+		schedule_timeout_uninterruptible(1);
+	return 0;
+}
+
 void rcutorture_trace_dump(void)
 {
 	static atomic_t beenhere = ATOMIC_INIT(0);
@@ -1171,6 +1249,20 @@ rcu_torture_printk(char *page)
 			       atomic_read(&rcu_torture_wcount[i]));
 	}
 	cnt += sprintf(&page[cnt], "\n");
+	if (cbflood_data) {
+		cnt += sprintf(&page[cnt], "%s%s ", torture_type, TORTURE_FLAG);
+		cnt += sprintf(&page[cnt],
+			       "Flood wakeup latency max (us, * = no-CBs CPU):");
+		for_each_possible_cpu(cpu) {
+			if (!cbflood_data[cpu].task)
+				continue;
+			cnt += sprintf(&page[cnt], " %d%s:%lld", cpu,
+				       rcu_is_nocb_cpu(cpu) ? "*" : "",
+				       (long long)div_s64(cbflood_data[cpu].max_lat_ns,
+							  NSEC_PER_USEC));
+		}
+		cnt += sprintf(&page[cnt], "\n");
+	}
 	if (cur_ops->stats)
 		cnt += cur_ops->stats(&page[cnt]);
 	return cnt;
@@ -1310,13 +1402,13 @@ rcu_torture_print_module_parms(struct rcu_torture_ops *cur_ops, char *tag)
 		"fqs_duration=%d fqs_holdoff=%d fqs_stutter=%d "
 		"test_boost=%d/%d test_boost_interval=%d "
 		"test_boost_duration=%d shutdown_secs=%d "
-		"onoff_interval=%d onoff_holdoff=%d\n",
+		"onoff_interval=%d onoff_holdoff=%d cbflood=%d\n",
 		torture_type, tag, nrealreaders, nfakewriters,
 		stat_interval, verbose, test_no_idle_hz, shuffle_interval,
 		stutter, irqreader, fqs_duration, fqs_holdoff, fqs_stutter,
 		test_boost, cur_ops->can_boost,
 		test_boost_interval, test_boost_duration, shutdown_secs,
-		onoff_interval, onoff_holdoff);
+		onoff_interval, onoff_holdoff, cbflood);
 }
 
 static struct notifier_block rcutorture_shutdown_nb = {
@@ -1666,6 +1758,15 @@ rcu_torture_cleanup(void)
 		kthread_stop(shutdown_task);
 	}
 	rcu_torture_onoff_cleanup();
+	if (cbflood_data) {
+		for_each_possible_cpu(i) {
+			if (cbflood_data[i].task) {
+				VERBOSE_PRINTK_STRING(
+					"Stopping rcu_torture_cbflood task");
+				kthread_stop(cbflood_data[i].task);
+			}
+		}
+	}
 
 	/* Wait for all RCU callbacks to fire.  */
 
@@ -1674,6 +1775,13 @@ rcu_torture_cleanup(void)
 
 	rcu_torture_stats_print();  /* -After- the stats thread is stopped! */
 
+	if (cbflood_data) {
+		for_each_possible_cpu(i)
+			vfree(cbflood_data[i].heads);
+		kfree(cbflood_data);
+		cbflood_data = NULL;
+	}
+
 	if (cur_ops->cleanup)
 		cur_ops->cleanup();
 	if (atomic_read(&n_rcu_torture_error))
@@ -1721,6 +1829,11 @@ rcu_torture_init(void)
 				  "fqs_duration, fqs disabled.\n");
 		fqs_duration = 0;
 	}
+	if (cur_ops->call == NULL && cbflood > 0) {
+		printk(KERN_ALERT "rcu-torture: ->call NULL and non-zero "
+				  "cbflood, cbflood disabled.\n");
+		cbflood = 0;
+	}
 	if (cur_ops->init)
 		cur_ops->init(); /* no "goto unwind" prior to this point!!! */
 
@@ -1897,6 +2010,40 @@ rcu_torture_init(void)
 			goto unwind;
 		}
 	}
+	if (cbflood > 0) {
+		cbflood_data = kcalloc(nr_cpu_ids, sizeof(cbflood_data[0]),
+				       GFP_KERNEL);
+		if (cbflood_data == NULL) {
+			VERBOSE_PRINTK_ERRSTRING("out of memory");
+			firsterr = -ENOMEM;
+			goto unwind;
+		}
+		for_each_online_cpu(cpu) {
+			struct rcu_torture_cbflood *cbf = &cbflood_data[cpu];
+
+			cbf->heads = vzalloc(cbflood * sizeof(cbf->heads[0]));
+			if (cbf->heads == NULL) {
+				VERBOSE_PRINTK_ERRSTRING("out of memory");
+				firsterr = -ENOMEM;
+				goto unwind;
+			}
+			for (i = 0; i < cbflood; i++)
+				cbf->heads[i].outstanding = &cbf->outstanding;
+			VERBOSE_PRINTK_STRING("Creating rcu_torture_cbflood task");
+			cbf->task = kthread_create_on_node(rcu_torture_cbflood,
+							   cbf,
+							   cpu_to_node(cpu),
+							   "rcu_torture_cbflood");
+			if (IS_ERR(cbf->task)) {
+				firsterr = PTR_ERR(cbf->task);
+				VERBOSE_PRINTK_ERRSTRING("Failed to create cbflood");
+				cbf->task = NULL;
+				goto unwind;
+			}
+			kthread_bind(cbf->task, cpu);
+			wake_up_process(cbf->task);
+		}
+	}
 	rcu_torture_onoff_init();
 	register_reboot_notifier(&rcutorture_shutdown_nb);
 	rcu_torture_stall_init();
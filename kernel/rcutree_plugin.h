@@ -25,6 +25,7 @@
  */
 
 #include <linux/delay.h>
+#include <linux/tick.h>
 
 #define RCU_KTHREAD_PRIO 1
 
@@ -34,6 +35,14 @@
 #define RCU_BOOST_PRIO RCU_KTHREAD_PRIO
 #endif
 
+#ifdef CONFIG_RCU_NOCB_CPU
+static cpumask_var_t rcu_nocb_mask; /* CPUs to have callbacks offloaded. */
+static bool have_rcu_nocb_mask;	    /* Was rcu_nocb_mask allocated? */
+static bool rcu_nocb_poll;	    /* Offload kthreads are to poll. */
+module_param(rcu_nocb_poll, bool, 0444);
+static char __initdata nocb_buf[NR_CPUS * 5];
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+
 /*
  * Check the RCU kernel configuration parameters and print informative
  * messages about anything out of the ordinary.  If you like #ifdef, you
@@ -70,6 +79,16 @@ static void __init rcu_bootup_announce_oddness(void)
 #if NUM_RCU_LVL_4 != 0
 	printk(KERN_INFO "\tExperimental four-level hierarchy is enabled.\n");
 #endif
+#ifdef CONFIG_RCU_NOCB_CPU
+	if (have_rcu_nocb_mask) {
+		cpulist_scnprintf(nocb_buf, sizeof(nocb_buf), rcu_nocb_mask);
+		printk(KERN_INFO "\tOffload RCU callbacks from CPUs: %s.\n",
+		       nocb_buf);
+		if (rcu_nocb_poll)
+			printk(KERN_INFO
+			       "\tOffloaded RCU callbacks are polled for.\n");
+	}
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
 }
 
 #ifdef CONFIG_TREE_PREEMPT_RCU
@@ -2299,3 +2318,320 @@ static void increment_cpu_stall_ticks(void)
 }
 
 #endif /* #else #ifdef CONFIG_RCU_CPU_STALL_INFO */
+
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * Offload callback processing from the CPUs named by the rcu_nocbs=
+ * boot parameter ("no-CBs CPUs") to an rcuo kthread per CPU and flavor,
+ * so that those CPUs do not invoke callbacks from softirq.
+ *
+ * call_rcu() on a no-CBs CPU appends the callback to ->nocb_head
+ * without locks: it atomically swings ->nocb_tail to the new callback
+ * and only then links the previous tail to it.  The kthread grabs the
+ * whole list, waits for a grace period, then invokes the callbacks,
+ * waiting briefly for any link that an enqueuer has not written yet.
+ * The no-CBs CPU still takes part in grace periods; it just has no
+ * callbacks of its own to process.
+ *
+ * The kthread waits for its grace period by queueing an ordinary
+ * callback on whatever CPU it runs on, bypassing offload, so that a
+ * kthread never waits on another kthread's list.  The boot CPU cannot
+ * be a no-CBs CPU, which leaves somewhere for the kthreads to run.
+ */
+
+/* Parse the boot-time rcu_nocbs= CPU list from the kernel parameters. */
+static int __init rcu_nocb_setup(char *str)
+{
+	alloc_bootmem_cpumask_var(&rcu_nocb_mask);
+	have_rcu_nocb_mask = true;
+	cpulist_parse(str, rcu_nocb_mask);
+	cpumask_and(rcu_nocb_mask, rcu_nocb_mask, cpu_possible_mask);
+	if (cpumask_test_cpu(smp_processor_id(), rcu_nocb_mask)) {
+		printk(KERN_WARNING "rcu_nocbs=: boot CPU %d must invoke callbacks, ignored\n",
+		       smp_processor_id());
+		cpumask_clear_cpu(smp_processor_id(), rcu_nocb_mask);
+	}
+	return 1;
+}
+__setup("rcu_nocbs=", rcu_nocb_setup);
+
+/* nohz_full= CPUs have no tick to invoke callbacks from: offload them. */
+static void __init rcu_init_nocb(void)
+{
+#ifdef CONFIG_NO_HZ_FULL
+	if (!tick_nohz_full_enabled())
+		return;
+	if (!have_rcu_nocb_mask &&
+	    zalloc_cpumask_var(&rcu_nocb_mask, GFP_NOWAIT))
+		have_rcu_nocb_mask = true;
+	if (have_rcu_nocb_mask)
+		cpumask_or(rcu_nocb_mask, rcu_nocb_mask, tick_nohz_full_mask);
+#endif /* #ifdef CONFIG_NO_HZ_FULL */
+}
+
+/* Is the specified CPU a no-CBs CPU? */
+bool rcu_is_nocb_cpu(int cpu)
+{
+	if (have_rcu_nocb_mask)
+		return cpumask_test_cpu(cpu, rcu_nocb_mask);
+	return false;
+}
+EXPORT_SYMBOL_GPL(rcu_is_nocb_cpu);
+
+struct rcu_nocb_gp {
+	struct rcu_head head;
+	struct completion done;
+};
+
+static void rcu_nocb_gp_done(struct rcu_head *rhp)
+{
+	complete(&container_of(rhp, struct rcu_nocb_gp, head)->done);
+}
+
+/*
+ * Enqueue the specified callback onto the specified CPU's no-CBs list
+ * and wake its kthread if the list was empty.  If the caller had irqs
+ * disabled it might hold scheduler locks, so the wakeup is left to the
+ * next pass of the RCU core on this CPU instead.
+ */
+static bool __call_rcu_nocb(struct rcu_data *rdp, struct rcu_head *rhp,
+			    bool lazy, unsigned long flags)
+{
+	struct rcu_head **old_rhpp;
+
+	if (!rcu_is_nocb_cpu(rdp->cpu) || rhp->func == rcu_nocb_gp_done)
+		return 0;
+
+	old_rhpp = xchg(&rdp->nocb_tail, &rhp->next);
+	ACCESS_ONCE(*old_rhpp) = rhp;
+	atomic_long_inc(&rdp->nocb_q_count);
+	if (lazy)
+		atomic_long_inc(&rdp->nocb_q_count_lazy);
+
+	if (__is_kfree_rcu_offset((unsigned long)rhp->func))
+		trace_rcu_kfree_callback(rdp->rsp->name, rhp,
+					 (unsigned long)rhp->func,
+					 atomic_long_read(&rdp->nocb_q_count_lazy),
+					 atomic_long_read(&rdp->nocb_q_count));
+	else
+		trace_rcu_callback(rdp->rsp->name, rhp,
+				   atomic_long_read(&rdp->nocb_q_count_lazy),
+				   atomic_long_read(&rdp->nocb_q_count));
+
+	/* If we are not being polled and there is a kthread, awaken it. */
+	if (old_rhpp == &rdp->nocb_head && !rcu_nocb_poll) {
+		if (irqs_disabled_flags(flags))
+			ACCESS_ONCE(rdp->nocb_defer_wakeup) = true;
+		else
+			wake_up(&rdp->nocb_wq);
+	}
+	return 1;
+}
+
+static bool rcu_nocb_need_deferred_wakeup(struct rcu_data *rdp)
+{
+	return ACCESS_ONCE(rdp->nocb_defer_wakeup);
+}
+
+static void do_nocb_deferred_wakeup(struct rcu_data *rdp)
+{
+	if (!rcu_nocb_need_deferred_wakeup(rdp))
+		return;
+	ACCESS_ONCE(rdp->nocb_defer_wakeup) = false;
+	wake_up(&rdp->nocb_wq);
+}
+
+/* Keep the tick on a CPU that still owes some kthread a wakeup. */
+static bool rcu_nocb_cpu_needs_wakeup(int cpu)
+{
+	return rcu_nocb_need_deferred_wakeup(&per_cpu(rcu_sched_data, cpu)) ||
+#ifdef CONFIG_TREE_PREEMPT_RCU
+	       rcu_nocb_need_deferred_wakeup(&per_cpu(rcu_preempt_data, cpu)) ||
+#endif /* #ifdef CONFIG_TREE_PREEMPT_RCU */
+	       rcu_nocb_need_deferred_wakeup(&per_cpu(rcu_bh_data, cpu));
+}
+
+/*
+ * rcu_barrier() support: queue a barrier callback behind the callbacks
+ * of every no-CBs CPU, online or not, since their kthreads keep invoking
+ * callbacks regardless.  The no-CBs lists can be appended to from any
+ * CPU, so this is done from the caller rather than by IPI.
+ */
+static void rcu_nocb_barrier(struct rcu_state *rsp)
+{
+	struct rcu_head *head;
+	unsigned long flags;
+	int cpu;
+
+	if (!have_rcu_nocb_mask)
+		return;
+	local_save_flags(flags);
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		head = &per_cpu(rcu_barrier_head, cpu);
+		debug_rcu_head_queue(head);
+		head->func = rcu_barrier_callback;
+		head->next = NULL;
+		atomic_inc(&rcu_barrier_cpu_count);
+		__call_rcu_nocb(per_cpu_ptr(rsp->rda, cpu), head, 0, flags);
+	}
+}
+
+/* Wait for a grace period that starts after this call. */
+static void rcu_nocb_wait_gp(struct rcu_data *rdp)
+{
+	struct rcu_nocb_gp gp;
+
+	init_rcu_head_on_stack(&gp.head);
+	init_completion(&gp.done);
+	__call_rcu(&gp.head, rcu_nocb_gp_done, rdp->rsp, 0);
+	wait_for_completion(&gp.done);
+	destroy_rcu_head_on_stack(&gp.head);
+}
+
+/*
+ * Per-rcu_data kthread, but only for no-CBs CPUs.  Each kthread invokes
+ * callbacks queued by the corresponding no-CBs CPU.
+ */
+static int rcu_nocb_kthread(void *arg)
+{
+	long c, cl;
+	struct rcu_head *list;
+	struct rcu_head *next;
+	struct rcu_head **tail;
+	struct rcu_data *rdp = arg;
+
+	/* Each pass through this loop invokes one batch of callbacks */
+	for (;;) {
+		/* If not polling, wait for next batch of callbacks. */
+		if (!rcu_nocb_poll)
+			wait_event_interruptible(rdp->nocb_wq,
+						 ACCESS_ONCE(rdp->nocb_head));
+		list = ACCESS_ONCE(rdp->nocb_head);
+		if (!list) {
+			schedule_timeout_interruptible(1);
+			flush_signals(current);
+			continue;
+		}
+
+		/*
+		 * Extract queued callbacks, update counts, and wait
+		 * for a grace period to elapse.
+		 */
+		ACCESS_ONCE(rdp->nocb_head) = NULL;
+		tail = xchg(&rdp->nocb_tail, &rdp->nocb_head);
+		c = atomic_long_xchg(&rdp->nocb_q_count, 0);
+		cl = atomic_long_xchg(&rdp->nocb_q_count_lazy, 0);
+		ACCESS_ONCE(rdp->nocb_p_count) += c;
+		ACCESS_ONCE(rdp->nocb_p_count_lazy) += cl;
+		rcu_nocb_wait_gp(rdp);
+
+		/* Each pass through the following loop invokes a callback. */
+		trace_rcu_batch_start(rdp->rsp->name, cl, c, -1);
+		c = cl = 0;
+		while (list) {
+			next = list->next;
+			/* Wait for enqueuing to complete, if needed. */
+			while (next == NULL && &list->next != tail) {
+				schedule_timeout_interruptible(1);
+				next = list->next;
+			}
+			debug_rcu_head_unqueue(list);
+			local_bh_disable();
+			if (__rcu_reclaim(rdp->rsp->name, list))
+				cl++;
+			c++;
+			local_bh_enable();
+			list = next;
+		}
+		trace_rcu_batch_end(rdp->rsp->name, c, !!list, 0, 0, 1);
+		ACCESS_ONCE(rdp->nocb_p_count) -= c;
+		ACCESS_ONCE(rdp->nocb_p_count_lazy) -= cl;
+		rdp->n_nocbs_invoked += c;
+	}
+	return 0;
+}
+
+/* Initialize per-rcu_data variables for no-CBs CPUs. */
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp)
+{
+	rdp->nocb_tail = &rdp->nocb_head;
+	init_waitqueue_head(&rdp->nocb_wq);
+}
+
+/*
+ * Create a kthread for each no-CBs CPU of the specified flavor, named
+ * rcuo followed by the flavor's letter (s, b or p) and the CPU, and
+ * start it on the CPUs that invoke their own callbacks.
+ */
+static void __init rcu_spawn_nocb_kthreads(struct rcu_state *rsp)
+{
+	int cpu;
+	struct rcu_data *rdp;
+	struct task_struct *t;
+	cpumask_var_t cbs_mask;
+
+	if (!zalloc_cpumask_var(&cbs_mask, GFP_KERNEL))
+		return;
+	cpumask_andnot(cbs_mask, cpu_possible_mask, rcu_nocb_mask);
+
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		rdp = per_cpu_ptr(rsp->rda, cpu);
+		t = kthread_create(rcu_nocb_kthread, rdp, "rcuo%c/%d",
+				   rsp->name[4], cpu);
+		BUG_ON(IS_ERR(t));
+		set_cpus_allowed_ptr(t, cbs_mask);
+		ACCESS_ONCE(rdp->nocb_kthread) = t;
+		wake_up_process(t);
+	}
+	free_cpumask_var(cbs_mask);
+}
+
+static int __init rcu_spawn_all_nocb_kthreads(void)
+{
+	if (!have_rcu_nocb_mask)
+		return 0;
+	rcu_spawn_nocb_kthreads(&rcu_sched_state);
+	rcu_spawn_nocb_kthreads(&rcu_bh_state);
+#ifdef CONFIG_TREE_PREEMPT_RCU
+	rcu_spawn_nocb_kthreads(&rcu_preempt_state);
+#endif /* #ifdef CONFIG_TREE_PREEMPT_RCU */
+	return 0;
+}
+early_initcall(rcu_spawn_all_nocb_kthreads);
+
+#else /* #ifdef CONFIG_RCU_NOCB_CPU */
+
+static bool __call_rcu_nocb(struct rcu_data *rdp, struct rcu_head *rhp,
+			    bool lazy, unsigned long flags)
+{
+	return 0;
+}
+
+static bool rcu_nocb_need_deferred_wakeup(struct rcu_data *rdp)
+{
+	return false;
+}
+
+static void do_nocb_deferred_wakeup(struct rcu_data *rdp)
+{
+}
+
+static bool rcu_nocb_cpu_needs_wakeup(int cpu)
+{
+	return false;
+}
+
+static void rcu_nocb_barrier(struct rcu_state *rsp)
+{
+}
+
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp)
+{
+}
+
+static void __init rcu_init_nocb(void)
+{
+}
+
+#endif /* #else #ifdef CONFIG_RCU_NOCB_CPU */
@@ -72,6 +72,7 @@
 #include <linux/slab.h>
 #include <linux/init_task.h>
 #include <linux/binfmts.h>
+#include <linux/context_tracking.h>
 
 #include <asm/switch_to.h>
 #include <asm/tlb.h>
@@ -623,6 +624,23 @@ static inline bool got_nohz_idle_kick(void)
 
 #endif /* CONFIG_NO_HZ */
 
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * A nohz_full= cpu can run without the tick as long as it has a single
+ * task: nothing to preempt it for.  inc_nr_running() kicks the cpu when
+ * a second task shows up.
+ */
+bool sched_can_stop_tick(void)
+{
+	struct rq *rq = this_rq();
+
+	/* Make sure rq->nr_running update is visible after the IPI */
+	smp_rmb();
+
+	return rq->nr_running <= 1;
+}
+#endif /* CONFIG_NO_HZ_FULL */
+
 void sched_avg_update(struct rq *rq)
 {
 	s64 period = sched_avg_period();
@@ -1483,7 +1501,8 @@ static void sched_ttwu_pending(void)
 
 void scheduler_ipi(void)
 {
-	if (llist_empty(&this_rq()->wake_list) && !got_nohz_idle_kick())
+	if (llist_empty(&this_rq()->wake_list) && !got_nohz_idle_kick() &&
+	    !tick_nohz_full_cpu(smp_processor_id()))
 		return;
 
 	/*
@@ -1500,6 +1519,7 @@ void scheduler_ipi(void)
 	 * somewhat pessimize the simple resched case.
 	 */
 	irq_enter();
+	tick_nohz_full_check();
 	sched_ttwu_pending();
 
 	/*
@@ -1716,6 +1736,23 @@ static void __sched_fork(struct task_struct *p)
 	p->se.vruntime			= 0;
 	INIT_LIST_HEAD(&p->se.group_node);
 
+#ifdef CONFIG_SMP
+	p->last_wakee			= NULL;
+	p->wakee_flips			= 0;
+	p->wakee_flip_decay_ts		= jiffies;
+#endif
+
+#ifdef CONFIG_NUMA_BALANCING
+	p->numa_scan_seq		= p->mm ? p->mm->numa_scan_seq : 0;
+	p->numa_scan_period		= sysctl_numa_balancing_scan_delay;
+	p->numa_preferred_nid		= -1;
+	p->numa_work_queued		= 0;
+	p->node_stamp			= 0;
+	p->numa_faults			= NULL;
+	p->numa_faults_locality[0]	= 0;
+	p->numa_faults_locality[1]	= 0;
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 	memset(&p->se.statistics, 0, sizeof(p->se.statistics));
 #endif
@@ -1968,6 +2005,7 @@ static void finish_task_switch(struct rq *rq, struct task_struct *prev)
 	finish_arch_post_lock_switch();
 
 	fire_sched_in_preempt_notifiers(current);
+	tick_nohz_task_switch();
 	if (mm)
 		mmdrop(mm);
 	if (unlikely(prev_state == TASK_DEAD)) {
@@ -2083,6 +2121,7 @@ context_switch(struct rq *rq, struct task_struct *prev,
 	spin_release(&rq->lock.dep_map, 1, _THIS_IP_);
 #endif
 
+	context_tracking_task_switch(prev, next);
 	/* Here we just switch the register state and the stack. */
 	switch_to(prev, next, prev);
 
@@ -2753,6 +2792,23 @@ unlock:
 	raw_spin_unlock_irqrestore(&p->pi_lock, flags);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/* Move current to @target_cpu, for NUMA placement */
+int migrate_task_to(struct task_struct *p, int target_cpu)
+{
+	struct migration_arg arg = { p, target_cpu };
+	int curr_cpu = task_cpu(p);
+
+	if (curr_cpu == target_cpu)
+		return 0;
+
+	if (!cpumask_test_cpu(target_cpu, tsk_cpus_allowed(p)))
+		return -EINVAL;
+
+	return stop_one_cpu(curr_cpu, migration_cpu_stop, &arg);
+}
+#endif
+
 #endif
 
 DEFINE_PER_CPU(struct kernel_stat, kstat);
@@ -3076,6 +3132,12 @@ void account_process_tick(struct task_struct *p, int user_tick)
 	cputime_t one_jiffy_scaled = cputime_to_scaled(cputime_one_jiffy);
 	struct rq *rq = this_rq();
 
+	/* nohz_full= cpus account at kernel/user boundaries instead */
+	if (context_tracking_active()) {
+		context_tracking_account(p, HARDIRQ_OFFSET);
+		return;
+	}
+
 	if (sched_clock_irqtime) {
 		irqtime_account_process_tick(p, user_tick, rq);
 		return;
@@ -3470,6 +3532,19 @@ asmlinkage void __sched schedule(void)
 }
 EXPORT_SYMBOL(schedule);
 
+#ifdef CONFIG_CONTEXT_TRACKING
+/*
+ * schedule() on the way back to user mode, which the cpu may already
+ * have entered as far as context tracking is concerned.
+ */
+asmlinkage void __sched schedule_user(void)
+{
+	user_exit();
+	schedule();
+	user_enter();
+}
+#endif
+
 /**
  * schedule_preempt_disabled - called with preemption disabled
  *
@@ -6022,19 +6097,38 @@ static void destroy_sched_domains(struct sched_domain *sd, int cpu)
  * two cpus are in the same cache domain, see cpus_share_cache().
  */
 DEFINE_PER_CPU(struct sched_domain *, sd_llc);
+DEFINE_PER_CPU(int, sd_llc_size);
 DEFINE_PER_CPU(int, sd_llc_id);
 
+/*
+ * The idle cpus of a cache domain, kept in the mask of the cpu whose
+ * number is the domain's ID, see set_cpu_llc_idle().  It may briefly
+ * disagree with idle_cpu(), users have to check.
+ */
+DEFINE_PER_CPU(cpumask_var_t, sd_llc_idle_mask);
+
 static void update_top_cache_domain(int cpu)
 {
 	struct sched_domain *sd;
-	int id = cpu;
+	int id = cpu, size = 1;
+	int old_id = per_cpu(sd_llc_id, cpu);
 
 	sd = highest_flag_domain(cpu, SD_SHARE_PKG_RESOURCES);
-	if (sd)
+	if (sd) {
 		id = cpumask_first(sched_domain_span(sd));
+		size = sd->span_weight;
+	}
 
 	rcu_assign_pointer(per_cpu(sd_llc, cpu), sd);
+	per_cpu(sd_llc_size, cpu) = size;
 	per_cpu(sd_llc_id, cpu) = id;
+
+	/* Carry our idle bit over to the mask of the new cache domain */
+	if (old_id != id) {
+		cpumask_clear_cpu(cpu, per_cpu(sd_llc_idle_mask, old_id));
+		if (idle_cpu(cpu))
+			cpumask_set_cpu(cpu, per_cpu(sd_llc_idle_mask, id));
+	}
 }
 
 /*
@@ -7283,6 +7377,9 @@ void __init sched_init(void)
 
 #ifdef CONFIG_SMP
 	zalloc_cpumask_var(&sched_domains_tmpmask, GFP_NOWAIT);
+	for_each_possible_cpu(i)
+		zalloc_cpumask_var_node(&per_cpu(sd_llc_idle_mask, i),
+					GFP_NOWAIT, cpu_to_node(i));
 	/* May be allocated at isolcpus cmdline parse time */
 	if (cpu_isolated_map == NULL)
 		zalloc_cpumask_var(&cpu_isolated_map, GFP_NOWAIT);
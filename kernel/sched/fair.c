@@ -26,6 +26,8 @@
 #include <linux/slab.h>
 #include <linux/profile.h>
 #include <linux/interrupt.h>
+#include <linux/mempolicy.h>
+#include <linux/task_work.h>
 
 #include <trace/events/sched.h>
 
@@ -772,6 +774,236 @@ update_stats_curr_start(struct cfs_rq *cfs_rq, struct sched_entity *se)
 	se->exec_start = rq_of(cfs_rq)->clock_task;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Automatic NUMA balancing.
+ *
+ * Every scan period one thread of each process marks the next
+ * numa_balancing_scan_size MB of its address space PROT_NONE.  The
+ * hinting faults taken on those pages tell which nodes the task's
+ * memory is on; misplaced pages are migrated towards the faulting cpu
+ * right away, see do_numa_page().  After each scan pass the faults are
+ * folded into a decaying per-node history, the node with the most
+ * faults becomes the task's preferred node, and the task moves there if
+ * that does not unbalance the load.  The load balancer then avoids
+ * pulling it off that node again.
+ *
+ * The scan period adapts: it doubles while nearly all faults are local
+ * and halves while they are not, within the min/max sysctls.
+ */
+unsigned int sysctl_numa_balancing;	/* on at boot with more than one node */
+unsigned int sysctl_numa_balancing_scan_period_min = 1000;
+unsigned int sysctl_numa_balancing_scan_period_max = 60000;
+unsigned int sysctl_numa_balancing_scan_size = 256;
+unsigned int sysctl_numa_balancing_scan_delay = 1000;
+
+static unsigned long weighted_cpuload(const int cpu);
+
+/*
+ * Move @p to the least loaded cpu of its preferred node, but only if that
+ * cpu stays no busier than the one it leaves, or the load balancer would
+ * pull it straight back.
+ */
+static void task_numa_migrate(struct task_struct *p)
+{
+	int nid = p->numa_preferred_nid;
+	unsigned long load, best_load = ULONG_MAX;
+	int cpu, best_cpu = -1;
+
+	for_each_cpu_and(cpu, cpumask_of_node(nid), tsk_cpus_allowed(p)) {
+		if (!cpu_active(cpu))
+			continue;
+		load = weighted_cpuload(cpu);
+		if (load < best_load) {
+			best_load = load;
+			best_cpu = cpu;
+		}
+	}
+	if (best_cpu == -1)
+		return;
+
+	if (best_load + p->se.load.weight > weighted_cpuload(task_cpu(p)))
+		return;
+
+	migrate_task_to(p, best_cpu);
+}
+
+/* Once per scan pass: fold in the new faults and pick the preferred node */
+static void task_numa_placement(struct task_struct *p)
+{
+	unsigned long *buffer = p->numa_faults + nr_node_ids;
+	unsigned long faults, max_faults = 0, local, remote;
+	int seq = ACCESS_ONCE(p->mm->numa_scan_seq);
+	int nid, max_nid = -1;
+
+	if (p->numa_scan_seq == seq)
+		return;
+	p->numa_scan_seq = seq;
+
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		faults = p->numa_faults[nid] / 2 + buffer[nid];
+		p->numa_faults[nid] = faults;
+		buffer[nid] = 0;
+		if (faults > max_faults) {
+			max_faults = faults;
+			max_nid = nid;
+		}
+	}
+
+	remote = p->numa_faults_locality[0];
+	local = p->numa_faults_locality[1];
+	p->numa_faults_locality[0] = p->numa_faults_locality[1] = 0;
+	if (local * 8 >= (local + remote) * 7)
+		p->numa_scan_period = min(p->numa_scan_period * 2,
+					  sysctl_numa_balancing_scan_period_max);
+	else
+		p->numa_scan_period = max(p->numa_scan_period / 2,
+					  sysctl_numa_balancing_scan_period_min);
+
+	if (max_nid == -1)
+		return;
+
+	p->numa_preferred_nid = max_nid;
+	if (cpu_to_node(task_cpu(p)) != max_nid)
+		task_numa_migrate(p);
+}
+
+/*
+ * Called from the NUMA hinting fault handler: @pages on @node were
+ * touched by current, and were just moved there if @migrated.
+ */
+void task_numa_fault(int node, int pages, bool migrated)
+{
+	struct task_struct *p = current;
+
+	if (!sysctl_numa_balancing || !p->mm)
+		return;
+
+	if (unlikely(!p->numa_faults)) {
+		p->numa_faults = kzalloc(2 * nr_node_ids * sizeof(unsigned long),
+					 GFP_KERNEL | __GFP_NOWARN);
+		if (!p->numa_faults)
+			return;
+	}
+
+	task_numa_placement(p);
+
+	p->numa_faults[nr_node_ids + node] += pages;
+	p->numa_faults_locality[!migrated && node == numa_node_id()] += pages;
+}
+
+void task_numa_free(struct task_struct *p)
+{
+	kfree(p->numa_faults);
+}
+
+/*
+ * Mark the next part of the address space for hinting faults.  Runs from
+ * task_work on the way back to user space, so it is charged to the task
+ * itself.  Only one thread of a process scans per period.
+ */
+static void task_numa_work(struct callback_head *work)
+{
+	struct task_struct *p = current;
+	struct mm_struct *mm = p->mm;
+	struct vm_area_struct *vma;
+	unsigned long migrate, next_scan, now = jiffies;
+	unsigned long start, end, nr, pages;
+
+	WARN_ON_ONCE(p != container_of(work, struct task_struct, numa_work));
+	p->numa_work_queued = 0;
+
+	if (p->flags & PF_EXITING)
+		return;
+
+	migrate = mm->numa_next_scan;
+	if (time_before(now, migrate))
+		return;
+	next_scan = now + msecs_to_jiffies(p->numa_scan_period);
+	if (cmpxchg(&mm->numa_next_scan, migrate, next_scan) != migrate)
+		return;
+
+	pages = (unsigned long)sysctl_numa_balancing_scan_size <<
+		(20 - PAGE_SHIFT);
+	start = mm->numa_scan_offset;
+
+	down_read(&mm->mmap_sem);
+	vma = find_vma(mm, start);
+	if (!vma) {
+		/* the rest of the last pass was unmapped meanwhile */
+		ACCESS_ONCE(mm->numa_scan_seq)++;
+		start = 0;
+		vma = mm->mmap;
+	}
+	for (; vma; vma = vma->vm_next) {
+		if (!vma_migratable(vma) || (vma->vm_flags & VM_MIXEDMAP))
+			continue;
+		/* PROT_NONE mappings never fault in */
+		if (!(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+			continue;
+		/* Shared libraries and other read-only file data stay put */
+		if (vma->vm_file &&
+		    (vma->vm_flags & (VM_READ | VM_WRITE)) == VM_READ)
+			continue;
+
+		start = max(start, vma->vm_start);
+		end = min(vma->vm_end, start + (pages << PAGE_SHIFT));
+		if (start >= end)
+			continue;
+		change_prot_numa(vma, start, end);
+
+		nr = (end - start) >> PAGE_SHIFT;
+		start = end;
+		if (nr >= pages)
+			break;
+		pages -= nr;
+	}
+	/* Wrap around once the end of the address space is reached */
+	if (vma) {
+		mm->numa_scan_offset = start;
+	} else {
+		mm->numa_scan_offset = 0;
+		ACCESS_ONCE(mm->numa_scan_seq)++;
+	}
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Once the task has run for its scan period, queue task_numa_work() if
+ * the process is due a scan.
+ */
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+	struct callback_head *work = &curr->numa_work;
+	u64 period, now;
+
+	if (!sysctl_numa_balancing || !curr->mm ||
+	    (curr->flags & PF_EXITING) || curr->numa_work_queued)
+		return;
+
+	now = curr->se.sum_exec_runtime;
+	period = (u64)curr->numa_scan_period * NSEC_PER_MSEC;
+	if (now - curr->node_stamp <= period)
+		return;
+
+	if (!curr->node_stamp)
+		curr->numa_scan_period = sysctl_numa_balancing_scan_period_min;
+	curr->node_stamp = now;
+
+	if (time_before(jiffies, curr->mm->numa_next_scan))
+		return;
+
+	curr->numa_work_queued = 1;
+	init_task_work(work, task_numa_work);
+	if (task_work_add(curr, work, true))
+		curr->numa_work_queued = 0;
+}
+#else
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /**************************************************
  * Scheduling class queueing methods:
  */
@@ -2649,14 +2881,50 @@ find_idlest_cpu(struct sched_group *group, struct task_struct *p, int this_cpu)
 }
 
 /*
- * Try and locate an idle CPU in the sched_domain.
+ * Find an allowed cpu in @mask within the cache domain @sd, searching
+ * circularly from the one after @target so that concurrent wakeups
+ * spread out instead of all piling onto the lowest idle cpu.  With
+ * @core, only take a cpu whose SMT siblings are all idle as well.
+ */
+static int scan_llc_idle(struct task_struct *p, struct sched_domain *sd,
+			 struct cpumask *mask, int target, bool core)
+{
+	int i, wrapped = 0;
+
+	for (i = cpumask_next_and(target, mask, tsk_cpus_allowed(p)); ;
+	     i = cpumask_next_and(i, mask, tsk_cpus_allowed(p))) {
+		if (i >= nr_cpu_ids) {
+			if (wrapped++)
+				break;
+			i = -1;
+			continue;
+		}
+		if (wrapped && i > target)
+			break;
+		if (!cpumask_test_cpu(i, sched_domain_span(sd)) || !idle_cpu(i))
+			continue;
+#ifdef CONFIG_SCHED_SMT
+		if (core && !cpumask_subset(topology_thread_cpumask(i), mask))
+			continue;
+#endif
+		return i;
+	}
+	return -1;
+}
+
+/*
+ * Try and locate an idle CPU in the cache domain of @target.
+ *
+ * Rather than walking the groups of every domain below the LLC, look at
+ * the LLC's idle mask, which the cpus keep up to date as they enter and
+ * leave idle.  Prefer a cpu on a fully idle core, then any idle cpu.
  */
 static int select_idle_sibling(struct task_struct *p, int target)
 {
 	int cpu = smp_processor_id();
 	int prev_cpu = task_cpu(p);
 	struct sched_domain *sd;
-	struct sched_group *sg;
+	struct cpumask *mask;
 	int i;
 
 	/*
@@ -2673,31 +2941,60 @@ static int select_idle_sibling(struct task_struct *p, int target)
 	if (target == prev_cpu && idle_cpu(prev_cpu))
 		return prev_cpu;
 
-	/*
-	 * Otherwise, iterate the domains and find an elegible idle cpu.
-	 */
 	sd = rcu_dereference(per_cpu(sd_llc, target));
-	for_each_lower_domain(sd) {
-		sg = sd->groups;
-		do {
-			if (!cpumask_intersects(sched_group_cpus(sg),
-						tsk_cpus_allowed(p)))
-				goto next;
+	if (!sd)
+		return target;
+
+	mask = llc_idle_mask(target);
+#ifdef CONFIG_SCHED_SMT
+	i = scan_llc_idle(p, sd, mask, target, true);
+	if (i >= 0)
+		return i;
+#endif
+	i = scan_llc_idle(p, sd, mask, target, false);
+	if (i >= 0)
+		return i;
 
-			for_each_cpu(i, sched_group_cpus(sg)) {
-				if (!idle_cpu(i))
-					goto next;
-			}
+	return target;
+}
 
-			target = cpumask_first_and(sched_group_cpus(sg),
-					tsk_cpus_allowed(p));
-			goto done;
-next:
-			sg = sg->next;
-		} while (sg != sd->groups);
+/*
+ * Remember whom the current task wakes.  A waker that keeps switching
+ * between wakees collects flips; the count halves every second so that
+ * it reflects the recent pattern only.
+ */
+static void record_wakee(struct task_struct *p)
+{
+	if (time_after(jiffies, current->wakee_flip_decay_ts + HZ)) {
+		current->wakee_flips >>= 1;
+		current->wakee_flip_decay_ts = jiffies;
+	}
+
+	if (current->last_wakee != p) {
+		current->last_wakee = p;
+		current->wakee_flips++;
 	}
-done:
-	return target;
+}
+
+/*
+ * Pulling the wakee next to the waker is good for a 1:1 relation, but a
+ * waker that feeds many wakees (a dispatcher, a server accept thread)
+ * would end up with all of them stacked on its cache domain.  Detect
+ * that from the flip counts: both sides flip, and the waker at least
+ * llc-size times as often as the wakee.  Such wakeups stay away from
+ * the waker and just look for an idle cpu near where the wakee ran.
+ */
+static int wake_wide(struct task_struct *p)
+{
+	unsigned int master = current->wakee_flips;
+	unsigned int slave = p->wakee_flips;
+	int factor = this_cpu_read(sd_llc_size);
+
+	if (master < slave)
+		swap(master, slave);
+	if (slave < factor || master < slave * factor)
+		return 0;
+	return 1;
 }
 
 /*
@@ -2726,7 +3023,8 @@ select_task_rq_fair(struct task_struct *p, int sd_flag, int wake_flags)
 		return prev_cpu;
 
 	if (sd_flag & SD_BALANCE_WAKE) {
-		if (cpumask_test_cpu(cpu, tsk_cpus_allowed(p)))
+		record_wakee(p);
+		if (cpumask_test_cpu(cpu, tsk_cpus_allowed(p)) && !wake_wide(p))
 			want_affine = 1;
 		new_cpu = prev_cpu;
 	}
@@ -2788,6 +3086,12 @@ select_task_rq_fair(struct task_struct *p, int sd_flag, int wake_flags)
 		goto unlock;
 	}
 
+	/* Wide wakeups still want an idle cpu, near where the wakee ran */
+	if (!sd && (sd_flag & SD_BALANCE_WAKE)) {
+		new_cpu = select_idle_sibling(p, prev_cpu);
+		goto unlock;
+	}
+
 	while (sd) {
 		int load_idx = sd->forkexec_idx;
 		struct sched_group *group;
@@ -3153,6 +3457,43 @@ task_hot(struct task_struct *p, u64 now, struct sched_domain *sd)
 	return delta < (s64)sysctl_sched_migration_cost;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/* Moving a task to the node its memory is on beats cache hotness */
+static bool migrate_improves_locality(struct task_struct *p,
+				      struct lb_env *env)
+{
+	int src_nid = cpu_to_node(env->src_cpu);
+	int dst_nid = cpu_to_node(env->dst_cpu);
+
+	if (!sysctl_numa_balancing || p->numa_preferred_nid == -1)
+		return false;
+	return src_nid != dst_nid && dst_nid == p->numa_preferred_nid;
+}
+
+static bool migrate_degrades_locality(struct task_struct *p,
+				      struct lb_env *env)
+{
+	int src_nid = cpu_to_node(env->src_cpu);
+	int dst_nid = cpu_to_node(env->dst_cpu);
+
+	if (!sysctl_numa_balancing || p->numa_preferred_nid == -1)
+		return false;
+	return src_nid != dst_nid && src_nid == p->numa_preferred_nid;
+}
+#else
+static inline bool migrate_improves_locality(struct task_struct *p,
+					     struct lb_env *env)
+{
+	return false;
+}
+
+static inline bool migrate_degrades_locality(struct task_struct *p,
+					     struct lb_env *env)
+{
+	return false;
+}
+#endif
+
 /*
  * can_migrate_task - may task p from runqueue rq be migrated to this_cpu?
  */
@@ -3177,6 +3518,15 @@ int can_migrate_task(struct task_struct *p, struct lb_env *env)
 		return 0;
 	}
 
+	/* Moving to or away from the node its memory is on trumps hotness */
+	if (migrate_improves_locality(p, env))
+		return 1;
+	if (migrate_degrades_locality(p, env) &&
+	    env->sd->nr_balance_failed <= env->sd->cache_nice_tries) {
+		schedstat_inc(p, se.statistics.nr_failed_migrations_hot);
+		return 0;
+	}
+
 	/*
 	 * Aggressive migration if:
 	 * 1) task is cache cold, or
@@ -5190,6 +5540,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	task_tick_numa(rq, curr);
 }
 
 /*
@@ -5599,6 +5951,11 @@ __init void init_sched_fair_class(void)
 #ifdef CONFIG_SMP
 	open_softirq(SCHED_SOFTIRQ, run_rebalance_domains);
 
+#ifdef CONFIG_NUMA_BALANCING
+	if (nr_online_nodes > 1)
+		sysctl_numa_balancing = 1;
+#endif
+
 #ifdef CONFIG_NO_HZ
 	nohz.next_balance = jiffies;
 	zalloc_cpumask_var(&nohz.idle_cpus_mask, GFP_NOWAIT);
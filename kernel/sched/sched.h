@@ -3,6 +3,7 @@
 #include <linux/mutex.h>
 #include <linux/spinlock.h>
 #include <linux/stop_machine.h>
+#include <linux/tick.h>
 
 #include "cpupri.h"
 
@@ -524,7 +525,31 @@ static inline struct sched_domain *highest_flag_domain(int cpu, int flag)
 }
 
 DECLARE_PER_CPU(struct sched_domain *, sd_llc);
+DECLARE_PER_CPU(int, sd_llc_size);
 DECLARE_PER_CPU(int, sd_llc_id);
+DECLARE_PER_CPU(cpumask_var_t, sd_llc_idle_mask);
+
+static inline struct cpumask *llc_idle_mask(int cpu)
+{
+	return per_cpu(sd_llc_idle_mask, per_cpu(sd_llc_id, cpu));
+}
+
+/*
+ * Called with the rq lock held when @cpu switches to and away from its
+ * idle task, so that wakeups can pick an idle cpu in the cache domain
+ * without scanning it.
+ */
+static inline void set_cpu_llc_idle(int cpu, bool idle)
+{
+	if (idle)
+		cpumask_set_cpu(cpu, llc_idle_mask(cpu));
+	else
+		cpumask_clear_cpu(cpu, llc_idle_mask(cpu));
+}
+
+#ifdef CONFIG_NUMA_BALANCING
+extern int migrate_task_to(struct task_struct *p, int cpu);
+#endif
 
 #endif /* CONFIG_SMP */
 
@@ -914,6 +939,15 @@ static inline void cpuacct_charge(struct task_struct *tsk, u64 cputime) {}
 static inline void inc_nr_running(struct rq *rq)
 {
 	rq->nr_running++;
+
+#ifdef CONFIG_NO_HZ_FULL
+	/* A second task needs the tick for preemption */
+	if (rq->nr_running == 2 && tick_nohz_full_cpu(rq->cpu)) {
+		/* Order rq->nr_running write against the IPI */
+		smp_wmb();
+		smp_send_reschedule(rq->cpu);
+	}
+#endif
 }
 
 static inline void dec_nr_running(struct rq *rq)
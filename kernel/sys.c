@@ -36,6 +36,7 @@
 #include <linux/personality.h>
 #include <linux/ptrace.h>
 #include <linux/fs_struct.h>
+#include <linux/futex.h>
 #include <linux/gfp.h>
 #include <linux/syscore_ops.h>
 #include <linux/version.h>
@@ -2016,6 +2017,16 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 			if (arg2 || arg3 || arg4 || arg5)
 				return -EINVAL;
 			return current->no_new_privs ? 1 : 0;
+		case PR_SET_FUTEX_HASH:
+			if (arg3 || arg4 || arg5)
+				return -EINVAL;
+			error = futex_set_private_hash(arg2);
+			break;
+		case PR_GET_FUTEX_HASH:
+			if (arg2 || arg3 || arg4 || arg5)
+				return -EINVAL;
+			error = futex_get_private_hash();
+			break;
 		default:
 			error = -EINVAL;
 			break;
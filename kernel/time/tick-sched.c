@@ -20,6 +20,10 @@
 #include <linux/profile.h>
 #include <linux/sched.h>
 #include <linux/module.h>
+#include <linux/irq_work.h>
+#include <linux/perf_event.h>
+#include <linux/posix-timers.h>
+#include <linux/context_tracking.h>
 
 #include <asm/irq_regs.h>
 
@@ -123,6 +127,40 @@ static int __init setup_tick_nohz(char *str)
 
 __setup("nohz=", setup_tick_nohz);
 
+#ifdef CONFIG_NO_HZ_FULL
+cpumask_var_t tick_nohz_full_mask;
+bool tick_nohz_full_running;
+static char __initdata nohz_full_buf[NR_CPUS * 5];
+
+/* Parse the boot-time nohz_full= CPU list from the kernel parameters. */
+static int __init tick_nohz_full_setup(char *str)
+{
+	int cpu;
+
+	alloc_bootmem_cpumask_var(&tick_nohz_full_mask);
+	if (cpulist_parse(str, tick_nohz_full_mask) < 0) {
+		printk(KERN_WARNING "nohz_full=: bad cpu list, ignored\n");
+		return 1;
+	}
+	cpumask_and(tick_nohz_full_mask, tick_nohz_full_mask,
+		    cpu_possible_mask);
+	cpu = smp_processor_id();
+	if (cpumask_test_cpu(cpu, tick_nohz_full_mask)) {
+		printk(KERN_WARNING "nohz_full=: boot CPU %d keeps its tick for timekeeping, ignored\n",
+		       cpu);
+		cpumask_clear_cpu(cpu, tick_nohz_full_mask);
+	}
+	if (cpumask_empty(tick_nohz_full_mask))
+		return 1;
+
+	for_each_cpu(cpu, tick_nohz_full_mask)
+		context_tracking_cpu_set(cpu);
+	tick_nohz_full_running = true;
+	return 1;
+}
+__setup("nohz_full=", tick_nohz_full_setup);
+#endif /* CONFIG_NO_HZ_FULL */
+
 /**
  * tick_nohz_update_jiffies - update jiffies when idle was interrupted
  *
@@ -271,49 +309,18 @@ u64 get_cpu_iowait_time_us(int cpu, u64 *last_update_time)
 }
 EXPORT_SYMBOL_GPL(get_cpu_iowait_time_us);
 
-static void tick_nohz_stop_sched_tick(struct tick_sched *ts)
+/*
+ * Stop the tick until the next timer event, in idle (ts->inidle) or
+ * for the single task of a nohz_full= cpu.  Interrupts must be disabled.
+ */
+static void tick_nohz_stop_sched_tick(struct tick_sched *ts, ktime_t now,
+				      int cpu)
 {
 	unsigned long seq, last_jiffies, next_jiffies, delta_jiffies;
-	ktime_t last_update, expires, now;
+	ktime_t last_update, expires;
 	struct clock_event_device *dev = __get_cpu_var(tick_cpu_device).evtdev;
 	u64 time_delta;
-	int cpu;
 
-	cpu = smp_processor_id();
-	ts = &per_cpu(tick_cpu_sched, cpu);
-
-	now = tick_nohz_start_idle(cpu, ts);
-
-	/*
-	 * If this cpu is offline and it is the one which updates
-	 * jiffies, then give up the assignment and let it be taken by
-	 * the cpu which runs the tick timer next. If we don't drop
-	 * this here the jiffies might be stale and do_timer() never
-	 * invoked.
-	 */
-	if (unlikely(!cpu_online(cpu))) {
-		if (cpu == tick_do_timer_cpu)
-			tick_do_timer_cpu = TICK_DO_TIMER_NONE;
-	}
-
-	if (unlikely(ts->nohz_mode == NOHZ_MODE_INACTIVE))
-		return;
-
-	if (need_resched())
-		return;
-
-	if (unlikely(local_softirq_pending() && cpu_online(cpu))) {
-		static int ratelimit;
-
-		if (ratelimit < 10) {
-			printk(KERN_ERR "NOHZ: local_softirq_pending %02x\n",
-			       (unsigned int) local_softirq_pending());
-			ratelimit++;
-		}
-		return;
-	}
-
-	ts->idle_calls++;
 	/* Read jiffies and the time when jiffies were updated last */
 	do {
 		seq = read_seqbegin(&xtime_lock);
@@ -388,6 +395,22 @@ static void tick_nohz_stop_sched_tick(struct tick_sched *ts)
 		else
 			expires.tv64 = KTIME_MAX;
 
+		/*
+		 * A busy cpu still takes one tick a second, so that the
+		 * scheduler's and the load balancer's view of it doesn't
+		 * go stale.  Count from the tick that would have been
+		 * next when it was stopped.
+		 */
+		if (!ts->inidle) {
+			ktime_t next_tick = ts->tick_stopped ? ts->idle_tick :
+				hrtimer_get_expires(&ts->sched_timer);
+
+			next_tick = ktime_add_ns(next_tick,
+						 NSEC_PER_SEC - TICK_NSEC);
+			if (expires.tv64 > next_tick.tv64)
+				expires = next_tick;
+		}
+
 		/* Skip reprogram of event if its not changed */
 		if (ts->tick_stopped && ktime_equal(expires, dev->next_event))
 			goto out;
@@ -400,15 +423,18 @@ static void tick_nohz_stop_sched_tick(struct tick_sched *ts)
 		 * the scheduler tick in nohz_restart_sched_tick.
 		 */
 		if (!ts->tick_stopped) {
-			select_nohz_load_balancer(1);
-			calc_load_enter_idle();
+			if (ts->inidle) {
+				select_nohz_load_balancer(1);
+				calc_load_enter_idle();
+				ts->idle_jiffies = last_jiffies;
+			}
 
 			ts->idle_tick = hrtimer_get_expires(&ts->sched_timer);
 			ts->tick_stopped = 1;
-			ts->idle_jiffies = last_jiffies;
 		}
 
-		ts->idle_sleeps++;
+		if (ts->inidle)
+			ts->idle_sleeps++;
 
 		/* Mark expires */
 		ts->idle_expires = expires;
@@ -445,6 +471,238 @@ out:
 	ts->sleep_length = ktime_sub(dev->next_event, now);
 }
 
+static void tick_nohz_restart(struct tick_sched *ts, ktime_t now)
+{
+	hrtimer_cancel(&ts->sched_timer);
+	hrtimer_set_expires(&ts->sched_timer, ts->idle_tick);
+
+	while (1) {
+		/* Forward the time to expire in the future */
+		hrtimer_forward(&ts->sched_timer, now, tick_period);
+
+		if (ts->nohz_mode == NOHZ_MODE_HIGHRES) {
+			hrtimer_start_expires(&ts->sched_timer,
+					      HRTIMER_MODE_ABS_PINNED);
+			/* Check, if the timer was already in the past */
+			if (hrtimer_active(&ts->sched_timer))
+				break;
+		} else {
+			if (!tick_program_event(
+				hrtimer_get_expires(&ts->sched_timer), 0))
+				break;
+		}
+		/* Reread time and update jiffies */
+		now = ktime_get();
+		tick_do_update_jiffies64(now);
+	}
+}
+
+/*
+ * Restart the tick after it was stopped, without the bookkeeping of
+ * leaving idle.  Interrupts must be disabled.
+ */
+static void tick_nohz_restart_sched_tick(struct tick_sched *ts, ktime_t now)
+{
+	tick_do_update_jiffies64(now);
+	ts->tick_stopped = 0;
+	ts->idle_exittime = now;
+
+	tick_nohz_restart(ts, now);
+}
+
+static void __tick_nohz_idle_enter(struct tick_sched *ts)
+{
+	int cpu = smp_processor_id();
+	ktime_t now;
+
+	now = tick_nohz_start_idle(cpu, ts);
+
+	/*
+	 * If this cpu is offline and it is the one which updates
+	 * jiffies, then give up the assignment and let it be taken by
+	 * the cpu which runs the tick timer next. If we don't drop
+	 * this here the jiffies might be stale and do_timer() never
+	 * invoked.
+	 */
+	if (unlikely(!cpu_online(cpu))) {
+		if (cpu == tick_do_timer_cpu)
+			tick_do_timer_cpu = TICK_DO_TIMER_NONE;
+	}
+
+	if (unlikely(ts->nohz_mode == NOHZ_MODE_INACTIVE))
+		return;
+
+	if (need_resched())
+		return;
+
+	if (unlikely(local_softirq_pending() && cpu_online(cpu))) {
+		static int ratelimit;
+
+		if (ratelimit < 10) {
+			printk(KERN_ERR "NOHZ: local_softirq_pending %02x\n",
+			       (unsigned int) local_softirq_pending());
+			ratelimit++;
+		}
+		return;
+	}
+
+	/*
+	 * The nohz_full= cpus never take the do_timer() duty, so its
+	 * owner has to keep ticking for them even when idle.
+	 */
+	if (tick_nohz_full_enabled() && cpu == tick_do_timer_cpu)
+		return;
+
+	ts->idle_calls++;
+	tick_nohz_stop_sched_tick(ts, now, cpu);
+}
+
+#ifdef CONFIG_NO_HZ_FULL
+static bool can_stop_full_tick(void)
+{
+	WARN_ON_ONCE(!irqs_disabled());
+
+	if (!sched_can_stop_tick())
+		return false;
+
+	if (!posix_cpu_timers_can_stop_tick(current))
+		return false;
+
+	if (!perf_event_can_stop_tick())
+		return false;
+
+#ifdef CONFIG_HAVE_UNSTABLE_SCHED_CLOCK
+	/* sched_clock_tick() is what keeps an unstable sched_clock sane */
+	if (!sched_clock_stable)
+		return false;
+#endif
+
+	return true;
+}
+
+static void tick_nohz_full_stop_tick(struct tick_sched *ts)
+{
+	int cpu = smp_processor_id();
+
+	if (!tick_nohz_full_cpu(cpu) || is_idle_task(current))
+		return;
+
+	if (ts->nohz_mode == NOHZ_MODE_INACTIVE || need_resched())
+		return;
+
+	if (!can_stop_full_tick())
+		return;
+
+	tick_nohz_stop_sched_tick(ts, ktime_get(), cpu);
+}
+
+/**
+ * tick_nohz_full_check - restart the tick of a busy cpu that needs it
+ *
+ * Called with interrupts disabled from the kicks below and from the
+ * scheduler when a second task or a posix cpu timer or perf event
+ * shows up that needs the tick.
+ */
+void tick_nohz_full_check(void)
+{
+	struct tick_sched *ts = &__get_cpu_var(tick_cpu_sched);
+
+	if (!tick_nohz_full_cpu(smp_processor_id()))
+		return;
+
+	if (ts->tick_stopped && !ts->inidle && !can_stop_full_tick())
+		tick_nohz_restart_sched_tick(ts, ktime_get());
+}
+
+static void nohz_full_kick_work_func(struct irq_work *work)
+{
+	tick_nohz_full_check();
+}
+
+static DEFINE_PER_CPU(struct irq_work, nohz_full_kick_work) = {
+	.func = nohz_full_kick_work_func,
+};
+
+/**
+ * tick_nohz_full_kick - re-check the tick of the current cpu
+ *
+ * For callers that can't restart the tick from where they are, e.g.
+ * with perf context locks held; the check runs from irq work.
+ */
+void tick_nohz_full_kick(void)
+{
+	if (__this_cpu_read(tick_cpu_sched.tick_stopped))
+		irq_work_queue(&__get_cpu_var(nohz_full_kick_work));
+}
+
+static void nohz_full_kick_ipi(void *info)
+{
+	tick_nohz_full_check();
+}
+
+/**
+ * tick_nohz_full_kick_all - re-check the tick of all nohz_full= cpus
+ *
+ * Sends IPIs, so it must be called with interrupts enabled.
+ */
+void tick_nohz_full_kick_all(void)
+{
+	if (!tick_nohz_full_running)
+		return;
+
+	preempt_disable();
+	smp_call_function_many(tick_nohz_full_mask,
+			       nohz_full_kick_ipi, NULL, false);
+	preempt_enable();
+}
+
+/**
+ * tick_nohz_task_switch - re-check the tick after a context switch
+ *
+ * The new task may need the tick that the previous one didn't.  The
+ * opposite case is left to the next interrupt exit.
+ */
+void tick_nohz_task_switch(void)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	tick_nohz_full_check();
+	local_irq_restore(flags);
+}
+
+static int __cpuinit tick_nohz_cpu_down_callback(struct notifier_block *nfb,
+						 unsigned long action,
+						 void *hcpu)
+{
+	unsigned int cpu = (unsigned long)hcpu;
+
+	switch (action & ~CPU_TASKS_FROZEN) {
+	case CPU_DOWN_PREPARE:
+		/* Nobody else may take the do_timer() duty over. */
+		if (tick_nohz_full_running && tick_do_timer_cpu == cpu)
+			return NOTIFY_BAD;
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static int __init tick_nohz_full_init(void)
+{
+	if (!tick_nohz_full_running)
+		return 0;
+
+	cpulist_scnprintf(nohz_full_buf, sizeof(nohz_full_buf),
+			  tick_nohz_full_mask);
+	printk(KERN_INFO "NO_HZ: Full dynticks CPUs: %s.\n", nohz_full_buf);
+	cpu_notifier(tick_nohz_cpu_down_callback, 0);
+	return 0;
+}
+early_initcall(tick_nohz_full_init);
+#else
+static inline void tick_nohz_full_stop_tick(struct tick_sched *ts) { }
+#endif /* CONFIG_NO_HZ_FULL */
+
 /**
  * tick_nohz_idle_enter - stop the idle tick from the idle task
  *
@@ -474,13 +732,19 @@ void tick_nohz_idle_enter(void)
 	local_irq_disable();
 
 	ts = &__get_cpu_var(tick_cpu_sched);
+	/*
+	 * A tick stopped for a busy nohz_full= task comes back first:
+	 * idle stops it with its own bookkeeping.
+	 */
+	if (ts->tick_stopped)
+		tick_nohz_restart_sched_tick(ts, ktime_get());
 	/*
 	 * set ts->inidle unconditionally. even if the system did not
 	 * switch to nohz mode the cpu frequency governers rely on the
 	 * update of the idle time accounting in tick_nohz_start_idle().
 	 */
 	ts->inidle = 1;
-	tick_nohz_stop_sched_tick(ts);
+	__tick_nohz_idle_enter(ts);
 
 	local_irq_enable();
 }
@@ -492,18 +756,21 @@ void tick_nohz_idle_enter(void)
  * a reschedule, it may still add, modify or delete a timer, enqueue
  * an RCU callback, etc...
  * So we need to re-calculate and reprogram the next tick event.
+ *
+ * On a nohz_full= cpu running a task this is also where the tick is
+ * stopped, once nothing needs it.
  */
 void tick_nohz_irq_exit(void)
 {
 	unsigned long flags;
 	struct tick_sched *ts = &__get_cpu_var(tick_cpu_sched);
 
-	if (!ts->inidle)
-		return;
-
 	local_irq_save(flags);
 
-	tick_nohz_stop_sched_tick(ts);
+	if (ts->inidle)
+		__tick_nohz_idle_enter(ts);
+	else
+		tick_nohz_full_stop_tick(ts);
 
 	local_irq_restore(flags);
 }
@@ -520,32 +787,6 @@ ktime_t tick_nohz_get_sleep_length(void)
 	return ts->sleep_length;
 }
 
-static void tick_nohz_restart(struct tick_sched *ts, ktime_t now)
-{
-	hrtimer_cancel(&ts->sched_timer);
-	hrtimer_set_expires(&ts->sched_timer, ts->idle_tick);
-
-	while (1) {
-		/* Forward the time to expire in the future */
-		hrtimer_forward(&ts->sched_timer, now, tick_period);
-
-		if (ts->nohz_mode == NOHZ_MODE_HIGHRES) {
-			hrtimer_start_expires(&ts->sched_timer,
-					      HRTIMER_MODE_ABS_PINNED);
-			/* Check, if the timer was already in the past */
-			if (hrtimer_active(&ts->sched_timer))
-				break;
-		} else {
-			if (!tick_program_event(
-				hrtimer_get_expires(&ts->sched_timer), 0))
-				break;
-		}
-		/* Reread time and update jiffies */
-		now = ktime_get();
-		tick_do_update_jiffies64(now);
-	}
-}
-
 /**
  * tick_nohz_idle_exit - restart the idle tick from the idle task
  *
@@ -593,8 +834,10 @@ void tick_nohz_idle_exit(void)
 	ticks = jiffies - ts->idle_jiffies;
 	/*
 	 * We might be one off. Do not randomly account a huge number of ticks!
+	 * Context tracking accounts the idle time of nohz_full= cpus when
+	 * they switch to a task.
 	 */
-	if (ticks && ticks < LONG_MAX)
+	if (ticks && ticks < LONG_MAX && !context_tracking_active())
 		account_idle_ticks(ticks);
 #endif
 
@@ -636,13 +879,21 @@ static void tick_nohz_handler(struct clock_event_device *dev)
 	 * this duty, then the jiffies update is still serialized by
 	 * xtime_lock.
 	 */
-	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE))
+	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE) &&
+		     !tick_nohz_full_cpu(cpu))
 		tick_do_timer_cpu = cpu;
 
 	/* Check, if the jiffies need an update */
 	if (tick_do_timer_cpu == cpu)
 		tick_do_update_jiffies64(now);
 
+	/*
+	 * The residual tick of a busy nohz_full= cpu runs as a normal
+	 * one, the interrupt exit decides whether to stop it again.
+	 */
+	if (ts->tick_stopped && !ts->inidle)
+		ts->tick_stopped = 0;
+
 	/*
 	 * When we are idle and the tick is stopped, we have to touch
 	 * the watchdog as we might not schedule for a really long
@@ -788,7 +1039,8 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 	 * this duty, then the jiffies update is still serialized by
 	 * xtime_lock.
 	 */
-	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE))
+	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE) &&
+		     !tick_nohz_full_cpu(cpu))
 		tick_do_timer_cpu = cpu;
 #endif
 
@@ -796,6 +1048,15 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 	if (tick_do_timer_cpu == cpu)
 		tick_do_update_jiffies64(now);
 
+#ifdef CONFIG_NO_HZ
+	/*
+	 * The residual tick of a busy nohz_full= cpu runs as a normal
+	 * one, the interrupt exit decides whether to stop it again.
+	 */
+	if (ts->tick_stopped && !ts->inidle)
+		ts->tick_stopped = 0;
+#endif
+
 	/*
 	 * Do not call, when we are not in irq context and have
 	 * no valid regs pointer
@@ -41,6 +41,8 @@
 #include <linux/debug_locks.h>
 #include <linux/lockdep.h>
 #include <linux/idr.h>
+#include <linux/nodemask.h>
+#include <linux/device.h>
 
 #include "workqueue_sched.h"
 
@@ -112,9 +114,12 @@ enum {
  * F: wq->flush_mutex protected.
  *
  * W: workqueue_lock protected.
+ *
+ * A: wq_attrs_mutex protected.
  */
 
 struct global_cwq;
+struct wq_device;
 
 /*
  * The poor guys doing the actual heavy lifting.  All on-duty workers
@@ -137,13 +142,15 @@ struct worker {
 	unsigned long		last_active;	/* L: last active timestamp */
 	unsigned int		flags;		/* X: flags */
 	int			id;		/* I: worker id */
+	unsigned int		attrs_id;	/* wq attrs applied to task */
 	struct work_struct	rebind_work;	/* L: rebind worker to cpu */
 };
 
 /*
  * Global per-cpu workqueue.  There's one and only one for each cpu
- * and all works are queued and processed here regardless of their
- * target workqueues.
+ * and one for each NUMA node serving unbound workqueues.  All works
+ * are queued and processed here regardless of their target
+ * workqueues.
  */
 struct global_cwq {
 	spinlock_t		lock;		/* the gcwq lock */
@@ -173,7 +180,9 @@ struct global_cwq {
 /*
  * The per-CPU workqueue.  The lower WORK_STRUCT_FLAG_BITS of
  * work_struct->data are used for flags and thus cwqs need to be
- * aligned at two's power of the number of flag bits.
+ * aligned at two's power of the number of flag bits.  Unbound
+ * workqueues keep an array of them, one per node, so the size is
+ * padded to the alignment as well.
  */
 struct cpu_workqueue_struct {
 	struct global_cwq	*gcwq;		/* I: the associated gcwq */
@@ -185,7 +194,7 @@ struct cpu_workqueue_struct {
 	int			nr_active;	/* L: nr of active works */
 	int			max_active;	/* L: max active works */
 	struct list_head	delayed_works;	/* L: delayed works */
-};
+} __aligned(1 << WORK_STRUCT_FLAG_BITS);
 
 /*
  * Structure used to wait for workqueue flush.
@@ -225,7 +234,7 @@ struct workqueue_struct {
 	unsigned int		flags;		/* W: WQ_* flags */
 	union {
 		struct cpu_workqueue_struct __percpu	*pcpu;
-		struct cpu_workqueue_struct		*single;
+		struct cpu_workqueue_struct		*node;
 		unsigned long				v;
 	} cpu_wq;				/* I: cwq's */
 	struct list_head	list;		/* W: list of all workqueues */
@@ -243,6 +252,12 @@ struct workqueue_struct {
 
 	int			nr_drainers;	/* W: drain in progress */
 	int			saved_max_active; /* W: saved cwq max_active */
+
+	struct workqueue_attrs	*unbound_attrs;	/* A: unbound wq attributes */
+	unsigned int		attrs_id;	/* A: bumped on attrs change */
+#ifdef CONFIG_SYSFS
+	struct wq_device	*wq_dev;	/* I: for sysfs interface */
+#endif
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map	lockdep_map;
 #endif
@@ -272,16 +287,21 @@ EXPORT_SYMBOL_GPL(system_nrt_freezable_wq);
 static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
 				  unsigned int sw)
 {
+	int node;
+
 	if (cpu < nr_cpu_ids) {
 		if (sw & 1) {
 			cpu = cpumask_next(cpu, mask);
 			if (cpu < nr_cpu_ids)
 				return cpu;
 		}
-		if (sw & 2)
-			return WORK_CPU_UNBOUND;
-	}
-	return WORK_CPU_NONE;
+		if (!(sw & 2))
+			return WORK_CPU_NONE;
+		node = first_node(node_possible_map);
+	} else
+		node = next_node(cpu - WORK_CPU_UNBOUND, node_possible_map);
+
+	return node < MAX_NUMNODES ? WORK_CPU_UNBOUND + node : WORK_CPU_NONE;
 }
 
 static inline int __next_wq_cpu(int cpu, const struct cpumask *mask,
@@ -293,15 +313,16 @@ static inline int __next_wq_cpu(int cpu, const struct cpumask *mask,
 /*
  * CPU iterators
  *
- * An extra gcwq is defined for an invalid cpu number
- * (WORK_CPU_UNBOUND) to host workqueues which are not bound to any
- * specific CPU.  The following iterators are similar to
- * for_each_*_cpu() iterators but also considers the unbound gcwq.
+ * Extra gcwqs are defined for invalid cpu numbers starting at
+ * WORK_CPU_UNBOUND, one for each possible NUMA node, to host
+ * workqueues which are not bound to any specific CPU.  The following
+ * iterators are similar to for_each_*_cpu() iterators but also
+ * consider the unbound gcwqs.
  *
- * for_each_gcwq_cpu()		: possible CPUs + WORK_CPU_UNBOUND
- * for_each_online_gcwq_cpu()	: online CPUs + WORK_CPU_UNBOUND
+ * for_each_gcwq_cpu()		: possible CPUs + unbound nodes
+ * for_each_online_gcwq_cpu()	: online CPUs + unbound nodes
  * for_each_cwq_cpu()		: possible CPUs for bound workqueues,
- *				  WORK_CPU_UNBOUND for unbound workqueues
+ *				  unbound nodes for unbound workqueues
  */
 #define for_each_gcwq_cpu(cpu)						\
 	for ((cpu) = __next_gcwq_cpu(-1, cpu_possible_mask, 3);		\
@@ -448,26 +469,37 @@ static DEFINE_PER_CPU(struct global_cwq, global_cwq);
 static DEFINE_PER_CPU_SHARED_ALIGNED(atomic_t, gcwq_nr_running);
 
 /*
- * Global cpu workqueue and nr_running counter for unbound gcwq.  The
- * gcwq is always online, has GCWQ_DISASSOCIATED set, and all its
- * workers have WORKER_UNBOUND set.
+ * Global cpu workqueues and nr_running counter for unbound gcwqs, one
+ * gcwq per possible node allocated on that node.  They are always
+ * online, have GCWQ_DISASSOCIATED set, and all their workers have
+ * WORKER_UNBOUND set.
  */
-static struct global_cwq unbound_global_cwq;
+static struct global_cwq **unbound_gcwqs;
 static atomic_t unbound_gcwq_nr_running = ATOMIC_INIT(0);	/* always 0 */
 
+/* serializes wq->unbound_attrs updates against workers applying them */
+static DEFINE_MUTEX(wq_attrs_mutex);
+static unsigned int wq_attrs_last_id;		/* A: last attrs_id issued */
+static cpumask_var_t wq_attrs_cpumask;		/* A: scratch for workers */
+
 static int worker_thread(void *__worker);
 
+static inline bool gcwq_is_unbound(struct global_cwq *gcwq)
+{
+	return gcwq->cpu >= WORK_CPU_UNBOUND;
+}
+
 static struct global_cwq *get_gcwq(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (cpu < WORK_CPU_UNBOUND)
 		return &per_cpu(global_cwq, cpu);
 	else
-		return &unbound_global_cwq;
+		return unbound_gcwqs[cpu - WORK_CPU_UNBOUND];
 }
 
 static atomic_t *get_gcwq_nr_running(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (cpu < WORK_CPU_UNBOUND)
 		return &per_cpu(gcwq_nr_running, cpu);
 	else
 		return &unbound_gcwq_nr_running;
@@ -479,11 +511,61 @@ static struct cpu_workqueue_struct *get_cwq(unsigned int cpu,
 	if (!(wq->flags & WQ_UNBOUND)) {
 		if (likely(cpu < nr_cpu_ids))
 			return per_cpu_ptr(wq->cpu_wq.pcpu, cpu);
-	} else if (likely(cpu == WORK_CPU_UNBOUND))
-		return wq->cpu_wq.single;
+	} else if (likely(cpu >= WORK_CPU_UNBOUND &&
+			  cpu < WORK_CPU_UNBOUND + nr_node_ids))
+		return &wq->cpu_wq.node[cpu - WORK_CPU_UNBOUND];
 	return NULL;
 }
 
+/*
+ * cpus the workers of an unbound gcwq run on by default: those of its
+ * node, or any if the node has none online.
+ */
+static const struct cpumask *unbound_gcwq_cpumask(struct global_cwq *gcwq)
+{
+	int node = gcwq->cpu - WORK_CPU_UNBOUND;
+	const struct cpumask *mask = cpumask_of_node(node);
+
+	return cpumask_intersects(mask, cpu_online_mask) ? mask :
+							   cpu_possible_mask;
+}
+
+/*
+ * Select the unbound gcwq for a work queued on @wq from @cpu.  Works
+ * go to the gcwq of @cpu's node unless @wq's cpumask excludes that
+ * node, in which case a node the cpumask covers is used.  Ordered
+ * workqueues always use the same gcwq to keep their works serialized.
+ */
+static unsigned int wq_unbound_cpu(struct workqueue_struct *wq,
+				   unsigned int cpu)
+{
+	const struct cpumask *mask;
+	unsigned int tcpu;
+	int node;
+
+	if (wq->flags & WQ_ORDERED)
+		return WORK_CPU_UNBOUND + first_node(node_possible_map);
+
+	if (cpu >= nr_cpu_ids)
+		cpu = raw_smp_processor_id();
+	node = cpu_to_node(cpu);
+
+	/*
+	 * Only workqueues which had their attributes changed can have a
+	 * restricted cpumask.  The cpumask may be updated under us, at
+	 * worst a work is queued on a node it just stopped covering.
+	 */
+	if (unlikely(ACCESS_ONCE(wq->attrs_id))) {
+		mask = wq->unbound_attrs->cpumask;
+		if (!cpumask_intersects(mask, cpumask_of_node(node))) {
+			tcpu = cpumask_any_and(mask, cpu_online_mask);
+			if (tcpu < nr_cpu_ids)
+				node = cpu_to_node(tcpu);
+		}
+	}
+	return WORK_CPU_UNBOUND + node;
+}
+
 static unsigned int work_color_to_flags(int color)
 {
 	return color << WORK_STRUCT_COLOR_SHIFT;
@@ -562,7 +644,8 @@ static struct global_cwq *get_work_gcwq(struct work_struct *work)
 	if (cpu == WORK_CPU_NONE)
 		return NULL;
 
-	BUG_ON(cpu >= nr_cpu_ids && cpu != WORK_CPU_UNBOUND);
+	BUG_ON(cpu >= nr_cpu_ids && (cpu < WORK_CPU_UNBOUND ||
+				     cpu >= WORK_CPU_UNBOUND + nr_node_ids));
 	return get_gcwq(cpu);
 }
 
@@ -999,7 +1082,7 @@ static bool is_chained_work(struct workqueue_struct *wq)
 static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 			 struct work_struct *work)
 {
-	struct global_cwq *gcwq;
+	struct global_cwq *gcwq, *last_gcwq;
 	struct cpu_workqueue_struct *cwq;
 	struct list_head *worklist;
 	unsigned int work_flags;
@@ -1014,39 +1097,36 @@ static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 
 	/* determine gcwq to use */
 	if (!(wq->flags & WQ_UNBOUND)) {
-		struct global_cwq *last_gcwq;
-
 		if (unlikely(cpu == WORK_CPU_UNBOUND))
 			cpu = raw_smp_processor_id();
-
-		/*
-		 * It's multi cpu.  If @wq is non-reentrant and @work
-		 * was previously on a different cpu, it might still
-		 * be running there, in which case the work needs to
-		 * be queued on that cpu to guarantee non-reentrance.
-		 */
 		gcwq = get_gcwq(cpu);
-		if (wq->flags & WQ_NON_REENTRANT &&
-		    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
-			struct worker *worker;
+	} else
+		gcwq = get_gcwq(wq_unbound_cpu(wq, cpu));
 
-			spin_lock_irqsave(&last_gcwq->lock, flags);
+	/*
+	 * It's multi cpu.  If @wq is non-reentrant and @work was
+	 * previously on a different cpu, it might still be running
+	 * there, in which case the work needs to be queued on that cpu
+	 * to guarantee non-reentrance.  Unbound workqueues have always
+	 * been non-reentrant and need the same check across nodes.
+	 */
+	if (wq->flags & (WQ_NON_REENTRANT | WQ_UNBOUND) &&
+	    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
+		struct worker *worker;
 
-			worker = find_worker_executing_work(last_gcwq, work);
+		spin_lock_irqsave(&last_gcwq->lock, flags);
 
-			if (worker && worker->current_cwq->wq == wq)
-				gcwq = last_gcwq;
-			else {
-				/* meh... not running there, queue here */
-				spin_unlock_irqrestore(&last_gcwq->lock, flags);
-				spin_lock_irqsave(&gcwq->lock, flags);
-			}
-		} else
+		worker = find_worker_executing_work(last_gcwq, work);
+
+		if (worker && worker->current_cwq->wq == wq)
+			gcwq = last_gcwq;
+		else {
+			/* meh... not running there, queue here */
+			spin_unlock_irqrestore(&last_gcwq->lock, flags);
 			spin_lock_irqsave(&gcwq->lock, flags);
-	} else {
-		gcwq = get_gcwq(WORK_CPU_UNBOUND);
+		}
+	} else
 		spin_lock_irqsave(&gcwq->lock, flags);
-	}
 
 	/* gcwq determined, get cwq and queue */
 	cwq = get_cwq(gcwq->cpu, wq);
@@ -1159,6 +1239,7 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 	struct work_struct *work = &dwork->work;
 
 	if (!test_and_set_bit(WORK_STRUCT_PENDING_BIT, work_data_bits(work))) {
+		struct global_cwq *gcwq;
 		unsigned int lcpu;
 
 		WARN_ON_ONCE(timer_pending(timer));
@@ -1171,15 +1252,18 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 		 * Note that the work's gcwq is preserved to allow
 		 * reentrance detection for delayed works.
 		 */
+		gcwq = get_work_gcwq(work);
 		if (!(wq->flags & WQ_UNBOUND)) {
-			struct global_cwq *gcwq = get_work_gcwq(work);
-
-			if (gcwq && gcwq->cpu != WORK_CPU_UNBOUND)
+			if (gcwq && !gcwq_is_unbound(gcwq))
 				lcpu = gcwq->cpu;
 			else
 				lcpu = raw_smp_processor_id();
-		} else
-			lcpu = WORK_CPU_UNBOUND;
+		} else {
+			if (gcwq && gcwq_is_unbound(gcwq))
+				lcpu = gcwq->cpu;
+			else
+				lcpu = wq_unbound_cpu(wq, WORK_CPU_UNBOUND);
+		}
 
 		set_work_cwq(work, get_cwq(lcpu, wq), 0);
 
@@ -1357,6 +1441,47 @@ static struct worker *alloc_worker(void)
 	return worker;
 }
 
+/**
+ * worker_apply_attrs - run @worker with the attributes of @wq
+ * @worker: self, an unbound worker
+ * @wq: unbound workqueue of the work about to be executed
+ *
+ * Unbound workers are shared by all unbound workqueues.  Before
+ * executing a work whose workqueue has different attributes than the
+ * ones the worker last ran with, take on its nice level and cpumask.
+ * The cpumask is narrowed to the worker's node when they overlap so
+ * that works stay close to where they were queued.  Workqueues which
+ * never had their attributes changed share attrs_id 0, the defaults
+ * new workers are created with.
+ *
+ * CONTEXT:
+ * Might sleep.
+ */
+static void worker_apply_attrs(struct worker *worker,
+			       struct workqueue_struct *wq)
+{
+	const struct cpumask *node_mask = unbound_gcwq_cpumask(worker->gcwq);
+	int nice = 0;
+
+	mutex_lock(&wq_attrs_mutex);
+
+	if (wq->attrs_id) {
+		nice = wq->unbound_attrs->nice;
+		cpumask_and(wq_attrs_cpumask, wq->unbound_attrs->cpumask,
+			    node_mask);
+		if (!cpumask_intersects(wq_attrs_cpumask, cpu_online_mask))
+			cpumask_copy(wq_attrs_cpumask,
+				     wq->unbound_attrs->cpumask);
+	} else
+		cpumask_copy(wq_attrs_cpumask, node_mask);
+
+	set_user_nice(current, nice);
+	set_cpus_allowed_ptr(current, wq_attrs_cpumask);
+	worker->attrs_id = wq->attrs_id;
+
+	mutex_unlock(&wq_attrs_mutex);
+}
+
 /**
  * create_worker - create a new workqueue worker
  * @gcwq: gcwq the new worker will belong to
@@ -1374,7 +1499,8 @@ static struct worker *alloc_worker(void)
  */
 static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 {
-	bool on_unbound_cpu = gcwq->cpu == WORK_CPU_UNBOUND;
+	bool on_unbound_cpu = gcwq_is_unbound(gcwq);
+	int node = gcwq->cpu - WORK_CPU_UNBOUND;
 	struct worker *worker = NULL;
 	int id = -1;
 
@@ -1400,22 +1526,27 @@ static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 						      cpu_to_node(gcwq->cpu),
 						      "kworker/%u:%d", gcwq->cpu, id);
 	else
-		worker->task = kthread_create(worker_thread, worker,
-					      "kworker/u:%d", id);
+		worker->task = kthread_create_on_node(worker_thread, worker,
+					node_online(node) ? node : NUMA_NO_NODE,
+					"kworker/u%d:%d", node, id);
 	if (IS_ERR(worker->task))
 		goto fail;
 
 	/*
 	 * A rogue worker will become a regular one if CPU comes
 	 * online later on.  Make sure every worker has
-	 * PF_THREAD_BOUND set.
+	 * PF_THREAD_BOUND set.  Unbound workers start out on the cpus
+	 * of their node with the default attributes, attrs_id 0.
 	 */
 	if (bind && !on_unbound_cpu)
 		kthread_bind(worker->task, gcwq->cpu);
 	else {
-		worker->task->flags |= PF_THREAD_BOUND;
-		if (on_unbound_cpu)
+		if (on_unbound_cpu) {
+			set_cpus_allowed_ptr(worker->task,
+					     unbound_gcwq_cpumask(gcwq));
 			worker->flags |= WORKER_UNBOUND;
+		}
+		worker->task->flags |= PF_THREAD_BOUND;
 	}
 
 	return worker;
@@ -1525,8 +1656,8 @@ static bool send_mayday(struct work_struct *work)
 
 	/* mayday mayday mayday */
 	cpu = cwq->gcwq->cpu;
-	/* WORK_CPU_UNBOUND can't be set in cpumask, use cpu 0 instead */
-	if (cpu == WORK_CPU_UNBOUND)
+	/* unbound gcwqs can't be set in cpumask, use cpu 0 for all nodes */
+	if (gcwq_is_unbound(cwq->gcwq))
 		cpu = 0;
 	if (!mayday_test_and_set_cpu(cpu, wq->mayday_mask))
 		wake_up_process(wq->rescuer->task);
@@ -1898,6 +2029,10 @@ __acquires(&gcwq->lock)
 
 	spin_unlock_irq(&gcwq->lock);
 
+	if (unlikely(worker->attrs_id != ACCESS_ONCE(cwq->wq->attrs_id)) &&
+	    worker->flags & WORKER_UNBOUND)
+		worker_apply_attrs(worker, cwq->wq);
+
 	smp_wmb();	/* paired with test_and_set_bit(PENDING) */
 	work_clear_pending(work);
 
@@ -2071,13 +2206,44 @@ sleep:
  *
  * This should happen rarely.
  */
+static void rescue_cwq(struct worker *rescuer,
+		       struct cpu_workqueue_struct *cwq)
+{
+	struct global_cwq *gcwq = cwq->gcwq;
+	struct work_struct *work, *n;
+
+	/* migrate to the target cpu if possible */
+	rescuer->gcwq = gcwq;
+	worker_maybe_bind_and_lock(rescuer);
+
+	/*
+	 * Slurp in all works issued via this workqueue and
+	 * process'em.
+	 */
+	BUG_ON(!list_empty(&rescuer->scheduled));
+	list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
+		if (get_work_cwq(work) == cwq)
+			move_linked_works(work, &rescuer->scheduled, &n);
+
+	process_scheduled_works(rescuer);
+
+	/*
+	 * Leave this gcwq.  If keep_working() is %true, notify a
+	 * regular worker; otherwise, we end up with 0 concurrency
+	 * and stalling the execution.
+	 */
+	if (keep_working(gcwq))
+		wake_up_worker(gcwq);
+
+	spin_unlock_irq(&gcwq->lock);
+}
+
 static int rescuer_thread(void *__wq)
 {
 	struct workqueue_struct *wq = __wq;
 	struct worker *rescuer = wq->rescuer;
-	struct list_head *scheduled = &rescuer->scheduled;
 	bool is_unbound = wq->flags & WQ_UNBOUND;
-	unsigned int cpu;
+	unsigned int cpu, tcpu;
 
 	set_user_nice(current, RESCUER_NICE_LEVEL);
 repeat:
@@ -2090,41 +2256,19 @@ repeat:
 
 	/*
 	 * See whether any cpu is asking for help.  Unbounded
-	 * workqueues use cpu 0 in mayday_mask for CPU_UNBOUND.
+	 * workqueues use cpu 0 in mayday_mask for all their nodes,
+	 * so go through the works of each of them.
 	 */
 	for_each_mayday_cpu(cpu, wq->mayday_mask) {
-		unsigned int tcpu = is_unbound ? WORK_CPU_UNBOUND : cpu;
-		struct cpu_workqueue_struct *cwq = get_cwq(tcpu, wq);
-		struct global_cwq *gcwq = cwq->gcwq;
-		struct work_struct *work, *n;
-
 		__set_current_state(TASK_RUNNING);
 		mayday_clear_cpu(cpu, wq->mayday_mask);
 
-		/* migrate to the target cpu if possible */
-		rescuer->gcwq = gcwq;
-		worker_maybe_bind_and_lock(rescuer);
-
-		/*
-		 * Slurp in all works issued via this workqueue and
-		 * process'em.
-		 */
-		BUG_ON(!list_empty(&rescuer->scheduled));
-		list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
-			if (get_work_cwq(work) == cwq)
-				move_linked_works(work, scheduled, &n);
-
-		process_scheduled_works(rescuer);
-
-		/*
-		 * Leave this gcwq.  If keep_working() is %true, notify a
-		 * regular worker; otherwise, we end up with 0 concurrency
-		 * and stalling the execution.
-		 */
-		if (keep_working(gcwq))
-			wake_up_worker(gcwq);
-
-		spin_unlock_irq(&gcwq->lock);
+		if (!is_unbound) {
+			rescue_cwq(rescuer, get_cwq(cpu, wq));
+			continue;
+		}
+		for_each_cwq_cpu(tcpu, wq)
+			rescue_cwq(rescuer, get_cwq(tcpu, wq));
 	}
 
 	schedule();
@@ -2965,14 +3109,16 @@ static int alloc_cwqs(struct workqueue_struct *wq)
 		void *ptr;
 
 		/*
-		 * Allocate enough room to align cwq and put an extra
-		 * pointer at the end pointing back to the originally
-		 * allocated pointer which will be used for free.
+		 * Allocate enough room to align the per-node cwqs and put
+		 * an extra pointer at the end pointing back to the
+		 * originally allocated pointer which will be used for
+		 * free.
 		 */
-		ptr = kzalloc(size + align + sizeof(void *), GFP_KERNEL);
+		ptr = kzalloc(nr_node_ids * size + align + sizeof(void *),
+			      GFP_KERNEL);
 		if (ptr) {
-			wq->cpu_wq.single = PTR_ALIGN(ptr, align);
-			*(void **)(wq->cpu_wq.single + 1) = ptr;
+			wq->cpu_wq.node = PTR_ALIGN(ptr, align);
+			*(void **)(wq->cpu_wq.node + nr_node_ids) = ptr;
 		}
 	}
 
@@ -2985,12 +3131,102 @@ static void free_cwqs(struct workqueue_struct *wq)
 {
 	if (!(wq->flags & WQ_UNBOUND))
 		free_percpu(wq->cpu_wq.pcpu);
-	else if (wq->cpu_wq.single) {
-		/* the pointer to free is stored right after the cwq */
-		kfree(*(void **)(wq->cpu_wq.single + 1));
+	else if (wq->cpu_wq.node) {
+		/* the pointer to free is stored right after the cwqs */
+		kfree(*(void **)(wq->cpu_wq.node + nr_node_ids));
 	}
 }
 
+/**
+ * alloc_workqueue_attrs - allocate a workqueue_attrs
+ * @gfp_mask: allocation mask to use
+ *
+ * Allocate a new workqueue_attrs, initialize with default settings and
+ * return it.  Returns NULL on failure.
+ */
+struct workqueue_attrs *alloc_workqueue_attrs(gfp_t gfp_mask)
+{
+	struct workqueue_attrs *attrs;
+
+	attrs = kzalloc(sizeof(*attrs), gfp_mask);
+	if (!attrs)
+		return NULL;
+	if (!alloc_cpumask_var(&attrs->cpumask, gfp_mask)) {
+		kfree(attrs);
+		return NULL;
+	}
+	cpumask_copy(attrs->cpumask, cpu_possible_mask);
+	return attrs;
+}
+EXPORT_SYMBOL_GPL(alloc_workqueue_attrs);
+
+/**
+ * free_workqueue_attrs - free a workqueue_attrs
+ * @attrs: workqueue_attrs to free
+ *
+ * Undo alloc_workqueue_attrs().
+ */
+void free_workqueue_attrs(struct workqueue_attrs *attrs)
+{
+	if (attrs) {
+		free_cpumask_var(attrs->cpumask);
+		kfree(attrs);
+	}
+}
+EXPORT_SYMBOL_GPL(free_workqueue_attrs);
+
+/**
+ * apply_workqueue_attrs - apply new workqueue_attrs to an unbound workqueue
+ * @wq: the target workqueue
+ * @attrs: the workqueue_attrs to apply
+ *
+ * Set the nice level and cpumask of the works of @wq.  Works which are
+ * already executing keep running with the old attributes, workers
+ * take on the new ones before the next work of @wq they execute.
+ *
+ * CONTEXT:
+ * Might sleep.
+ *
+ * RETURNS:
+ * 0 on success, -EINVAL if @wq isn't unbound or @attrs is invalid.
+ */
+int apply_workqueue_attrs(struct workqueue_struct *wq,
+			  const struct workqueue_attrs *attrs)
+{
+	if (WARN_ON(!(wq->flags & WQ_UNBOUND)))
+		return -EINVAL;
+
+	if (attrs->nice < -20 || attrs->nice > 19 ||
+	    !cpumask_intersects(attrs->cpumask, cpu_possible_mask))
+		return -EINVAL;
+
+	mutex_lock(&wq_attrs_mutex);
+
+	wq->unbound_attrs->nice = attrs->nice;
+	cpumask_and(wq->unbound_attrs->cpumask, attrs->cpumask,
+		    cpu_possible_mask);
+
+	/* 0 stands for the defaults, never hand it out */
+	if (!++wq_attrs_last_id)
+		++wq_attrs_last_id;
+	wq->attrs_id = wq_attrs_last_id;
+
+	mutex_unlock(&wq_attrs_mutex);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(apply_workqueue_attrs);
+
+#ifdef CONFIG_SYSFS
+static int workqueue_sysfs_register(struct workqueue_struct *wq);
+static void workqueue_sysfs_unregister(struct workqueue_struct *wq);
+#else
+static inline int workqueue_sysfs_register(struct workqueue_struct *wq)
+{
+	return 0;
+}
+static inline void workqueue_sysfs_unregister(struct workqueue_struct *wq) { }
+#endif
+
 static int wq_clamp_max_active(int max_active, unsigned int flags,
 			       const char *name)
 {
@@ -3042,6 +3278,13 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 	if (flags & WQ_UNBOUND)
 		flags |= WQ_HIGHPRI;
 
+	/*
+	 * Unbound workqueues with @max_active of one are relied upon for
+	 * strict ordering.  Keep them on a single node.
+	 */
+	if (flags & WQ_UNBOUND && max_active == 1)
+		flags |= WQ_ORDERED;
+
 	max_active = max_active ?: WQ_DFL_ACTIVE;
 	max_active = wq_clamp_max_active(max_active, flags, wq->name);
 
@@ -3059,6 +3302,12 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 	if (alloc_cwqs(wq) < 0)
 		goto err;
 
+	if (flags & WQ_UNBOUND) {
+		wq->unbound_attrs = alloc_workqueue_attrs(GFP_KERNEL);
+		if (!wq->unbound_attrs)
+			goto err;
+	}
+
 	for_each_cwq_cpu(cpu, wq) {
 		struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
 		struct global_cwq *gcwq = get_gcwq(cpu);
@@ -3105,10 +3354,16 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 
 	spin_unlock(&workqueue_lock);
 
+	if (wq->flags & WQ_SYSFS && workqueue_sysfs_register(wq)) {
+		destroy_workqueue(wq);
+		return NULL;
+	}
+
 	return wq;
 err:
 	if (wq) {
 		free_cwqs(wq);
+		free_workqueue_attrs(wq->unbound_attrs);
 		free_mayday_mask(wq->mayday_mask);
 		kfree(wq->rescuer);
 		kfree(wq);
@@ -3127,6 +3382,8 @@ void destroy_workqueue(struct workqueue_struct *wq)
 {
 	unsigned int cpu;
 
+	workqueue_sysfs_unregister(wq);
+
 	/* drain it before proceeding with destruction */
 	drain_workqueue(wq);
 
@@ -3156,6 +3413,7 @@ void destroy_workqueue(struct workqueue_struct *wq)
 	}
 
 	free_cwqs(wq);
+	free_workqueue_attrs(wq->unbound_attrs);
 	kfree(wq);
 }
 EXPORT_SYMBOL_GPL(destroy_workqueue);
@@ -3201,8 +3459,10 @@ EXPORT_SYMBOL_GPL(workqueue_set_max_active);
  * @cpu: CPU in question
  * @wq: target workqueue
  *
- * Test whether @wq's cpu workqueue for @cpu is congested.  There is
- * no synchronization around this function and the test result is
+ * Test whether @wq's cpu workqueue for @cpu is congested.  For an
+ * unbound @wq, the cpu workqueue of the node @cpu belongs to is tested,
+ * that of the local node if @cpu is WORK_CPU_UNBOUND.  There is no
+ * synchronization around this function and the test result is
  * unreliable and only useful as advisory hints or for debugging.
  *
  * RETURNS:
@@ -3210,7 +3470,11 @@ EXPORT_SYMBOL_GPL(workqueue_set_max_active);
  */
 bool workqueue_congested(unsigned int cpu, struct workqueue_struct *wq)
 {
-	struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	struct cpu_workqueue_struct *cwq;
+
+	if (wq->flags & WQ_UNBOUND)
+		cpu = wq_unbound_cpu(wq, cpu);
+	cwq = get_cwq(cpu, wq);
 
 	return !list_empty(&cwq->delayed_works);
 }
@@ -3221,13 +3485,16 @@ EXPORT_SYMBOL_GPL(workqueue_congested);
  * @work: the work of interest
  *
  * RETURNS:
- * CPU number if @work was ever queued.  WORK_CPU_NONE otherwise.
+ * CPU number if @work was ever queued, WORK_CPU_UNBOUND if that was on
+ * an unbound workqueue.  WORK_CPU_NONE otherwise.
  */
 unsigned int work_cpu(struct work_struct *work)
 {
 	struct global_cwq *gcwq = get_work_gcwq(work);
 
-	return gcwq ? gcwq->cpu : WORK_CPU_NONE;
+	if (!gcwq)
+		return WORK_CPU_NONE;
+	return gcwq_is_unbound(gcwq) ? WORK_CPU_UNBOUND : gcwq->cpu;
 }
 EXPORT_SYMBOL_GPL(work_cpu);
 
@@ -3266,6 +3533,272 @@ unsigned int work_busy(struct work_struct *work)
 }
 EXPORT_SYMBOL_GPL(work_busy);
 
+#ifdef CONFIG_SYSFS
+/*
+ * Workqueues with WQ_SYSFS set are visible to userland via
+ * /sys/bus/workqueue/devices/WQ_NAME.  All visible workqueues have the
+ * following attributes.
+ *
+ *  per_cpu	RO bool	: whether the workqueue is per-cpu or unbound
+ *  max_active	RW int	: maximum number of in-flight work items
+ *
+ * Unbound workqueues have the following extra attributes.
+ *
+ *  nice	RW int	: nice value of the workers
+ *  cpumask	RW mask	: bitmask of allowed CPUs for the workers
+ */
+struct wq_device {
+	struct workqueue_struct		*wq;
+	struct device			dev;
+};
+
+static bool wq_sysfs_ready;
+
+static struct workqueue_struct *dev_to_wq(struct device *dev)
+{
+	struct wq_device *wq_dev = container_of(dev, struct wq_device, dev);
+
+	return wq_dev->wq;
+}
+
+static ssize_t wq_per_cpu_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", !(wq->flags & WQ_UNBOUND));
+}
+
+static ssize_t wq_max_active_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", wq->saved_max_active);
+}
+
+static ssize_t wq_max_active_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int val;
+
+	/* ordering of ordered workqueues depends on max_active of one */
+	if (wq->flags & WQ_ORDERED)
+		return -EINVAL;
+
+	if (sscanf(buf, "%d", &val) != 1 || val <= 0)
+		return -EINVAL;
+
+	workqueue_set_max_active(wq, val);
+	return count;
+}
+
+static struct device_attribute wq_sysfs_attrs[] = {
+	__ATTR(per_cpu, 0444, wq_per_cpu_show, NULL),
+	__ATTR(max_active, 0644, wq_max_active_show, wq_max_active_store),
+	__ATTR_NULL,
+};
+
+static ssize_t wq_nice_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int written;
+
+	mutex_lock(&wq_attrs_mutex);
+	written = scnprintf(buf, PAGE_SIZE, "%d\n", wq->unbound_attrs->nice);
+	mutex_unlock(&wq_attrs_mutex);
+
+	return written;
+}
+
+/* prepare a copy of @wq's attrs for one of them to be modified */
+static struct workqueue_attrs *wq_sysfs_prep_attrs(struct workqueue_struct *wq)
+{
+	struct workqueue_attrs *attrs;
+
+	attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	if (!attrs)
+		return NULL;
+
+	mutex_lock(&wq_attrs_mutex);
+	attrs->nice = wq->unbound_attrs->nice;
+	cpumask_copy(attrs->cpumask, wq->unbound_attrs->cpumask);
+	mutex_unlock(&wq_attrs_mutex);
+	return attrs;
+}
+
+static ssize_t wq_nice_store(struct device *dev, struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	struct workqueue_attrs *attrs;
+	int ret;
+
+	attrs = wq_sysfs_prep_attrs(wq);
+	if (!attrs)
+		return -ENOMEM;
+
+	if (sscanf(buf, "%d", &attrs->nice) == 1)
+		ret = apply_workqueue_attrs(wq, attrs);
+	else
+		ret = -EINVAL;
+
+	free_workqueue_attrs(attrs);
+	return ret ?: count;
+}
+
+static ssize_t wq_cpumask_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int written;
+
+	mutex_lock(&wq_attrs_mutex);
+	written = cpumask_scnprintf(buf, PAGE_SIZE, wq->unbound_attrs->cpumask);
+	mutex_unlock(&wq_attrs_mutex);
+
+	written += scnprintf(buf + written, PAGE_SIZE - written, "\n");
+	return written;
+}
+
+static ssize_t wq_cpumask_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	struct workqueue_attrs *attrs;
+	int ret;
+
+	attrs = wq_sysfs_prep_attrs(wq);
+	if (!attrs)
+		return -ENOMEM;
+
+	ret = bitmap_parse(buf, count, cpumask_bits(attrs->cpumask),
+			   nr_cpumask_bits);
+	if (!ret)
+		ret = apply_workqueue_attrs(wq, attrs);
+
+	free_workqueue_attrs(attrs);
+	return ret ?: count;
+}
+
+static struct device_attribute wq_sysfs_unbound_attrs[] = {
+	__ATTR(nice, 0644, wq_nice_show, wq_nice_store),
+	__ATTR(cpumask, 0644, wq_cpumask_show, wq_cpumask_store),
+	__ATTR_NULL,
+};
+
+static struct bus_type wq_subsys = {
+	.name				= "workqueue",
+	.dev_attrs			= wq_sysfs_attrs,
+};
+
+static void wq_device_release(struct device *dev)
+{
+	struct wq_device *wq_dev = container_of(dev, struct wq_device, dev);
+
+	kfree(wq_dev);
+}
+
+/**
+ * workqueue_sysfs_register - make a workqueue visible in sysfs
+ * @wq: the workqueue to register
+ *
+ * Expose @wq in sysfs under /sys/bus/workqueue/devices.  Workqueues
+ * with WQ_SYSFS set are registered on allocation, or from
+ * wq_sysfs_init() if they were allocated before the driver core was
+ * up.
+ *
+ * RETURNS:
+ * 0 on success, -errno on failure.
+ */
+static int workqueue_sysfs_register(struct workqueue_struct *wq)
+{
+	struct wq_device *wq_dev;
+	int ret;
+
+	if (!wq_sysfs_ready)
+		return 0;
+
+	wq->wq_dev = wq_dev = kzalloc(sizeof(*wq_dev), GFP_KERNEL);
+	if (!wq_dev)
+		return -ENOMEM;
+
+	wq_dev->wq = wq;
+	wq_dev->dev.bus = &wq_subsys;
+	wq_dev->dev.release = wq_device_release;
+	dev_set_name(&wq_dev->dev, "%s", wq->name);
+
+	/*
+	 * unbound_attrs are created separately.  Suppress uevent until
+	 * everything is ready.
+	 */
+	dev_set_uevent_suppress(&wq_dev->dev, true);
+
+	ret = device_register(&wq_dev->dev);
+	if (ret) {
+		put_device(&wq_dev->dev);
+		wq->wq_dev = NULL;
+		return ret;
+	}
+
+	if (wq->flags & WQ_UNBOUND) {
+		struct device_attribute *attr;
+
+		for (attr = wq_sysfs_unbound_attrs; attr->attr.name; attr++) {
+			ret = device_create_file(&wq_dev->dev, attr);
+			if (ret) {
+				device_unregister(&wq_dev->dev);
+				wq->wq_dev = NULL;
+				return ret;
+			}
+		}
+	}
+
+	dev_set_uevent_suppress(&wq_dev->dev, false);
+	kobject_uevent(&wq_dev->dev.kobj, KOBJ_ADD);
+	return 0;
+}
+
+/**
+ * workqueue_sysfs_unregister - undo workqueue_sysfs_register()
+ * @wq: the workqueue to unregister
+ *
+ * If @wq is registered to sysfs by workqueue_sysfs_register(), unregister.
+ */
+static void workqueue_sysfs_unregister(struct workqueue_struct *wq)
+{
+	struct wq_device *wq_dev = wq->wq_dev;
+
+	if (!wq_dev)
+		return;
+
+	wq->wq_dev = NULL;
+	device_unregister(&wq_dev->dev);
+}
+
+/*
+ * The bus can only be registered once the driver core is up, which is
+ * after the system workqueues are allocated by init_workqueues().
+ * Catch up with the early WQ_SYSFS workqueues here.
+ */
+static int __init wq_sysfs_init(void)
+{
+	int ret;
+
+	ret = bus_register(&wq_subsys);
+	if (ret)
+		return ret;
+
+	wq_sysfs_ready = true;
+	return workqueue_sysfs_register(system_unbound_wq);
+}
+core_initcall(wq_sysfs_init);
+#endif	/* CONFIG_SYSFS */
+
 /*
  * CPU hotplug.
  *
@@ -3861,11 +4394,22 @@ out_unlock:
 static int __init init_workqueues(void)
 {
 	unsigned int cpu;
-	int i;
+	int i, node;
 
 	cpu_notifier(workqueue_cpu_up_callback, CPU_PRI_WORKQUEUE_UP);
 	cpu_notifier(workqueue_cpu_down_callback, CPU_PRI_WORKQUEUE_DOWN);
 
+	/* allocate the unbound gcwqs on their nodes */
+	unbound_gcwqs = kcalloc(nr_node_ids, sizeof(unbound_gcwqs[0]),
+				GFP_KERNEL);
+	BUG_ON(!unbound_gcwqs);
+	for_each_node(node) {
+		unbound_gcwqs[node] = kzalloc_node(sizeof(struct global_cwq),
+				GFP_KERNEL, node_online(node) ? node : NUMA_NO_NODE);
+		BUG_ON(!unbound_gcwqs[node]);
+	}
+	BUG_ON(!alloc_cpumask_var(&wq_attrs_cpumask, GFP_KERNEL));
+
 	/* initialize gcwqs */
 	for_each_gcwq_cpu(cpu) {
 		struct global_cwq *gcwq = get_gcwq(cpu);
@@ -3897,7 +4441,7 @@ static int __init init_workqueues(void)
 		struct global_cwq *gcwq = get_gcwq(cpu);
 		struct worker *worker;
 
-		if (cpu != WORK_CPU_UNBOUND)
+		if (!gcwq_is_unbound(gcwq))
 			gcwq->flags &= ~GCWQ_DISASSOCIATED;
 		worker = create_worker(gcwq, true);
 		BUG_ON(!worker);
@@ -3909,7 +4453,8 @@ static int __init init_workqueues(void)
 	system_wq = alloc_workqueue("events", 0, 0);
 	system_long_wq = alloc_workqueue("events_long", 0, 0);
 	system_nrt_wq = alloc_workqueue("events_nrt", WQ_NON_REENTRANT, 0);
-	system_unbound_wq = alloc_workqueue("events_unbound", WQ_UNBOUND,
+	system_unbound_wq = alloc_workqueue("events_unbound",
+					    WQ_UNBOUND | WQ_SYSFS,
 					    WQ_UNBOUND_MAX_ACTIVE);
 	system_freezable_wq = alloc_workqueue("events_freezable",
 					      WQ_FREEZABLE, 0);
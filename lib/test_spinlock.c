@@ -0,0 +1,163 @@
+/*
+ * spinlock contention benchmark
+ *
+ * Measures how lock throughput scales with contention: one spinlock is
+ * taken by 1, 2, 4, ... up to max_cpus cpus at once, for test_ms each
+ * time, and the total lock/unlock pairs per second at each cpu count go
+ * to the kernel log.  On a multi-socket machine the curve shows where
+ * the lock's cache line starts bouncing between sockets, which is where
+ * ticket and queued spinlocks differ most.
+ *
+ * hold_loops sets the length of the critical section (a shared counter
+ * update plus that many cpu_relax()), wait_loops the pause between
+ * acquisitions; a short wait keeps the lock saturated, a long one
+ * measures the uncontended handover.  The load fails with -EAGAIN once
+ * the numbers are printed:
+ *
+ *	insmod test_spinlock.ko max_cpus=32 hold_loops=20 test_ms=1000
+ */
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/cpu.h>
+#include <linux/workqueue.h>
+#include <linux/delay.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+
+static unsigned int max_cpus;
+module_param(max_cpus, uint, 0444);
+MODULE_PARM_DESC(max_cpus, "Most cpus contending at once (default: all)");
+
+static unsigned int hold_loops = 10;
+module_param(hold_loops, uint, 0444);
+MODULE_PARM_DESC(hold_loops, "cpu_relax() loops with the lock held");
+
+static unsigned int wait_loops = 10;
+module_param(wait_loops, uint, 0444);
+MODULE_PARM_DESC(wait_loops, "cpu_relax() loops between acquisitions");
+
+static unsigned int test_ms = 500;
+module_param(test_ms, uint, 0444);
+MODULE_PARM_DESC(test_ms, "Duration of each run in milliseconds");
+
+static DEFINE_SPINLOCK(test_lock);
+static unsigned long test_counter;
+
+/*
+ * The contenders are work items on a CPU_INTENSIVE workqueue, one queued
+ * on each cpu, so they neither hold up other work on their cpu nor need
+ * threads of their own.  They all start spinning on test_go and stop on
+ * test_stop, so every one of them contends for the whole run.
+ */
+static struct workqueue_struct *test_wq;
+static atomic_t test_n_ready;
+static int test_go;
+static int test_stop;
+
+struct test_contender {
+	struct work_struct work;
+	unsigned long ops;
+};
+
+static void test_contend(struct work_struct *work)
+{
+	struct test_contender *c = container_of(work, struct test_contender,
+						work);
+	unsigned long ops = 0;
+	unsigned int i;
+
+	atomic_inc(&test_n_ready);
+	while (!ACCESS_ONCE(test_go))
+		cond_resched();
+
+	while (!ACCESS_ONCE(test_stop)) {
+		spin_lock(&test_lock);
+		test_counter++;
+		for (i = 0; i < hold_loops; i++)
+			cpu_relax();
+		spin_unlock(&test_lock);
+
+		for (i = 0; i < wait_loops; i++)
+			cpu_relax();
+		if (!(++ops & 1023))
+			cond_resched();
+	}
+	c->ops = ops;
+}
+
+/* Contend from the first @n online cpus, return lock ops per second */
+static u64 test_run(struct test_contender *contenders, unsigned int n)
+{
+	unsigned int i, queued = 0;
+	u64 ops = 0, us;
+	ktime_t start;
+	int cpu;
+
+	test_go = 0;
+	test_stop = 0;
+	atomic_set(&test_n_ready, 0);
+
+	get_online_cpus();
+	cpu = cpumask_first(cpu_online_mask);
+	for (i = 0; i < n && cpu < nr_cpu_ids; i++) {
+		contenders[i].ops = 0;
+		INIT_WORK(&contenders[i].work, test_contend);
+		queue_work_on(cpu, test_wq, &contenders[i].work);
+		queued++;
+		cpu = cpumask_next(cpu, cpu_online_mask);
+	}
+
+	while (atomic_read(&test_n_ready) < queued)
+		msleep(1);
+
+	start = ktime_get();
+	ACCESS_ONCE(test_go) = 1;
+	msleep(test_ms);
+	ACCESS_ONCE(test_stop) = 1;
+
+	for (i = 0; i < queued; i++) {
+		flush_work(&contenders[i].work);
+		ops += contenders[i].ops;
+	}
+	us = ktime_us_delta(ktime_get(), start);
+	put_online_cpus();
+
+	return us ? div64_u64(ops * USEC_PER_SEC, us) : 0;
+}
+
+static int __init spinlock_test_init(void)
+{
+	struct test_contender *contenders;
+	unsigned int max, n;
+
+	max = max_cpus ? max_cpus : num_online_cpus();
+	max = min(max, num_online_cpus());
+	contenders = kcalloc(max, sizeof(*contenders), GFP_KERNEL);
+	if (!contenders)
+		return -ENOMEM;
+	test_wq = alloc_workqueue("test_spinlock", WQ_CPU_INTENSIVE, 0);
+	if (!test_wq) {
+		kfree(contenders);
+		return -ENOMEM;
+	}
+
+	pr_info("test_spinlock: hold_loops %u wait_loops %u, %u ms per run\n",
+		hold_loops, wait_loops, test_ms);
+	for (n = 1; ; n = min(n * 2, max)) {
+		pr_info("test_spinlock: %3u cpus: %llu ops/s\n", n,
+			(unsigned long long)test_run(contenders, n));
+		if (n == max)
+			break;
+	}
+
+	destroy_workqueue(test_wq);
+	kfree(contenders);
+	return -EAGAIN;
+}
+module_init(spinlock_test_init);
+
+MODULE_LICENSE("GPL");
@@ -0,0 +1,232 @@
+/*
+ * timer wheel stress benchmark
+ *
+ * Measures what a wheel full of rarely firing timers costs, the load that
+ * networking and block request timeouts put on it:
+ *
+ *  - mod_timer() throughput, with every cpu re-arming its own nr_timers
+ *    timers to random timeouts (mostly a few jiffies, one in four up to
+ *    max_timeout_ms) and cancelling one now and then;
+ *  - how late the timers that do fire run, in jiffies past expiry;
+ *  - the worst jitter of a probe timer re-armed every jiffy on each cpu.
+ *
+ * The results go to the kernel log and the load fails with -EAGAIN, so
+ * the module can be loaded again right away for the next measurement:
+ *
+ *	insmod test_timer.ko cpus=8 nr_timers=10000 test_ms=2000
+ */
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+
+static unsigned int cpus;
+module_param(cpus, uint, 0444);
+MODULE_PARM_DESC(cpus, "Number of cpus churning timers (default: all)");
+
+static unsigned int nr_timers = 1000;
+module_param(nr_timers, uint, 0444);
+MODULE_PARM_DESC(nr_timers, "Timers each cpu keeps re-arming");
+
+static unsigned int test_ms = 1000;
+module_param(test_ms, uint, 0444);
+MODULE_PARM_DESC(test_ms, "Duration of the run in milliseconds");
+
+static unsigned int max_timeout_ms = 10000;
+module_param(max_timeout_ms, uint, 0444);
+MODULE_PARM_DESC(max_timeout_ms, "Longest timeout used for the long timers");
+
+struct test_churn {
+	struct task_struct *task;
+	unsigned long ops;
+	u64 us;				/* how long this thread churned */
+	atomic_long_t fired;
+	atomic_long_t late;		/* sum of jiffies past expiry */
+	unsigned long max_late;
+	struct timer_list probe;
+	int probe_stop;
+	ktime_t probe_last;
+	s64 probe_max_ns;		/* worst deviation from one tick */
+};
+
+struct test_timer {
+	struct timer_list timer;
+	struct test_churn *t;
+};
+
+static void update_max(unsigned long *max, unsigned long val)
+{
+	unsigned long old = ACCESS_ONCE(*max);
+
+	while (val > old) {
+		unsigned long prev = cmpxchg(max, old, val);
+
+		if (prev == old)
+			break;
+		old = prev;
+	}
+}
+
+static void test_timer_fn(unsigned long data)
+{
+	struct test_timer *tt = (struct test_timer *)data;
+	struct test_churn *t = tt->t;
+	unsigned long late = jiffies - tt->timer.expires;
+
+	atomic_long_inc(&t->fired);
+	atomic_long_add(late, &t->late);
+	update_max(&t->max_late, late);
+}
+
+/* Runs on the thread's cpu only, so no atomics needed */
+static void test_probe_fn(unsigned long data)
+{
+	struct test_churn *t = (struct test_churn *)data;
+	ktime_t now = ktime_get();
+	s64 ns;
+
+	if (t->probe_last.tv64) {
+		ns = ktime_to_ns(ktime_sub(now, t->probe_last)) - TICK_NSEC;
+		if (ns < 0)
+			ns = -ns;
+		if (ns > t->probe_max_ns)
+			t->probe_max_ns = ns;
+	}
+	t->probe_last = now;
+
+	if (!ACCESS_ONCE(t->probe_stop))
+		mod_timer(&t->probe, jiffies + 1);
+}
+
+/* Mostly short timeouts, with one in four spread up to max_timeout_ms */
+static unsigned long test_timeout(void)
+{
+	u32 r = random32();
+
+	if (r & 3)
+		return 1 + (r >> 2) % 16;
+	return 1 + (r >> 2) % (msecs_to_jiffies(max_timeout_ms) + 1);
+}
+
+/*
+ * Churn until kthread_stop().  The threads are started and stopped one
+ * after another, so each one times itself.
+ */
+static int test_func(void *private)
+{
+	struct test_churn *t = private;
+	struct test_timer *timers;
+	unsigned long ops = 0;
+	unsigned int i;
+	ktime_t start;
+
+	timers = vzalloc(nr_timers * sizeof(*timers));
+	if (!timers)
+		return -ENOMEM;
+	for (i = 0; i < nr_timers; i++) {
+		timers[i].t = t;
+		setup_timer(&timers[i].timer, test_timer_fn,
+			    (unsigned long)&timers[i]);
+	}
+	setup_timer(&t->probe, test_probe_fn, (unsigned long)t);
+
+	start = ktime_get();
+	mod_timer(&t->probe, jiffies + 1);
+	while (!kthread_should_stop()) {
+		struct test_timer *tt = &timers[random32() % nr_timers];
+
+		if (!(ops & 15))
+			del_timer(&tt->timer);
+		else
+			mod_timer(&tt->timer, jiffies + test_timeout());
+		if (!(++ops & 1023))
+			cond_resched();
+	}
+	t->us = ktime_us_delta(ktime_get(), start);
+	t->ops = ops;
+
+	ACCESS_ONCE(t->probe_stop) = 1;
+	del_timer_sync(&t->probe);
+	for (i = 0; i < nr_timers; i++)
+		del_timer_sync(&timers[i].timer);
+	vfree(timers);
+	return 0;
+}
+
+static int __init timer_test_init(void)
+{
+	struct test_churn *churn;
+	unsigned int n, started = 0;
+	unsigned long fired = 0, late = 0, max_late = 0;
+	s64 probe_max_ns = 0;
+	u64 ops_per_sec = 0;
+	int cpu, i, ret;
+
+	if (!nr_timers)
+		return -EINVAL;
+
+	n = cpus ? cpus : num_online_cpus();
+	n = min(n, num_online_cpus());
+	churn = kcalloc(n, sizeof(*churn), GFP_KERNEL);
+	if (!churn)
+		return -ENOMEM;
+
+	cpu = cpumask_first(cpu_online_mask);
+	for (i = 0; i < n && cpu < nr_cpu_ids; i++) {
+		struct test_churn *t = &churn[i];
+
+		t->task = kthread_create(test_func, t, "timer_test/%d", cpu);
+		if (IS_ERR(t->task)) {
+			pr_err("test_timer: failed to start thread %d\n", i);
+			break;
+		}
+		/* it may exit early, keep it around for kthread_stop() */
+		get_task_struct(t->task);
+		kthread_bind(t->task, cpu);
+		wake_up_process(t->task);
+		started++;
+		cpu = cpumask_next(cpu, cpu_online_mask);
+	}
+
+	msleep(test_ms);
+
+	for (i = 0; i < started; i++) {
+		struct test_churn *t = &churn[i];
+
+		ret = kthread_stop(t->task);
+		put_task_struct(t->task);
+		if (ret) {
+			pr_err("test_timer: thread %d failed: %d\n", i, ret);
+			continue;
+		}
+		if (t->us)
+			ops_per_sec += div64_u64((u64)t->ops * USEC_PER_SEC,
+						 t->us);
+		fired += atomic_long_read(&t->fired);
+		late += atomic_long_read(&t->late);
+		max_late = max(max_late, t->max_late);
+		probe_max_ns = max(probe_max_ns, t->probe_max_ns);
+	}
+
+	pr_info("test_timer: %u cpus x %u timers, max timeout %u ms, %u ms\n",
+		started, nr_timers, max_timeout_ms, test_ms);
+	pr_info("test_timer: %llu mod_timer ops/s, %lu fired, lateness avg %lu max %lu jiffies\n",
+		(unsigned long long)ops_per_sec,
+		fired, fired ? late / fired : 0, max_late);
+	pr_info("test_timer: probe tick jitter max %lld us\n",
+		(long long)div_s64(probe_max_ns, NSEC_PER_USEC));
+
+	kfree(churn);
+	return -EAGAIN;
+}
+module_init(timer_test_init);
+
+MODULE_LICENSE("GPL");
@@ -0,0 +1,302 @@
+/*
+ * vmalloc stress test
+ *
+ * Runs a set of allocation patterns against the vmalloc/vmap allocator
+ * from one kernel thread per cpu at the same time, and prints how long
+ * each pattern took on each cpu.  The module refuses to stay loaded, so
+ * every insmod is one run:
+ *
+ *	insmod test_vmalloc.ko nr_threads=8 test_loop_count=100000
+ *
+ * run_test_mask selects the patterns, bit n for the n-th entry of
+ * test_case_array below (default: all).
+ */
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+
+static unsigned int nr_test_threads;
+module_param_named(nr_threads, nr_test_threads, uint, 0444);
+MODULE_PARM_DESC(nr_threads, "Number of worker threads (default: online cpus)");
+
+static unsigned int test_loop_count = 100000;
+module_param(test_loop_count, uint, 0444);
+MODULE_PARM_DESC(test_loop_count, "Iterations of each test case");
+
+static unsigned int run_test_mask = ~0U;
+module_param(run_test_mask, uint, 0444);
+MODULE_PARM_DESC(run_test_mask, "Bitmask of test cases to run");
+
+/* Number of areas kept allocated by the long busy list case */
+#define LONG_BUSY_LIST	15000
+
+static int fix_size_alloc_test(void)
+{
+	unsigned int i;
+	void *p;
+
+	for (i = 0; i < test_loop_count; i++) {
+		p = vmalloc(PAGE_SIZE);
+		if (!p)
+			return -ENOMEM;
+		*((u8 *)p) = 1;
+		vfree(p);
+	}
+	return 0;
+}
+
+static int random_size_alloc_test(void)
+{
+	unsigned int i, n;
+	void *p;
+
+	for (i = 0; i < test_loop_count; i++) {
+		n = random32() % 100 + 1;
+		p = vmalloc(n * PAGE_SIZE);
+		if (!p)
+			return -ENOMEM;
+		*((u8 *)p) = 1;
+		vfree(p);
+	}
+	return 0;
+}
+
+/* VM_IOREMAP areas are aligned to their (power of two) size */
+static int align_alloc_test(void)
+{
+	struct vm_struct *area;
+	unsigned int i;
+
+	for (i = 0; i < test_loop_count; i++) {
+		area = __get_vm_area(PAGE_SIZE << (i % 6), VM_IOREMAP,
+				     VMALLOC_START, VMALLOC_END);
+		if (!area)
+			return -ENOMEM;
+		free_vm_area(area);
+	}
+	return 0;
+}
+
+/*
+ * Allocate after every other one-page area has been freed, so the
+ * address space is full of holes too small for the requests.
+ */
+static int fragmented_alloc_test(void)
+{
+	unsigned int i, nr = 2048;
+	void **ptrs;
+	void *p;
+	int ret = 0;
+
+	ptrs = vzalloc(nr * sizeof(void *));
+	if (!ptrs)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++)
+		ptrs[i] = vmalloc(PAGE_SIZE);
+	for (i = 0; i < nr; i += 2) {
+		vfree(ptrs[i]);
+		ptrs[i] = NULL;
+	}
+
+	for (i = 0; i < test_loop_count; i++) {
+		p = vmalloc(2 * PAGE_SIZE);
+		if (!p) {
+			ret = -ENOMEM;
+			break;
+		}
+		vfree(p);
+	}
+
+	for (i = 0; i < nr; i++)
+		vfree(ptrs[i]);
+	vfree(ptrs);
+	return ret;
+}
+
+/* Allocate with many areas already busy below the free space. */
+static int long_busy_list_alloc_test(void)
+{
+	unsigned int i;
+	void **ptrs;
+	void *p;
+	int ret = 0;
+
+	ptrs = vzalloc(LONG_BUSY_LIST * sizeof(void *));
+	if (!ptrs)
+		return -ENOMEM;
+
+	for (i = 0; i < LONG_BUSY_LIST; i++)
+		ptrs[i] = vmalloc(PAGE_SIZE);
+
+	for (i = 0; i < test_loop_count; i++) {
+		p = vmalloc(PAGE_SIZE);
+		if (!p) {
+			ret = -ENOMEM;
+			break;
+		}
+		vfree(p);
+	}
+
+	for (i = 0; i < LONG_BUSY_LIST; i++)
+		vfree(ptrs[i]);
+	vfree(ptrs);
+	return ret;
+}
+
+/* Small vm_map_ram() mappings, served from the per-cpu vmap blocks */
+static int map_ram_test(void)
+{
+	struct page *pages[4];
+	unsigned int i;
+	void *p;
+	int ret = 0;
+
+	for (i = 0; i < ARRAY_SIZE(pages); i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < test_loop_count; i++) {
+		p = vm_map_ram(pages, ARRAY_SIZE(pages), -1, PAGE_KERNEL);
+		if (!p) {
+			ret = -ENOMEM;
+			break;
+		}
+		vm_unmap_ram(p, ARRAY_SIZE(pages));
+	}
+out:
+	for (i = 0; i < ARRAY_SIZE(pages); i++)
+		if (pages[i])
+			__free_page(pages[i]);
+	return ret;
+}
+
+struct test_case_desc {
+	const char *name;
+	int (*fn)(void);
+};
+
+static struct test_case_desc test_case_array[] = {
+	{ "fix_size_alloc_test", fix_size_alloc_test },
+	{ "random_size_alloc_test", random_size_alloc_test },
+	{ "align_alloc_test", align_alloc_test },
+	{ "fragmented_alloc_test", fragmented_alloc_test },
+	{ "long_busy_list_alloc_test", long_busy_list_alloc_test },
+	{ "map_ram_test", map_ram_test },
+};
+
+struct test_case_data {
+	int ret;
+	u64 time_us;
+};
+
+struct test_driver {
+	struct task_struct *task;
+	int cpu;
+	struct test_case_data data[ARRAY_SIZE(test_case_array)];
+};
+
+static atomic_t test_n_undone;
+static DECLARE_COMPLETION(test_all_done);
+
+static int test_func(void *private)
+{
+	struct test_driver *t = private;
+	ktime_t start;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(test_case_array); i++) {
+		if (!(run_test_mask & (1U << i)))
+			continue;
+
+		start = ktime_get();
+		t->data[i].ret = test_case_array[i].fn();
+		t->data[i].time_us = ktime_us_delta(ktime_get(), start);
+	}
+
+	if (atomic_dec_and_test(&test_n_undone))
+		complete(&test_all_done);
+
+	/* wait to be reaped */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static int __init vmalloc_test_init(void)
+{
+	struct test_driver *tdriver;
+	unsigned int n, started = 0;
+	int cpu, i;
+
+	n = nr_test_threads ? nr_test_threads : num_online_cpus();
+	tdriver = kcalloc(n, sizeof(*tdriver), GFP_KERNEL);
+	if (!tdriver)
+		return -ENOMEM;
+
+	atomic_set(&test_n_undone, 1);
+
+	cpu = cpumask_first(cpu_online_mask);
+	for (i = 0; i < n; i++) {
+		struct test_driver *t = &tdriver[i];
+
+		t->cpu = cpu;
+		t->task = kthread_create(test_func, t, "vmalloc_test/%d", i);
+		if (IS_ERR(t->task)) {
+			pr_err("test_vmalloc: failed to start thread %d\n", i);
+			t->task = NULL;
+			break;
+		}
+		kthread_bind(t->task, cpu);
+		atomic_inc(&test_n_undone);
+		wake_up_process(t->task);
+		started++;
+
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+	}
+
+	if (!atomic_dec_and_test(&test_n_undone))
+		wait_for_completion(&test_all_done);
+
+	for (i = 0; i < started; i++) {
+		struct test_driver *t = &tdriver[i];
+		int j;
+
+		kthread_stop(t->task);
+		for (j = 0; j < ARRAY_SIZE(test_case_array); j++) {
+			if (!(run_test_mask & (1U << j)))
+				continue;
+			pr_info("test_vmalloc: cpu %d %-28s loops %u: %s, %llu us\n",
+				t->cpu, test_case_array[j].name,
+				test_loop_count,
+				t->data[j].ret ? "failed" : "passed",
+				(unsigned long long)t->data[j].time_us);
+		}
+	}
+
+	kfree(tdriver);
+
+	/* Nothing to keep around: fail the load so the next insmod reruns. */
+	return -EAGAIN;
+}
+module_init(vmalloc_test_init);
+
+MODULE_LICENSE("GPL");
@@ -40,12 +40,14 @@ unsigned long transparent_hugepage_flags __read_mostly =
 
 /* default scan 8*512 pte (or vmas) every 30 second */
 static unsigned int khugepaged_pages_to_scan __read_mostly = HPAGE_PMD_NR*8;
-static unsigned int khugepaged_pages_collapsed;
-static unsigned int khugepaged_full_scans;
 static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
 /* during fragmentation poll the hugepage allocator once every minute */
 static unsigned int khugepaged_alloc_sleep_millisecs __read_mostly = 60000;
-static struct task_struct *khugepaged_thread __read_mostly;
+/*
+ * CPU time each khugepaged thread may use, in percent of one cpu. The
+ * sleep after a scan pass is stretched until the pass fits the budget.
+ */
+static unsigned int khugepaged_max_cpu_percent __read_mostly = 10;
 static DEFINE_MUTEX(khugepaged_mutex);
 static DEFINE_SPINLOCK(khugepaged_mm_lock);
 static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
@@ -56,9 +58,10 @@ static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
  */
 static unsigned int khugepaged_max_ptes_none __read_mostly = HPAGE_PMD_NR-1;
 
-static int khugepaged(void *none);
+static int khugepaged(void *data);
 static int mm_slots_hash_init(void);
 static int khugepaged_slab_init(void);
+static int khugepaged_scan_init(void);
 static void khugepaged_slab_free(void);
 
 #define MM_SLOTS_HASH_HEADS 1024
@@ -68,31 +71,54 @@ static struct kmem_cache *mm_slot_cache __read_mostly;
 /**
  * struct mm_slot - hash lookup from mm to mm_slot
  * @hash: hash collision list
- * @mm_node: khugepaged scan list headed in khugepaged_scan.mm_head
+ * @mm_node: khugepaged scan list headed in khugepaged_scan[nid]->mm_head
  * @mm: the mm that this information is valid for
+ * @nid: the node whose khugepaged scans this mm
  */
 struct mm_slot {
 	struct hlist_node hash;
 	struct list_head mm_node;
 	struct mm_struct *mm;
+	int nid;
 };
 
 /**
- * struct khugepaged_scan - cursor for scanning
+ * struct khugepaged_scan - per-node cursor for scanning
  * @mm_head: the head of the mm list to scan
  * @mm_slot: the current mm_slot we are scanning
  * @address: the next address inside that to be scanned
+ * @nid: the node this cursor and its thread belong to
+ * @thread: the khugepaged thread of this node, if running
+ * @pages_scanned: pages (or vmas) scanned so far
+ * @pages_collapsed: hugepages collapsed so far
+ * @full_scans: passes over the whole mm list
+ * @cpu_time: cpu time spent scanning and collapsing, in nanoseconds
+ * @start: jiffies when the thread was first started
+ * @node_load: per-node count of the pages in the pmd being scanned
+ * @mm_load: per-node count of the pages seen in the current mm so far
  *
- * There is only the one khugepaged_scan instance of this cursor structure.
+ * Every node with memory has its own khugepaged thread and its own list
+ * of mms. An mm starts on the list of the node it first faulted on and
+ * moves to the node holding most of its pages after each full pass.
+ * All the lists and cursors are protected by khugepaged_mm_lock.
  */
 struct khugepaged_scan {
 	struct list_head mm_head;
 	struct mm_slot *mm_slot;
 	unsigned long address;
+	int nid;
+	struct task_struct *thread;
+
+	unsigned long pages_scanned;
+	unsigned long pages_collapsed;
+	unsigned long full_scans;
+	u64 cpu_time;
+	unsigned long start;
+
+	unsigned int *node_load;
+	unsigned int *mm_load;
 };
-static struct khugepaged_scan khugepaged_scan = {
-	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
-};
+static struct khugepaged_scan *khugepaged_scan[MAX_NUMNODES] __read_mostly;
 
 
 static int set_recommended_min_free_kbytes(void)
@@ -135,26 +161,55 @@ static int set_recommended_min_free_kbytes(void)
 }
 late_initcall(set_recommended_min_free_kbytes);
 
+static struct task_struct *khugepaged_create_thread(struct khugepaged_scan *scan)
+{
+	struct task_struct *thread;
+	const struct cpumask *mask = cpumask_of_node(scan->nid);
+
+	if (nr_node_ids > 1)
+		thread = kthread_create_on_node(khugepaged, scan, scan->nid,
+						"khugepaged/%d", scan->nid);
+	else
+		thread = kthread_create(khugepaged, scan, "khugepaged");
+	if (IS_ERR(thread))
+		return thread;
+
+	if (!cpumask_empty(mask))
+		set_cpus_allowed_ptr(thread, mask);
+	if (!scan->start)
+		scan->start = jiffies;
+	wake_up_process(thread);
+	return thread;
+}
+
 static int start_khugepaged(void)
 {
 	int err = 0;
 	if (khugepaged_enabled()) {
-		int wakeup;
+		int nid, wakeup = 0;
 		if (unlikely(!mm_slot_cache || !mm_slots_hash)) {
 			err = -ENOMEM;
 			goto out;
 		}
 		mutex_lock(&khugepaged_mutex);
-		if (!khugepaged_thread)
-			khugepaged_thread = kthread_run(khugepaged, NULL,
-							"khugepaged");
-		if (unlikely(IS_ERR(khugepaged_thread))) {
-			printk(KERN_ERR
-			       "khugepaged: kthread_run(khugepaged) failed\n");
-			err = PTR_ERR(khugepaged_thread);
-			khugepaged_thread = NULL;
+		for_each_node_state(nid, N_HIGH_MEMORY) {
+			struct khugepaged_scan *scan = khugepaged_scan[nid];
+			struct task_struct *thread;
+
+			if (scan->thread)
+				continue;
+			thread = khugepaged_create_thread(scan);
+			if (unlikely(IS_ERR(thread))) {
+				printk(KERN_ERR
+				       "khugepaged: kthread_run(khugepaged) "
+				       "failed for node %d\n", nid);
+				err = PTR_ERR(thread);
+				continue;
+			}
+			scan->thread = thread;
+			if (!list_empty(&scan->mm_head))
+				wakeup = 1;
 		}
-		wakeup = !list_empty(&khugepaged_scan.mm_head);
 		mutex_unlock(&khugepaged_mutex);
 		if (wakeup)
 			wake_up_interruptible(&khugepaged_wait);
@@ -408,7 +463,12 @@ static ssize_t pages_collapsed_show(struct kobject *kobj,
 				    struct kobj_attribute *attr,
 				    char *buf)
 {
-	return sprintf(buf, "%u\n", khugepaged_pages_collapsed);
+	unsigned long sum = 0;
+	int nid;
+
+	for_each_node(nid)
+		sum += khugepaged_scan[nid]->pages_collapsed;
+	return sprintf(buf, "%lu\n", sum);
 }
 static struct kobj_attribute pages_collapsed_attr =
 	__ATTR_RO(pages_collapsed);
@@ -417,11 +477,73 @@ static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr,
 			       char *buf)
 {
-	return sprintf(buf, "%u\n", khugepaged_full_scans);
+	unsigned long sum = 0;
+	int nid;
+
+	for_each_node(nid)
+		sum += khugepaged_scan[nid]->full_scans;
+	return sprintf(buf, "%lu\n", sum);
 }
 static struct kobj_attribute full_scans_attr =
 	__ATTR_RO(full_scans);
 
+/*
+ * One line per node with memory. collapsed_per_sec is the collapse
+ * throughput since that node's khugepaged was first started.
+ */
+static ssize_t node_stats_show(struct kobject *kobj,
+			       struct kobj_attribute *attr,
+			       char *buf)
+{
+	ssize_t len = 0;
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY) {
+		struct khugepaged_scan *scan = khugepaged_scan[nid];
+		unsigned long secs = 0;
+
+		if (scan->start)
+			secs = (jiffies - scan->start) / HZ;
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "node %d pages_scanned %lu pages_collapsed %lu "
+				 "full_scans %lu cpu_ms %llu "
+				 "collapsed_per_sec %lu\n",
+				 nid, scan->pages_scanned,
+				 scan->pages_collapsed, scan->full_scans,
+				 div_u64(scan->cpu_time, NSEC_PER_MSEC),
+				 secs ? scan->pages_collapsed / secs : 0);
+	}
+	return len;
+}
+static struct kobj_attribute node_stats_attr =
+	__ATTR_RO(node_stats);
+
+static ssize_t max_cpu_percent_show(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_max_cpu_percent);
+}
+static ssize_t max_cpu_percent_store(struct kobject *kobj,
+				     struct kobj_attribute *attr,
+				     const char *buf, size_t count)
+{
+	int err;
+	unsigned long percent;
+
+	err = strict_strtoul(buf, 10, &percent);
+	if (err || !percent || percent > 100)
+		return -EINVAL;
+
+	khugepaged_max_cpu_percent = percent;
+	wake_up_interruptible(&khugepaged_wait);
+
+	return count;
+}
+static struct kobj_attribute max_cpu_percent_attr =
+	__ATTR(max_cpu_percent, 0644, max_cpu_percent_show,
+	       max_cpu_percent_store);
+
 static ssize_t khugepaged_defrag_show(struct kobject *kobj,
 				      struct kobj_attribute *attr, char *buf)
 {
@@ -478,6 +600,8 @@ static struct attribute *khugepaged_attr[] = {
 	&pages_to_scan_attr.attr,
 	&pages_collapsed_attr.attr,
 	&full_scans_attr.attr,
+	&node_stats_attr.attr,
+	&max_cpu_percent_attr.attr,
 	&scan_sleep_millisecs_attr.attr,
 	&alloc_sleep_millisecs_attr.attr,
 	NULL,
@@ -560,6 +684,14 @@ static int __init hugepage_init(void)
 		goto out;
 	}
 
+	err = khugepaged_scan_init();
+	if (err) {
+		kfree(mm_slots_hash);
+		mm_slots_hash = NULL;
+		khugepaged_slab_free();
+		goto out;
+	}
+
 	/*
 	 * By default disable transparent hugepages on smaller systems,
 	 * where the extra memory used could hurt more than TLB overhead
@@ -1565,6 +1697,49 @@ static int __init mm_slots_hash_init(void)
 	return 0;
 }
 
+static int __init khugepaged_scan_init(void)
+{
+	struct khugepaged_scan *scan;
+	int nid;
+
+	for_each_node(nid) {
+		/* possible but offline nodes have no NODE_DATA yet */
+		scan = kzalloc_node(sizeof(*scan) +
+				    2 * nr_node_ids * sizeof(unsigned int),
+				    GFP_KERNEL,
+				    node_online(nid) ? nid : NUMA_NO_NODE);
+		if (!scan)
+			goto fail;
+		INIT_LIST_HEAD(&scan->mm_head);
+		scan->nid = nid;
+		scan->node_load = (unsigned int *)(scan + 1);
+		scan->mm_load = scan->node_load + nr_node_ids;
+		khugepaged_scan[nid] = scan;
+	}
+	return 0;
+
+fail:
+	for_each_node(nid) {
+		kfree(khugepaged_scan[nid]);
+		khugepaged_scan[nid] = NULL;
+	}
+	return -ENOMEM;
+}
+
+/*
+ * The node whose khugepaged picks up a newly registered mm: the node
+ * of the cpu it is faulting on, or the first node with memory if that
+ * one has none.
+ */
+static int khugepaged_home_node(void)
+{
+	int nid = numa_node_id();
+
+	if (!node_state(nid, N_HIGH_MEMORY))
+		nid = first_node(node_states[N_HIGH_MEMORY]);
+	return nid;
+}
+
 #if 0
 static void __init mm_slots_hash_free(void)
 {
@@ -1606,6 +1781,7 @@ static inline int khugepaged_test_exit(struct mm_struct *mm)
 
 int __khugepaged_enter(struct mm_struct *mm)
 {
+	struct khugepaged_scan *scan;
 	struct mm_slot *mm_slot;
 	int wakeup;
 
@@ -1622,12 +1798,14 @@ int __khugepaged_enter(struct mm_struct *mm)
 
 	spin_lock(&khugepaged_mm_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
+	mm_slot->nid = khugepaged_home_node();
+	scan = khugepaged_scan[mm_slot->nid];
 	/*
 	 * Insert just behind the scanning cursor, to let the area settle
 	 * down a little.
 	 */
-	wakeup = list_empty(&khugepaged_scan.mm_head);
-	list_add_tail(&mm_slot->mm_node, &khugepaged_scan.mm_head);
+	wakeup = list_empty(&scan->mm_head);
+	list_add_tail(&mm_slot->mm_node, &scan->mm_head);
 	spin_unlock(&khugepaged_mm_lock);
 
 	atomic_inc(&mm->mm_count);
@@ -1668,7 +1846,7 @@ void __khugepaged_exit(struct mm_struct *mm)
 
 	spin_lock(&khugepaged_mm_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && khugepaged_scan.mm_slot != mm_slot) {
+	if (mm_slot && khugepaged_scan[mm_slot->nid]->mm_slot != mm_slot) {
 		hlist_del(&mm_slot->hash);
 		list_del(&mm_slot->mm_node);
 		free = 1;
@@ -1828,7 +2006,8 @@ static void __collapse_huge_page_copy(pte_t *pte, struct page *page,
 	}
 }
 
-static void collapse_huge_page(struct mm_struct *mm,
+static void collapse_huge_page(struct khugepaged_scan *scan,
+			       struct mm_struct *mm,
 			       unsigned long address,
 			       struct page **hpage,
 			       struct vm_area_struct *vma,
@@ -1997,7 +2176,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 #ifndef CONFIG_NUMA
 	*hpage = NULL;
 #endif
-	khugepaged_pages_collapsed++;
+	scan->pages_collapsed++;
 out_up_write:
 	up_write(&mm->mmap_sem);
 	return;
@@ -2010,7 +2189,22 @@ out:
 	goto out_up_write;
 }
 
-static int khugepaged_scan_pmd(struct mm_struct *mm,
+/*
+ * Collapse onto the node that holds most of the small pages, the
+ * scanning node winning ties.
+ */
+static int khugepaged_find_target_node(struct khugepaged_scan *scan)
+{
+	int nid, target = scan->nid;
+
+	for (nid = 0; nid < nr_node_ids; nid++)
+		if (scan->node_load[nid] > scan->node_load[target])
+			target = nid;
+	return target;
+}
+
+static int khugepaged_scan_pmd(struct khugepaged_scan *scan,
+			       struct mm_struct *mm,
 			       struct vm_area_struct *vma,
 			       unsigned long address,
 			       struct page **hpage)
@@ -2023,7 +2217,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	struct page *page;
 	unsigned long _address;
 	spinlock_t *ptl;
-	int node = -1;
+	int node;
 
 	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
 
@@ -2039,6 +2233,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
 		goto out;
 
+	memset(scan->node_load, 0, nr_node_ids * sizeof(unsigned int));
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
 	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, _address += PAGE_SIZE) {
@@ -2054,13 +2249,9 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		page = vm_normal_page(vma, _address, pteval);
 		if (unlikely(!page))
 			goto out_unmap;
-		/*
-		 * Chose the node of the first page. This could
-		 * be more sophisticated and look at more pages,
-		 * but isn't for now.
-		 */
-		if (node == -1)
-			node = page_to_nid(page);
+		node = page_to_nid(page);
+		scan->node_load[node]++;
+		scan->mm_load[node]++;
 		VM_BUG_ON(PageCompound(page));
 		if (!PageLRU(page) || PageLocked(page) || !PageAnon(page))
 			goto out_unmap;
@@ -2075,9 +2266,11 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		ret = 1;
 out_unmap:
 	pte_unmap_unlock(pte, ptl);
-	if (ret)
+	if (ret) {
+		node = khugepaged_find_target_node(scan);
 		/* collapse_huge_page will return with the mmap_sem released */
-		collapse_huge_page(mm, address, hpage, vma, node);
+		collapse_huge_page(scan, mm, address, hpage, vma, node);
+	}
 out:
 	return ret;
 }
@@ -2105,7 +2298,29 @@ static void collect_mm_slot(struct mm_slot *mm_slot)
 	}
 }
 
-static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
+/*
+ * After a full pass over an mm, hand it to the node holding most of
+ * the pages seen in it, so that its collapses run next to its memory.
+ */
+static void khugepaged_migrate_mm_slot(struct khugepaged_scan *scan,
+				       struct mm_slot *mm_slot)
+{
+	int nid, target = scan->nid;
+
+	VM_BUG_ON(NR_CPUS != 1 && !spin_is_locked(&khugepaged_mm_lock));
+
+	for (nid = 0; nid < nr_node_ids; nid++)
+		if (scan->mm_load[nid] > scan->mm_load[target])
+			target = nid;
+	if (target == scan->nid || !node_state(target, N_HIGH_MEMORY))
+		return;
+
+	list_move_tail(&mm_slot->mm_node, &khugepaged_scan[target]->mm_head);
+	mm_slot->nid = target;
+}
+
+static unsigned int khugepaged_scan_mm_slot(struct khugepaged_scan *scan,
+					    unsigned int pages,
 					    struct page **hpage)
 	__releases(&khugepaged_mm_lock)
 	__acquires(&khugepaged_mm_lock)
@@ -2118,13 +2333,14 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	VM_BUG_ON(!pages);
 	VM_BUG_ON(NR_CPUS != 1 && !spin_is_locked(&khugepaged_mm_lock));
 
-	if (khugepaged_scan.mm_slot)
-		mm_slot = khugepaged_scan.mm_slot;
+	if (scan->mm_slot)
+		mm_slot = scan->mm_slot;
 	else {
-		mm_slot = list_entry(khugepaged_scan.mm_head.next,
+		mm_slot = list_entry(scan->mm_head.next,
 				     struct mm_slot, mm_node);
-		khugepaged_scan.address = 0;
-		khugepaged_scan.mm_slot = mm_slot;
+		scan->address = 0;
+		scan->mm_slot = mm_slot;
+		memset(scan->mm_load, 0, nr_node_ids * sizeof(unsigned int));
 	}
 	spin_unlock(&khugepaged_mm_lock);
 
@@ -2133,7 +2349,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	if (unlikely(khugepaged_test_exit(mm)))
 		vma = NULL;
 	else
-		vma = find_vma(mm, khugepaged_scan.address);
+		vma = find_vma(mm, scan->address);
 
 	progress++;
 	for (; vma; vma = vma->vm_next) {
@@ -2167,26 +2383,26 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 		hend = vma->vm_end & HPAGE_PMD_MASK;
 		if (hstart >= hend)
 			goto skip;
-		if (khugepaged_scan.address > hend)
+		if (scan->address > hend)
 			goto skip;
-		if (khugepaged_scan.address < hstart)
-			khugepaged_scan.address = hstart;
-		VM_BUG_ON(khugepaged_scan.address & ~HPAGE_PMD_MASK);
+		if (scan->address < hstart)
+			scan->address = hstart;
+		VM_BUG_ON(scan->address & ~HPAGE_PMD_MASK);
 
-		while (khugepaged_scan.address < hend) {
+		while (scan->address < hend) {
 			int ret;
 			cond_resched();
 			if (unlikely(khugepaged_test_exit(mm)))
 				goto breakouterloop;
 
-			VM_BUG_ON(khugepaged_scan.address < hstart ||
-				  khugepaged_scan.address + HPAGE_PMD_SIZE >
+			VM_BUG_ON(scan->address < hstart ||
+				  scan->address + HPAGE_PMD_SIZE >
 				  hend);
-			ret = khugepaged_scan_pmd(mm, vma,
-						  khugepaged_scan.address,
+			ret = khugepaged_scan_pmd(scan, mm, vma,
+						  scan->address,
 						  hpage);
 			/* move to next address */
-			khugepaged_scan.address += HPAGE_PMD_SIZE;
+			scan->address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
 			if (ret)
 				/* we released mmap_sem so break loop */
@@ -2200,7 +2416,7 @@ breakouterloop:
 breakouterloop_mmap_sem:
 
 	spin_lock(&khugepaged_mm_lock);
-	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
+	VM_BUG_ON(scan->mm_slot != mm_slot);
 	/*
 	 * Release the current mm_slot if this mm is about to die, or
 	 * if we scanned all vmas of this mm.
@@ -2211,35 +2427,40 @@ breakouterloop_mmap_sem:
 		 * khugepaged runs here, khugepaged_exit will find
 		 * mm_slot not pointing to the exiting mm.
 		 */
-		if (mm_slot->mm_node.next != &khugepaged_scan.mm_head) {
-			khugepaged_scan.mm_slot = list_entry(
+		if (mm_slot->mm_node.next != &scan->mm_head) {
+			scan->mm_slot = list_entry(
 				mm_slot->mm_node.next,
 				struct mm_slot, mm_node);
-			khugepaged_scan.address = 0;
+			scan->address = 0;
 		} else {
-			khugepaged_scan.mm_slot = NULL;
-			khugepaged_full_scans++;
+			scan->mm_slot = NULL;
+			scan->full_scans++;
 		}
 
-		collect_mm_slot(mm_slot);
+		if (khugepaged_test_exit(mm))
+			collect_mm_slot(mm_slot);
+		else
+			khugepaged_migrate_mm_slot(scan, mm_slot);
+		memset(scan->mm_load, 0, nr_node_ids * sizeof(unsigned int));
 	}
 
 	return progress;
 }
 
-static int khugepaged_has_work(void)
+static int khugepaged_has_work(struct khugepaged_scan *scan)
 {
-	return !list_empty(&khugepaged_scan.mm_head) &&
+	return !list_empty(&scan->mm_head) &&
 		khugepaged_enabled();
 }
 
-static int khugepaged_wait_event(void)
+static int khugepaged_wait_event(struct khugepaged_scan *scan)
 {
-	return !list_empty(&khugepaged_scan.mm_head) ||
+	return !list_empty(&scan->mm_head) ||
 		!khugepaged_enabled();
 }
 
-static void khugepaged_do_scan(struct page **hpage)
+static void khugepaged_do_scan(struct khugepaged_scan *scan,
+			       struct page **hpage)
 {
 	unsigned int progress = 0, pass_through_head = 0;
 	unsigned int pages = khugepaged_pages_to_scan;
@@ -2267,16 +2488,35 @@ static void khugepaged_do_scan(struct page **hpage)
 			break;
 
 		spin_lock(&khugepaged_mm_lock);
-		if (!khugepaged_scan.mm_slot)
+		if (!scan->mm_slot)
 			pass_through_head++;
-		if (khugepaged_has_work() &&
+		if (khugepaged_has_work(scan) &&
 		    pass_through_head < 2)
-			progress += khugepaged_scan_mm_slot(pages - progress,
+			progress += khugepaged_scan_mm_slot(scan,
+							    pages - progress,
 							    hpage);
 		else
 			progress = pages;
 		spin_unlock(&khugepaged_mm_lock);
 	}
+	scan->pages_scanned += progress;
+}
+
+/*
+ * How long to sleep after a pass that kept the cpu busy for @busy
+ * nanoseconds: at least scan_sleep_millisecs, and long enough that
+ * the pass stays within max_cpu_percent of one cpu.
+ */
+static unsigned int khugepaged_scan_sleep(u64 busy)
+{
+	unsigned int msecs = khugepaged_scan_sleep_millisecs;
+	unsigned int percent = khugepaged_max_cpu_percent;
+	u64 throttle;
+
+	if (percent >= 100)
+		return msecs;
+	throttle = div_u64(busy * (100 - percent), percent * NSEC_PER_MSEC);
+	return max_t(u64, msecs, min_t(u64, throttle, UINT_MAX));
 }
 
 static void khugepaged_alloc_sleep(void)
@@ -2303,9 +2543,11 @@ static struct page *khugepaged_alloc_hugepage(void)
 }
 #endif
 
-static void khugepaged_loop(void)
+static void khugepaged_loop(struct khugepaged_scan *scan)
 {
 	struct page *hpage;
+	u64 runtime, busy;
+	unsigned int msecs;
 
 #ifdef CONFIG_NUMA
 	hpage = NULL;
@@ -2322,7 +2564,10 @@ static void khugepaged_loop(void)
 		}
 #endif
 
-		khugepaged_do_scan(&hpage);
+		runtime = task_sched_runtime(current);
+		khugepaged_do_scan(scan, &hpage);
+		busy = task_sched_runtime(current) - runtime;
+		scan->cpu_time += busy;
 #ifndef CONFIG_NUMA
 		if (hpage)
 			put_page(hpage);
@@ -2330,19 +2575,21 @@ static void khugepaged_loop(void)
 		try_to_freeze();
 		if (unlikely(kthread_should_stop()))
 			break;
-		if (khugepaged_has_work()) {
-			if (!khugepaged_scan_sleep_millisecs)
+		if (khugepaged_has_work(scan)) {
+			msecs = khugepaged_scan_sleep(busy);
+			if (!msecs)
 				continue;
 			wait_event_freezable_timeout(khugepaged_wait, false,
-			    msecs_to_jiffies(khugepaged_scan_sleep_millisecs));
+						     msecs_to_jiffies(msecs));
 		} else if (khugepaged_enabled())
 			wait_event_freezable(khugepaged_wait,
-					     khugepaged_wait_event());
+					     khugepaged_wait_event(scan));
 	}
 }
 
-static int khugepaged(void *none)
+static int khugepaged(void *data)
 {
+	struct khugepaged_scan *scan = data;
 	struct mm_slot *mm_slot;
 
 	set_freezable();
@@ -2353,9 +2600,9 @@ static int khugepaged(void *none)
 
 	for (;;) {
 		mutex_unlock(&khugepaged_mutex);
-		VM_BUG_ON(khugepaged_thread != current);
-		khugepaged_loop();
-		VM_BUG_ON(khugepaged_thread != current);
+		VM_BUG_ON(scan->thread != current);
+		khugepaged_loop(scan);
+		VM_BUG_ON(scan->thread != current);
 
 		mutex_lock(&khugepaged_mutex);
 		if (!khugepaged_enabled())
@@ -2365,13 +2612,13 @@ static int khugepaged(void *none)
 	}
 
 	spin_lock(&khugepaged_mm_lock);
-	mm_slot = khugepaged_scan.mm_slot;
-	khugepaged_scan.mm_slot = NULL;
+	mm_slot = scan->mm_slot;
+	scan->mm_slot = NULL;
 	if (mm_slot)
 		collect_mm_slot(mm_slot);
 	spin_unlock(&khugepaged_mm_lock);
 
-	khugepaged_thread = NULL;
+	scan->thread = NULL;
 	mutex_unlock(&khugepaged_mutex);
 
 	return 0;
@@ -1993,12 +1993,21 @@ void mem_cgroup_update_page_stat(struct page *page,
 
 /*
  * size of first charge trial. "32" comes from vmscan.c's magic value.
- * TODO: maybe necessary to use big numbers in big irons.
+ * The batch grows up to CHARGE_BATCH_MAX while the memcg is far enough
+ * below its limit, see mem_cgroup_charge_batch().
  */
 #define CHARGE_BATCH	32U
+#define CHARGE_BATCH_MAX	256U
+
+/*
+ * Each cpu keeps stocks for a few memcgs at once, so that tasks of
+ * different cgroups sharing a cpu don't keep draining each other's stock.
+ */
+#define NR_MEMCG_STOCK	4
 struct memcg_stock_pcp {
-	struct mem_cgroup *cached; /* this never be root cgroup */
-	unsigned int nr_pages;
+	struct mem_cgroup *cached[NR_MEMCG_STOCK]; /* this never be root cgroup */
+	unsigned int nr_pages[NR_MEMCG_STOCK];
+	unsigned int next_evict;
 	struct work_struct work;
 	unsigned long flags;
 #define FLUSHING_CACHED_CHARGE	(0)
@@ -2015,33 +2024,48 @@ static DEFINE_MUTEX(percpu_charge_mutex);
 static bool consume_stock(struct mem_cgroup *memcg)
 {
 	struct memcg_stock_pcp *stock;
-	bool ret = true;
+	bool ret = false;
+	int i;
 
 	stock = &get_cpu_var(memcg_stock);
-	if (memcg == stock->cached && stock->nr_pages)
-		stock->nr_pages--;
-	else /* need to call res_counter_charge */
-		ret = false;
+	for (i = 0; i < NR_MEMCG_STOCK; i++) {
+		if (memcg == stock->cached[i] && stock->nr_pages[i]) {
+			stock->nr_pages[i]--;
+			ret = true;
+			break;
+		}
+	}
 	put_cpu_var(memcg_stock);
 	return ret;
 }
 
 /*
- * Returns stocks cached in percpu to res_counter and reset cached information.
+ * Returns one stock slot cached in percpu to res_counter and resets it.
  */
-static void drain_stock(struct memcg_stock_pcp *stock)
+static void drain_stock_slot(struct memcg_stock_pcp *stock, int i)
 {
-	struct mem_cgroup *old = stock->cached;
+	struct mem_cgroup *old = stock->cached[i];
 
-	if (stock->nr_pages) {
-		unsigned long bytes = stock->nr_pages * PAGE_SIZE;
+	if (stock->nr_pages[i]) {
+		unsigned long bytes = stock->nr_pages[i] * PAGE_SIZE;
 
 		res_counter_uncharge(&old->res, bytes);
 		if (do_swap_account)
 			res_counter_uncharge(&old->memsw, bytes);
-		stock->nr_pages = 0;
+		stock->nr_pages[i] = 0;
 	}
-	stock->cached = NULL;
+	stock->cached[i] = NULL;
+}
+
+/*
+ * Returns stocks cached in percpu to res_counter and reset cached information.
+ */
+static void drain_stock(struct memcg_stock_pcp *stock)
+{
+	int i;
+
+	for (i = 0; i < NR_MEMCG_STOCK; i++)
+		drain_stock_slot(stock, i);
 }
 
 /*
@@ -2062,15 +2086,73 @@ static void drain_local_stock(struct work_struct *dummy)
 static void refill_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 {
 	struct memcg_stock_pcp *stock = &get_cpu_var(memcg_stock);
+	int i, slot = -1;
 
-	if (stock->cached != memcg) { /* reset if necessary */
-		drain_stock(stock);
-		stock->cached = memcg;
+	for (i = 0; i < NR_MEMCG_STOCK; i++) {
+		if (stock->cached[i] == memcg) {
+			slot = i;
+			break;
+		}
+		if (slot < 0 && !stock->nr_pages[i])
+			slot = i;
+	}
+	if (slot < 0) { /* all slots taken: evict round robin */
+		slot = stock->next_evict++ % NR_MEMCG_STOCK;
+		drain_stock_slot(stock, slot);
 	}
-	stock->nr_pages += nr_pages;
+	stock->cached[slot] = memcg;
+	stock->nr_pages[slot] += nr_pages;
 	put_cpu_var(memcg_stock);
 }
 
+/*
+ * Smallest room left below the limit of @cnt and all its ancestors.
+ * Racy on purpose: this only sizes the next batch, so it reads the
+ * counters without their locks rather than bouncing them on every
+ * stock miss.  A stale or (on 32bit) torn value only picks a worse
+ * batch size, the charge itself is still checked under the locks.
+ */
+static unsigned long long mem_cgroup_margin_hier(struct res_counter *cnt,
+						 unsigned long long margin)
+{
+	unsigned long long usage, limit;
+
+	for (; cnt; cnt = cnt->parent) {
+		usage = ACCESS_ONCE(cnt->usage);
+		limit = ACCESS_ONCE(cnt->limit);
+		if (limit <= usage)
+			return 0;
+		margin = min(margin, limit - usage);
+	}
+	return margin;
+}
+
+/*
+ * Every cpu may hold up to a batch of charge in stock for a memcg, so
+ * only use batches beyond CHARGE_BATCH while all cpus together could
+ * not stock more than an eighth of the room left below the limit of
+ * the memcg or any of its ancestors.
+ */
+static unsigned int mem_cgroup_charge_batch(struct mem_cgroup *memcg,
+					    unsigned int nr_pages)
+{
+	unsigned long long margin;
+	u64 per_cpu;
+	unsigned int batch = CHARGE_BATCH;
+
+	if (nr_pages > 1)
+		return max(batch, nr_pages);
+
+	margin = mem_cgroup_margin_hier(&memcg->res, RESOURCE_MAX);
+	if (do_swap_account)
+		margin = mem_cgroup_margin_hier(&memcg->memsw, margin);
+	per_cpu = div_u64(margin >> PAGE_SHIFT, 8 * num_online_cpus());
+
+	while (batch < CHARGE_BATCH_MAX && (batch << 1) <= per_cpu)
+		batch <<= 1;
+	return batch;
+}
+
 /*
  * Drains all per-CPU charge caches for given root_memcg resp. subtree
  * of the hierarchy under it. sync flag says whether we should block
@@ -2086,11 +2168,16 @@ static void drain_all_stock(struct mem_cgroup *root_memcg, bool sync)
 	for_each_online_cpu(cpu) {
 		struct memcg_stock_pcp *stock = &per_cpu(memcg_stock, cpu);
 		struct mem_cgroup *memcg;
-
-		memcg = stock->cached;
-		if (!memcg || !stock->nr_pages)
-			continue;
-		if (!mem_cgroup_same_or_subtree(root_memcg, memcg))
+		bool cached = false;
+		int i;
+
+		for (i = 0; i < NR_MEMCG_STOCK && !cached; i++) {
+			memcg = stock->cached[i];
+			if (memcg && stock->nr_pages[i] &&
+			    mem_cgroup_same_or_subtree(root_memcg, memcg))
+				cached = true;
+		}
+		if (!cached)
 			continue;
 		if (!test_and_set_bit(FLUSHING_CACHED_CHARGE, &stock->flags)) {
 			if (cpu == curcpu)
@@ -2196,7 +2283,8 @@ enum {
 };
 
 static int mem_cgroup_do_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
-				unsigned int nr_pages, bool oom_check)
+				unsigned int nr_pages, unsigned int min_pages,
+				bool oom_check)
 {
 	unsigned long csize = nr_pages * PAGE_SIZE;
 	struct mem_cgroup *mem_over_limit;
@@ -2220,12 +2308,13 @@ static int mem_cgroup_do_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 		mem_over_limit = mem_cgroup_from_res_counter(fail_res, res);
 	/*
 	 * nr_pages can be either a huge page (HPAGE_PMD_NR), a batch
-	 * of regular pages (CHARGE_BATCH), or a single regular page (1).
+	 * of regular pages (mem_cgroup_charge_batch()), or a single
+	 * regular page (1). min_pages is what the caller actually needs.
 	 *
 	 * Never reclaim on behalf of optional batching, retry with a
 	 * single page instead.
 	 */
-	if (nr_pages == CHARGE_BATCH)
+	if (nr_pages > min_pages)
 		return CHARGE_RETRY;
 
 	if (!(gfp_mask & __GFP_WAIT))
@@ -2290,7 +2379,7 @@ static int __mem_cgroup_try_charge(struct mm_struct *mm,
 				   struct mem_cgroup **ptr,
 				   bool oom)
 {
-	unsigned int batch = max(CHARGE_BATCH, nr_pages);
+	unsigned int batch = 0;
 	int nr_oom_retries = MEM_CGROUP_RECLAIM_RETRIES;
 	struct mem_cgroup *memcg = NULL;
 	int ret;
@@ -2363,6 +2452,9 @@ again:
 		rcu_read_unlock();
 	}
 
+	if (!batch)
+		batch = mem_cgroup_charge_batch(memcg, nr_pages);
+
 	do {
 		bool oom_check;
 
@@ -2378,7 +2470,8 @@ again:
 			nr_oom_retries = MEM_CGROUP_RECLAIM_RETRIES;
 		}
 
-		ret = mem_cgroup_do_charge(memcg, gfp_mask, batch, oom_check);
+		ret = mem_cgroup_do_charge(memcg, gfp_mask, batch, nr_pages,
+					   oom_check);
 		switch (ret) {
 		case CHARGE_OK:
 			break;
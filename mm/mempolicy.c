@@ -2339,6 +2339,81 @@ void numa_default_policy(void)
 	do_set_mempolicy(MPOL_DEFAULT, 0, NULL);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * change_prot_numa - make the pages in a range fault on the next access
+ *
+ * The ptes keep pointing at their pages but become PROT_NONE, so the
+ * next access takes a NUMA hinting fault that tells which node the
+ * page is used from, see do_numa_page().  Returns the number of ptes
+ * changed.  The caller holds mmap_sem for read.
+ */
+unsigned long change_prot_numa(struct vm_area_struct *vma,
+			       unsigned long addr, unsigned long end)
+{
+	unsigned long nr_updated;
+
+	nr_updated = change_protection(vma, addr, end, PAGE_NONE, 0, 1);
+	if (nr_updated)
+		count_vm_events(NUMA_PTE_UPDATES, nr_updated);
+
+	return nr_updated;
+}
+
+/*
+ * mpol_misplaced - check whether a page is on the node its policy wants
+ * @page:	page that took a NUMA hinting fault
+ * @vma:	vm area the page is mapped in
+ * @addr:	virtual address of the fault
+ *
+ * Returns the node the page should move to, or -1 if it is fine where it
+ * is.  With the default local policy that is the node of the faulting
+ * cpu.  The caller holds mmap_sem for read.
+ */
+int mpol_misplaced(struct page *page, struct vm_area_struct *vma,
+		   unsigned long addr)
+{
+	struct mempolicy *pol;
+	struct zone *zone;
+	int curnid = page_to_nid(page);
+	int thisnid = numa_node_id();
+	int polnid = -1;
+
+	pol = get_vma_policy(current, vma, addr);
+
+	switch (pol->mode) {
+	case MPOL_INTERLEAVE:
+		polnid = interleave_nid(pol, vma, addr, PAGE_SHIFT);
+		break;
+
+	case MPOL_PREFERRED:
+		if (pol->flags & MPOL_F_LOCAL)
+			polnid = thisnid;
+		else
+			polnid = pol->v.preferred_node;
+		break;
+
+	case MPOL_BIND:
+		/* Anywhere in the set will do, else the closest one to us */
+		if (node_isset(curnid, pol->v.nodes))
+			break;
+		(void)first_zones_zonelist(
+				node_zonelist(thisnid, GFP_HIGHUSER),
+				gfp_zone(GFP_HIGHUSER),
+				&pol->v.nodes, &zone);
+		if (zone)
+			polnid = zone->node;
+		break;
+
+	default:
+		BUG();
+	}
+	mpol_cond_put(pol);
+
+	return polnid == curnid ? -1 : polnid;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /*
  * Parse and format mempolicy from/to strings
  */
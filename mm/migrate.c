@@ -1438,4 +1438,108 @@ int migrate_vmas(struct mm_struct *mm, const nodemask_t *to,
  	}
  	return err;
 }
+
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Don't let NUMA hinting faults migrate more than ratelimit_pages into a
+ * node per window, so that a task that just moved does not saturate the
+ * interconnect pulling its whole working set over at once.
+ */
+static unsigned int migrate_interval_millisecs __read_mostly = 100;
+static unsigned int ratelimit_pages __read_mostly = 128 << (20 - PAGE_SHIFT);
+
+static bool numamigrate_ratelimited(pg_data_t *pgdat, unsigned long nr_pages)
+{
+	bool limited = false;
+
+	spin_lock(&pgdat->numabalancing_migrate_lock);
+	if (time_after(jiffies, pgdat->numabalancing_migrate_next_window)) {
+		pgdat->numabalancing_migrate_nr_pages = 0;
+		pgdat->numabalancing_migrate_next_window = jiffies +
+			msecs_to_jiffies(migrate_interval_millisecs);
+	}
+	if (pgdat->numabalancing_migrate_nr_pages > ratelimit_pages)
+		limited = true;
+	else
+		pgdat->numabalancing_migrate_nr_pages += nr_pages;
+	spin_unlock(&pgdat->numabalancing_migrate_lock);
+
+	return limited;
+}
+
+/* Only migrate if the target node has room without going into reclaim */
+static bool migrate_balanced_pgdat(pg_data_t *pgdat, unsigned long nr_pages)
+{
+	int z;
+
+	for (z = pgdat->nr_zones - 1; z >= 0; z--) {
+		struct zone *zone = pgdat->node_zones + z;
+
+		if (!populated_zone(zone) || zone->all_unreclaimable)
+			continue;
+		if (zone_watermark_ok(zone, 0,
+				      high_wmark_pages(zone) + nr_pages, 0, 0))
+			return true;
+	}
+	return false;
+}
+
+static struct page *alloc_misplaced_dst_page(struct page *page,
+					     unsigned long data, int **result)
+{
+	int nid = (int) data;
+
+	return alloc_pages_exact_node(nid,
+				      (GFP_HIGHUSER_MOVABLE | __GFP_THISNODE |
+				       __GFP_NOMEMALLOC | __GFP_NORETRY |
+				       __GFP_NOWARN) & ~GFP_IOFS, 0);
+}
+
+/*
+ * migrate_misplaced_page - move a page that took a NUMA hinting fault
+ * @page:	the page, with a reference held by the caller
+ * @node:	the node it should be on
+ *
+ * Pages mapped by more than one process are left where they are, there
+ * is no telling which of the users should win.  Consumes the caller's
+ * reference.  Returns 1 if the page was migrated, 0 otherwise.
+ */
+int migrate_misplaced_page(struct page *page, int node)
+{
+	pg_data_t *pgdat = NODE_DATA(node);
+	LIST_HEAD(migratepages);
+	int migrated = 0;
+
+	if (page_mapcount(page) != 1 || PageTransHuge(page))
+		goto out;
+	if (numamigrate_ratelimited(pgdat, 1))
+		goto out;
+	if (!migrate_balanced_pgdat(pgdat, 1))
+		goto out;
+	if (isolate_lru_page(page))
+		goto out;
+
+	inc_zone_page_state(page, NR_ISOLATED_ANON + page_is_file_cache(page));
+	list_add(&page->lru, &migratepages);
+
+	/*
+	 * The page is isolated, which holds a reference of its own.  Drop
+	 * ours now or the migration would see an unexpected refcount.
+	 */
+	put_page(page);
+	page = NULL;
+
+	if (migrate_pages(&migratepages, alloc_misplaced_dst_page, node,
+			  false, MIGRATE_ASYNC))
+		putback_lru_pages(&migratepages);
+	else {
+		count_vm_event(NUMA_PAGE_MIGRATE);
+		migrated = 1;
+	}
+out:
+	if (page)
+		put_page(page);
+	return migrated;
+}
+#endif /* CONFIG_NUMA_BALANCING */
 #endif
@@ -618,10 +618,22 @@ static inline int free_pages_check(struct page *page)
 	return 0;
 }
 
+static inline unsigned int order_to_pindex(int migratetype,
+					   unsigned int order)
+{
+	return order * MIGRATE_PCPTYPES + migratetype;
+}
+
+static inline unsigned int pindex_to_order(unsigned int pindex)
+{
+	return pindex / MIGRATE_PCPTYPES;
+}
+
 /*
  * Frees a number of pages from the PCP lists
- * Assumes all pages on list are in same zone, and of same order.
- * count is the number of pages to free.
+ * Assumes all pages on list are in same zone.  The order of a page is
+ * implied by the list it sits on.
+ * count is the number of base pages to free; pcp->count is updated here.
  *
  * If the zone was previously in an "all pages pinned" state then look to
  * see if this freeing clears that state.
@@ -632,17 +644,22 @@ static inline int free_pages_check(struct page *page)
 static void free_pcppages_bulk(struct zone *zone, int count,
 					struct per_cpu_pages *pcp)
 {
-	int migratetype = 0;
+	int pindex = 0;
 	int batch_free = 0;
-	int to_free = count;
+	int freed = 0;
+
+	count = min(pcp->count, count);
+	if (!count)
+		return;
 
 	spin_lock(&zone->lock);
 	zone->all_unreclaimable = 0;
 	zone->pages_scanned = 0;
 
-	while (to_free) {
+	while (count > 0) {
 		struct page *page;
 		struct list_head *list;
+		unsigned int order;
 
 		/*
 		 * Remove pages from lists in a round-robin fashion. A
@@ -653,26 +670,54 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 		 */
 		do {
 			batch_free++;
-			if (++migratetype == MIGRATE_PCPTYPES)
-				migratetype = 0;
-			list = &pcp->lists[migratetype];
+			if (++pindex == NR_PCP_LISTS)
+				pindex = 0;
+			list = &pcp->lists[pindex];
 		} while (list_empty(list));
 
 		/* This is the only non-empty list. Free them all. */
-		if (batch_free == MIGRATE_PCPTYPES)
-			batch_free = to_free;
+		if (batch_free == NR_PCP_LISTS)
+			batch_free = count;
 
+		order = pindex_to_order(pindex);
 		do {
 			page = list_entry(list->prev, struct page, lru);
 			/* must delete as __free_one_page list manipulates */
 			list_del(&page->lru);
 			/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
-			__free_one_page(page, zone, 0, page_private(page));
-			trace_mm_page_pcpu_drain(page, 0, page_private(page));
-		} while (--to_free && --batch_free && !list_empty(list));
+			__free_one_page(page, zone, order, page_private(page));
+			trace_mm_page_pcpu_drain(page, order, page_private(page));
+			count -= 1 << order;
+			freed += 1 << order;
+		} while (count > 0 && --batch_free && !list_empty(list));
 	}
-	__mod_zone_page_state(zone, NR_FREE_PAGES, count);
+	pcp->count -= freed;
+	__mod_zone_page_state(zone, NR_FREE_PAGES, freed);
 	spin_unlock(&zone->lock);
+	__count_vm_event(PCP_FREE_DRAIN);
+}
+
+/*
+ * Queue a freed page of order <= PCP_MAX_ORDER on this cpu's lists and
+ * give a batch back to the buddy allocator once they are above pcp->high.
+ * Called with interrupts disabled and page_private set to the migratetype.
+ */
+static void free_pcp_page(struct zone *zone, struct page *page,
+			  unsigned int order, int migratetype, int cold)
+{
+	struct per_cpu_pages *pcp;
+	struct list_head *list;
+
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	list = &pcp->lists[order_to_pindex(migratetype, order)];
+	if (cold)
+		list_add_tail(&page->lru, list);
+	else
+		list_add(&page->lru, list);
+	pcp->count += 1 << order;
+	if (pcp->count >= pcp->high)
+		free_pcppages_bulk(zone,
+				   pcp->count - pcp->high + pcp->batch, pcp);
 }
 
 static void free_one_page(struct zone *zone, struct page *page, int order,
@@ -716,17 +761,32 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 static void __free_pages_ok(struct page *page, unsigned int order)
 {
 	unsigned long flags;
+	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
 
 	if (!free_pages_prepare(page, order))
 		return;
 
+	migratetype = get_pageblock_migratetype(page);
 	local_irq_save(flags);
 	if (unlikely(wasMlocked))
 		free_page_mlock(page);
 	__count_vm_events(PGFREE, 1 << order);
-	free_one_page(page_zone(page), page, order,
-					get_pageblock_migratetype(page));
+	/*
+	 * Small high-order pages go to the pcp lists like order-0 ones, but
+	 * only from the pcp migratetypes: reserve, isolate and CMA blocks
+	 * stay with the buddy allocator.  A compound page is taken apart
+	 * here since it may be handed out again without __GFP_COMP.
+	 */
+	if (order <= PCP_MAX_ORDER && migratetype < MIGRATE_PCPTYPES) {
+		if (PageCompound(page) && destroy_compound_page(page, order))
+			goto out;
+		set_page_private(page, migratetype);
+		free_pcp_page(page_zone(page), page, order, migratetype, 0);
+		__count_vm_event(PCP_HIGHORDER_FREE);
+	} else
+		free_one_page(page_zone(page), page, order, migratetype);
+out:
 	local_irq_restore(flags);
 }
 
@@ -1158,11 +1218,62 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 	else
 		to_drain = pcp->count;
 	free_pcppages_bulk(zone, to_drain, pcp);
-	pcp->count -= to_drain;
 	local_irq_restore(flags);
 }
 #endif
 
+/*
+ * pcp->high follows the refill scale: it grows while the cpu keeps
+ * emptying its lists and falls back to high_min when it goes quiet.
+ */
+static void pcp_update_high(struct per_cpu_pages *pcp)
+{
+	pcp->high = min(pcp->high_min << pcp->alloc_factor, pcp->high_max);
+}
+
+#define PCP_ALLOC_FACTOR_MAX	3
+
+/*
+ * Number of pages of @order to pull from the buddy lists when a pcp list
+ * runs dry.  Every refill doubles the batch, up to 8 * pcp->batch, and
+ * decay_pcp_high() halves it again each vmstat interval, so the batch
+ * tracks how often this cpu refills.  It never fills past pcp->high.
+ */
+static unsigned long pcp_refill_batch(struct per_cpu_pages *pcp,
+				      unsigned int order)
+{
+	int batch = pcp->batch << pcp->alloc_factor;
+
+	if (pcp->alloc_factor < PCP_ALLOC_FACTOR_MAX) {
+		pcp->alloc_factor++;
+		pcp_update_high(pcp);
+	}
+	batch = min(batch, max(pcp->high - pcp->count, pcp->batch));
+	batch >>= order;
+	/* a high-order refill should save at least one zone->lock round */
+	return max(batch, order ? 2 : 1);
+}
+
+/*
+ * Called from refresh_cpu_vm_stats() each vmstat interval, on the cpu
+ * owning @pcp.  Halve the refill scale and give back whatever sits above
+ * the lowered high watermark.
+ */
+void decay_pcp_high(struct zone *zone, struct per_cpu_pages *pcp)
+{
+	unsigned long flags;
+
+	if (!pcp->alloc_factor)
+		return;
+
+	local_irq_save(flags);
+	pcp->alloc_factor >>= 1;
+	pcp_update_high(pcp);
+	if (pcp->count > pcp->high)
+		free_pcppages_bulk(zone, pcp->count - pcp->high, pcp);
+	local_irq_restore(flags);
+}
+
 /*
  * Drain pages of the indicated processor.
  *
@@ -1183,10 +1294,8 @@ static void drain_pages(unsigned int cpu)
 		pset = per_cpu_ptr(zone->pageset, cpu);
 
 		pcp = &pset->pcp;
-		if (pcp->count) {
+		if (pcp->count)
 			free_pcppages_bulk(zone, pcp->count, pcp);
-			pcp->count = 0;
-		}
 		local_irq_restore(flags);
 	}
 }
@@ -1286,7 +1395,6 @@ void mark_free_pages(struct zone *zone)
 void free_hot_cold_page(struct page *page, int cold)
 {
 	struct zone *zone = page_zone(page);
-	struct per_cpu_pages *pcp;
 	unsigned long flags;
 	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
@@ -1316,16 +1424,7 @@ void free_hot_cold_page(struct page *page, int cold)
 		migratetype = MIGRATE_MOVABLE;
 	}
 
-	pcp = &this_cpu_ptr(zone->pageset)->pcp;
-	if (cold)
-		list_add_tail(&page->lru, &pcp->lists[migratetype]);
-	else
-		list_add(&page->lru, &pcp->lists[migratetype]);
-	pcp->count++;
-	if (pcp->count >= pcp->high) {
-		free_pcppages_bulk(zone, pcp->batch, pcp);
-		pcp->count -= pcp->batch;
-	}
+	free_pcp_page(zone, page, 0, migratetype, cold);
 
 out:
 	local_irq_restore(flags);
@@ -1435,21 +1534,37 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 	struct page *page;
 	int cold = !!(gfp_flags & __GFP_COLD);
 
+	if (unlikely(gfp_flags & __GFP_NOFAIL)) {
+		/*
+		 * __GFP_NOFAIL is not to be used in new code.
+		 *
+		 * All __GFP_NOFAIL callers should be fixed so that they
+		 * properly detect and handle allocation failures.
+		 *
+		 * We most definitely don't want callers attempting to
+		 * allocate greater than order-1 page units with
+		 * __GFP_NOFAIL.
+		 */
+		WARN_ON_ONCE(order > 1);
+	}
+
 again:
-	if (likely(order == 0)) {
+	if (likely(order <= PCP_MAX_ORDER)) {
 		struct per_cpu_pages *pcp;
 		struct list_head *list;
 
 		local_irq_save(flags);
 		pcp = &this_cpu_ptr(zone->pageset)->pcp;
-		list = &pcp->lists[migratetype];
+		list = &pcp->lists[order_to_pindex(migratetype, order)];
 		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
-					pcp->batch, list,
-					migratetype, cold);
+			pcp->count += rmqueue_bulk(zone, order,
+					pcp_refill_batch(pcp, order), list,
+					migratetype, cold) << order;
+			__count_vm_event(PCP_ALLOC_REFILL);
 			if (unlikely(list_empty(list)))
 				goto failed;
-		}
+		} else if (order)
+			__count_vm_event(PCP_HIGHORDER_ALLOC);
 
 		if (cold)
 			page = list_entry(list->prev, struct page, lru);
@@ -1457,21 +1572,8 @@ again:
 			page = list_entry(list->next, struct page, lru);
 
 		list_del(&page->lru);
-		pcp->count--;
+		pcp->count -= 1 << order;
 	} else {
-		if (unlikely(gfp_flags & __GFP_NOFAIL)) {
-			/*
-			 * __GFP_NOFAIL is not to be used in new code.
-			 *
-			 * All __GFP_NOFAIL callers should be fixed so that they
-			 * properly detect and handle allocation failures.
-			 *
-			 * We most definitely don't want callers attempting to
-			 * allocate greater than order-1 page units with
-			 * __GFP_NOFAIL.
-			 */
-			WARN_ON_ONCE(order > 1);
-		}
 		spin_lock_irqsave(&zone->lock, flags);
 		page = __rmqueue(zone, order, migratetype);
 		spin_unlock(&zone->lock);
@@ -3805,21 +3907,25 @@ static int zone_batchsize(struct zone *zone)
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int pindex;
 
 	memset(p, 0, sizeof(*p));
 
 	pcp = &p->pcp;
 	pcp->count = 0;
-	pcp->high = 6 * batch;
+	pcp->high_min = 6 * batch;
+	pcp->high_max = 4 * pcp->high_min;
+	pcp->high = pcp->high_min;
+	pcp->alloc_factor = 0;
 	pcp->batch = max(1UL, 1 * batch);
-	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
-		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	for (pindex = 0; pindex < NR_PCP_LISTS; pindex++)
+		INIT_LIST_HEAD(&pcp->lists[pindex]);
 }
 
 /*
  * setup_pagelist_highmark() sets the high water mark for hot per_cpu_pagelist
- * to the value high for the pageset p.
+ * to the value high for the pageset p.  An explicit high mark is not
+ * scaled with the refill rate.
  */
 
 static void setup_pagelist_highmark(struct per_cpu_pageset *p,
@@ -3829,6 +3935,8 @@ static void setup_pagelist_highmark(struct per_cpu_pageset *p,
 
 	pcp = &p->pcp;
 	pcp->high = high;
+	pcp->high_min = high;
+	pcp->high_max = high;
 	pcp->batch = max(1UL, high/4);
 	if ((high/4) > (PAGE_SHIFT * 8))
 		pcp->batch = PAGE_SHIFT * 8;
@@ -4362,6 +4470,13 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
 	pgdat->kswapd_max_order = 0;
+	init_waitqueue_head(&pgdat->reclaim_wait);
+	atomic_set(&pgdat->nr_reclaimers, 0);
+#ifdef CONFIG_NUMA_BALANCING
+	spin_lock_init(&pgdat->numabalancing_migrate_lock);
+	pgdat->numabalancing_migrate_nr_pages = 0;
+	pgdat->numabalancing_migrate_next_window = jiffies;
+#endif
 	pgdat_page_cgroup_init(pgdat);
 
 	for (j = 0; j < MAX_NR_ZONES; j++) {
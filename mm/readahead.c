@@ -17,6 +17,7 @@
 #include <linux/task_io_accounting_ops.h>
 #include <linux/pagevec.h>
 #include <linux/pagemap.h>
+#include <linux/slab.h>
 
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
@@ -255,6 +256,7 @@ unsigned long ra_submit(struct file_ra_state *ra,
 
 	actual = __do_page_cache_readahead(mapping, filp,
 					ra->start, ra->size, ra->async_size);
+	ra->ra_pages_read += actual;
 
 	return actual;
 }
@@ -334,7 +336,272 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  *
  * The code ramps up the readahead size aggressively at first, but slow down as
  * it approaches max_readhead.
+ *
+ * Besides the current window, the file's stream table remembers the
+ * windows of up to RA_STREAMS other streams, most recently used first.
+ * When a read arrives where one of them expects it, that stream is swapped
+ * in and carries on ramping up, instead of being rebuilt from the page
+ * cache.  The same table holds strided streams: reads of the same size a
+ * fixed distance apart.  Once a stride is seen twice, the next stride
+ * points are read ahead, with the middle one marked PG_readahead to keep
+ * the pipeline going.
+ *
+ * Readers sharing a file update the table without any locking, so an
+ * entry can change or be cleared under us: entries are copied before they
+ * are looked at, and nothing read from one is trusted as a divisor.
+ */
+
+/* How many stride points to read ahead at a time */
+#define RA_STRIDE_POINTS	8
+
+/*
+ * The stream table of @filp, if @ra is its readahead state.  With @alloc,
+ * allocate it if it doesn't exist yet; failing that we just track no other
+ * streams.
+ */
+static struct file_ra_streams *ra_streams(struct file_ra_state *ra,
+					  struct file *filp, bool alloc)
+{
+	struct file_ra_streams *rs;
+
+	if (!filp || ra != &filp->f_ra)
+		return NULL;
+	rs = ACCESS_ONCE(filp->f_ra_streams);
+	if (rs || !alloc)
+		return rs;
+
+	rs = kzalloc(sizeof(*rs), GFP_NOFS | __GFP_NOWARN);
+	if (rs && cmpxchg(&filp->f_ra_streams, NULL, rs)) {
+		kfree(rs);	/* raced with another reader */
+		rs = filp->f_ra_streams;
+	}
+	return rs;
+}
+
+/* Pages a dropped stream had read ahead but not used, as far as we know */
+static unsigned long ra_stream_unused(struct file_ra_stream *sp)
+{
+	struct file_ra_stream s = ACCESS_ONCE(*sp);
+
+	if (!s.size)
+		return 0;
+	if (s.stride) {
+		if (s.start <= s.prev + s.stride)
+			return 0;
+		return (s.start - s.prev - s.stride) / s.stride * s.size;
+	}
+	if (s.prev >= s.start + s.size)
+		return 0;
+	if (s.prev < s.start)
+		return s.size;
+	return s.start + s.size - 1 - s.prev;
+}
+
+/* Remove streams[i], moving the ones behind it up */
+static struct file_ra_stream ra_stream_take(struct file_ra_streams *rs, int i)
+{
+	struct file_ra_stream s = ACCESS_ONCE(rs->streams[i]);
+
+	memmove(&rs->streams[i], &rs->streams[i + 1],
+		(RA_STREAMS - 1 - i) * sizeof(s));
+	memset(&rs->streams[RA_STREAMS - 1], 0, sizeof(s));
+	return s;
+}
+
+/* Add a stream at the front, dropping the least recently used one */
+static void ra_stream_push(struct file_ra_streams *rs,
+			   struct file_ra_stream *s)
+{
+	rs->pages_wasted += ra_stream_unused(&rs->streams[RA_STREAMS - 1]);
+	memmove(&rs->streams[1], &rs->streams[0],
+		(RA_STREAMS - 1) * sizeof(*s));
+	rs->streams[0] = *s;
+}
+
+/*
+ * Before the current window is replaced by a stream elsewhere in the file,
+ * remember it.
+ */
+static void ra_stream_save(struct file_ra_state *ra, struct file *filp,
+			   pgoff_t offset)
+{
+	struct file_ra_stream s = {
+		.start		= ra->start,
+		.size		= ra->size,
+		.async_size	= ra->async_size,
+	};
+	pgoff_t prev = ra->prev_pos >> PAGE_CACHE_SHIFT;
+	struct file_ra_streams *rs;
+
+	if (!ra->size)
+		return;
+	if (offset >= ra->start && offset <= ra->start + ra->size)
+		return;		/* still the same stream */
+	rs = ra_streams(ra, filp, true);
+	if (!rs)
+		return;
+
+	if (ra->prev_pos >= 0 && prev >= ra->start &&
+	    prev < ra->start + ra->size)
+		s.prev = prev;
+	else
+		s.prev = ra->start + ra->size - ra->async_size - 1;
+	ra_stream_push(rs, &s);
+}
+
+static inline bool ra_expects(struct file_ra_state *ra, pgoff_t offset)
+{
+	return offset == ra->start + ra->size - ra->async_size ||
+	       offset == ra->start + ra->size;
+}
+
+/*
+ * Swap in a remembered sequential stream that expects a read at @offset,
+ * or has its readahead marker there.
+ */
+static bool ra_stream_switch(struct file_ra_state *ra, struct file *filp,
+			     pgoff_t offset, bool hit_readahead_marker)
+{
+	struct file_ra_streams *rs = ra_streams(ra, filp, false);
+	struct file_ra_stream found;
+	int i;
+
+	if (!rs)
+		return false;
+
+	for (i = 0; i < RA_STREAMS; i++) {
+		found = ACCESS_ONCE(rs->streams[i]);
+
+		if (found.stride || !found.size)
+			continue;
+		if (offset == found.start + found.size - found.async_size ||
+		    offset == found.start + found.size ||
+		    (hit_readahead_marker && offset >= found.start &&
+		     offset < found.start + found.size))
+			break;
+	}
+	if (i == RA_STREAMS)
+		return false;
+
+	ra_stream_take(rs, i);
+	ra_stream_save(ra, filp, offset);
+	ra->start = found.start;
+	ra->size = found.size;
+	ra->async_size = found.async_size;
+	return true;
+}
+
+/* Read ahead the next stride points of @s, marking the middle one */
+static unsigned long ra_stride_submit(struct address_space *mapping,
+				      struct file_ra_state *ra,
+				      struct file *filp,
+				      struct file_ra_stream *s,
+				      unsigned long max)
+{
+	unsigned long n, i, actual = 0;
+
+	s->size = max(s->size, 1U);
+	s->stride = max(s->stride, 1U);
+	n = clamp_t(unsigned long, max / s->size, 2, RA_STRIDE_POINTS);
+
+	for (i = 0; i < n; i++) {
+		actual += __do_page_cache_readahead(mapping, filp, s->start,
+				s->size, i == n / 2 ? s->size : 0);
+		s->start += s->stride;
+	}
+	ra->ra_pages_read += actual;
+	return actual;
+}
+
+/*
+ * Small non-sequential read at @offset: read it, and if it continues a
+ * stride, read ahead the following stride points too.  Otherwise start
+ * tracking a possible stride from the previous read.
  */
+static unsigned long try_stride_readahead(struct address_space *mapping,
+					  struct file_ra_state *ra,
+					  struct file *filp, pgoff_t offset,
+					  unsigned long req_size,
+					  unsigned long max)
+{
+	struct file_ra_stream cand = { .prev = offset, .size = req_size };
+	pgoff_t prev = ra->prev_pos >> PAGE_CACHE_SHIFT;
+	struct file_ra_streams *rs;
+	unsigned long actual;
+	int i, slot = -1;
+
+	actual = __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+
+	rs = ra_streams(ra, filp, true);
+	if (!rs)
+		return actual;
+
+	for (i = 0; i < RA_STREAMS; i++) {
+		struct file_ra_stream s = ACCESS_ONCE(rs->streams[i]);
+
+		if (!s.stride) {
+			if (!s.size)
+				slot = i;
+			continue;
+		}
+		slot = i;
+		if (offset != s.prev + s.stride)
+			continue;
+
+		/* a confirmed stride: read ahead past this point */
+		ra_stream_take(rs, i);
+		cand = s;
+		cand.prev = offset;
+		cand.size = max_t(unsigned int, cand.size, req_size);
+		if (cand.start <= offset)
+			cand.start = offset + cand.stride;
+		actual += ra_stride_submit(mapping, ra, filp, &cand, max);
+		ra_stream_push(rs, &cand);
+		return actual;
+	}
+
+	/*
+	 * A new candidate takes the place of the least recently used stride
+	 * stream or an empty slot, never that of a sequential stream.
+	 */
+	if (ra->prev_pos < 0 || offset <= prev || offset - prev <= req_size ||
+	    slot < 0)
+		return actual;
+	cand.stride = offset - prev;
+	rs->pages_wasted += ra_stream_unused(&rs->streams[slot]);
+	ra_stream_take(rs, slot);
+	ra_stream_push(rs, &cand);
+	return actual;
+}
+
+/* Readahead marker hit at @offset by a strided stream: keep it going */
+static bool try_stride_async(struct address_space *mapping,
+			     struct file_ra_state *ra, struct file *filp,
+			     pgoff_t offset, unsigned long max)
+{
+	struct file_ra_streams *rs = ra_streams(ra, filp, false);
+	struct file_ra_stream s;
+	int i;
+
+	if (!rs)
+		return false;
+
+	for (i = 0; i < RA_STREAMS; i++) {
+		s = ACCESS_ONCE(rs->streams[i]);
+
+		if (s.stride && offset > s.prev && offset < s.start &&
+		    (offset - s.prev) % s.stride == 0)
+			break;
+	}
+	if (i == RA_STREAMS)
+		return false;
+
+	ra_stream_take(rs, i);
+	s.prev = offset;
+	ra_stride_submit(mapping, ra, filp, &s, max);
+	ra_stream_push(rs, &s);
+	return true;
+}
 
 /*
  * Count contiguously cached pages from @offset-1 to @offset-@max,
@@ -360,6 +627,7 @@ static pgoff_t count_history_pages(struct address_space *mapping,
  */
 static int try_context_readahead(struct address_space *mapping,
 				 struct file_ra_state *ra,
+				 struct file *filp,
 				 pgoff_t offset,
 				 unsigned long req_size,
 				 unsigned long max)
@@ -382,6 +650,7 @@ static int try_context_readahead(struct address_space *mapping,
 	if (size >= offset)
 		size *= 2;
 
+	ra_stream_save(ra, filp, offset);
 	ra->start = offset;
 	ra->size = get_init_ra_size(size + req_size, max);
 	ra->async_size = ra->size;
@@ -406,12 +675,18 @@ ondemand_readahead(struct address_space *mapping,
 	if (!offset)
 		goto initial_readahead;
 
+	/*
+	 * Not where the current stream expects it: maybe where another
+	 * one does.
+	 */
+	if (!ra_expects(ra, offset))
+		ra_stream_switch(ra, filp, offset, hit_readahead_marker);
+
 	/*
 	 * It's the expected callback offset, assume sequential access.
 	 * Ramp up sizes, and push forward the readahead window.
 	 */
-	if ((offset == (ra->start + ra->size - ra->async_size) ||
-	     offset == (ra->start + ra->size))) {
+	if (ra_expects(ra, offset)) {
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
@@ -427,6 +702,9 @@ ondemand_readahead(struct address_space *mapping,
 	if (hit_readahead_marker) {
 		pgoff_t start;
 
+		if (try_stride_async(mapping, ra, filp, offset, max))
+			return 0;
+
 		rcu_read_lock();
 		start = radix_tree_next_hole(&mapping->page_tree, offset+1,max);
 		rcu_read_unlock();
@@ -434,6 +712,7 @@ ondemand_readahead(struct address_space *mapping,
 		if (!start || start - offset > max)
 			return 0;
 
+		ra_stream_save(ra, filp, offset);
 		ra->start = start;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
@@ -458,16 +737,18 @@ ondemand_readahead(struct address_space *mapping,
 	 * Query the page cache and look for the traces(cached history pages)
 	 * that a sequential stream would leave behind.
 	 */
-	if (try_context_readahead(mapping, ra, offset, req_size, max))
+	if (try_context_readahead(mapping, ra, filp, offset, req_size, max))
 		goto readit;
 
 	/*
 	 * standalone, small random read
-	 * Read as is, and do not pollute the readahead state.
+	 * Read as is, and do not pollute the readahead window; but it may be
+	 * part of a strided stream.
 	 */
-	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	return try_stride_readahead(mapping, ra, filp, offset, req_size, max);
 
 initial_readahead:
+	ra_stream_save(ra, filp, offset);
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
@@ -508,6 +789,8 @@ void page_cache_sync_readahead(struct address_space *mapping,
 	if (!ra->ra_pages)
 		return;
 
+	ra->ra_misses++;
+
 	/* be dumb */
 	if (filp && (filp->f_mode & FMODE_RANDOM)) {
 		force_page_cache_readahead(mapping, filp, offset, req_size);
@@ -551,6 +834,7 @@ page_cache_async_readahead(struct address_space *mapping,
 		return;
 
 	ClearPageReadahead(page);
+	ra->ra_hits++;
 
 	/*
 	 * Defer asynchronous read-ahead on IO congestion.
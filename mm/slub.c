@@ -1489,6 +1489,20 @@ static inline void remove_partial(struct kmem_cache_node *n,
 	n->nr_partial--;
 }
 
+/*
+ * Take list_lock on the allocation and free paths, counting how often it
+ * was already held by somebody else. The counters are only updated with
+ * the lock held and are exported through sysfs and slabinfo.
+ */
+static inline void lock_node_list(struct kmem_cache_node *n)
+{
+	if (unlikely(!spin_trylock(&n->list_lock))) {
+		spin_lock(&n->list_lock);
+		n->list_lock_contended++;
+	}
+	n->list_lock_taken++;
+}
+
 /*
  * Lock slab, remove from the partial list and put the object into the
  * per cpu freelist.
@@ -1553,7 +1567,7 @@ static void *get_partial_node(struct kmem_cache *s,
 	if (!n || !n->nr_partial)
 		return NULL;
 
-	spin_lock(&n->list_lock);
+	lock_node_list(n);
 	list_for_each_entry_safe(page, page2, &n->partial, lru) {
 		void *t = acquire_slab(s, n, page, object == NULL);
 		int available;
@@ -1824,7 +1838,7 @@ redo:
 			 * that acquire_slab() will see a slab page that
 			 * is frozen
 			 */
-			spin_lock(&n->list_lock);
+			lock_node_list(n);
 		}
 	} else {
 		m = M_FULL;
@@ -1835,7 +1849,7 @@ redo:
 			 * slabs from diagnostic functions will not see
 			 * any frozen slabs.
 			 */
-			spin_lock(&n->list_lock);
+			lock_node_list(n);
 		}
 	}
 
@@ -1918,7 +1932,7 @@ static void unfreeze_partials(struct kmem_cache *s)
 						spin_unlock(&n->list_lock);
 
 					n = n2;
-					spin_lock(&n->list_lock);
+					lock_node_list(n);
 				}
 			}
 
@@ -2203,21 +2217,10 @@ static inline void *get_freelist(struct kmem_cache *s, struct page *page)
  * we need to allocate a new slab. This is the slowest path since it involves
  * a call to the page allocator and the setup of a new slab.
  */
-static void *__slab_alloc(struct kmem_cache *s, gfp_t gfpflags, int node,
+static void *___slab_alloc(struct kmem_cache *s, gfp_t gfpflags, int node,
 			  unsigned long addr, struct kmem_cache_cpu *c)
 {
 	void **object;
-	unsigned long flags;
-
-	local_irq_save(flags);
-#ifdef CONFIG_PREEMPT
-	/*
-	 * We may have been preempted and rescheduled on a different
-	 * cpu before disabling interrupts. Need to reload cpu area
-	 * pointer.
-	 */
-	c = this_cpu_ptr(s->cpu_slab);
-#endif
 
 	if (!c->page)
 		goto new_slab;
@@ -2248,7 +2251,6 @@ redo:
 load_freelist:
 	c->freelist = get_freepointer(s, object);
 	c->tid = next_tid(c->tid);
-	local_irq_restore(flags);
 	return object;
 
 new_slab:
@@ -2272,8 +2274,6 @@ new_slab:
 		if (unlikely(!object)) {
 			if (!(gfpflags & __GFP_NOWARN) && printk_ratelimit())
 				slab_out_of_memory(s, gfpflags, node);
-
-			local_irq_restore(flags);
 			return NULL;
 		}
 	}
@@ -2288,10 +2288,34 @@ new_slab:
 	c->freelist = get_freepointer(s, object);
 	deactivate_slab(s, c);
 	c->node = NUMA_NO_NODE;
-	local_irq_restore(flags);
 	return object;
 }
 
+/*
+ * Wrapper for ___slab_alloc() for callers that have not disabled
+ * interrupts yet.
+ */
+static void *__slab_alloc(struct kmem_cache *s, gfp_t gfpflags, int node,
+			  unsigned long addr, struct kmem_cache_cpu *c)
+{
+	void *p;
+	unsigned long flags;
+
+	local_irq_save(flags);
+#ifdef CONFIG_PREEMPT
+	/*
+	 * We may have been preempted and rescheduled on a different
+	 * cpu before disabling interrupts. Need to reload cpu area
+	 * pointer.
+	 */
+	c = this_cpu_ptr(s->cpu_slab);
+#endif
+
+	p = ___slab_alloc(s, gfpflags, node, addr, c);
+	local_irq_restore(flags);
+	return p;
+}
+
 /*
  * Inlined fastpath so that allocation functions (kmalloc, kmem_cache_alloc)
  * have the fastpath folded into their functions. So no function call
@@ -2435,10 +2459,9 @@ EXPORT_SYMBOL(kmem_cache_alloc_node_trace);
  * handling required then we can return immediately.
  */
 static void __slab_free(struct kmem_cache *s, struct page *page,
-			void *x, unsigned long addr)
+			void *head, void *tail, int cnt, unsigned long addr)
 {
 	void *prior;
-	void **object = (void *)x;
 	int was_frozen;
 	int inuse;
 	struct page new;
@@ -2448,16 +2471,16 @@ static void __slab_free(struct kmem_cache *s, struct page *page,
 
 	stat(s, FREE_SLOWPATH);
 
-	if (kmem_cache_debug(s) && !free_debug_processing(s, page, x, addr))
+	if (kmem_cache_debug(s) && !free_debug_processing(s, page, head, addr))
 		return;
 
 	do {
 		prior = page->freelist;
 		counters = page->counters;
-		set_freepointer(s, object, prior);
+		set_freepointer(s, tail, prior);
 		new.counters = counters;
 		was_frozen = new.frozen;
-		new.inuse--;
+		new.inuse -= cnt;
 		if ((!new.inuse || !prior) && !was_frozen && !n) {
 
 			if (!kmem_cache_debug(s) && !prior)
@@ -2479,7 +2502,8 @@ static void __slab_free(struct kmem_cache *s, struct page *page,
 				 * Otherwise the list_lock will synchronize with
 				 * other processors updating the list of slabs.
 				 */
-				spin_lock_irqsave(&n->list_lock, flags);
+				local_irq_save(flags);
+				lock_node_list(n);
 
 			}
 		}
@@ -2487,7 +2511,7 @@ static void __slab_free(struct kmem_cache *s, struct page *page,
 
 	} while (!cmpxchg_double_slab(s, page,
 		prior, counters,
-		object, new.counters,
+		head, new.counters,
 		"__slab_free"));
 
 	if (likely(!n)) {
@@ -2558,16 +2582,20 @@ slab_empty:
  *
  * If fastpath is not possible then fall back to __slab_free where we deal
  * with all sorts of special processing.
+ *
+ * Bulk free of a freelist chained from head to tail, all in the same slab,
+ * is possible by passing tail and cnt. A single object is freed by passing
+ * a NULL tail and a cnt of 1. The caller must have run slab_free_hook() on
+ * every object already.
  */
 static __always_inline void slab_free(struct kmem_cache *s,
-			struct page *page, void *x, unsigned long addr)
+			struct page *page, void *head, void *tail, int cnt,
+			unsigned long addr)
 {
-	void **object = (void *)x;
+	void *tail_obj = tail ? : head;
 	struct kmem_cache_cpu *c;
 	unsigned long tid;
 
-	slab_free_hook(s, x);
-
 redo:
 	/*
 	 * Determine the currently cpus per cpu slab.
@@ -2581,19 +2609,19 @@ redo:
 	barrier();
 
 	if (likely(page == c->page)) {
-		set_freepointer(s, object, c->freelist);
+		set_freepointer(s, tail_obj, c->freelist);
 
 		if (unlikely(!this_cpu_cmpxchg_double(
 				s->cpu_slab->freelist, s->cpu_slab->tid,
 				c->freelist, tid,
-				object, next_tid(tid)))) {
+				head, next_tid(tid)))) {
 
 			note_cmpxchg_failure("slab_free", s, tid);
 			goto redo;
 		}
 		stat(s, FREE_FASTPATH);
 	} else
-		__slab_free(s, page, x, addr);
+		__slab_free(s, page, head, tail_obj, cnt, addr);
 
 }
 
@@ -2603,12 +2631,179 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 
 	page = virt_to_head_page(x);
 
-	slab_free(s, page, x, _RET_IP_);
+	slab_free_hook(s, x);
+	slab_free(s, page, x, NULL, 1, _RET_IP_);
 
 	trace_kmem_cache_free(_RET_IP_, x);
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+struct detached_freelist {
+	struct page *page;
+	void *tail;
+	void *freelist;
+	int cnt;
+};
+
+/*
+ * Chain up objects from the end of @p that belong to the same slab page
+ * into a freelist in @df, clearing their slots in @p. Objects from other
+ * pages are skipped, but only for a few lookahead steps, so the scan stays
+ * short when the array is not sorted by slab.
+ *
+ * Returns the number of entries of @p still to be processed.
+ */
+static size_t build_detached_freelist(struct kmem_cache *s, size_t size,
+				      void **p, struct detached_freelist *df)
+{
+	size_t first_skipped_index = 0;
+	int lookahead = 3;
+	void *object;
+
+	df->page = NULL;
+	do {
+		object = p[--size];
+	} while (!object && size);
+
+	if (!object)
+		return 0;
+
+	slab_free_hook(s, object);
+	df->page = virt_to_head_page(object);
+	set_freepointer(s, object, NULL);
+	df->tail = object;
+	df->freelist = object;
+	df->cnt = 1;
+	p[size] = NULL;
+
+	while (size) {
+		object = p[--size];
+		if (!object)
+			continue;
+
+		if (df->page == virt_to_head_page(object)) {
+			slab_free_hook(s, object);
+			set_freepointer(s, object, df->freelist);
+			df->freelist = object;
+			df->cnt++;
+			p[size] = NULL;
+			continue;
+		}
+
+		if (!--lookahead)
+			break;
+
+		if (!first_skipped_index)
+			first_skipped_index = size + 1;
+	}
+
+	return first_skipped_index;
+}
+
+/*
+ * Free @size objects from @p, handing all objects of one slab to the free
+ * path in a single cmpxchg. The entries of @p are overwritten.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
+{
+	size_t i;
+
+	if (!size)
+		return;
+
+	if (kmem_cache_debug(s)) {
+		for (i = 0; i < size; i++)
+			kmem_cache_free(s, p[i]);
+		return;
+	}
+
+	do {
+		struct detached_freelist df;
+
+		size = build_detached_freelist(s, size, p, &df);
+		if (!df.page)
+			continue;
+
+		slab_free(s, df.page, df.freelist, df.tail, df.cnt, _RET_IP_);
+	} while (likely(size));
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
+/*
+ * Allocate @size objects into @p with interrupts disabled once for the
+ * whole batch, taking objects straight off the per cpu freelist and only
+ * entering the slow path when it runs dry. Returns @size or 0; nothing is
+ * left allocated on failure.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
+			  void **p)
+{
+	struct kmem_cache_cpu *c;
+	size_t i, j;
+
+	if (kmem_cache_debug(s)) {
+		for (i = 0; i < size; i++) {
+			p[i] = slab_alloc(s, flags, NUMA_NO_NODE, _RET_IP_);
+			if (unlikely(!p[i])) {
+				kmem_cache_free_bulk(s, i, p);
+				return 0;
+			}
+		}
+		return i;
+	}
+
+	if (slab_pre_alloc_hook(s, flags))
+		return 0;
+
+	/*
+	 * Interrupts are disabled across the whole batch, which also keeps
+	 * us on this cpu while we work on its freelist directly.
+	 */
+	local_irq_disable();
+	c = this_cpu_ptr(s->cpu_slab);
+
+	for (i = 0; i < size; i++) {
+		void *object = c->freelist;
+
+		if (unlikely(!object)) {
+			/*
+			 * The slow path refills c->freelist behind the back
+			 * of any task preempted in the fastpath: invalidate
+			 * its transaction id first.
+			 */
+			c->tid = next_tid(c->tid);
+
+			p[i] = ___slab_alloc(s, flags, NUMA_NO_NODE,
+					     _RET_IP_, c);
+			if (unlikely(!p[i]))
+				goto error;
+
+			/* new_slab() may have enabled interrupts and moved us */
+			c = this_cpu_ptr(s->cpu_slab);
+			continue;
+		}
+		c->freelist = get_freepointer(s, object);
+		p[i] = object;
+	}
+	c->tid = next_tid(c->tid);
+	local_irq_enable();
+
+	for (j = 0; j < size; j++) {
+		if (unlikely(flags & __GFP_ZERO))
+			memset(p[j], 0, s->objsize);
+		slab_post_alloc_hook(s, flags, p[j]);
+	}
+	return size;
+
+error:
+	local_irq_enable();
+	for (j = 0; j < i; j++)
+		slab_post_alloc_hook(s, flags, p[j]);
+	kmem_cache_free_bulk(s, i, p);
+	return 0;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
 /*
  * Object placement in a slab is made very easy because we always start at
  * offset 0. If we tune the size of the object to the alignment then we can
@@ -2774,6 +2969,8 @@ init_kmem_cache_node(struct kmem_cache_node *n, struct kmem_cache *s)
 	n->nr_partial = 0;
 	spin_lock_init(&n->list_lock);
 	INIT_LIST_HEAD(&n->partial);
+	n->list_lock_taken = 0;
+	n->list_lock_contended = 0;
 #ifdef CONFIG_SLUB_DEBUG
 	atomic_long_set(&n->nr_slabs, 0);
 	atomic_long_set(&n->total_objects, 0);
@@ -3476,7 +3673,8 @@ void kfree(const void *x)
 		put_page(page);
 		return;
 	}
-	slab_free(page->slab, page, object, _RET_IP_);
+	slab_free_hook(page->slab, object);
+	slab_free(page->slab, page, object, NULL, 1, _RET_IP_);
 }
 EXPORT_SYMBOL(kfree);
 
@@ -4774,6 +4972,47 @@ static ssize_t slabs_cpu_partial_show(struct kmem_cache *s, char *buf)
 }
 SLAB_ATTR_RO(slabs_cpu_partial);
 
+static ssize_t show_list_lock(struct kmem_cache *s, char *buf, int contended)
+{
+	unsigned long total = 0;
+	int node;
+	int len;
+
+	for_each_node_state(node, N_NORMAL_MEMORY) {
+		struct kmem_cache_node *n = get_node(s, node);
+
+		if (n)
+			total += contended ? n->list_lock_contended :
+					     n->list_lock_taken;
+	}
+
+	len = sprintf(buf, "%lu", total);
+
+#ifdef CONFIG_NUMA
+	for_each_node_state(node, N_NORMAL_MEMORY) {
+		struct kmem_cache_node *n = get_node(s, node);
+
+		if (n && len < PAGE_SIZE - 30)
+			len += sprintf(buf + len, " N%d=%lu", node,
+				contended ? n->list_lock_contended :
+					    n->list_lock_taken);
+	}
+#endif
+	return len + sprintf(buf + len, "\n");
+}
+
+static ssize_t list_lock_taken_show(struct kmem_cache *s, char *buf)
+{
+	return show_list_lock(s, buf, 0);
+}
+SLAB_ATTR_RO(list_lock_taken);
+
+static ssize_t list_lock_contended_show(struct kmem_cache *s, char *buf)
+{
+	return show_list_lock(s, buf, 1);
+}
+SLAB_ATTR_RO(list_lock_contended);
+
 static ssize_t reclaim_account_show(struct kmem_cache *s, char *buf)
 {
 	return sprintf(buf, "%d\n", !!(s->flags & SLAB_RECLAIM_ACCOUNT));
@@ -5122,6 +5361,8 @@ static struct attribute *slab_attrs[] = {
 	&shrink_attr.attr,
 	&reserved_attr.attr,
 	&slabs_cpu_partial_attr.attr,
+	&list_lock_taken_attr.attr,
+	&list_lock_contended_attr.attr,
 #ifdef CONFIG_SLUB_DEBUG
 	&total_objects_attr.attr,
 	&slabs_attr.attr,
@@ -31,6 +31,8 @@
 #include <linux/memcontrol.h>
 #include <linux/poll.h>
 #include <linux/oom.h>
+#include <linux/frontswap.h>
+#include <linux/swapfile.h>
 
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
@@ -41,8 +43,10 @@ static bool swap_count_continued(struct swap_info_struct *, pgoff_t,
 				 unsigned char);
 static void free_swap_count_continuations(struct swap_info_struct *);
 static sector_t map_swap_entry(swp_entry_t, struct block_device**);
+static unsigned char swap_entry_free(struct swap_info_struct *,
+				     swp_entry_t, unsigned char);
 
-static DEFINE_SPINLOCK(swap_lock);
+DEFINE_SPINLOCK(swap_lock);
 static unsigned int nr_swapfiles;
 long nr_swap_pages;
 long total_swap_pages;
@@ -53,9 +57,9 @@ static const char Unused_file[] = "Unused swap file entry ";
 static const char Bad_offset[] = "Bad swap offset entry ";
 static const char Unused_offset[] = "Unused swap offset entry ";
 
-static struct swap_list_t swap_list = {-1, -1};
+struct swap_list_t swap_list = {-1, -1};
 
-static struct swap_info_struct *swap_info[MAX_SWAPFILES];
+struct swap_info_struct *swap_info[MAX_SWAPFILES];
 
 static DEFINE_MUTEX(swapon_mutex);
 
@@ -408,17 +412,22 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/*
+ * Allocate up to @n swap entries for the swap cache into @slots and return
+ * how many were allocated. Called with swap_lock held.
+ */
+static int __get_swap_pages(int n, swp_entry_t slots[])
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
 	int type, next;
 	int wrapped = 0;
+	int nr = 0;
 
-	spin_lock(&swap_lock);
 	if (nr_swap_pages <= 0)
-		goto noswap;
-	nr_swap_pages--;
+		return 0;
+	n = min_t(long, n, nr_swap_pages);
+	nr_swap_pages -= n;
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		si = swap_info[type];
@@ -436,18 +445,238 @@ swp_entry_t get_swap_page(void)
 
 		swap_list.next = next;
 		/* This is called for allocating swap entry for cache */
-		offset = scan_swap_map(si, SWAP_HAS_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
-			return swp_entry(type, offset);
+		while (nr < n) {
+			offset = scan_swap_map(si, SWAP_HAS_CACHE);
+			if (!offset)
+				break;
+			slots[nr++] = swp_entry(type, offset);
 		}
+		if (nr == n)
+			break;
 		next = swap_list.next;
 	}
 
-	nr_swap_pages++;
-noswap:
+	nr_swap_pages += n - nr;
+	return nr;
+}
+
+/*
+ * Per-cpu swap slot caches.
+ *
+ * get_swap_page() hands out slots from a per-cpu array that is refilled
+ * SWAP_SLOTS_CACHE_SIZE slots at a time, and swapcache_free() queues
+ * slots it releases on a per-cpu array that is freed in one go when full,
+ * so that swap_lock is taken once per batch rather than once per page.
+ *
+ * Slots in either array are marked SWAP_HAS_CACHE in the swap_map without
+ * being in the swap cache. swapoff disables the caches and drains them,
+ * so that try_to_unuse() does not wait for such slots forever.
+ *
+ * The two arrays have separate locks.  Refilling goes through
+ * scan_swap_map(), which may sleep and may free slots itself through
+ * __try_to_reclaim_swap(), so the allocation side is a mutex and runs
+ * with preemption enabled, while the free side stays a spinlock.
+ */
+#define SWAP_SLOTS_CACHE_SIZE	64
+
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects cur, nr and slots */
+	int		cur;
+	int		nr;
+	swp_entry_t	slots[SWAP_SLOTS_CACHE_SIZE];
+	spinlock_t	free_lock;	/* protects n_ret and slots_ret */
+	int		n_ret;
+	swp_entry_t	slots_ret[SWAP_SLOTS_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+bool swap_slots_cache_enabled __read_mostly;
+static int swap_slots_cache_disabled;
+static DEFINE_MUTEX(swap_slots_cache_mutex);
+
+/*
+ * Don't let the caches strand slots when swap is nearly full: only
+ * refill while there is plenty left for every cpu.
+ */
+static inline bool swap_slots_cache_worthwhile(void)
+{
+	return nr_swap_pages > num_online_cpus() * SWAP_SLOTS_CACHE_SIZE * 2;
+}
+
+static void swap_slots_free(swp_entry_t *slots, int n)
+{
+	int i;
+
+	if (!n)
+		return;
+
+	spin_lock(&swap_lock);
+	for (i = 0; i < n; i++)
+		swap_entry_free(swap_info[swp_type(slots[i])], slots[i],
+				SWAP_HAS_CACHE);
 	spin_unlock(&swap_lock);
-	return (swp_entry_t) {0};
+}
+
+/* return all slots held by a cpu's cache */
+static void drain_slots_cache_cpu(int cpu)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+	mutex_lock(&cache->alloc_lock);
+	swap_slots_free(cache->slots + cache->cur, cache->nr);
+	cache->cur = cache->nr = 0;
+	mutex_unlock(&cache->alloc_lock);
+
+	spin_lock(&cache->free_lock);
+	swap_slots_free(cache->slots_ret, cache->n_ret);
+	cache->n_ret = 0;
+	spin_unlock(&cache->free_lock);
+}
+
+static void drain_all_slots_caches(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		drain_slots_cache_cpu(cpu);
+}
+
+/*
+ * swapoff must not race with slots sitting in the caches; nested users
+ * are counted so the caches come back when the last one is done.
+ */
+static void swap_slots_cache_disable(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	if (!swap_slots_cache_disabled++) {
+		swap_slots_cache_enabled = false;
+		drain_all_slots_caches();
+	}
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+static void swap_slots_cache_enable(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	if (!--swap_slots_cache_disabled)
+		swap_slots_cache_enabled = true;
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+static swp_entry_t get_swap_page_cached(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry = { 0 };
+
+	/*
+	 * Preemptible: if we migrate meanwhile we just use another cpu's
+	 * cache, which alloc_lock keeps consistent.
+	 */
+	cache = &per_cpu(swp_slots, raw_smp_processor_id());
+	mutex_lock(&cache->alloc_lock);
+	if (swap_slots_cache_enabled) {
+		if (!cache->nr && swap_slots_cache_worthwhile()) {
+			spin_lock(&swap_lock);
+			cache->nr = __get_swap_pages(SWAP_SLOTS_CACHE_SIZE,
+						     cache->slots);
+			spin_unlock(&swap_lock);
+			cache->cur = 0;
+		}
+		if (cache->nr) {
+			entry = cache->slots[cache->cur++];
+			cache->nr--;
+		}
+	}
+	mutex_unlock(&cache->alloc_lock);
+
+	return entry;
+}
+
+/*
+ * Queue a slot whose swap cache reference was the last one for batched
+ * freeing. Nothing can take a new reference meanwhile: the page has
+ * already left the swap cache and no pte or shmem inode points to it.
+ */
+static bool swapcache_free_cached(swp_entry_t entry)
+{
+	struct swap_slots_cache *cache;
+	struct swap_info_struct *p;
+	unsigned long type, offset;
+	bool queued = false;
+
+	if (!swap_slots_cache_enabled)
+		return false;
+
+	type = swp_type(entry);
+	offset = swp_offset(entry);
+	if (type >= nr_swapfiles)
+		return false;
+	p = swap_info[type];
+	if (!(p->flags & SWP_USED) || offset >= p->max ||
+	    ACCESS_ONCE(p->swap_map[offset]) != SWAP_HAS_CACHE)
+		return false;
+
+	cache = &get_cpu_var(swp_slots);
+	spin_lock(&cache->free_lock);
+	if (swap_slots_cache_enabled) {
+		cache->slots_ret[cache->n_ret++] = entry;
+		if (cache->n_ret == SWAP_SLOTS_CACHE_SIZE) {
+			swap_slots_free(cache->slots_ret, cache->n_ret);
+			cache->n_ret = 0;
+		}
+		queued = true;
+	}
+	spin_unlock(&cache->free_lock);
+	put_cpu_var(swp_slots);
+
+	return queued;
+}
+
+static int __cpuinit swap_slots_cpu_notify(struct notifier_block *self,
+					   unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_slots_cache_cpu((unsigned long)hcpu);
+	return NOTIFY_OK;
+}
+
+static int __init swap_slots_cache_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+		mutex_init(&cache->alloc_lock);
+		spin_lock_init(&cache->free_lock);
+	}
+	hotcpu_notifier(swap_slots_cpu_notify, 0);
+	swap_slots_cache_enabled = true;
+	return 0;
+}
+__initcall(swap_slots_cache_init);
+
+swp_entry_t get_swap_page(void)
+{
+	swp_entry_t entry;
+	int retried = 0;
+
+	entry = get_swap_page_cached();
+	if (entry.val)
+		return entry;
+
+retry:
+	spin_lock(&swap_lock);
+	if (!__get_swap_pages(1, &entry))
+		entry.val = 0;
+	spin_unlock(&swap_lock);
+
+	/* other cpus may be sitting on the last free slots */
+	if (!entry.val && !retried++ && swap_slots_cache_enabled) {
+		drain_all_slots_caches();
+		goto retry;
+	}
+	return entry;
 }
 
 /* The only caller of this function is now susupend routine */
@@ -556,6 +785,7 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 			swap_list.next = p->type;
 		nr_swap_pages++;
 		p->inuse_pages--;
+		frontswap_invalidate_page(p->type, offset);
 		if ((p->flags & SWP_BLKDEV) &&
 				disk->fops->swap_slot_free_notify)
 			disk->fops->swap_slot_free_notify(p->bdev, offset);
@@ -587,6 +817,12 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 	struct swap_info_struct *p;
 	unsigned char count;
 
+	if (swapcache_free_cached(entry)) {
+		if (page)
+			mem_cgroup_uncharge_swapcache(page, entry, false);
+		return;
+	}
+
 	p = swap_info_get(entry);
 	if (p) {
 		count = swap_entry_free(p, entry, SWAP_HAS_CACHE);
@@ -596,6 +832,24 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 	}
 }
 
+/*
+ * Unlocked peek at the swap count of an entry, for callers that can
+ * tolerate a stale answer.
+ */
+int __swp_swapcount(swp_entry_t entry)
+{
+	struct swap_info_struct *p;
+	unsigned long type = swp_type(entry);
+	pgoff_t offset = swp_offset(entry);
+
+	if (type >= nr_swapfiles)
+		return 0;
+	p = swap_info[type];
+	if (!(p->flags & SWP_USED) || offset >= p->max)
+		return 0;
+	return swap_count(ACCESS_ONCE(p->swap_map[offset]));
+}
+
 /*
  * How many references to page are currently swapped out?
  * This does not give an exact answer when swap count is continued,
@@ -1016,11 +1270,12 @@ static int unuse_mm(struct mm_struct *mm,
 }
 
 /*
- * Scan swap_map from current position to next entry still in use.
+ * Scan swap_map (or frontswap_map if frontswap parameter is true)
+ * from current position to next entry still in use.
  * Recycle to start on reaching the end, returning 0 when empty.
  */
 static unsigned int find_next_to_unuse(struct swap_info_struct *si,
-					unsigned int prev)
+					unsigned int prev, bool frontswap)
 {
 	unsigned int max = si->max;
 	unsigned int i = prev;
@@ -1046,6 +1301,12 @@ static unsigned int find_next_to_unuse(struct swap_info_struct *si,
 			prev = 0;
 			i = 1;
 		}
+		if (frontswap) {
+			if (frontswap_test(si, i))
+				break;
+			else
+				continue;
+		}
 		count = si->swap_map[i];
 		if (count && swap_count(count) != SWAP_MAP_BAD)
 			break;
@@ -1057,8 +1318,12 @@ static unsigned int find_next_to_unuse(struct swap_info_struct *si,
  * We completely avoid races by reading each swap page in advance,
  * and then search for the process using it.  All the necessary
  * page table adjustments can then be made atomically.
+ *
+ * if the boolean frontswap is true, only unuse pages_to_unuse pages;
+ * pages_to_unuse==0 means all pages; ignored if frontswap is false
  */
-static int try_to_unuse(unsigned int type)
+int try_to_unuse(unsigned int type, bool frontswap,
+		 unsigned long pages_to_unuse)
 {
 	struct swap_info_struct *si = swap_info[type];
 	struct mm_struct *start_mm;
@@ -1091,7 +1356,7 @@ static int try_to_unuse(unsigned int type)
 	 * one pass through swap_map is enough, but not necessarily:
 	 * there are races when an instance of an entry might be missed.
 	 */
-	while ((i = find_next_to_unuse(si, i)) != 0) {
+	while ((i = find_next_to_unuse(si, i, frontswap)) != 0) {
 		if (signal_pending(current)) {
 			retval = -EINTR;
 			break;
@@ -1258,6 +1523,10 @@ static int try_to_unuse(unsigned int type)
 		 * interactive performance.
 		 */
 		cond_resched();
+		if (frontswap && pages_to_unuse > 0) {
+			if (!--pages_to_unuse)
+				break;
+		}
 	}
 
 	mmput(start_mm);
@@ -1517,7 +1786,8 @@ bad_bmap:
 }
 
 static void enable_swap_info(struct swap_info_struct *p, int prio,
-				unsigned char *swap_map)
+				unsigned char *swap_map,
+				unsigned long *frontswap_map)
 {
 	int i, prev;
 
@@ -1527,6 +1797,7 @@ static void enable_swap_info(struct swap_info_struct *p, int prio,
 	else
 		p->prio = --least_priority;
 	p->swap_map = swap_map;
+	frontswap_map_set(p, frontswap_map);
 	p->flags |= SWP_WRITEOK;
 	nr_swap_pages += p->pages;
 	total_swap_pages += p->pages;
@@ -1544,6 +1815,8 @@ static void enable_swap_info(struct swap_info_struct *p, int prio,
 	else
 		swap_info[prev]->next = p->type;
 	spin_unlock(&swap_lock);
+
+	frontswap_init(p->type);
 }
 
 SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
@@ -1615,9 +1888,11 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->flags &= ~SWP_WRITEOK;
 	spin_unlock(&swap_lock);
 
+	swap_slots_cache_disable();
 	oom_score_adj = test_set_oom_score_adj(OOM_SCORE_ADJ_MAX);
-	err = try_to_unuse(type);
+	err = try_to_unuse(type, false, 0); /* force all pages to be unused */
 	compare_swap_oom_score_adj(OOM_SCORE_ADJ_MAX, oom_score_adj);
+	swap_slots_cache_enable();
 
 	if (err) {
 		/*
@@ -1627,7 +1902,8 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 		 * sys_swapoff for this swap_info_struct at this point.
 		 */
 		/* re-insert swap space back into swap_list */
-		enable_swap_info(p, p->prio, p->swap_map);
+		enable_swap_info(p, p->prio, p->swap_map,
+				 frontswap_map_get(p));
 		goto out_dput;
 	}
 
@@ -1653,9 +1929,12 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
 	p->flags = 0;
+	frontswap_invalidate_area(type);
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
 	vfree(swap_map);
+	vfree(frontswap_map_get(p));
+	frontswap_map_set(p, NULL);
 	/* Destroy swap account informatin */
 	swap_cgroup_swapoff(type);
 
@@ -2015,6 +2294,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	sector_t span;
 	unsigned long maxpages;
 	unsigned char *swap_map = NULL;
+	unsigned long *frontswap_map = NULL;
 	struct page *page = NULL;
 	struct inode *inode = NULL;
 
@@ -2099,6 +2379,9 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		goto bad_swap;
 	}
 
+	if (frontswap_enabled)
+		frontswap_map = vzalloc(BITS_TO_LONGS(maxpages) * sizeof(long));
+
 	if (p->bdev) {
 		if (blk_queue_nonrot(bdev_get_queue(p->bdev))) {
 			p->flags |= SWP_SOLIDSTATE;
@@ -2113,14 +2396,15 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	if (swap_flags & SWAP_FLAG_PREFER)
 		prio =
 		  (swap_flags & SWAP_FLAG_PRIO_MASK) >> SWAP_FLAG_PRIO_SHIFT;
-	enable_swap_info(p, prio, swap_map);
+	enable_swap_info(p, prio, swap_map, frontswap_map);
 
 	printk(KERN_INFO "Adding %uk swap on %s.  "
-			"Priority:%d extents:%d across:%lluk %s%s\n",
+			"Priority:%d extents:%d across:%lluk %s%s%s\n",
 		p->pages<<(PAGE_SHIFT-10), name, p->prio,
 		nr_extents, (unsigned long long)span<<(PAGE_SHIFT-10),
 		(p->flags & SWP_SOLIDSTATE) ? "SS" : "",
-		(p->flags & SWP_DISCARDABLE) ? "D" : "");
+		(p->flags & SWP_DISCARDABLE) ? "D" : "",
+		(frontswap_map) ? "FS" : "");
 
 	mutex_unlock(&swapon_mutex);
 	atomic_inc(&proc_poll_event);
@@ -2142,6 +2426,7 @@ bad_swap:
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	vfree(swap_map);
+	vfree(frontswap_map);
 	if (swap_file) {
 		if (inode && S_ISREG(inode->i_mode)) {
 			mutex_unlock(&inode->i_mutex);
@@ -24,6 +24,7 @@
 #include <linux/rbtree.h>
 #include <linux/radix-tree.h>
 #include <linux/rcupdate.h>
+#include <linux/llist.h>
 #include <linux/pfn.h>
 #include <linux/kmemleak.h>
 #include <linux/atomic.h>
@@ -255,20 +256,29 @@ struct vmap_area {
 	unsigned long flags;
 	struct rb_node rb_node;		/* address sorted rbtree */
 	struct list_head list;		/* address sorted list */
-	struct list_head purge_list;	/* "lazy purge" list */
+	struct llist_node purge_list;	/* "lazy purge" list */
 	struct vm_struct *vm;
-	struct rcu_head rcu_head;
+	unsigned long subtree_max_size;	/* free tree: largest block below */
 };
 
 static DEFINE_SPINLOCK(vmap_area_lock);
 static LIST_HEAD(vmap_area_list);
 static struct rb_root vmap_area_root = RB_ROOT;
 
-/* The vmap cache globals are protected by vmap_area_lock */
-static struct rb_node *free_vmap_cache;
-static unsigned long cached_hole_size;
-static unsigned long cached_vstart;
-static unsigned long cached_align;
+/*
+ * Free KVA, the complement of vmap_area_root over the whole address
+ * space, sorted by address.  Each node caches the size of the largest
+ * free block in its subtree, so the lowest block that fits a request
+ * is found without walking the busy areas.  Protected by vmap_area_lock.
+ */
+static struct rb_root free_vmap_area_root = RB_ROOT;
+
+/*
+ * Carving a request out of the middle of a free block leaves two blocks
+ * and needs a new node.  It is allocated before vmap_area_lock is taken
+ * and parked here, one per cpu.
+ */
+static DEFINE_PER_CPU(struct vmap_area *, ne_fit_preload_node);
 
 static unsigned long vmap_area_pcpu_hole;
 
@@ -318,9 +328,267 @@ static void __insert_vmap_area(struct vmap_area *va)
 	if (tmp) {
 		struct vmap_area *prev;
 		prev = rb_entry(tmp, struct vmap_area, rb_node);
-		list_add_rcu(&va->list, &prev->list);
+		list_add(&va->list, &prev->list);
+	} else
+		list_add(&va->list, &vmap_area_list);
+}
+
+static inline unsigned long va_size(struct vmap_area *va)
+{
+	return va->va_end - va->va_start;
+}
+
+static inline unsigned long get_subtree_max_size(struct rb_node *node)
+{
+	if (!node)
+		return 0;
+	return rb_entry(node, struct vmap_area, rb_node)->subtree_max_size;
+}
+
+static inline unsigned long compute_subtree_max_size(struct vmap_area *va)
+{
+	return max3(va_size(va),
+		    get_subtree_max_size(va->rb_node.rb_left),
+		    get_subtree_max_size(va->rb_node.rb_right));
+}
+
+static void free_vmap_area_augment_cb(struct rb_node *node, void *unused)
+{
+	struct vmap_area *va = rb_entry(node, struct vmap_area, rb_node);
+
+	va->subtree_max_size = compute_subtree_max_size(va);
+}
+
+/*
+ * The size of @va changed in place: fix up subtree_max_size towards the
+ * root, stopping as soon as a node's value does not change.
+ */
+static void augment_tree_propagate_from(struct vmap_area *va)
+{
+	struct rb_node *node = &va->rb_node;
+	unsigned long new_size;
+
+	while (node) {
+		va = rb_entry(node, struct vmap_area, rb_node);
+		new_size = compute_subtree_max_size(va);
+		if (va->subtree_max_size == new_size)
+			break;
+		va->subtree_max_size = new_size;
+		node = rb_parent(node);
+	}
+}
+
+static void insert_free_vmap_area(struct vmap_area *va)
+{
+	struct rb_node **p = &free_vmap_area_root.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		struct vmap_area *tmp_va;
+
+		parent = *p;
+		tmp_va = rb_entry(parent, struct vmap_area, rb_node);
+		if (va->va_end <= tmp_va->va_start)
+			p = &(*p)->rb_left;
+		else if (va->va_start >= tmp_va->va_end)
+			p = &(*p)->rb_right;
+		else
+			BUG();
+	}
+
+	va->subtree_max_size = va_size(va);
+	rb_link_node(&va->rb_node, parent, p);
+	rb_insert_color(&va->rb_node, &free_vmap_area_root);
+	rb_augment_insert(&va->rb_node, free_vmap_area_augment_cb, NULL);
+}
+
+static void unlink_free_vmap_area(struct vmap_area *va)
+{
+	struct rb_node *deepest;
+
+	deepest = rb_augment_erase_begin(&va->rb_node);
+	rb_erase(&va->rb_node, &free_vmap_area_root);
+	rb_augment_erase_end(deepest, free_vmap_area_augment_cb, NULL);
+}
+
+/*
+ * Return the address a request of @size/@align would get in the free
+ * block @va, given the lower bound @vstart, or 0 if it does not fit.
+ */
+static inline unsigned long va_fit_start(struct vmap_area *va,
+		unsigned long size, unsigned long align, unsigned long vstart)
+{
+	unsigned long addr = ALIGN(max(va->va_start, vstart), align);
+
+	/* Can be overflowed due to big size or alignment. */
+	if (addr + size < addr || addr < vstart)
+		return 0;
+	if (addr + size > va->va_end)
+		return 0;
+	return addr;
+}
+
+/*
+ * Find the lowest free block that can hold @size bytes aligned to
+ * @align at or above @vstart.  Subtrees whose largest block is smaller
+ * than size + align - 1 are skipped, which makes the search O(log n).
+ */
+static struct vmap_area *find_vmap_lowest_match(unsigned long size,
+		unsigned long align, unsigned long vstart)
+{
+	struct vmap_area *va;
+	struct rb_node *node;
+	unsigned long length;
+
+	node = free_vmap_area_root.rb_node;
+
+	/* Adjust the search size for alignment overhead. */
+	length = size + align - 1;
+
+	while (node) {
+		va = rb_entry(node, struct vmap_area, rb_node);
+
+		if (get_subtree_max_size(node->rb_left) >= length &&
+				vstart < va->va_start) {
+			node = node->rb_left;
+		} else {
+			if (va_fit_start(va, size, align, vstart))
+				return va;
+
+			/*
+			 * Does not make sense to go deeper towards the right
+			 * sub-tree if it does not have a free block that is
+			 * equal or bigger to the requested search length.
+			 */
+			if (get_subtree_max_size(node->rb_right) >= length) {
+				node = node->rb_right;
+				continue;
+			}
+
+			/*
+			 * Roll back and find the first right sub-tree that
+			 * satisfies the search.  This happens because of the
+			 * vstart limit or an alignment overhead bigger than
+			 * a page.  Moving vstart past each parent keeps us
+			 * from descending into a subtree already checked.
+			 */
+			while ((node = rb_parent(node))) {
+				va = rb_entry(node, struct vmap_area, rb_node);
+				if (va_fit_start(va, size, align, vstart))
+					return va;
+
+				if (get_subtree_max_size(node->rb_right) >= length &&
+						vstart <= va->va_start) {
+					vstart = va->va_start + 1;
+					node = node->rb_right;
+					break;
+				}
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Take [addr, addr + size) out of the free block @va, which contains it.
+ * Returns -ENOMEM if the block has to be split and no node is at hand.
+ */
+static int carve_free_vmap_area(struct vmap_area *va,
+		unsigned long addr, unsigned long size)
+{
+	struct vmap_area *lva;
+
+	if (va->va_start == addr && va->va_end == addr + size) {
+		unlink_free_vmap_area(va);
+		kfree(va);
+	} else if (va->va_start == addr) {
+		va->va_start = addr + size;
+		augment_tree_propagate_from(va);
+	} else if (va->va_end == addr + size) {
+		va->va_end = addr;
+		augment_tree_propagate_from(va);
+	} else {
+		lva = __this_cpu_read(ne_fit_preload_node);
+		if (lva)
+			__this_cpu_write(ne_fit_preload_node, NULL);
+		else
+			lva = kmalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+		if (unlikely(!lva))
+			return -ENOMEM;
+
+		lva->va_start = va->va_start;
+		lva->va_end = addr;
+		va->va_start = addr + size;
+		augment_tree_propagate_from(va);
+		insert_free_vmap_area(lva);
+	}
+	return 0;
+}
+
+/* Find the free block containing [addr, addr + size) and carve it out. */
+static int carve_free_vmap_range(unsigned long addr, unsigned long size)
+{
+	struct rb_node *n = free_vmap_area_root.rb_node;
+
+	while (n) {
+		struct vmap_area *va;
+
+		va = rb_entry(n, struct vmap_area, rb_node);
+		if (addr < va->va_start)
+			n = n->rb_left;
+		else if (addr >= va->va_end)
+			n = n->rb_right;
+		else {
+			BUG_ON(addr + size > va->va_end);
+			return carve_free_vmap_area(va, addr, size);
+		}
+	}
+	BUG();
+	return -EINVAL;
+}
+
+/*
+ * Give @va's range back to the free tree, merging it with the free
+ * blocks on either side.  @va is either reused as the free node or freed.
+ */
+static void merge_free_vmap_area(struct vmap_area *va)
+{
+	struct rb_node *n = free_vmap_area_root.rb_node;
+	struct vmap_area *prev = NULL, *next = NULL;
+
+	/* the last nodes we went left and right at are the neighbours */
+	while (n) {
+		struct vmap_area *tmp_va;
+
+		tmp_va = rb_entry(n, struct vmap_area, rb_node);
+		if (va->va_end <= tmp_va->va_start) {
+			next = tmp_va;
+			n = n->rb_left;
+		} else if (va->va_start >= tmp_va->va_end) {
+			prev = tmp_va;
+			n = n->rb_right;
+		} else
+			BUG();
+	}
+
+	if (next && next->va_start == va->va_end) {
+		if (prev && prev->va_end == va->va_start) {
+			unlink_free_vmap_area(next);
+			prev->va_end = next->va_end;
+			augment_tree_propagate_from(prev);
+			kfree(next);
+		} else {
+			next->va_start = va->va_start;
+			augment_tree_propagate_from(next);
+		}
+		kfree(va);
+	} else if (prev && prev->va_end == va->va_start) {
+		prev->va_end = va->va_end;
+		augment_tree_propagate_from(prev);
+		kfree(va);
 	} else
-		list_add_rcu(&va->list, &vmap_area_list);
+		insert_free_vmap_area(va);
 }
 
 static void purge_vmap_area_lazy(void);
@@ -334,11 +602,9 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 				unsigned long vstart, unsigned long vend,
 				int node, gfp_t gfp_mask)
 {
-	struct vmap_area *va;
-	struct rb_node *n;
+	struct vmap_area *va, *pva, *free;
 	unsigned long addr;
 	int purged = 0;
-	struct vmap_area *first;
 
 	BUG_ON(!size);
 	BUG_ON(size & ~PAGE_MASK);
@@ -350,85 +616,32 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 		return ERR_PTR(-ENOMEM);
 
 retry:
-	spin_lock(&vmap_area_lock);
 	/*
-	 * Invalidate cache if we have more permissive parameters.
-	 * cached_hole_size notes the largest hole noticed _below_
-	 * the vmap_area cached in free_vmap_cache: if size fits
-	 * into that hole, we want to scan from vstart to reuse
-	 * the hole instead of allocating above free_vmap_cache.
-	 * Note that __free_vmap_area may update free_vmap_cache
-	 * without updating cached_hole_size or cached_align.
+	 * Make sure this cpu has a spare node for splitting a free block,
+	 * while we can still sleep.  If we migrate after this, or another
+	 * task takes the node first, the split falls back to GFP_NOWAIT.
 	 */
-	if (!free_vmap_cache ||
-			size < cached_hole_size ||
-			vstart < cached_vstart ||
-			align < cached_align) {
-nocache:
-		cached_hole_size = 0;
-		free_vmap_cache = NULL;
+	if (!this_cpu_read(ne_fit_preload_node)) {
+		pva = kmalloc_node(sizeof(struct vmap_area),
+				gfp_mask & GFP_RECLAIM_MASK, node);
+		if (pva && this_cpu_cmpxchg(ne_fit_preload_node, NULL, pva))
+			kfree(pva);
 	}
-	/* record if we encounter less permissive parameters */
-	cached_vstart = vstart;
-	cached_align = align;
-
-	/* find starting point for our search */
-	if (free_vmap_cache) {
-		first = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-		addr = ALIGN(first->va_end, align);
-		if (addr < vstart)
-			goto nocache;
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-	} else {
-		addr = ALIGN(vstart, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = vmap_area_root.rb_node;
-		first = NULL;
-
-		while (n) {
-			struct vmap_area *tmp;
-			tmp = rb_entry(n, struct vmap_area, rb_node);
-			if (tmp->va_end >= addr) {
-				first = tmp;
-				if (tmp->va_start <= addr)
-					break;
-				n = n->rb_left;
-			} else
-				n = n->rb_right;
-		}
 
-		if (!first)
-			goto found;
-	}
-
-	/* from the starting point, walk areas until a suitable hole is found */
-	while (addr + size > first->va_start && addr + size <= vend) {
-		if (addr + cached_hole_size < first->va_start)
-			cached_hole_size = first->va_start - addr;
-		addr = ALIGN(first->va_end, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = rb_next(&first->rb_node);
-		if (n)
-			first = rb_entry(n, struct vmap_area, rb_node);
-		else
-			goto found;
-	}
-
-found:
+	spin_lock(&vmap_area_lock);
+	free = find_vmap_lowest_match(size, align, vstart);
+	if (!free)
+		goto overflow;
+	addr = va_fit_start(free, size, align, vstart);
 	if (addr + size > vend)
 		goto overflow;
+	if (carve_free_vmap_area(free, addr, size))
+		goto overflow;
 
 	va->va_start = addr;
 	va->va_end = addr + size;
 	va->flags = 0;
 	__insert_vmap_area(va);
-	free_vmap_cache = &va->rb_node;
 	spin_unlock(&vmap_area_lock);
 
 	BUG_ON(va->va_start & (align-1));
@@ -456,24 +669,9 @@ static void __free_vmap_area(struct vmap_area *va)
 {
 	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
 
-	if (free_vmap_cache) {
-		if (va->va_end < cached_vstart) {
-			free_vmap_cache = NULL;
-		} else {
-			struct vmap_area *cache;
-			cache = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-			if (va->va_start <= cache->va_start) {
-				free_vmap_cache = rb_prev(&va->rb_node);
-				/*
-				 * We don't try to update cached_hole_size or
-				 * cached_align, but it won't go very wrong.
-				 */
-			}
-		}
-	}
 	rb_erase(&va->rb_node, &vmap_area_root);
 	RB_CLEAR_NODE(&va->rb_node);
-	list_del_rcu(&va->list);
+	list_del(&va->list);
 
 	/*
 	 * Track the highest possible candidate for pcpu area
@@ -484,7 +682,7 @@ static void __free_vmap_area(struct vmap_area *va)
 	if (va->va_end > VMALLOC_START && va->va_end <= VMALLOC_END)
 		vmap_area_pcpu_hole = max(vmap_area_pcpu_hole, va->va_end);
 
-	kfree_rcu(va, rcu_head);
+	merge_free_vmap_area(va);
 }
 
 /*
@@ -553,6 +751,13 @@ static unsigned long lazy_max_pages(void)
 
 static atomic_t vmap_lazy_nr = ATOMIC_INIT(0);
 
+/*
+ * Lazily freed areas waiting for a TLB flush, queued on the cpu that
+ * freed them so that frees do not contend with each other, and collected
+ * from all cpus in one go by __purge_vmap_area_lazy().
+ */
+static DEFINE_PER_CPU(struct llist_head, vmap_purge_list);
+
 /* for per-CPU blocks */
 static void purge_fragmented_blocks_allcpus(void);
 
@@ -579,10 +784,10 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 					int sync, int force_flush)
 {
 	static DEFINE_SPINLOCK(purge_lock);
-	LIST_HEAD(valist);
+	struct llist_node *valist = NULL;
 	struct vmap_area *va;
-	struct vmap_area *n_va;
 	int nr = 0;
+	int cpu;
 
 	/*
 	 * If sync is 0 but force_flush is 1, we'll go sync anyway but callers
@@ -598,20 +803,24 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (sync)
 		purge_fragmented_blocks_allcpus();
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(va, &vmap_area_list, list) {
-		if (va->flags & VM_LAZY_FREE) {
+	for_each_possible_cpu(cpu) {
+		struct llist_node *node, *next;
+
+		node = llist_del_all(&per_cpu(vmap_purge_list, cpu));
+		for (; node; node = next) {
+			next = node->next;
+			va = llist_entry(node, struct vmap_area, purge_list);
 			if (va->va_start < *start)
 				*start = va->va_start;
 			if (va->va_end > *end)
 				*end = va->va_end;
 			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			list_add_tail(&va->purge_list, &valist);
 			va->flags |= VM_LAZY_FREEING;
 			va->flags &= ~VM_LAZY_FREE;
+			node->next = valist;
+			valist = node;
 		}
 	}
-	rcu_read_unlock();
 
 	if (nr)
 		atomic_sub(nr, &vmap_lazy_nr);
@@ -621,8 +830,11 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 
 	if (nr) {
 		spin_lock(&vmap_area_lock);
-		list_for_each_entry_safe(va, n_va, &valist, purge_list)
+		while (valist) {
+			va = llist_entry(valist, struct vmap_area, purge_list);
+			valist = valist->next;
 			__free_vmap_area(va);
+		}
 		spin_unlock(&vmap_area_lock);
 	}
 	spin_unlock(&purge_lock);
@@ -657,6 +869,8 @@ static void purge_vmap_area_lazy(void)
 static void free_vmap_area_noflush(struct vmap_area *va)
 {
 	va->flags |= VM_LAZY_FREE;
+	llist_add(&va->purge_list, &get_cpu_var(vmap_purge_list));
+	put_cpu_var(vmap_purge_list);
 	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
 	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
 		try_purge_vmap_area_lazy();
@@ -742,6 +956,7 @@ struct vmap_block_queue {
 struct vmap_block {
 	spinlock_t lock;
 	struct vmap_area *va;
+	unsigned long va_start;		/* va may be gone for RCU walkers */
 	struct vmap_block_queue *vbq;
 	unsigned long free, dirty;
 	DECLARE_BITMAP(alloc_map, VMAP_BBMAP_BITS);
@@ -808,6 +1023,7 @@ static struct vmap_block *new_vmap_block(gfp_t gfp_mask)
 
 	spin_lock_init(&vb->lock);
 	vb->va = va;
+	vb->va_start = va->va_start;
 	vb->free = VMAP_BBMAP_BITS;
 	vb->dirty = 0;
 	bitmap_zero(vb->alloc_map, VMAP_BBMAP_BITS);
@@ -1032,8 +1248,8 @@ void vm_unmap_aliases(void)
 				j = find_next_zero_bit(vb->dirty_map,
 					VMAP_BBMAP_BITS, i);
 
-				s = vb->va->va_start + (i << PAGE_SHIFT);
-				e = vb->va->va_start + (j << PAGE_SHIFT);
+				s = vb->va_start + (i << PAGE_SHIFT);
+				e = vb->va_start + (j << PAGE_SHIFT);
 				flush = 1;
 
 				if (s < start)
@@ -1170,8 +1386,9 @@ void __init vm_area_register_early(struct vm_struct *vm, size_t align)
 
 void __init vmalloc_init(void)
 {
-	struct vmap_area *va;
+	struct vmap_area *va, *free;
 	struct vm_struct *tmp;
+	unsigned long vmap_start;
 	int i;
 
 	for_each_possible_cpu(i) {
@@ -1185,6 +1402,8 @@ void __init vmalloc_init(void)
 	/* Import existing vmlist entries. */
 	for (tmp = vmlist; tmp; tmp = tmp->next) {
 		va = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+		/* early boot: nothing sensible to do without them */
+		BUG_ON(!va);
 		va->flags = VM_VM_AREA;
 		va->va_start = (unsigned long)tmp->addr;
 		va->va_end = va->va_start + tmp->size;
@@ -1192,6 +1411,26 @@ void __init vmalloc_init(void)
 		__insert_vmap_area(va);
 	}
 
+	/* Everything else is free. */
+	vmap_start = 1;
+	list_for_each_entry(va, &vmap_area_list, list) {
+		if (va->va_start > vmap_start) {
+			free = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+			BUG_ON(!free);
+			free->va_start = vmap_start;
+			free->va_end = va->va_start;
+			insert_free_vmap_area(free);
+		}
+		vmap_start = va->va_end;
+	}
+	if (vmap_start < ULONG_MAX) {
+		free = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+		BUG_ON(!free);
+		free->va_start = vmap_start;
+		free->va_end = ULONG_MAX;
+		insert_free_vmap_area(free);
+	}
+
 	vmap_area_pcpu_hole = VMALLOC_END;
 
 	vmap_initialized = true;
@@ -2462,7 +2701,27 @@ retry:
 		pvm_find_next_prev(base + end, &next, &prev);
 	}
 found:
-	/* we've found a fitting base, insert all va's */
+	/*
+	 * We've found a fitting base, take the ranges out of the free tree
+	 * first: a split there can fail for want of a node, and nothing
+	 * is visible in the busy tree yet.
+	 */
+	for (area = 0; area < nr_vms; area++) {
+		if (carve_free_vmap_range(base + offsets[area], sizes[area])) {
+			while (area--) {
+				struct vmap_area *va = vas[area];
+
+				va->va_start = base + offsets[area];
+				va->va_end = va->va_start + sizes[area];
+				merge_free_vmap_area(va);
+				vas[area] = NULL;
+			}
+			spin_unlock(&vmap_area_lock);
+			goto err_free;
+		}
+	}
+
+	/* and insert all va's */
 	for (area = 0; area < nr_vms; area++) {
 		struct vmap_area *va = vas[area];
 
@@ -42,6 +42,8 @@
 #include <linux/sysctl.h>
 #include <linux/oom.h>
 #include <linux/prefetch.h>
+#include <linux/memory_hotplug.h>
+#include <linux/ktime.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -1356,9 +1358,29 @@ static int too_many_isolated(struct zone *zone, int file,
 	return isolated > inactive;
 }
 
+/*
+ * Unevictable pages and freed compound pages need work that cannot be
+ * done under the lru_lock.  putback_inactive_pages() collects them on
+ * a list instead of dropping and retaking the lock for each one, and
+ * they are finished here once the lock is released.
+ */
+static void putback_deferred_pages(struct list_head *deferred)
+{
+	while (!list_empty(deferred)) {
+		struct page *page = lru_to_page(deferred);
+
+		list_del(&page->lru);
+		if (PageCompound(page) && !page_count(page))
+			(*get_compound_page_dtor(page))(page);
+		else
+			putback_lru_page(page);
+	}
+}
+
 static noinline_for_stack void
 putback_inactive_pages(struct mem_cgroup_zone *mz,
-		       struct list_head *page_list)
+		       struct list_head *page_list,
+		       struct list_head *deferred)
 {
 	struct zone_reclaim_stat *reclaim_stat = get_reclaim_stat(mz);
 	struct zone *zone = mz->zone;
@@ -1374,9 +1396,7 @@ putback_inactive_pages(struct mem_cgroup_zone *mz,
 		VM_BUG_ON(PageLRU(page));
 		list_del(&page->lru);
 		if (unlikely(!page_evictable(page, NULL))) {
-			spin_unlock_irq(&zone->lru_lock);
-			putback_lru_page(page);
-			spin_lock_irq(&zone->lru_lock);
+			list_add(&page->lru, deferred);
 			continue;
 		}
 		SetPageLRU(page);
@@ -1392,11 +1412,9 @@ putback_inactive_pages(struct mem_cgroup_zone *mz,
 			__ClearPageActive(page);
 			del_page_from_lru_list(zone, page, lru);
 
-			if (unlikely(PageCompound(page))) {
-				spin_unlock_irq(&zone->lru_lock);
-				(*get_compound_page_dtor(page))(page);
-				spin_lock_irq(&zone->lru_lock);
-			} else
+			if (unlikely(PageCompound(page)))
+				list_add(&page->lru, deferred);
+			else
 				list_add(&page->lru, &pages_to_free);
 		}
 	}
@@ -1503,6 +1521,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct mem_cgroup_zone *mz,
 		     struct scan_control *sc, int priority, int file)
 {
 	LIST_HEAD(page_list);
+	LIST_HEAD(deferred);
 	unsigned long nr_scanned;
 	unsigned long nr_reclaimed = 0;
 	unsigned long nr_taken;
@@ -1577,13 +1596,14 @@ shrink_inactive_list(unsigned long nr_to_scan, struct mem_cgroup_zone *mz,
 					       nr_reclaimed);
 	}
 
-	putback_inactive_pages(mz, &page_list);
+	putback_inactive_pages(mz, &page_list, &deferred);
 
 	__mod_zone_page_state(zone, NR_ISOLATED_ANON, -nr_anon);
 	__mod_zone_page_state(zone, NR_ISOLATED_FILE, -nr_file);
 
 	spin_unlock_irq(&zone->lru_lock);
 
+	putback_deferred_pages(&deferred);
 	free_hot_cold_page_list(&page_list, 1);
 
 	/*
@@ -2073,6 +2093,13 @@ static inline bool should_continue_reclaim(struct mem_cgroup_zone *mz,
 	}
 }
 
+/*
+ * kswapd has no small reclaim target to overshoot, so it isolates in
+ * larger batches and takes the lru_lock a quarter as often for the same
+ * number of pages scanned.
+ */
+#define KSWAPD_CLUSTER_MAX	(SWAP_CLUSTER_MAX * 4)
+
 /*
  * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
  */
@@ -2080,6 +2107,8 @@ static void shrink_mem_cgroup_zone(int priority, struct mem_cgroup_zone *mz,
 				   struct scan_control *sc)
 {
 	unsigned long nr[NR_LRU_LISTS];
+	unsigned long batch = current_is_kswapd() ? KSWAPD_CLUSTER_MAX :
+						    SWAP_CLUSTER_MAX;
 	unsigned long nr_to_scan;
 	enum lru_list lru;
 	unsigned long nr_reclaimed, nr_scanned;
@@ -2096,8 +2125,7 @@ restart:
 					nr[LRU_INACTIVE_FILE]) {
 		for_each_evictable_lru(lru) {
 			if (nr[lru]) {
-				nr_to_scan = min_t(unsigned long,
-						   nr[lru], SWAP_CLUSTER_MAX);
+				nr_to_scan = min(nr[lru], batch);
 				nr[lru] -= nr_to_scan;
 
 				nr_reclaimed += shrink_list(lru, nr_to_scan,
@@ -2431,10 +2459,61 @@ out:
 	return 0;
 }
 
+/*
+ * Direct reclaimers on one node mostly contend with each other for the
+ * lru_lock and isolate pages out from under each other.  Once enough of
+ * them are at it, further ones kick kswapd and wait for a reclaimer to
+ * finish, or for kswapd to restore the watermark, rather than joining
+ * in.  Returns true if the wait left enough free memory to retry the
+ * allocation without reclaiming at all.
+ */
+static bool throttle_direct_reclaim(struct zone *zone, gfp_t gfp_mask,
+				    int order)
+{
+	pg_data_t *pgdat = zone->zone_pgdat;
+	int limit = max_t(int, nr_cpus_node(pgdat->node_id) / 2, 4);
+
+	if (atomic_read(&pgdat->nr_reclaimers) < limit)
+		return false;
+
+	/* Don't hold up writeback we may be holding fs locks for */
+	if (!(gfp_mask & __GFP_FS) || (current->flags & PF_KTHREAD) ||
+	    fatal_signal_pending(current))
+		return false;
+
+	count_vm_event(ALLOCSTALL_THROTTLED);
+	wakeup_kswapd(zone, order, zone_idx(zone));
+	wait_event_interruptible_timeout(pgdat->reclaim_wait,
+		atomic_read(&pgdat->nr_reclaimers) < limit ||
+		zone_watermark_ok_safe(zone, order, low_wmark_pages(zone),
+				       zone_idx(zone), 0), HZ/10);
+
+	return zone_watermark_ok_safe(zone, order, low_wmark_pages(zone),
+				      zone_idx(zone), 0);
+}
+
+static void count_direct_reclaim_latency(ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+
+	count_vm_events(DIRECT_RECLAIM_US, us);
+	if (us < USEC_PER_MSEC)
+		count_vm_event(DIRECT_RECLAIM_LT_1MS);
+	else if (us < 10 * USEC_PER_MSEC)
+		count_vm_event(DIRECT_RECLAIM_LT_10MS);
+	else if (us < 100 * USEC_PER_MSEC)
+		count_vm_event(DIRECT_RECLAIM_LT_100MS);
+	else
+		count_vm_event(DIRECT_RECLAIM_SLOW);
+}
+
 unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 				gfp_t gfp_mask, nodemask_t *nodemask)
 {
 	unsigned long nr_reclaimed;
+	struct zone *preferred_zone;
+	pg_data_t *pgdat = NULL;
+	ktime_t start = ktime_get();
 	struct scan_control sc = {
 		.gfp_mask = gfp_mask,
 		.may_writepage = !laptop_mode,
@@ -2449,6 +2528,17 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 		.gfp_mask = sc.gfp_mask,
 	};
 
+	first_zones_zonelist(zonelist, gfp_zone(gfp_mask), nodemask,
+			     &preferred_zone);
+	if (preferred_zone) {
+		if (throttle_direct_reclaim(preferred_zone, gfp_mask, order)) {
+			count_direct_reclaim_latency(start);
+			return 1;
+		}
+		pgdat = preferred_zone->zone_pgdat;
+		atomic_inc(&pgdat->nr_reclaimers);
+	}
+
 	trace_mm_vmscan_direct_reclaim_begin(order,
 				sc.may_writepage,
 				gfp_mask);
@@ -2457,6 +2547,14 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 
 	trace_mm_vmscan_direct_reclaim_end(nr_reclaimed);
 
+	if (pgdat) {
+		atomic_dec(&pgdat->nr_reclaimers);
+		smp_mb__after_atomic_dec();
+		if (waitqueue_active(&pgdat->reclaim_wait))
+			wake_up_interruptible(&pgdat->reclaim_wait);
+	}
+	count_direct_reclaim_latency(start);
+
 	return nr_reclaimed;
 }
 
@@ -2989,6 +3087,30 @@ out:
 	return order;
 }
 
+/*
+ * vmstat counters are not perfectly accurate and the estimated value for
+ * counters such as NR_FREE_PAGES can deviate from the true value by
+ * nr_online_cpus * threshold. To avoid the zone watermarks being breached
+ * while under pressure, we reduce the per-cpu vmstat threshold while any
+ * kswapd thread of the node is awake and restore it once they all sleep.
+ */
+static DEFINE_MUTEX(kswapd_awake_lock);
+
+static void kswapd_set_awake(pg_data_t *pgdat, bool awake)
+{
+	mutex_lock(&kswapd_awake_lock);
+	if (awake) {
+		if (!pgdat->kswapd_awake++)
+			set_pgdat_percpu_threshold(pgdat,
+						   calculate_pressure_threshold);
+	} else {
+		if (!--pgdat->kswapd_awake)
+			set_pgdat_percpu_threshold(pgdat,
+						   calculate_normal_threshold);
+	}
+	mutex_unlock(&kswapd_awake_lock);
+}
+
 static void kswapd_try_to_sleep(pg_data_t *pgdat, int order, int classzone_idx)
 {
 	long remaining = 0;
@@ -3013,20 +3135,10 @@ static void kswapd_try_to_sleep(pg_data_t *pgdat, int order, int classzone_idx)
 	if (!sleeping_prematurely(pgdat, order, remaining, classzone_idx)) {
 		trace_mm_vmscan_kswapd_sleep(pgdat->node_id);
 
-		/*
-		 * vmstat counters are not perfectly accurate and the estimated
-		 * value for counters such as NR_FREE_PAGES can deviate from the
-		 * true value by nr_online_cpus * threshold. To avoid the zone
-		 * watermarks being breached while under pressure, we reduce the
-		 * per-cpu vmstat threshold while kswapd is awake and restore
-		 * them before going back to sleep.
-		 */
-		set_pgdat_percpu_threshold(pgdat, calculate_normal_threshold);
-
+		kswapd_set_awake(pgdat, false);
 		if (!kthread_should_stop())
 			schedule();
-
-		set_pgdat_percpu_threshold(pgdat, calculate_pressure_threshold);
+		kswapd_set_awake(pgdat, true);
 	} else {
 		if (remaining)
 			count_vm_event(KSWAPD_LOW_WMARK_HIT_QUICKLY);
@@ -3083,6 +3195,7 @@ static int kswapd(void *p)
 	 */
 	tsk->flags |= PF_MEMALLOC | PF_SWAPWRITE | PF_KSWAPD;
 	set_freezable();
+	kswapd_set_awake(pgdat, true);
 
 	order = new_order = 0;
 	balanced_order = 0;
@@ -3131,13 +3244,22 @@ static int kswapd(void *p)
 		 * after returning from the refrigerator
 		 */
 		if (!ret) {
+			ktime_t start = ktime_get();
+
 			trace_mm_vmscan_kswapd_wake(pgdat->node_id, order);
 			balanced_classzone_idx = classzone_idx;
 			balanced_order = balance_pgdat(pgdat, order,
 						&balanced_classzone_idx);
+			count_vm_events(KSWAPD_RECLAIM_US,
+					ktime_us_delta(ktime_get(), start));
+
+			/* let throttled direct reclaimers recheck */
+			if (waitqueue_active(&pgdat->reclaim_wait))
+				wake_up_interruptible(&pgdat->reclaim_wait);
 		}
 	}
 
+	kswapd_set_awake(pgdat, false);
 	current->reclaim_state = NULL;
 	return 0;
 }
@@ -3262,34 +3384,70 @@ static int __devinit cpu_callback(struct notifier_block *nfb,
 
 			mask = cpumask_of_node(pgdat->node_id);
 
-			if (cpumask_any_and(cpu_online_mask, mask) < nr_cpu_ids)
+			if (cpumask_any_and(cpu_online_mask, mask) < nr_cpu_ids) {
+				int i;
+
 				/* One of our CPUs online: restore mask */
 				set_cpus_allowed_ptr(pgdat->kswapd, mask);
+				for (i = 0; i < MAX_KSWAPD_THREADS - 1; i++)
+					if (pgdat->kswapd_extra[i])
+						set_cpus_allowed_ptr(
+							pgdat->kswapd_extra[i],
+							mask);
+			}
 		}
 	}
 	return NOTIFY_OK;
 }
 
+/*
+ * Number of kswapd threads per node.  The extra threads run the same loop
+ * and share the node's wakeups, so a node whose allocation rate outruns a
+ * single kswapd is reclaimed in parallel instead of pushing the
+ * allocators into direct reclaim.
+ */
+int kswapd_threads = 1;
+static DEFINE_MUTEX(kswapd_threads_lock);
+
 /*
  * This kswapd start function will be called by init and node-hot-add.
  * On node-hot-add, kswapd will moved to proper cpus if cpus are hot-added.
+ * It also starts or stops the extra threads to match kswapd_threads.
  */
 int kswapd_run(int nid)
 {
 	pg_data_t *pgdat = NODE_DATA(nid);
-	int ret = 0;
+	struct task_struct *tsk;
+	int i;
 
-	if (pgdat->kswapd)
-		return 0;
+	if (!pgdat->kswapd) {
+		tsk = kthread_run(kswapd, pgdat, "kswapd%d", nid);
+		if (IS_ERR(tsk)) {
+			/* failure at boot is fatal */
+			BUG_ON(system_state == SYSTEM_BOOTING);
+			printk("Failed to start kswapd on node %d\n",nid);
+			return -1;
+		}
+		pgdat->kswapd = tsk;
+	}
 
-	pgdat->kswapd = kthread_run(kswapd, pgdat, "kswapd%d", nid);
-	if (IS_ERR(pgdat->kswapd)) {
-		/* failure at boot is fatal */
-		BUG_ON(system_state == SYSTEM_BOOTING);
-		printk("Failed to start kswapd on node %d\n",nid);
-		ret = -1;
+	for (i = 0; i < MAX_KSWAPD_THREADS - 1; i++) {
+		tsk = pgdat->kswapd_extra[i];
+		if (i < kswapd_threads - 1 && !tsk) {
+			tsk = kthread_run(kswapd, pgdat, "kswapd%d:%d",
+					  nid, i + 1);
+			if (IS_ERR(tsk)) {
+				printk("Failed to start kswapd%d:%d\n",
+				       nid, i + 1);
+				return -1;
+			}
+			pgdat->kswapd_extra[i] = tsk;
+		} else if (i >= kswapd_threads - 1 && tsk) {
+			kthread_stop(tsk);
+			pgdat->kswapd_extra[i] = NULL;
+		}
 	}
-	return ret;
+	return 0;
 }
 
 /*
@@ -3298,12 +3456,37 @@ int kswapd_run(int nid)
  */
 void kswapd_stop(int nid)
 {
-	struct task_struct *kswapd = NODE_DATA(nid)->kswapd;
+	pg_data_t *pgdat = NODE_DATA(nid);
+	int i;
+
+	for (i = 0; i < MAX_KSWAPD_THREADS - 1; i++) {
+		if (pgdat->kswapd_extra[i]) {
+			kthread_stop(pgdat->kswapd_extra[i]);
+			pgdat->kswapd_extra[i] = NULL;
+		}
+	}
+	if (pgdat->kswapd) {
+		kthread_stop(pgdat->kswapd);
+		pgdat->kswapd = NULL;
+	}
+}
 
-	if (kswapd) {
-		kthread_stop(kswapd);
-		NODE_DATA(nid)->kswapd = NULL;
+int kswapd_threads_sysctl_handler(ctl_table *table, int write,
+				  void __user *buffer, size_t *length,
+				  loff_t *ppos)
+{
+	int nid, ret;
+
+	mutex_lock(&kswapd_threads_lock);
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (!ret && write) {
+		lock_memory_hotplug();
+		for_each_node_state(nid, N_HIGH_MEMORY)
+			kswapd_run(nid);
+		unlock_memory_hotplug();
 	}
+	mutex_unlock(&kswapd_threads_lock);
+	return ret;
 }
 
 static int __init kswapd_init(void)
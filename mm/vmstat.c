@@ -461,6 +461,7 @@ void refresh_cpu_vm_stats(int cpu)
 				p->expire = 3;
 #endif
 			}
+		decay_pcp_high(zone, &p->pcp);
 		cond_resched();
 #ifdef CONFIG_NUMA
 		/*
@@ -739,6 +740,10 @@ const char * const vmstat_text[] = {
 
 	"pgfault",
 	"pgmajfault",
+	"pcp_alloc_refill",
+	"pcp_free_drain",
+	"pcp_highorder_alloc",
+	"pcp_highorder_free",
 
 	TEXTS_FOR_ZONES("pgrefill")
 	TEXTS_FOR_ZONES("pgsteal_kswapd")
@@ -757,9 +762,23 @@ const char * const vmstat_text[] = {
 	"kswapd_skip_congestion_wait",
 	"pageoutrun",
 	"allocstall",
+	"allocstall_throttled",
+	"direct_reclaim_us",
+	"kswapd_reclaim_us",
+	"direct_reclaim_lt_1ms",
+	"direct_reclaim_lt_10ms",
+	"direct_reclaim_lt_100ms",
+	"direct_reclaim_slow",
 
 	"pgrotated",
 
+#ifdef CONFIG_NUMA_BALANCING
+	"numa_pte_updates",
+	"numa_hint_faults",
+	"numa_hint_faults_local",
+	"numa_pages_migrated",
+#endif
+
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",
 	"compact_pages_moved",
@@ -1008,11 +1027,15 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 			   "\n    cpu: %i"
 			   "\n              count: %i"
 			   "\n              high:  %i"
-			   "\n              batch: %i",
+			   "\n              batch: %i"
+			   "\n              high_min: %i"
+			   "\n              alloc_factor: %i",
 			   i,
 			   pageset->pcp.count,
 			   pageset->pcp.high,
-			   pageset->pcp.batch);
+			   pageset->pcp.batch,
+			   pageset->pcp.high_min,
+			   pageset->pcp.alloc_factor);
 #ifdef CONFIG_SMP
 		seq_printf(m, "\n  vm stats threshold: %d",
 				pageset->stat_threshold);
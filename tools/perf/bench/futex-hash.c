@@ -0,0 +1,218 @@
+/*
+ *
+ * futex-hash.c
+ *
+ * hash: Benchmark for futex hash table contention
+ *
+ * Many threads each operate on their own set of futexes with FUTEX_WAIT
+ * calls that fail right away because the futex value does not match, so
+ * every call only hashes the key and takes and drops its bucket lock.
+ * Collisions and bucket lock contention show up as lower throughput.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/prctl.h>
+#include <linux/futex.h>
+
+/* perf.h pulls in the kernel's unistd.h, which has no numbers for us */
+#ifndef __NR_futex
+# if defined(__x86_64__)
+#  define __NR_futex 202
+# elif defined(__i386__)
+#  define __NR_futex 240
+# endif
+#endif
+
+#ifndef PR_SET_FUTEX_HASH
+#define PR_SET_FUTEX_HASH 40
+#endif
+
+static unsigned int nthreads;
+static unsigned int nfutexes = 1024;
+static unsigned int nsecs = 10;
+static unsigned int private_buckets;
+static bool fshared = false;
+
+static volatile int done;
+static pthread_mutex_t start_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int threads_starting;
+static pthread_cond_t thread_parent = PTHREAD_COND_INITIALIZER;
+
+struct worker {
+	pthread_t thread;
+	unsigned long ops;
+	u32 *futex;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		    "Specify number of threads (default: online cpus)"),
+	OPT_UINTEGER('f', "futexes", &nfutexes,
+		    "Specify number of futexes per thread"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		    "Specify runtime in seconds"),
+	OPT_BOOLEAN('S', "shared", &fshared,
+		    "Use shared futexes instead of private ones"),
+	OPT_UINTEGER('p', "private-hash", &private_buckets,
+		    "Use a private futex hash with this many buckets"),
+	OPT_END()
+};
+
+static const char * const bench_futex_hash_usage[] = {
+	"perf bench futex hash <options>",
+	NULL
+};
+
+static int futex_wait(u32 *uaddr, u32 val)
+{
+	int op = FUTEX_WAIT | (fshared ? 0 : FUTEX_PRIVATE_FLAG);
+
+	return syscall(__NR_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long ops = 0;
+	unsigned int i;
+
+	pthread_mutex_lock(&start_mutex);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&start_cond, &start_mutex);
+	pthread_mutex_unlock(&start_mutex);
+
+	do {
+		for (i = 0; i < nfutexes; i++, ops++) {
+			/* the value never matches, so this returns EAGAIN */
+			if (futex_wait(&w->futex[i], 1234) == 0 ||
+			    errno != EAGAIN) {
+				fprintf(stderr, "futex_wait: %s\n",
+					strerror(errno));
+				exit(1);
+			}
+		}
+	} while (!done);
+
+	w->ops = ops;
+	return NULL;
+}
+
+static void alarm_handler(int sig __used)
+{
+	done = 1;
+}
+
+int bench_futex_hash(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	unsigned long total = 0;
+	struct worker *workers;
+	double secs;
+	unsigned int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_hash_usage, 0);
+	if (argc) {
+		usage_with_options(bench_futex_hash_usage, options);
+		exit(1);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nthreads || !nfutexes || !nsecs) {
+		usage_with_options(bench_futex_hash_usage, options);
+		exit(1);
+	}
+
+	/* must happen while we are still single threaded */
+	if (private_buckets &&
+	    prctl(PR_SET_FUTEX_HASH, private_buckets, 0, 0, 0)) {
+		fprintf(stderr, "PR_SET_FUTEX_HASH: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers)
+		die("calloc");
+
+	signal(SIGALRM, alarm_handler);
+
+	threads_starting = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		workers[i].futex = calloc(nfutexes, sizeof(u32));
+		if (!workers[i].futex)
+			die("calloc");
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i]))
+			die("pthread_create");
+	}
+
+	pthread_mutex_lock(&start_mutex);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &start_mutex);
+	gettimeofday(&start, NULL);
+	alarm(nsecs);
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&start_mutex);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			die("pthread_join");
+		total += workers[i].ops;
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads operating on %u %s futexes each, %s hash\n\n",
+		       nthreads, nfutexes, fshared ? "shared" : "private",
+		       private_buckets ? "private" : "global");
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		for (i = 0; i < nthreads; i++)
+			printf(" [thread %3u] %14.0f ops/sec\n", i,
+			       workers[i].ops / secs);
+		printf("\n %14.0f ops/sec (average per thread)\n",
+		       total / secs / nthreads);
+		printf(" %14.0f ops/sec (total)\n", total / secs);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0f\n", total / secs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	for (i = 0; i < nthreads; i++)
+		free(workers[i].futex);
+	free(workers);
+	return 0;
+}
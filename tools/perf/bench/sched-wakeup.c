@@ -0,0 +1,306 @@
+/*
+ *
+ * sched-wakeup.c
+ *
+ * wakeup: Benchmark for wakeup latency
+ *
+ * Each message thread owns a group of worker threads.  It stamps the
+ * time, wakes all of its workers at once and waits until every one of
+ * them has run its request, which is a short cpu burn.  Workers record
+ * how long it took from the stamp until they were running, so the
+ * result is the latency of fan-out wakeups with the wakee placement
+ * and idle cpu search the scheduler does on each of them.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include <linux/futex.h>
+
+/* perf.h pulls in the kernel's unistd.h, which has no numbers for us */
+#ifndef __NR_futex
+# if defined(__x86_64__)
+#  define __NR_futex 202
+# elif defined(__i386__)
+#  define __NR_futex 240
+# endif
+#endif
+
+/* latencies are kept per usec up to this, anything above in one bucket */
+#define LAT_BUCKETS	10000
+
+#define REQ_NONE	0
+#define REQ_RUN		1
+#define REQ_EXIT	2
+
+static unsigned int nmessage = 2;
+static unsigned int nworkers;
+static unsigned int nsecs = 10;
+static unsigned int burn_usecs = 50;
+
+static volatile int done;
+
+struct worker {
+	pthread_t thread;
+	struct message *msg;
+	int futex;			/* REQ_* handed over by the message thread */
+	unsigned long *lat;		/* LAT_BUCKETS + 1 counters */
+};
+
+struct message {
+	pthread_t thread;
+	int pending;			/* workers still busy with a request */
+	struct timespec stamp;
+	unsigned long rounds;
+	struct worker *workers;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('m', "message-threads", &nmessage,
+		    "Specify number of message threads"),
+	OPT_UINTEGER('t', "threads", &nworkers,
+		    "Specify number of workers per message thread (default: online cpus / message threads)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		    "Specify runtime in seconds"),
+	OPT_UINTEGER('c', "cpu-usecs", &burn_usecs,
+		    "Specify usecs of cpu work per request"),
+	OPT_END()
+};
+
+static const char * const bench_sched_wakeup_usage[] = {
+	"perf bench sched wakeup <options>",
+	NULL
+};
+
+static int futex_wait(int *uaddr, int val)
+{
+	return syscall(__NR_futex, uaddr, FUTEX_WAIT_PRIVATE, val,
+		       NULL, NULL, 0);
+}
+
+static int futex_wake(int *uaddr, int nr)
+{
+	return syscall(__NR_futex, uaddr, FUTEX_WAKE_PRIVATE, nr,
+		       NULL, NULL, 0);
+}
+
+static unsigned long usecs_since(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000UL +
+		(now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static void burn(unsigned int usecs)
+{
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (usecs_since(&start) < usecs)
+		;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	struct message *m = w->msg;
+	unsigned long us;
+
+	for (;;) {
+		while (w->futex == REQ_NONE)
+			futex_wait(&w->futex, REQ_NONE);
+		if (w->futex == REQ_EXIT)
+			break;
+
+		us = usecs_since(&m->stamp);
+		w->lat[us < LAT_BUCKETS ? us : LAT_BUCKETS]++;
+		w->futex = REQ_NONE;
+
+		burn(burn_usecs);
+		if (!__sync_sub_and_fetch(&m->pending, 1))
+			futex_wake(&m->pending, 1);
+	}
+	return NULL;
+}
+
+static void *message_fn(void *arg)
+{
+	struct message *m = arg;
+	unsigned int i;
+	int pending;
+
+	while (!done) {
+		m->pending = nworkers;
+		clock_gettime(CLOCK_MONOTONIC, &m->stamp);
+		__sync_synchronize();
+		for (i = 0; i < nworkers; i++) {
+			m->workers[i].futex = REQ_RUN;
+			futex_wake(&m->workers[i].futex, 1);
+		}
+		while ((pending = m->pending))
+			futex_wait(&m->pending, pending);
+		m->rounds++;
+	}
+
+	/* every request has been served, send the workers home */
+	for (i = 0; i < nworkers; i++) {
+		m->workers[i].futex = REQ_EXIT;
+		futex_wake(&m->workers[i].futex, 1);
+	}
+	return NULL;
+}
+
+static void alarm_handler(int sig __used)
+{
+	done = 1;
+}
+
+/* usecs below which @permille of the samples in @lat lie */
+static unsigned long percentile(unsigned long *lat, unsigned long total,
+				unsigned int permille)
+{
+	unsigned long sum = 0, want = (total * permille + 999) / 1000;
+	unsigned long i;
+
+	for (i = 0; i <= LAT_BUCKETS; i++) {
+		sum += lat[i];
+		if (sum >= want)
+			return i;
+	}
+	return LAT_BUCKETS;
+}
+
+int bench_sched_wakeup(int argc, const char **argv,
+		       const char *prefix __used)
+{
+	static const unsigned int permille[] = { 500, 900, 990, 999 };
+	struct timeval start, stop, diff;
+	unsigned long *lat, total = 0, rounds = 0, max = 0;
+	struct message *msgs;
+	unsigned int i, j, k;
+
+	argc = parse_options(argc, argv, options,
+			     bench_sched_wakeup_usage, 0);
+	if (argc) {
+		usage_with_options(bench_sched_wakeup_usage, options);
+		exit(1);
+	}
+
+	if (!nmessage || !nsecs) {
+		usage_with_options(bench_sched_wakeup_usage, options);
+		exit(1);
+	}
+	if (!nworkers)
+		nworkers = sysconf(_SC_NPROCESSORS_ONLN) / nmessage;
+	if (!nworkers)
+		nworkers = 1;
+
+	msgs = calloc(nmessage, sizeof(*msgs));
+	lat = calloc(LAT_BUCKETS + 1, sizeof(*lat));
+	if (!msgs || !lat)
+		die("calloc");
+
+	signal(SIGALRM, alarm_handler);
+	gettimeofday(&start, NULL);
+	alarm(nsecs);
+
+	for (i = 0; i < nmessage; i++) {
+		struct message *m = &msgs[i];
+
+		m->workers = calloc(nworkers, sizeof(*m->workers));
+		if (!m->workers)
+			die("calloc");
+		for (j = 0; j < nworkers; j++) {
+			struct worker *w = &m->workers[j];
+
+			w->msg = m;
+			w->lat = calloc(LAT_BUCKETS + 1, sizeof(*w->lat));
+			if (!w->lat)
+				die("calloc");
+			if (pthread_create(&w->thread, NULL, worker_fn, w))
+				die("pthread_create");
+		}
+		if (pthread_create(&m->thread, NULL, message_fn, m))
+			die("pthread_create");
+	}
+
+	for (i = 0; i < nmessage; i++) {
+		struct message *m = &msgs[i];
+
+		if (pthread_join(m->thread, NULL))
+			die("pthread_join");
+		rounds += m->rounds;
+		for (j = 0; j < nworkers; j++) {
+			struct worker *w = &m->workers[j];
+
+			if (pthread_join(w->thread, NULL))
+				die("pthread_join");
+			for (k = 0; k <= LAT_BUCKETS; k++) {
+				lat[k] += w->lat[k];
+				total += w->lat[k];
+				if (w->lat[k])
+					max = k;
+			}
+			free(w->lat);
+		}
+		free(m->workers);
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	if (!total) {
+		fprintf(stderr, "no wakeups recorded\n");
+		exit(1);
+	}
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u message threads, %u workers each, %u usecs per request\n\n",
+		       nmessage, nworkers, burn_usecs);
+
+		printf(" %14s: %lu.%03lu [sec]\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+		printf(" %14s: %lu rounds, %lu wakeups\n\n", "Total",
+		       rounds, total);
+
+		printf(" Wakeup latency percentiles (usec)\n");
+		for (i = 0; i < ARRAY_SIZE(permille); i++)
+			printf(" %12.1fth: %s%lu\n", permille[i] / 10.0,
+			       percentile(lat, total, permille[i]) < LAT_BUCKETS ?
+			       "" : ">=",
+			       percentile(lat, total, permille[i]));
+		printf(" %14s: %s%lu\n", "max",
+		       max < LAT_BUCKETS ? "" : ">=", max);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu\n", percentile(lat, total, 990));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	free(lat);
+	free(msgs);
+	return 0;
+}
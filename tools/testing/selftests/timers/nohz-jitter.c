@@ -0,0 +1,145 @@
+/*
+ * Full dynticks: pin a busy loop to one cpu, ideally one in nohz_full=,
+ * and read CLOCK_MONOTONIC back to back.  Any gap above the threshold is
+ * time the loop didn't run: the tick, another interrupt, or preemption.
+ * At the end print how many gaps there were, the largest one, a
+ * histogram of them by power of two usecs, and how many local timer
+ * interrupts (LOC in /proc/interrupts) the cpu took meanwhile, so runs
+ * with and without nohz_full= can be compared.
+ *
+ * Usage: nohz-jitter [-c cpu] [-t seconds] [-T threshold ns]
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+
+#define NR_BUCKETS	16
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* local timer interrupts taken by @cpu so far, -1 if unknown */
+static long long read_loc(int cpu)
+{
+	char line[16384], *tok;
+	int col = -1, i;
+	long long ret = -1;
+	FILE *f;
+
+	f = fopen("/proc/interrupts", "r");
+	if (!f)
+		return -1;
+
+	/* the header names the cpu of each column */
+	if (fgets(line, sizeof(line), f)) {
+		for (i = 0, tok = strtok(line, " \t\n"); tok;
+		     i++, tok = strtok(NULL, " \t\n")) {
+			if (!strncmp(tok, "CPU", 3) && atoi(tok + 3) == cpu) {
+				col = i;
+				break;
+			}
+		}
+	}
+
+	while (col >= 0 && fgets(line, sizeof(line), f)) {
+		tok = strtok(line, " \t\n");
+		if (!tok || strcmp(tok, "LOC:"))
+			continue;
+		for (i = 0; i <= col && tok; i++)
+			tok = strtok(NULL, " \t\n");
+		if (tok)
+			ret = atoll(tok);
+		break;
+	}
+
+	fclose(f);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int cpu = -1, seconds = 10, opt, i;
+	unsigned long long threshold = 10000, start, end, prev, now, gap;
+	unsigned long long max = 0, loops = 0, gaps = 0, total = 0;
+	unsigned long hist[NR_BUCKETS] = { 0 };
+	long long loc_before, loc_after;
+	cpu_set_t set;
+
+	while ((opt = getopt(argc, argv, "c:t:T:")) != -1) {
+		switch (opt) {
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'T':
+			threshold = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-c cpu] [-t seconds] [-T threshold ns]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	/* the boot cpu never runs tickless, so default to the last one */
+	if (cpu < 0)
+		cpu = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		perror("sched_setaffinity");
+		return 1;
+	}
+
+	loc_before = read_loc(cpu);
+	start = prev = now_ns();
+	end = start + seconds * 1000000000ULL;
+	do {
+		now = now_ns();
+		gap = now - prev;
+		prev = now;
+		loops++;
+		if (gap < threshold)
+			continue;
+
+		gaps++;
+		total += gap;
+		if (gap > max)
+			max = gap;
+		/* bucket i holds gaps of [2^i, 2^(i+1)) usecs */
+		for (i = 0; gap >= 2000 && i < NR_BUCKETS - 1; i++)
+			gap >>= 1;
+		hist[i]++;
+	} while (now < end);
+	loc_after = read_loc(cpu);
+
+	printf("cpu %d, %d s, %llu loops, threshold %llu ns\n",
+	       cpu, seconds, loops, threshold);
+	printf("%llu gaps, %llu us lost, max %llu us\n",
+	       gaps, total / 1000, max / 1000);
+	for (i = 0; i < NR_BUCKETS; i++) {
+		if (!hist[i])
+			continue;
+		printf("  %6lu us%s %10lu\n", 1UL << i,
+		       i == NR_BUCKETS - 1 ? "+" : " ", hist[i]);
+	}
+	if (loc_before >= 0 && loc_after >= 0)
+		printf("%lld local timer interrupts, %.1f/s\n",
+		       loc_after - loc_before,
+		       (double)(loc_after - loc_before) / seconds);
+
+	return 0;
+}
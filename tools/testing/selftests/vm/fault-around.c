@@ -0,0 +1,129 @@
+/*
+ * Fault-around: map a file that is already in the page cache and read
+ * one byte from every page, then report how many minor faults that
+ * took.  With fault-around enabled the count drops by roughly the
+ * window size (/sys/kernel/debug/fault_around_bytes / page size).
+ *
+ * Usage: fault-around [-m MB] [-s stride in pages] [file]
+ *
+ * Without a file argument a temporary file of the given size is created
+ * in the current directory and removed again afterwards.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+static long minflt(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_minflt;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	unsigned long mb = 256, stride = 1;
+	char tmpname[] = "fault-around.XXXXXX";
+	const char *name = NULL;
+	size_t size, off;
+	struct stat st;
+	volatile char sum = 0;
+	long faults;
+	double start, elapsed;
+	char *buf, *p;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "m:s:")) != -1) {
+		switch (opt) {
+		case 'm':
+			mb = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			stride = strtoul(optarg, NULL, 0);
+			if (!stride)
+				stride = 1;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-m MB] [-s stride in pages] [file]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		name = argv[optind];
+
+	if (name) {
+		fd = open(name, O_RDONLY);
+		if (fd < 0 || fstat(fd, &st)) {
+			perror(name);
+			return 1;
+		}
+		size = st.st_size;
+	} else {
+		fd = mkstemp(tmpname);
+		if (fd < 0) {
+			perror("mkstemp");
+			return 1;
+		}
+		unlink(tmpname);
+		size = mb << 20;
+		buf = malloc(1 << 20);
+		if (!buf)
+			return 1;
+		memset(buf, 0x5a, 1 << 20);
+		for (off = 0; off < size; off += 1 << 20)
+			if (write(fd, buf, 1 << 20) != 1 << 20) {
+				perror("write");
+				return 1;
+			}
+		free(buf);
+	}
+
+	/* pull the whole file into the page cache before timing */
+	p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	for (off = 0; off < size; off += pagesize)
+		sum += p[off];
+	munmap(p, size);
+
+	p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	faults = minflt();
+	start = now();
+	for (off = 0; off < size; off += stride * pagesize)
+		sum += p[off];
+	elapsed = now() - start;
+	faults = minflt() - faults;
+	munmap(p, size);
+	close(fd);
+
+	printf("%zu MB, %zu pages touched, stride %lu\n", size >> 20,
+	       (size / pagesize + stride - 1) / stride, stride);
+	printf("minor faults: %ld (%.2f pages/fault)\n", faults,
+	       faults ? (double)(size / pagesize) / faults : 0.0);
+	printf("time: %.3f ms\n", elapsed * 1e3);
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * Page fault throughput under nested memory cgroups: builds a chain of
+ * depth cgroups under the given memory cgroup mount, hangs a number of
+ * leaf cgroups off its end and runs one process in each, repeatedly
+ * faulting in and unmapping an anonymous region.  Reports the aggregate
+ * fault rate, to compare memcg charge overhead across depths and counts.
+ *
+ * Usage: memcg-fault [-d depth] [-c cgroups] [-m MB] [-t seconds] mountpoint
+ *	e.g. mount -t cgroup -o memory none /cgroup; memcg-fault -d 4 /cgroup
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static volatile sig_atomic_t stop;
+
+static void alarm_handler(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_file(const char *dir, const char *name, const char *val)
+{
+	char path[PATH_MAX];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	ret = fputs(val, f) < 0 ? -1 : 0;
+	if (fclose(f))
+		ret = -1;
+	return ret;
+}
+
+/* fault in and drop the region until the alarm, return pages faulted */
+static unsigned long worker(size_t size, int seconds)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	unsigned long faults = 0;
+	size_t i;
+	char *p;
+
+	signal(SIGALRM, alarm_handler);
+	alarm(seconds);
+	while (!stop) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			exit(1);
+		}
+		for (i = 0; i < size && !stop; i += pagesize) {
+			p[i] = 1;
+			faults++;
+		}
+		munmap(p, size);
+	}
+	return faults;
+}
+
+int main(int argc, char **argv)
+{
+	int depth = 1, cgroups = 4, seconds = 10, opt, i, status;
+	unsigned long mb = 64, total = 0;
+	char base[PATH_MAX], leaf[PATH_MAX + 32], pid[32];
+	double start, elapsed;
+	int fds[2];
+
+	while ((opt = getopt(argc, argv, "d:c:m:t:")) != -1) {
+		switch (opt) {
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'c':
+			cgroups = atoi(optarg);
+			break;
+		case 'm':
+			mb = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || depth < 1 || cgroups < 1)
+		goto usage;
+
+	/* the chain: mountpoint/memcg-fault/n1/n2/... */
+	snprintf(base, sizeof(base), "%s/memcg-fault", argv[optind]);
+	if (mkdir(base, 0755)) {
+		perror(base);
+		return 1;
+	}
+	if (write_file(base, "memory.use_hierarchy", "1"))
+		fprintf(stderr, "warning: could not enable use_hierarchy\n");
+	for (i = 1; i < depth; i++) {
+		size_t len = strlen(base);
+
+		snprintf(base + len, sizeof(base) - len, "/n%d", i);
+		if (mkdir(base, 0755)) {
+			perror(base);
+			return 1;
+		}
+	}
+
+	if (pipe(fds)) {
+		perror("pipe");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < cgroups; i++) {
+		pid_t child;
+
+		snprintf(leaf, sizeof(leaf), "%s/leaf%d", base, i);
+		if (mkdir(leaf, 0755)) {
+			perror(leaf);
+			return 1;
+		}
+		child = fork();
+		if (child < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (!child) {
+			unsigned long n;
+
+			snprintf(pid, sizeof(pid), "%d", getpid());
+			if (write_file(leaf, "tasks", pid)) {
+				perror("tasks");
+				exit(1);
+			}
+			n = worker(mb << 20, seconds);
+			if (write(fds[1], &n, sizeof(n)) != sizeof(n))
+				exit(1);
+			exit(0);
+		}
+	}
+
+	for (i = 0; i < cgroups; i++) {
+		unsigned long n;
+
+		if (read(fds[0], &n, sizeof(n)) == sizeof(n))
+			total += n;
+	}
+	while (wait(&status) > 0)
+		;
+	elapsed = now() - start;
+
+	for (i = 0; i < cgroups; i++) {
+		snprintf(leaf, sizeof(leaf), "%s/leaf%d", base, i);
+		rmdir(leaf);
+	}
+	for (i = depth; i > 0; i--) {
+		rmdir(base);
+		*strrchr(base, '/') = '\0';
+	}
+
+	printf("depth %d, %d cgroups x %lu MB, %.1f s\n",
+	       depth, cgroups, mb, elapsed);
+	printf("faults/s: %.0f\n", total / elapsed);
+	return 0;
+
+usage:
+	fprintf(stderr,
+		"usage: %s [-d depth] [-c cgroups] [-m MB] [-t seconds] mountpoint\n",
+		argv[0]);
+	return 1;
+}
@@ -0,0 +1,147 @@
+/*
+ * mmap_sem contention: threads of one process fault in and discard their
+ * own anonymous regions (mmap_sem held for read), while other threads
+ * keep mapping and unmapping small regions (mmap_sem held for write), as
+ * a multi-threaded allocator or JVM does.  Reports the aggregate fault
+ * and mmap/munmap rates and the context switches taken, to compare the
+ * rwsem slowpath with and without optimistic spinning.
+ *
+ * Usage: mmap-fault [-f fault threads] [-w mmap threads] [-m MB] [-t seconds]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+static volatile int stop;
+static size_t region_size;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* fault the region in page by page and throw it away, count faults */
+static void *fault_thread(void *arg)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	unsigned long *faults = arg;
+	size_t i;
+	char *p;
+
+	p = mmap(NULL, region_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	while (!stop) {
+		for (i = 0; i < region_size && !stop; i += pagesize) {
+			p[i] = 1;
+			(*faults)++;
+		}
+		madvise(p, region_size, MADV_DONTNEED);
+	}
+	munmap(p, region_size);
+	return NULL;
+}
+
+/* map, touch and unmap a small region, count mmap/munmap pairs */
+static void *mmap_thread(void *arg)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	unsigned long *ops = arg;
+	char *p;
+
+	while (!stop) {
+		p = mmap(NULL, 4 * pagesize, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			exit(1);
+		}
+		p[0] = 1;
+		munmap(p, 4 * pagesize);
+		(*ops)++;
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int faulters = 4, mappers = 2, seconds = 10, opt, i;
+	unsigned long mb = 16, faults = 0, ops = 0;
+	unsigned long *counts;
+	pthread_t *threads;
+	struct rusage ru;
+	double start, elapsed;
+
+	while ((opt = getopt(argc, argv, "f:w:m:t:")) != -1) {
+		switch (opt) {
+		case 'f':
+			faulters = atoi(optarg);
+			break;
+		case 'w':
+			mappers = atoi(optarg);
+			break;
+		case 'm':
+			mb = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-f fault threads] [-w mmap threads] [-m MB] [-t seconds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	region_size = mb << 20;
+	threads = calloc(faulters + mappers, sizeof(*threads));
+	counts = calloc(faulters + mappers, sizeof(*counts));
+	if (!threads || !counts) {
+		perror("calloc");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < faulters + mappers; i++) {
+		if (pthread_create(&threads[i], NULL,
+				   i < faulters ? fault_thread : mmap_thread,
+				   &counts[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	sleep(seconds);
+	stop = 1;
+
+	for (i = 0; i < faulters + mappers; i++) {
+		pthread_join(threads[i], NULL);
+		if (i < faulters)
+			faults += counts[i];
+		else
+			ops += counts[i];
+	}
+	elapsed = now() - start;
+	getrusage(RUSAGE_SELF, &ru);
+
+	printf("%d fault threads x %lu MB, %d mmap threads, %.1f s\n",
+	       faulters, mb, mappers, elapsed);
+	printf("faults/s:      %.0f\n", faults / elapsed);
+	printf("mmap+munmap/s: %.0f\n", ops / elapsed);
+	printf("ctx switches:  %ld voluntary, %ld involuntary\n",
+	       ru.ru_nvcsw, ru.ru_nivcsw);
+	return 0;
+}
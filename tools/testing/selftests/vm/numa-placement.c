@@ -0,0 +1,172 @@
+/*
+ * Automatic NUMA balancing: fault a buffer in while bound to the cpus of
+ * one node, then move to the cpus of another node and keep sweeping it.
+ * Every second print where the buffer's pages are (queried with
+ * move_pages() without a target, which only reports) and which node the
+ * thread runs on, so convergence can be watched and compared with
+ * kernel.numa_balancing on and off.
+ *
+ * Usage: numa-placement [-m MB] [-t seconds] [-f from node] [-n to node]
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define MAX_NODES	64
+#define BATCH		1024
+
+static long pagesize;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* restrict the calling thread to the cpus sysfs lists for @node */
+static int bind_node(int node)
+{
+	char path[64], buf[4096], *s, *end;
+	cpu_set_t set;
+	long lo, hi;
+	FILE *f;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/node/node%d/cpulist", node);
+	f = fopen(path, "r");
+	if (!f || !fgets(buf, sizeof(buf), f)) {
+		perror(path);
+		return -1;
+	}
+	fclose(f);
+
+	CPU_ZERO(&set);
+	for (s = buf; *s && *s != '\n'; s = end) {
+		lo = hi = strtol(s, &end, 10);
+		if (end == s)
+			break;
+		if (*end == '-')
+			hi = strtol(end + 1, &end, 10);
+		while (lo <= hi)
+			CPU_SET(lo++, &set);
+		if (*end == ',')
+			end++;
+	}
+	if (!CPU_COUNT(&set)) {
+		fprintf(stderr, "node %d has no cpus\n", node);
+		return -1;
+	}
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		perror("sched_setaffinity");
+		return -1;
+	}
+	return 0;
+}
+
+/* count the pages of @buf per node */
+static int page_nodes(char *buf, size_t len, unsigned long *count)
+{
+	unsigned long nr = len / pagesize, i, j, n;
+	void *pages[BATCH];
+	int status[BATCH];
+
+	memset(count, 0, MAX_NODES * sizeof(*count));
+	for (i = 0; i < nr; i += n) {
+		n = nr - i < BATCH ? nr - i : BATCH;
+		for (j = 0; j < n; j++)
+			pages[j] = buf + (i + j) * pagesize;
+		if (syscall(__NR_move_pages, 0, n, pages, NULL, status, 0)) {
+			perror("move_pages");
+			return -1;
+		}
+		for (j = 0; j < n; j++)
+			if (status[j] >= 0 && status[j] < MAX_NODES)
+				count[status[j]]++;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int from = 0, to = 1, seconds = 30, opt, node;
+	unsigned long mb = 256, count[MAX_NODES], sweeps = 0, nr;
+	double start, next;
+	size_t len, i;
+	char *buf;
+
+	while ((opt = getopt(argc, argv, "m:t:f:n:")) != -1) {
+		switch (opt) {
+		case 'm':
+			mb = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'f':
+			from = atoi(optarg);
+			break;
+		case 'n':
+			to = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-m MB] [-t seconds] [-f from node] [-n to node]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	len = mb << 20;
+	nr = len / pagesize;
+
+	if (bind_node(from))
+		return 1;
+	buf = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	for (i = 0; i < len; i += pagesize)
+		buf[i] = 1;
+
+	if (bind_node(to))
+		return 1;
+
+	printf("%lu MB faulted on node %d, now running on node %d\n",
+	       mb, from, to);
+	printf("%6s %8s %10s %10s %10s\n",
+	       "time", "cpu node", "on from", "on to", "sweeps");
+
+	start = now();
+	next = start;
+	while (now() - start < seconds) {
+		for (i = 0; i < len; i += pagesize)
+			buf[i]++;
+		sweeps++;
+		if (now() < next)
+			continue;
+		next += 1;
+
+		if (page_nodes(buf, len, count))
+			return 1;
+		node = -1;
+		syscall(__NR_getcpu, NULL, &node, NULL);
+		printf("%5.0fs %8d %9.1f%% %9.1f%% %10lu\n", now() - start,
+		       node, 100.0 * count[from] / nr, 100.0 * count[to] / nr,
+		       sweeps);
+		fflush(stdout);
+	}
+
+	munmap(buf, len);
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Swap storm: several processes each dirty an anonymous region, and
+ * together the regions are larger than free memory, so every pass
+ * through them swaps pages out and back in.  Reports the aggregate
+ * page touch rate and the pswpin/pswpout deltas from /proc/vmstat.
+ *
+ * Needs a configured swap device, and enough swap for the total size.
+ *
+ * Usage: swap-storm [-p procs] [-m MB per proc] [-t seconds]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+static volatile sig_atomic_t stop;
+
+static void alarm_handler(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static unsigned long vmstat(const char *name)
+{
+	char key[64];
+	unsigned long val, ret = 0;
+	FILE *f = fopen("/proc/vmstat", "r");
+
+	if (!f)
+		return 0;
+	while (fscanf(f, "%63s %lu", key, &val) == 2)
+		if (!strcmp(key, name)) {
+			ret = val;
+			break;
+		}
+	fclose(f);
+	return ret;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* dirty pages in a pseudo-random order, return the number of touches */
+static unsigned long worker(size_t size, int seconds, unsigned int seed)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	size_t i, npages = size / pagesize;
+	unsigned long touched = 0;
+	char *p;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	for (i = 0; i < npages; i++)
+		p[i * pagesize] = 1;
+
+	signal(SIGALRM, alarm_handler);
+	alarm(seconds);
+	srand(seed);
+	while (!stop) {
+		i = ((size_t)rand() * 4099) % npages;
+		p[i * pagesize]++;
+		touched++;
+	}
+	munmap(p, size);
+	return touched;
+}
+
+int main(int argc, char **argv)
+{
+	int procs = 4, seconds = 30, opt, i, status;
+	unsigned long mb = 256, total = 0, pswpin, pswpout;
+	int fds[2];
+	double start, elapsed;
+
+	while ((opt = getopt(argc, argv, "p:m:t:")) != -1) {
+		switch (opt) {
+		case 'p':
+			procs = atoi(optarg);
+			break;
+		case 'm':
+			mb = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-p procs] [-m MB per proc] [-t seconds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (pipe(fds)) {
+		perror("pipe");
+		return 1;
+	}
+
+	pswpin = vmstat("pswpin");
+	pswpout = vmstat("pswpout");
+	start = now();
+
+	for (i = 0; i < procs; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (!pid) {
+			unsigned long n = worker(mb << 20, seconds, i + 1);
+
+			if (write(fds[1], &n, sizeof(n)) != sizeof(n))
+				exit(1);
+			exit(0);
+		}
+	}
+
+	for (i = 0; i < procs; i++) {
+		unsigned long n;
+
+		if (read(fds[0], &n, sizeof(n)) == sizeof(n))
+			total += n;
+	}
+	while (wait(&status) > 0)
+		;
+	elapsed = now() - start;
+	pswpin = vmstat("pswpin") - pswpin;
+	pswpout = vmstat("pswpout") - pswpout;
+
+	printf("%d procs x %lu MB, %.1f s\n", procs, mb, elapsed);
+	printf("touches/s: %.0f\n", total / elapsed);
+	printf("pswpin:  %lu (%.0f/s)\n", pswpin, pswpin / elapsed);
+	printf("pswpout: %lu (%.0f/s)\n", pswpout, pswpout / elapsed);
+	return 0;
+}
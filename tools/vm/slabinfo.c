@@ -43,6 +43,7 @@ struct slabinfo {
 	unsigned long cmpxchg_double_cpu_fail, cmpxchg_double_fail;
 	unsigned long alloc_node_mismatch, deactivate_bypass;
 	unsigned long cpu_partial_alloc, cpu_partial_free;
+	unsigned long list_lock_taken, list_lock_contended;
 	int numa[MAX_NODES];
 	int numa_partial[MAX_NODES];
 } slabinfo[MAX_SLABS];
@@ -499,6 +500,18 @@ static void slab_stats(struct slabinfo *s)
 			s->cmpxchg_double_fail, s->cmpxchg_double_cpu_fail);
 }
 
+static void lock_stats(struct slabinfo *s)
+{
+	if (!s->list_lock_taken)
+		return;
+
+	printf("\nNode list_lock        Taken Contended   %%\n");
+	printf("--------------------------------------------\n");
+	printf("Alloc/free paths  %9lu %9lu %3lu\n",
+		s->list_lock_taken, s->list_lock_contended,
+		s->list_lock_contended * 100 / s->list_lock_taken);
+}
+
 static void report(struct slabinfo *s)
 {
 	if (strcmp(s->name, "*") == 0)
@@ -538,6 +551,7 @@ static void report(struct slabinfo *s)
 	show_tracking(s);
 	slab_numa(s, 1);
 	slab_stats(s);
+	lock_stats(s);
 }
 
 static void slabcache(struct slabinfo *s)
@@ -1219,6 +1233,8 @@ static void read_slab_dir(void)
 			slab->cpu_partial_free = get_obj("cpu_partial_free");
 			slab->alloc_node_mismatch = get_obj("alloc_node_mismatch");
 			slab->deactivate_bypass = get_obj("deactivate_bypass");
+			slab->list_lock_taken = get_obj("list_lock_taken");
+			slab->list_lock_contended = get_obj("list_lock_contended");
 			chdir("..");
 			if (slab->name[0] == ':')
 				alias_targets++;